@@ -31,6 +31,11 @@ Motor::Motor(int In1pin, int In2pin, int PWMpin, int offset, int STBYpin)
    PWM = PWMpin;
    Standby = STBYpin;
    Offset = offset;
+   Level = 0;
+   Direction = 0;
+   FwdBits = 1u << In1;
+   RevBits = 1u << In2;
+   DirMask = FwdBits | RevBits;
 
    gpio_init(In1);
    gpio_set_dir(In1, GPIO_OUT);
@@ -43,9 +48,7 @@ Motor::Motor(int In1pin, int In2pin, int PWMpin, int offset, int STBYpin)
    gpio_set_dir(Standby, GPIO_OUT);
 
    // Setup PWM for PWM pin
-   uint slice_num = pwm_gpio_to_slice_num(PWM);
-   pwm_set_wrap(slice_num, 255); // 8-bit resolution
-   pwm_set_enabled(slice_num, true);
+   MotorPwm::apply(PWM);
 }
 
 void Motor::drive(int speed)
@@ -60,66 +63,71 @@ void Motor::drive(int speed)
 
 void Motor::fwd(int speed)
 {
-   gpio_put(In1, true);
-   gpio_put(In2, false);
-   pwm_set_gpio_level(PWM, speed);
+   gpio_put_masked(DirMask, FwdBits);
+   pwm_set_gpio_level(PWM, MotorScale::level(speed));
+   Level = speed;
+   Direction = 1;
 }
 
 void Motor::rev(int speed)
 {
-   gpio_put(In1, 0);
-   gpio_put(In2, 1);
-   pwm_set_gpio_level(PWM, speed);
+   gpio_put_masked(DirMask, RevBits);
+   pwm_set_gpio_level(PWM, MotorScale::level(speed));
+   Level = speed;
+   Direction = -1;
 }
 
 void Motor::brake()
 {
-   gpio_put(In1, 1);
-   gpio_put(In2, 1);
+   gpio_put_masked(DirMask, DirMask);
    pwm_set_gpio_level(PWM, 0);
+   Level = 0;
+   Direction = 0;
 }
 
 void Motor::standby()
 {
    gpio_put(Standby, 0);
+   Level = 0;
+   Direction = 0;
 }
 
-void forward(Motor motor1, Motor motor2, int speed)
+void forward(Motor &motor1, Motor &motor2, int speed)
 {
    motor1.drive(speed);
    motor2.drive(speed);
 }
-void forward(Motor motor1, Motor motor2)
+void forward(Motor &motor1, Motor &motor2)
 {
    motor1.drive(DEFAULTSPEED);
    motor2.drive(DEFAULTSPEED);
 }
 
-void back(Motor motor1, Motor motor2, int speed)
+void back(Motor &motor1, Motor &motor2, int speed)
 {
    int temp = abs(speed);
    motor1.drive(-temp);
    motor2.drive(-temp);
 }
-void back(Motor motor1, Motor motor2)
+void back(Motor &motor1, Motor &motor2)
 {
    motor1.drive(-DEFAULTSPEED);
    motor2.drive(-DEFAULTSPEED);
 }
-void left(Motor left, Motor right, int speed)
+void left(Motor &left, Motor &right, int speed)
 {
    int temp = abs(speed) / 2;
    left.drive(-temp);
    right.drive(temp);
 }
 
-void right(Motor left, Motor right, int speed)
+void right(Motor &left, Motor &right, int speed)
 {
    int temp = abs(speed) / 2;
    left.drive(temp);
    right.drive(-temp);
 }
-void brake(Motor motor1, Motor motor2)
+void brake(Motor &motor1, Motor &motor2)
 {
    motor1.brake();
    motor2.brake();
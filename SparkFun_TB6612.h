@@ -23,9 +23,19 @@ Developed with ROB-9457
 
 // #include <Arduino.h>
 
+#include <cstddef>
+#include <cstdint>
+
+#include "pwm_channel.hpp"
+
 // used in some functions so you don't have to send a speed
 #define DEFAULTSPEED 255
 
+// 20 kHz is above hearing and well inside the TB6612's 100 kHz PWM limit
+using MotorPwm = PwmConfig<SYS_CLK_HZ, 20000>;
+// speed 0..DEFAULTSPEED to a level of MotorPwm
+using MotorScale = PwmScale<MotorPwm, DEFAULTSPEED>;
+
 class Motor
 {
 public:
@@ -50,10 +60,27 @@ public:
     //(forward, back, left, and right all call drive)
     void standby();
 
+    // Last applied speed, 0..DEFAULTSPEED
+    int level() const { return Level; }
+
+    // Last applied direction: 1 forward, -1 reverse, 0 braking or standby
+    int direction() const { return Direction; }
+
 private:
+    // MotorGroup drives several motors with shared register writes
+    template <size_t N>
+    friend class MotorGroup;
+
     // variables for the 2 inputs, PWM input, Offset value, and the Standby pin
     int In1, In2, PWM, Offset, Standby;
 
+    // In1 and In2 as GPIO masks, so both change in one SIO write and the
+    // H-bridge never sees a mix of the old and new direction
+    uint32_t DirMask, FwdBits, RevBits;
+
+    // what the driver is currently told to do, for telemetry
+    int Level, Direction;
+
     // private functions that spin the motor CC and CCW
     void fwd(int speed);
     void rev(int speed);
@@ -63,22 +90,22 @@ private:
 // values until it does.  These will also take a negative number and go backwards
 // There is also an optional speed input, if speed is not used, the function will
 // use the DEFAULTSPEED constant.
-void forward(Motor motor1, Motor motor2, int speed);
-void forward(Motor motor1, Motor motor2);
+void forward(Motor &motor1, Motor &motor2, int speed);
+void forward(Motor &motor1, Motor &motor2);
 
 // Similar to forward, will take 2 motors and go backwards.  This will take either
 // a positive or negative number and will go backwards either way.  Once again the
 // speed input is optional and will use DEFAULTSPEED if it is not defined.
-void back(Motor motor1, Motor motor2, int speed);
-void back(Motor motor1, Motor motor2);
+void back(Motor &motor1, Motor &motor2, int speed);
+void back(Motor &motor1, Motor &motor2);
 
 // Left and right take 2 motors, and it is important the order they are sent.
 // The left motor should be on the left side of the bot.  These functions
 // also take a speed value
-void left(Motor left, Motor right, int speed);
-void right(Motor left, Motor right, int speed);
+void left(Motor &left, Motor &right, int speed);
+void right(Motor &left, Motor &right, int speed);
 
 // This function takes 2 motors and and brakes them
-void brake(Motor motor1, Motor motor2);
+void brake(Motor &motor1, Motor &motor2);
 
 #endif
\ No newline at end of file
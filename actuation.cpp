@@ -0,0 +1,134 @@
+// actuation.cpp
+#include "actuation.hpp"
+#include "control_protocol.hpp"
+#include "profiling.hpp"
+
+Actuation::Actuation(DriveTrain &drive_train, Servo &servo)
+    : drive_train_(drive_train), servo_(servo), drive_axis_(0, DRIVE_LIMITS), steer_axis_(STEER_CENTRE, STEER_LIMITS),
+      encoder_(nullptr), encoder_count_(0),
+      speed_loop_(SPEED_LIMITS, SPEED_GAINS, DEFAULTSPEED, ENCODER_COUNTS_PER_REV, WHEEL_CIRCUMFERENCE_UM),
+      speed_mode_(false), motor_drive_(0), last_motor_drive_(-1), servo_dir_(STEER_CENTRE), last_servo_dir_(STEER_CENTRE - 1), ticks_(0),
+      deadman_us_(DEADMAN_TIMEOUT_MS * 1000), deadman_armed_(false), armed_us_(0), failsafe_trips_(0),
+      failsafe_latency_max_us_(0)
+{
+}
+
+void Actuation::set_deadman_timeout(uint32_t ms)
+{
+    deadman_us_ = ms * 1000;
+}
+
+void Actuation::start()
+{
+    loop_motor();
+    loop_servo();
+}
+
+void Actuation::set_setpoint(int16_t drive, uint16_t steer, uint8_t flags)
+{
+    if (flags & pico_tcp::CONTROL_FLAG_BRAKE)
+    {
+        // braking does not ramp, and does not wait for the tick either
+        drive_axis_.jump_to(0);
+        speed_mode_ = false;
+        motor_drive_ = 0;
+        PROFILE_SCOPE(pico_tcp::PROFILE_APPLY_MOTOR);
+        loop_motor();
+    }
+    else if (flags & pico_tcp::CONTROL_FLAG_SPEED)
+    {
+        if (!speed_mode_)
+        {
+            // from the speed the wheel has now and the level driving it
+            speed_loop_.engage(motor_drive_);
+            speed_mode_ = true;
+        }
+        speed_loop_.set_target(drive < -SPEED_MAX_MM_S ? -SPEED_MAX_MM_S
+                                                       : (drive > SPEED_MAX_MM_S ? SPEED_MAX_MM_S : drive));
+    }
+    else
+    {
+        if (speed_mode_)
+        {
+            // ramp on from the level the speed loop left
+            drive_axis_.restart_at(motor_drive_);
+            speed_mode_ = false;
+        }
+        drive_axis_.set_target(drive);
+    }
+    steer_axis_.set_target(steer);
+
+    deadman_armed_ = deadman_us_ != 0;
+    armed_us_ = time_us_32();
+}
+
+void Actuation::tick()
+{
+    const bool trip = deadman_armed_ && time_us_32() - armed_us_ >= deadman_us_;
+    if (trip)
+    {
+        deadman_armed_ = false;
+        drive_axis_.jump_to(0);
+        speed_mode_ = false;
+        steer_axis_.jump_to(STEER_CENTRE);
+    }
+
+    if (encoder_)
+    {
+        encoder_count_ = *encoder_;
+        speed_loop_.measure(encoder_count_);
+    }
+    motor_drive_ = speed_mode_ ? speed_loop_.step(encoder_ != nullptr) : drive_axis_.step();
+    servo_dir_ = steer_axis_.step();
+    {
+        PROFILE_SCOPE(pico_tcp::PROFILE_APPLY_MOTOR);
+        loop_motor();
+    }
+    {
+        PROFILE_SCOPE(pico_tcp::PROFILE_APPLY_SERVO);
+        loop_servo();
+    }
+
+    if (trip)
+    {
+        // the deadline is the timeout after the setpoint, the brake has just been written
+        const uint32_t late_us = time_us_32() - armed_us_ - deadman_us_;
+        failsafe_trips_++;
+        if (late_us > failsafe_latency_max_us_)
+        {
+            failsafe_latency_max_us_ = late_us;
+        }
+    }
+    ticks_++;
+}
+
+void Actuation::loop_motor()
+{
+    if (last_motor_drive_ == motor_drive_)
+    {
+        return;
+    }
+
+    if (motor_drive_ == 0)
+    {
+        drive_train_.brake();
+    }
+    else
+    {
+        drive_train_.drive({motor_drive_});
+    }
+
+    last_motor_drive_ = motor_drive_;
+}
+
+void Actuation::loop_servo()
+{
+    if (last_servo_dir_ == servo_dir_)
+    {
+        return;
+    }
+
+    servo_.set_angle(servo_dir_);
+
+    last_servo_dir_ = servo_dir_;
+}
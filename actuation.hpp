@@ -0,0 +1,146 @@
+#pragma once
+// actuation.hpp - the car's motor and servo, driven through the motion profile
+//
+// Actuation owns the setpoint ramps and writes the outputs; it does not know
+// about cores, timers or the network. The firmware steps it from a repeating
+// timer on core 0, and tools/picow_replay steps it from a recorded journal, so
+// both run exactly the same code between a setpoint and the PWM registers.
+//
+// Drive comes in one of two units, chosen per setpoint. By default it is a
+// PWM level, -255..255, ramped by DRIVE_LIMITS and written as it is. With
+// CONTROL_FLAG_SPEED it is a wheel speed in mm/s: the target is ramped by
+// SPEED_LIMITS and a SpeedLoop (speed_control.hpp) turns it into the PWM level
+// every tick, from the wheel encoder's count. Switching between the two picks
+// up where the other left off, so the motor does not jump. Without an encoder
+// speed setpoints run on the loop's feedforward alone, open loop.
+//
+// The dead-man failsafe lives here as well. Every setpoint arms it; if the
+// next one does not follow within the timeout, the tick brakes the motor and
+// centres the servo without ramping. The tick runs from a hardware alarm,
+// independent of both cores' loops, and checks the deadline every time, so the
+// stop is written at most one tick after the deadline. On the replay's virtual
+// clock it trips at the same tick as on the device.
+
+#include <array>
+#include <cstdint>
+
+#include "SparkFun_TB6612.h"
+#include "motor_group.hpp"
+#include "motion_profile.hpp"
+#include "pwm_channel.hpp"
+#include "servo.hpp"
+#include "speed_control.hpp"
+
+// pin assignment, checked at compile time below
+constexpr uint MOTOR_IN1_PIN = 26;
+constexpr uint MOTOR_IN2_PIN = 27;
+constexpr uint MOTOR_PWM_PIN = 28;
+constexpr uint MOTOR_STBY_PIN = 5;
+constexpr uint SERVO_PWM_PIN = 15;
+// the state machine reads A and B as a pair, B has to be the next pin
+constexpr uint ENCODER_A_PIN = 6;
+constexpr uint ENCODER_B_PIN = ENCODER_A_PIN + 1;
+
+static_assert(pins_distinct(std::array<uint, 7>{MOTOR_IN1_PIN, MOTOR_IN2_PIN, MOTOR_PWM_PIN, MOTOR_STBY_PIN,
+                                                SERVO_PWM_PIN, ENCODER_A_PIN, ENCODER_B_PIN}),
+              "a GPIO is assigned twice");
+// the motor runs at 20 kHz and the servo at 50 Hz, they cannot share a slice
+static_assert(slices_distinct(std::array<uint, 2>{MOTOR_PWM_PIN, SERVO_PWM_PIN}), "motor and servo share a PWM slice");
+
+constexpr MotionLimits DRIVE_LIMITS = {1000, 20000}; // 0 to full speed in about 0.3 s
+constexpr MotionLimits STEER_LIMITS = {400, 8000};   // degrees
+
+// wheel and encoder: a 65 mm wheel, 360 lines counted on both edges of A and B
+constexpr uint32_t ENCODER_COUNTS_PER_REV = 1440;
+constexpr uint32_t WHEEL_CIRCUMFERENCE_UM = 204200;
+// top speed is about 1.3 m/s, 9400 edges per second; follow up to five times that
+constexpr uint32_t ENCODER_MAX_STEP_RATE = 50000;
+
+// speed setpoints, mm/s
+constexpr int32_t SPEED_MAX_MM_S = 1500;
+constexpr MotionLimits SPEED_LIMITS = {4000, 40000}; // 0 to 1.2 m/s in about 0.4 s
+// feedforward: full PWM makes about 1340 mm/s at 7.4 V; the rest was tuned
+// against the motor model with tools/picow_speed --bench
+constexpr SpeedGains SPEED_GAINS = {speed_q16(255.0 / 1340), speed_q16(0.8), speed_q16(0.01), 0};
+
+// no setpoint for this long and the failsafe stops the car
+constexpr uint32_t DEADMAN_TIMEOUT_MS = 250;
+constexpr int32_t STEER_CENTRE = 90;
+
+// every motor of the car, switched together
+using DriveTrain = MotorGroup<1>;
+
+class Actuation
+{
+public:
+    Actuation(DriveTrain &drive_train, Servo &servo);
+
+    // Close the speed loop with the encoder count kept at count, the word the
+    // encoder's DMA writes (QuadratureEncoder::count_word()) or one a replay
+    // sets; without one, speed setpoints run open loop. Call before start().
+    void set_encoder(const volatile uint32_t *count) { encoder_ = count; }
+
+    // Write the initial outputs: brake, servo centred.
+    void start();
+
+    // Failsafe timeout, 0 disables it. Same rules as set_setpoint().
+    void set_deadman_timeout(uint32_t ms);
+
+    // Hand a setpoint to the ramps; it takes effect from the next tick on.
+    // drive is a PWM level, or mm/s with CONTROL_FLAG_SPEED. A brake does not
+    // wait for the tick: the motor is braked right here, and the next speed
+    // setpoint starts from rest. Must not be interrupted by tick() (mask the
+    // timer around it).
+    void set_setpoint(int16_t drive, uint16_t steer, uint8_t flags);
+
+    // One step of both ramps, then write whatever changed.
+    void tick();
+
+    // Ticks run so far. A setpoint handed over when ticks() == n is first
+    // applied by tick number n + 1, which makes a journal replayable.
+    uint32_t ticks() const { return ticks_; }
+
+    // Times the failsafe stopped the car since boot.
+    uint32_t failsafe_trips() const { return failsafe_trips_; }
+
+    // Worst time from a failsafe deadline to the brake being written.
+    uint32_t failsafe_latency_max_us() const { return failsafe_latency_max_us_; }
+
+    // True while drive is a speed; the loop is only closed with an encoder.
+    bool speed_mode() const { return speed_mode_; }
+    bool closed_loop() const { return speed_mode_ && encoder_ != nullptr; }
+
+    // The encoder count the last tick read, for the journal.
+    bool has_encoder() const { return encoder_ != nullptr; }
+    uint32_t encoder_count() const { return encoder_count_; }
+
+    // Measured wheel speed in mm/s, 0 without an encoder.
+    int32_t wheel_speed() const { return speed_loop_.speed(); }
+
+    // The ramped speed target in mm/s, 0 outside speed mode.
+    int32_t speed_target() const { return speed_mode_ ? speed_loop_.target() : 0; }
+
+private:
+    void loop_motor();
+    void loop_servo();
+
+    DriveTrain &drive_train_;
+    Servo &servo_;
+    RampAxis drive_axis_;
+    RampAxis steer_axis_;
+    const volatile uint32_t *encoder_;
+    uint32_t encoder_count_;
+    SpeedLoop speed_loop_;
+    bool speed_mode_;
+    int motor_drive_;
+    int last_motor_drive_;
+    int servo_dir_;
+    int last_servo_dir_;
+    uint32_t ticks_;
+
+    uint32_t deadman_us_;
+    bool deadman_armed_;
+    uint32_t armed_us_; // time of the last setpoint
+    uint32_t failsafe_trips_;
+    uint32_t failsafe_latency_max_us_;
+};
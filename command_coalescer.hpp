@@ -0,0 +1,99 @@
+#pragma once
+// command_coalescer.hpp - one setpoint per receive burst, brakes first
+//
+// After a WiFi stall lwIP hands the receive callback everything that queued
+// up in one go, dozens of commands from a fast controller. Applying them in
+// turn only replays stale history: core 0 would hand each one to the ramps
+// and the journal just for the next one to replace it. The servers feed the
+// commands of one burst (a TCP pbuf chain, a UDP datagram) through a
+// CommandCoalescer instead and apply what is left at the end, the command
+// with the highest seq. Every command carries both channels, drive and steer,
+// so that is the newest setpoint of each.
+//
+// A brake is not held back to the end of the burst: offer() returns
+// CoalesceVerdict::Urgent and the caller applies it on the spot, and core 0
+// writes it without waiting for the next motion tick. It still has to be the
+// newest command so far; a brake that a newer command has already overtaken
+// is as stale as any other command.
+
+#include <cstdint>
+
+#include "control_protocol.hpp"
+
+namespace pico_tcp
+{
+
+    enum class CoalesceVerdict : uint8_t
+    {
+        Held,   // newest so far, applied by take() at the end of the burst
+        Urgent, // a brake, apply now
+        Stale,  // older than a command already seen, dropped
+    };
+
+    class CommandCoalescer
+    {
+    public:
+        // Start a burst.
+        void begin()
+        {
+            have_pending_ = false;
+            have_newest_ = false;
+        }
+
+        CoalesceVerdict offer(const ControlCommand &cmd)
+        {
+            // serial number arithmetic, so the sequence may wrap; on a tie
+            // the later one wins, the stream order is all there is
+            if (have_newest_ && static_cast<int16_t>(cmd.seq - newest_seq_) < 0)
+            {
+                stale_++;
+                return CoalesceVerdict::Stale;
+            }
+            have_newest_ = true;
+            newest_seq_ = cmd.seq;
+            if (have_pending_)
+            {
+                coalesced_++;
+                have_pending_ = false;
+            }
+            if (cmd.flags & CONTROL_FLAG_BRAKE)
+            {
+                urgent_++;
+                return CoalesceVerdict::Urgent;
+            }
+            pending_ = cmd;
+            have_pending_ = true;
+            return CoalesceVerdict::Held;
+        }
+
+        // End the burst. Returns false if nothing is left to apply.
+        bool take(ControlCommand &out)
+        {
+            if (!have_pending_)
+            {
+                return false;
+            }
+            out = pending_;
+            have_pending_ = false;
+            return true;
+        }
+
+        // Commands replaced by a newer one of the same burst.
+        uint32_t coalesced() const { return coalesced_; }
+
+        // Commands older than one already seen in the same burst.
+        uint32_t stale() const { return stale_; }
+
+        // Brakes applied ahead of the end of their burst.
+        uint32_t urgent() const { return urgent_; }
+
+    private:
+        ControlCommand pending_ = {};
+        bool have_pending_ = false;
+        bool have_newest_ = false;
+        uint16_t newest_seq_ = 0;
+        uint32_t coalesced_ = 0;
+        uint32_t stale_ = 0;
+        uint32_t urgent_ = 0;
+    };
+} // namespace pico_tcp
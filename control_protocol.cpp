@@ -0,0 +1,287 @@
+// control_protocol.cpp
+#include "control_protocol.hpp"
+#include <cstring>
+
+extern "C"
+{
+#include "lwip/pbuf.h"
+}
+
+using namespace pico_tcp;
+
+bool pico_tcp::decode_control(const uint8_t *payload, uint16_t len, ControlCommand &out)
+{
+    if (len < CONTROL_PAYLOAD_SIZE)
+    {
+        return false;
+    }
+    out.seq = read_u16(payload);
+    out.drive = static_cast<int16_t>(read_u16(payload + 2));
+    out.steer = read_u16(payload + 4);
+    out.flags = payload[6];
+    return true;
+}
+
+size_t pico_tcp::encode_control(const ControlCommand &cmd, uint8_t *out, size_t cap)
+{
+    const size_t total = FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE;
+    if (cap < total)
+    {
+        return 0;
+    }
+    out[0] = FRAME_MAGIC;
+    out[1] = FRAME_CONTROL;
+    write_u16(out + 2, CONTROL_PAYLOAD_SIZE);
+    uint8_t *payload = out + FRAME_HEADER_SIZE;
+    write_u16(payload, cmd.seq);
+    write_u16(payload + 2, static_cast<uint16_t>(cmd.drive));
+    write_u16(payload + 4, cmd.steer);
+    payload[6] = cmd.flags;
+    return total;
+}
+
+void pico_tcp::encode_sample(const TelemetrySample &sample, uint8_t *out)
+{
+    write_u32(out, sample.t_us);
+    write_u16(out + 4, static_cast<uint16_t>(sample.motor_level));
+    out[6] = static_cast<uint8_t>(sample.motor_dir);
+    out[7] = sample.servo_angle;
+    write_u16(out + 8, sample.servo_pulse);
+    write_u16(out + 10, sample.applies);
+    write_u16(out + 12, sample.apply_max_us);
+    write_u16(out + 14, sample.latency_max_us);
+    write_u16(out + 16, sample.failsafe_trips);
+    write_u16(out + 18, sample.failsafe_latency_max_us);
+    out[20] = sample.trajectory_depth;
+    out[21] = sample.trajectory_state;
+    write_u16(out + 22, sample.trajectory_lead_ms);
+    write_u16(out + 24, sample.trajectory_underruns);
+    write_u16(out + 26, static_cast<uint16_t>(sample.wheel_speed));
+    write_u16(out + 28, static_cast<uint16_t>(sample.speed_target));
+    out[30] = sample.drive_mode;
+    out[31] = 0;
+}
+
+void pico_tcp::decode_sample(const uint8_t *in, TelemetrySample &out)
+{
+    out.t_us = read_u32(in);
+    out.motor_level = static_cast<int16_t>(read_u16(in + 4));
+    out.motor_dir = static_cast<int8_t>(in[6]);
+    out.servo_angle = in[7];
+    out.servo_pulse = read_u16(in + 8);
+    out.applies = read_u16(in + 10);
+    out.apply_max_us = read_u16(in + 12);
+    out.latency_max_us = read_u16(in + 14);
+    out.failsafe_trips = read_u16(in + 16);
+    out.failsafe_latency_max_us = read_u16(in + 18);
+    out.trajectory_depth = in[20];
+    out.trajectory_state = in[21];
+    out.trajectory_lead_ms = read_u16(in + 22);
+    out.trajectory_underruns = read_u16(in + 24);
+    out.wheel_speed = static_cast<int16_t>(read_u16(in + 26));
+    out.speed_target = static_cast<int16_t>(read_u16(in + 28));
+    out.drive_mode = in[30];
+}
+
+void pico_tcp::encode_journal_entry(const JournalEntry &entry, uint8_t *out)
+{
+    write_u32(out, entry.t_us);
+    write_u32(out + 4, entry.tick);
+    write_u16(out + 8, static_cast<uint16_t>(entry.drive));
+    write_u16(out + 10, entry.steer);
+    out[12] = entry.source;
+    out[13] = entry.flags;
+    write_u16(out + 14, entry.lead_ms);
+    write_u32(out + 16, entry.point_t_us);
+}
+
+void pico_tcp::decode_journal_entry(const uint8_t *in, JournalEntry &out)
+{
+    out.t_us = read_u32(in);
+    out.tick = read_u32(in + 4);
+    out.drive = static_cast<int16_t>(read_u16(in + 8));
+    out.steer = read_u16(in + 10);
+    out.source = in[12];
+    out.flags = in[13];
+    out.lead_ms = read_u16(in + 14);
+    out.point_t_us = read_u32(in + 16);
+}
+
+void pico_tcp::encode_count_block(const CountBlock &block, uint8_t *out)
+{
+    write_u32(out, block.tick);
+    write_u32(out + 4, block.count);
+    out[8] = block.n;
+    for (size_t i = 0; i + 1 < COUNT_BLOCK_TICKS; ++i)
+    {
+        out[9 + i] = static_cast<uint8_t>(block.delta[i]);
+    }
+}
+
+void pico_tcp::decode_count_block(const uint8_t *in, CountBlock &out)
+{
+    out.tick = read_u32(in);
+    out.count = read_u32(in + 4);
+    out.n = in[8];
+    for (size_t i = 0; i + 1 < COUNT_BLOCK_TICKS; ++i)
+    {
+        out.delta[i] = static_cast<int8_t>(in[9 + i]);
+    }
+}
+
+void pico_tcp::encode_command_stamp(const CommandStamp &stamp, uint8_t *out)
+{
+    write_u16(out, stamp.seq);
+    out[2] = stamp.source;
+    out[3] = stamp.flags;
+    write_u32(out + 4, stamp.arrival_us);
+    write_u32(out + 8, stamp.handoff_us);
+    write_u32(out + 12, stamp.write_us);
+}
+
+void pico_tcp::decode_command_stamp(const uint8_t *in, CommandStamp &out)
+{
+    out.seq = read_u16(in);
+    out.source = in[2];
+    out.flags = in[3];
+    out.arrival_us = read_u32(in + 4);
+    out.handoff_us = read_u32(in + 8);
+    out.write_us = read_u32(in + 12);
+}
+
+bool pico_tcp::decode_trajectory(const uint8_t *payload, uint16_t len, TrajectoryBatch &out)
+{
+    if (len < TRAJECTORY_HEADER_SIZE)
+    {
+        return false;
+    }
+    out.count = payload[0];
+    out.flags = payload[1];
+    out.lead_ms = read_u16(payload + 2);
+    if (out.count == 0 || out.count > TRAJECTORY_BATCH_MAX ||
+        len < TRAJECTORY_HEADER_SIZE + out.count * TRAJECTORY_POINT_SIZE)
+    {
+        return false;
+    }
+    const uint8_t *in = payload + TRAJECTORY_HEADER_SIZE;
+    for (uint8_t i = 0; i < out.count; ++i, in += TRAJECTORY_POINT_SIZE)
+    {
+        out.points[i].t_us = read_u32(in);
+        out.points[i].drive = static_cast<int16_t>(read_u16(in + 4));
+        out.points[i].steer = read_u16(in + 6);
+    }
+    return true;
+}
+
+size_t pico_tcp::encode_trajectory(const TrajectoryBatch &batch, uint8_t *out, size_t cap)
+{
+    const size_t total = TRAJECTORY_HEADER_SIZE + batch.count * TRAJECTORY_POINT_SIZE;
+    if (cap < total || batch.count > TRAJECTORY_BATCH_MAX)
+    {
+        return 0;
+    }
+    out[0] = batch.count;
+    out[1] = batch.flags;
+    write_u16(out + 2, batch.lead_ms);
+    uint8_t *p = out + TRAJECTORY_HEADER_SIZE;
+    for (uint8_t i = 0; i < batch.count; ++i, p += TRAJECTORY_POINT_SIZE)
+    {
+        write_u32(p, batch.points[i].t_us);
+        write_u16(p + 4, static_cast<uint16_t>(batch.points[i].drive));
+        write_u16(p + 6, batch.points[i].steer);
+    }
+    return total;
+}
+
+size_t FrameDecoder::feed(const struct pbuf *p, FrameHandler handler, void *arg)
+{
+    size_t frames = 0;
+    for (const struct pbuf *q = p; q != nullptr; q = q->next)
+    {
+        frames += feed(static_cast<const uint8_t *>(q->payload), q->len, handler, arg);
+        if (q->len == q->tot_len)
+        {
+            break;
+        }
+    }
+    return frames;
+}
+
+size_t FrameDecoder::feed(const uint8_t *data, size_t len, FrameHandler handler, void *arg)
+{
+    size_t frames = 0;
+    size_t i = 0;
+    while (i < len)
+    {
+        if (fill_ == 0)
+        {
+            if (data[i] != FRAME_MAGIC)
+            {
+                ++sync_errors_;
+                ++i;
+                continue;
+            }
+            // fast path: the whole frame is contiguous, decode in place
+            if (len - i >= FRAME_HEADER_SIZE)
+            {
+                const uint16_t plen = read_u16(data + i + 2);
+                if (plen > FRAME_MAX_PAYLOAD)
+                {
+                    ++sync_errors_;
+                    ++i;
+                    continue;
+                }
+                if (len - i >= FRAME_HEADER_SIZE + plen)
+                {
+                    handler(arg, data[i + 1], data + i + FRAME_HEADER_SIZE, plen);
+                    i += FRAME_HEADER_SIZE + plen;
+                    ++frames;
+                    continue;
+                }
+            }
+        }
+
+        // slow path: the frame continues in the next buffer, stage what we have
+        size_t need = FRAME_HEADER_SIZE;
+        if (fill_ >= FRAME_HEADER_SIZE)
+        {
+            need += read_u16(staging_.data() + 2);
+        }
+        size_t take = need - fill_;
+        if (take > len - i)
+        {
+            take = len - i;
+        }
+        memcpy(staging_.data() + fill_, data + i, take);
+        fill_ += take;
+        i += take;
+
+        if (fill_ == FRAME_HEADER_SIZE)
+        {
+            const uint16_t plen = read_u16(staging_.data() + 2);
+            if (plen > FRAME_MAX_PAYLOAD)
+            {
+                // bogus header: drop its magic byte and resynchronise on the
+                // next one, which may be among the bytes already staged
+                size_t next = 1;
+                while (next < fill_ && staging_[next] != FRAME_MAGIC)
+                {
+                    ++next;
+                }
+                sync_errors_ += static_cast<uint32_t>(next);
+                memmove(staging_.data(), staging_.data() + next, fill_ - next);
+                fill_ -= next;
+                continue;
+            }
+            need = FRAME_HEADER_SIZE + plen;
+        }
+        if (fill_ >= FRAME_HEADER_SIZE && fill_ == need)
+        {
+            handler(arg, staging_[1], staging_.data() + FRAME_HEADER_SIZE,
+                    static_cast<uint16_t>(fill_ - FRAME_HEADER_SIZE));
+            fill_ = 0;
+            ++frames;
+        }
+    }
+    return frames;
+}
@@ -0,0 +1,459 @@
+#pragma once
+// control_protocol.hpp - wire format of the remote control link
+//
+// Every message on the control connection is a frame:
+//
+//   offset  size  field
+//   0       1     magic (FRAME_MAGIC)
+//   1       1     type (FrameType)
+//   2       2     payload length, little endian
+//   4       n     payload
+//
+// All multi-byte payload fields are little endian as well, which is the native
+// byte order of the RP2040, so encoding and decoding are plain loads/stores.
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+struct pbuf;
+
+namespace pico_tcp
+{
+
+    constexpr uint8_t PROTOCOL_VERSION = 1;
+    constexpr uint8_t FRAME_MAGIC = 0xA5;
+    constexpr size_t FRAME_HEADER_SIZE = 4;
+    constexpr size_t FRAME_MAX_PAYLOAD = 256;
+
+    // Types below 0x80 are sent by clients, types from 0x80 up by the device.
+    enum FrameType : uint8_t
+    {
+        FRAME_CONTROL = 0x01,        // client -> device, ControlCommand
+        FRAME_BENCH_START = 0x02,    // client -> device, start a TCP benchmark
+        FRAME_BENCH_ECHO = 0x03,     // client -> device, a FRAME_BENCH_PROBE payload sent back
+        FRAME_SUBSCRIBE = 0x04,      // client -> device, u8 bit mask of Subscription
+        FRAME_PROFILE_QUERY = 0x05,  // client -> device, u8 stage to report
+        FRAME_JOURNAL_QUERY = 0x06,  // client -> device, u32 index of the first journal entry wanted
+        FRAME_MEM_QUERY = 0x07,      // client -> device, u8 memory row to report
+        FRAME_TIME_SYNC = 0x08,      // client -> device, u64 client time, answered with FRAME_TIME_REPLY
+        FRAME_TRAJECTORY = 0x09,     // client -> device, batch of timed setpoints (TrajectoryBatch)
+        FRAME_POWER_QUERY = 0x0A,    // client -> device, empty, answered with FRAME_POWER_REPORT
+        FRAME_COUNT_QUERY = 0x0B,    // client -> device, u32 index of the first encoder count block wanted
+        FRAME_HELLO = 0x81,          // device -> client on connect and on promotion
+        FRAME_BENCH_PROBE = 0x82,    // device -> client, to be echoed
+        FRAME_BENCH_REPORT = 0x83,   // device -> client, benchmark results
+        FRAME_TELEMETRY = 0x84,      // device -> subscribed clients, batch of TelemetrySample
+        FRAME_PROFILE_REPORT = 0x85, // device -> client, timing of one stage (profiling.hpp)
+        FRAME_JOURNAL_DATA = 0x86,   // device -> client, journal entries
+        FRAME_MEM_REPORT = 0x87,     // device -> client, one memory row (mem_stats.hpp)
+        FRAME_TIME_REPLY = 0x88,     // device -> client, receive and send times of a FRAME_TIME_SYNC
+        FRAME_COMMAND_STAMPS = 0x89, // device -> subscribed clients, batch of CommandStamp
+        FRAME_POWER_REPORT = 0x8A,   // device -> client, power modes and their transitions (power_policy.hpp)
+        FRAME_COUNT_DATA = 0x8B,     // device -> client, encoder count blocks
+    };
+
+    enum Subscription : uint8_t
+    {
+        SUBSCRIBE_TELEMETRY = 1 << 0,
+        SUBSCRIBE_COMMAND_STAMPS = 1 << 1,
+    };
+
+    enum ControlFlags : uint8_t
+    {
+        CONTROL_FLAG_BRAKE = 1 << 0, // brake regardless of drive
+        CONTROL_FLAG_SPEED = 1 << 1, // drive is a wheel speed in mm/s, held by the speed loop (actuation.hpp)
+    };
+
+    // Payload of a FRAME_CONTROL frame.
+    //   0  u16 seq    wraps around, newer commands have a larger seq
+    //   2  i16 drive  PWM level, -255..255, or mm/s with CONTROL_FLAG_SPEED
+    //   4  u16 steer  servo angle in degrees, 0..180
+    //   6  u8  flags  ControlFlags
+    struct ControlCommand
+    {
+        uint16_t seq;
+        int16_t drive;
+        uint16_t steer;
+        uint8_t flags;
+    };
+    constexpr size_t CONTROL_PAYLOAD_SIZE = 7;
+
+    // Payload of a FRAME_HELLO frame.
+    //   0  u8 version      PROTOCOL_VERSION
+    //   1  u8 client       slot index of this connection
+    //   2  u8 role         0 = controller, 1 = observer
+    //   3  u8 max_clients
+    constexpr size_t HELLO_PAYLOAD_SIZE = 4;
+
+    // Payload of a FRAME_BENCH_START frame.
+    //   0  u16 size        probe payload size, clamped to BENCH_PROBE_MIN..BENCH_PROBE_MAX (tcp_server.hpp)
+    //   2  u16 iterations  probes to send
+    //   4  u8  depth       probes in flight at once, 1..BENCH_MAX_DEPTH
+    constexpr size_t BENCH_START_PAYLOAD_SIZE = 5;
+    constexpr uint8_t BENCH_MAX_DEPTH = 16;
+
+    // Payload of FRAME_BENCH_PROBE / FRAME_BENCH_ECHO, padded to the requested size.
+    //   0  u16 session  increments with every FRAME_BENCH_START
+    //   2  u16 index    probe number
+    //   4  u32 sent_us  device time the probe was queued
+    constexpr size_t BENCH_PROBE_MIN = 8;
+
+    // Payload of a FRAME_BENCH_REPORT frame. Times are microseconds; RTT
+    // percentiles are bucket upper bounds (within 25% of the true value).
+    //   0  u16 iterations  probes echoed
+    //   2  u16 size        probe payload size used
+    //   4  u32 elapsed_us  first probe queued to last echo received
+    //   8  u32 bytes       frame bytes sent plus received
+    //   12 u32 bytes_per_s
+    //   16 u32 rtt_min
+    //   20 u32 rtt_p50
+    //   24 u32 rtt_p90
+    //   28 u32 rtt_p99
+    //   32 u32 rtt_max
+    constexpr size_t BENCH_REPORT_PAYLOAD_SIZE = 36;
+
+    // One telemetry sample, taken by the actuation core at a fixed rate.
+    //   0  u32 t_us          device time
+    //   4  i16 motor_level   applied PWM level, negative when reversing
+    //   6  u8  motor_dir     1 forward, 0xff reverse, 0 brake / standby
+    //   7  u8  servo_angle   degrees
+    //   8  u16 servo_pulse   microseconds
+    //   10 u16 applies       setpoints handed to the motion profile since the previous sample
+    //   12 u16 apply_max_us  longest motion profile tick (ramp step and PWM writes) since the previous sample
+    //   14 u16 latency_max_us longest command arrival -> motion profile handoff since the previous sample
+    //   16 u16 failsafe_trips dead-man stops since boot, wrapping
+    //   18 u16 failsafe_latency_max_us worst dead-man deadline -> brake written since boot
+    //   20 u8  trajectory_depth  trajectory points buffered, not counting the one playing
+    //   21 u8  trajectory_state  TrajectoryState (trajectory.hpp)
+    //   22 u16 trajectory_lead_ms buffered ahead of playback
+    //   24 u16 trajectory_underruns since boot, wrapping
+    //   26 i16 wheel_speed   mm/s from the encoder, 0 without one
+    //   28 i16 speed_target  ramped speed setpoint in mm/s, 0 unless drive_mode is speed
+    //   30 u8  drive_mode    DriveMode
+    //   31 u8  reserved
+    struct TelemetrySample
+    {
+        uint32_t t_us;
+        int16_t motor_level;
+        int8_t motor_dir;
+        uint8_t servo_angle;
+        uint16_t servo_pulse;
+        uint16_t applies;
+        uint16_t apply_max_us;
+        uint16_t latency_max_us;
+        uint16_t failsafe_trips;
+        uint16_t failsafe_latency_max_us;
+        uint8_t trajectory_depth;
+        uint8_t trajectory_state;
+        uint16_t trajectory_lead_ms;
+        uint16_t trajectory_underruns;
+        int16_t wheel_speed;
+        int16_t speed_target;
+        uint8_t drive_mode;
+    };
+    constexpr size_t TELEMETRY_SAMPLE_SIZE = 32;
+
+    enum DriveMode : uint8_t
+    {
+        DRIVE_MODE_PWM = 0,        // drive is a PWM level
+        DRIVE_MODE_SPEED = 1,      // drive is a speed, the loop closed over the encoder
+        DRIVE_MODE_SPEED_OPEN = 2, // drive is a speed, no encoder: feedforward only
+    };
+
+    // Payload of a FRAME_TELEMETRY frame: this header, then count samples.
+    //   0  u16 batch            increments per batch, gaps mean lost batches
+    //   2  u8  count
+    //   3  u8  sample_size      TELEMETRY_SAMPLE_SIZE
+    //   4  u32 samples_dropped  samples the actuation core could not queue
+    //   8  u32 batches_dropped  batches not sent because a TX ring was full
+    //   12 u32 tcp_xmit         lwIP TCP counters, 0 without LWIP_STATS
+    //   16 u32 tcp_recv
+    //   20 u32 tcp_drop
+    //   24 u32 tcp_memerr
+    //   28 u32 commands_coalesced  replaced by a newer one of the same receive burst, TCP and UDP
+    //   32 u32 commands_stale      older than a command already applied or seen, TCP and UDP
+    //   36 u32 commands_urgent     brakes applied ahead of the rest of their burst
+    //   40 u32 commands_rejected   from a TCP observer, or in a datagram from another than the UDP peer
+    constexpr size_t TELEMETRY_HEADER_SIZE = 44;
+
+    // Payload of a FRAME_PROFILE_REPORT frame, the answer to a FRAME_PROFILE_QUERY.
+    // Empty if the stage does not exist or the firmware was built without
+    // PICOW_PROFILE. Durations are in system clock cycles.
+    //   0  u8  stage
+    //   1  u8  stage_count  query 0..stage_count-1 for the full picture
+    //   2  u16 buckets      PROFILE_BUCKETS
+    //   4  u32 clk_hz       cycles per second
+    //   8  u32 count
+    //   12 u32 min
+    //   16 u32 max
+    //   20 u32 mean
+    //   24 u32 bucket[buckets]  bucket 0 counts 0, bucket b counts [2^(b-1), 2^b)
+    constexpr size_t PROFILE_BUCKETS = 33;
+    constexpr size_t PROFILE_REPORT_HEADER_SIZE = 24;
+    constexpr size_t PROFILE_REPORT_PAYLOAD_SIZE = PROFILE_REPORT_HEADER_SIZE + 4 * PROFILE_BUCKETS;
+
+    // Payload of a FRAME_MEM_REPORT frame, the answer to a FRAME_MEM_QUERY.
+    // Empty if the row does not exist. Pools count elements, everything else
+    // bytes.
+    //   0  u8  row
+    //   1  u8  row_count   query 0..row_count-1 for the full table
+    //   2  u8  kind        MemRowKind
+    //   3  u8  name_len
+    //   4  u32 used
+    //   8  u32 max         high-water mark
+    //   12 u32 size        capacity
+    //   16 u32 errors      failed allocations
+    //   20 name[name_len]
+    constexpr size_t MEM_REPORT_HEADER_SIZE = 20;
+    constexpr size_t MEM_REPORT_NAME_MAX = 32;
+
+    void encode_sample(const TelemetrySample &sample, uint8_t *out);
+    void decode_sample(const uint8_t *in, TelemetrySample &out);
+
+    // Where a command came from: the slot index of a TCP client, or one of these.
+    constexpr uint8_t COMMAND_SOURCE_UDP = 0x80;
+    constexpr uint8_t COMMAND_SOURCE_TRAJECTORY = 0xfe; // a trajectory point, played out by the motion tick
+    constexpr uint8_t COMMAND_SOURCE_LOCAL = 0xff;      // made up on the device, e.g. the brake on shutdown
+
+    // One setpoint as handed to the motion profile, or one trajectory point
+    // (journal.hpp).
+    //   0  u32 t_us    device time of the handoff
+    //   4  u32 tick    motion ticks completed at the handoff; first applied by tick + 1
+    //   8  i16 drive
+    //   10 u16 steer
+    //   12 u8  source  COMMAND_SOURCE_* or TCP client slot
+    //   13 u8  flags   ControlFlags
+    //   14 u16 lead_ms
+    //   16 u32 point_t_us
+    // A COMMAND_SOURCE_TRAJECTORY entry is a trajectory point, recorded once
+    // when the motion tick takes it in (trajectory.hpp): drive and steer are
+    // the point's, flags are TrajectoryFlags, lead_ms is the batch's lead and
+    // point_t_us the point's time on the client's time line. A replay that
+    // queues it in a TrajectoryPlayer before tick + 1 plays the same
+    // setpoints. lead_ms and point_t_us are 0 in other entries.
+    struct JournalEntry
+    {
+        uint32_t t_us;
+        uint32_t tick;
+        int16_t drive;
+        uint16_t steer;
+        uint8_t source;
+        uint8_t flags;
+        uint16_t lead_ms;
+        uint32_t point_t_us;
+    };
+    constexpr size_t JOURNAL_ENTRY_SIZE = 20;
+
+    // Payload of a FRAME_JOURNAL_DATA frame: this header, then count entries
+    // with consecutive indices. If the requested entries were already
+    // overwritten, first is the oldest one still held; count is 0 once the
+    // client has caught up with recorded.
+    //   0  u32 first     index of the first entry
+    //   4  u32 recorded  entries recorded since boot
+    //   8  u8  count
+    //   9  u8  entry_size  JOURNAL_ENTRY_SIZE
+    constexpr size_t JOURNAL_DATA_HEADER_SIZE = 10;
+
+    void encode_journal_entry(const JournalEntry &entry, uint8_t *out);
+    void decode_journal_entry(const uint8_t *in, JournalEntry &out);
+
+    // The encoder counts read by ticks tick + 1 .. tick + n, which closed the
+    // speed loop with them or, for the SPEED_WINDOW_TICKS + 1 ticks before the
+    // loop closes, measured the speed it starts from (journal.hpp).
+    //   0  u32 tick
+    //   4  u32 count  read by tick + 1
+    //   8  u8  n      counts in the block, 1..COUNT_BLOCK_TICKS
+    //   9  i8  delta[COUNT_BLOCK_TICKS - 1]  each further count minus the one before
+    constexpr size_t COUNT_BLOCK_TICKS = 32;
+    struct CountBlock
+    {
+        uint32_t tick;
+        uint32_t count;
+        uint8_t n;
+        int8_t delta[COUNT_BLOCK_TICKS - 1];
+    };
+    constexpr size_t COUNT_BLOCK_SIZE = 8 + COUNT_BLOCK_TICKS;
+
+    // Payload of a FRAME_COUNT_DATA frame: the header of FRAME_JOURNAL_DATA,
+    // then count blocks of entry_size (COUNT_BLOCK_SIZE) bytes.
+
+    void encode_count_block(const CountBlock &block, uint8_t *out);
+    void decode_count_block(const uint8_t *in, CountBlock &out);
+
+    // Payload of a FRAME_TIME_SYNC frame.
+    //   0  u64 t0  client time the request was sent, echoed back as is
+    // Payload of the FRAME_TIME_REPLY frame answering it, in device
+    // microseconds (time_us_32()):
+    //   0  u64 t0  from the request
+    //   8  u32 t1  request handed to the TCP receive callback
+    //   12 u32 t2  reply queued
+    // With t3 the client time the reply arrived, as in NTP:
+    //   offset (device - client) = ((t1 - t0) + (t2 - t3)) / 2
+    //   round trip without the device's turnaround = (t3 - t0) - (t2 - t1)
+    // The exchange with the shortest round trip gives the best offset; its
+    // error is at most half of that round trip.
+    constexpr size_t TIME_SYNC_PAYLOAD_SIZE = 8;
+    constexpr size_t TIME_REPLY_PAYLOAD_SIZE = 16;
+
+    // Where the device time of one control command went, in device
+    // microseconds. Core 0 records one for every setpoint it hands to the
+    // motion profile, and one for every trajectory point playback reaches.
+    //   0  u16 seq         from the ControlCommand; for COMMAND_SOURCE_TRAJECTORY
+    //                      the low 16 bits of the point's t_us
+    //   2  u8  source      COMMAND_SOURCE_* or TCP client slot
+    //   3  u8  flags       ControlFlags
+    //   4  u32 arrival_us  frame handed to the TCP or UDP receive callback
+    //   8  u32 handoff_us  setpoint handed to the motion profile on core 0
+    //   12 u32 write_us    first motion tick with the setpoint done writing the PWM
+    // A setpoint replaced before the next tick gets no stamp. A trajectory
+    // point's arrival is when core 1 queued its batch, its handoff and write
+    // the tick that reached it; of points that came due on the same tick only
+    // the last is stamped.
+    struct CommandStamp
+    {
+        uint16_t seq;
+        uint8_t source;
+        uint8_t flags;
+        uint32_t arrival_us;
+        uint32_t handoff_us;
+        uint32_t write_us;
+    };
+    constexpr size_t COMMAND_STAMP_SIZE = 16;
+
+    // Payload of a FRAME_COMMAND_STAMPS frame: this header, then count stamps.
+    //   0  u8  count
+    //   1  u8  stamp_size  COMMAND_STAMP_SIZE
+    //   2  u16 reserved
+    //   4  u32 dropped     stamps core 0 could not queue since boot
+    constexpr size_t COMMAND_STAMPS_HEADER_SIZE = 8;
+
+    void encode_command_stamp(const CommandStamp &stamp, uint8_t *out);
+    void decode_command_stamp(const uint8_t *in, CommandStamp &out);
+
+    enum TrajectoryFlags : uint8_t
+    {
+        TRAJECTORY_FLAG_START = 1 << 0,             // the first point starts a new trajectory
+        TRAJECTORY_FLAG_END = 1 << 1,               // the last point ends it, no underrun after it
+        TRAJECTORY_FLAG_BRAKE_ON_UNDERRUN = 1 << 2, // with START: brake on underrun instead of holding
+        TRAJECTORY_FLAG_SPEED = 1 << 3,             // with START: drive is in mm/s, as CONTROL_FLAG_SPEED
+    };
+
+    // One point of a trajectory. t_us is the client's time line, any origin,
+    // increasing within a trajectory (wrapping like time_us_32()).
+    struct TrajectoryPoint
+    {
+        uint32_t t_us;
+        int16_t drive;
+        uint16_t steer;
+    };
+    constexpr size_t TRAJECTORY_POINT_SIZE = 8;
+    constexpr size_t TRAJECTORY_BATCH_MAX = 16;
+
+    // Payload of a FRAME_TRAJECTORY frame: this header, then count points of
+    //   0  u32 t_us
+    //   4  i16 drive
+    //   6  u16 steer
+    // Header:
+    //   0  u8  count     1..TRAJECTORY_BATCH_MAX
+    //   1  u8  flags     TrajectoryFlags
+    //   2  u16 lead_ms   with START: how far playback stays behind the first
+    //                    point's arrival, 0 for the default (trajectory.hpp)
+    constexpr size_t TRAJECTORY_HEADER_SIZE = 4;
+
+    struct TrajectoryBatch
+    {
+        uint8_t count;
+        uint8_t flags;
+        uint16_t lead_ms;
+        TrajectoryPoint points[TRAJECTORY_BATCH_MAX];
+    };
+
+    // Decode a FRAME_TRAJECTORY payload. Returns false if it is malformed.
+    bool decode_trajectory(const uint8_t *payload, uint16_t len, TrajectoryBatch &out);
+
+    // Encode the payload of a FRAME_TRAJECTORY frame. Returns its length, or
+    // 0 if cap is too small.
+    size_t encode_trajectory(const TrajectoryBatch &batch, uint8_t *out, size_t cap);
+
+    // Payload of a FRAME_POWER_REPORT frame: this header, then u32 ms_in_mode
+    // for each of mode_count modes, then count transitions of
+    //   0  u32 t_ms     milliseconds since boot
+    //   4  u8  from     PowerMode
+    //   5  u8  to
+    //   6  u16 reserved
+    // oldest first. Header:
+    //   0  u8  mode         PowerMode now
+    //   1  u8  mode_count   POWER_REPORT_MODES
+    //   2  u8  count        up to POWER_REPORT_TRANSITIONS_MAX
+    //   3  u8  reserved
+    //   4  u32 now_ms       device time of the report
+    //   8  u32 transitions  since boot
+    //   12 u32 errors       failed cyw43_wifi_pm() calls
+    constexpr size_t POWER_REPORT_HEADER_SIZE = 16;
+    constexpr size_t POWER_REPORT_MODES = 3;
+    constexpr size_t POWER_TRANSITION_SIZE = 8;
+    constexpr size_t POWER_REPORT_TRANSITIONS_MAX = 8;
+    constexpr size_t POWER_REPORT_PAYLOAD_MAX =
+        POWER_REPORT_HEADER_SIZE + 4 * POWER_REPORT_MODES + POWER_TRANSITION_SIZE * POWER_REPORT_TRANSITIONS_MAX;
+
+    inline uint16_t read_u16(const uint8_t *p)
+    {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    inline void write_u16(uint8_t *p, uint16_t v)
+    {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+    }
+
+    inline uint32_t read_u32(const uint8_t *p)
+    {
+        return static_cast<uint32_t>(read_u16(p)) | (static_cast<uint32_t>(read_u16(p + 2)) << 16);
+    }
+
+    inline void write_u32(uint8_t *p, uint32_t v)
+    {
+        write_u16(p, static_cast<uint16_t>(v));
+        write_u16(p + 2, static_cast<uint16_t>(v >> 16));
+    }
+
+    // Decode a FRAME_CONTROL payload. Returns false if it is too short.
+    bool decode_control(const uint8_t *payload, uint16_t len, ControlCommand &out);
+
+    // Encode a complete FRAME_CONTROL frame (header included) into out.
+    // Returns the number of bytes written, or 0 if cap is too small.
+    size_t encode_control(const ControlCommand &cmd, uint8_t *out, size_t cap);
+
+    // Incremental frame decoder.
+    //
+    // Frames are decoded straight out of the received data; only a frame that
+    // straddles a pbuf (or segment) boundary is staged in the decoder, so a
+    // segment carrying many frames costs no copies at all.
+    class FrameDecoder
+    {
+    public:
+        // Called once per complete frame. payload is only valid during the call.
+        using FrameHandler = void (*)(void *arg, uint8_t type, const uint8_t *payload, uint16_t len);
+
+        FrameDecoder() = default;
+
+        // Drop any partially received frame.
+        void reset() { fill_ = 0; }
+
+        // Feed a whole pbuf chain. Returns the number of frames delivered.
+        size_t feed(const struct pbuf *p, FrameHandler handler, void *arg);
+
+        // Feed a contiguous block. Returns the number of frames delivered.
+        size_t feed(const uint8_t *data, size_t len, FrameHandler handler, void *arg);
+
+        // Bytes skipped while looking for a valid frame header.
+        uint32_t sync_errors() const { return sync_errors_; }
+
+    private:
+        std::array<uint8_t, FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD> staging_;
+        size_t fill_ = 0;
+        uint32_t sync_errors_ = 0;
+    };
+} // namespace pico_tcp
@@ -0,0 +1,197 @@
+// deferred_log.cpp
+#include "deferred_log.hpp"
+#include "profiling.hpp"
+
+#include <cstring>
+
+using namespace pico_tcp;
+
+LogRing pico_tcp::log_rings[2];
+
+namespace
+{
+    uint32_t dropped_seen[2];
+    bool base_printed = false;
+
+    // snprintf() appended to a buffer, cut at its end
+    struct Line
+    {
+        char *buf;
+        size_t size;
+        size_t at;
+
+        template <typename... Args>
+        void put(const char *fmt, Args... args)
+        {
+            if (at + 1 >= size)
+            {
+                return;
+            }
+            const int n = snprintf(buf + at, size - at, fmt, args...);
+            if (n > 0)
+            {
+                at = at + static_cast<size_t>(n) < size ? at + static_cast<size_t>(n) : size - 1;
+            }
+        }
+
+        void text(const char *p, size_t n) { put("%.*s", static_cast<int>(n), p); }
+    };
+
+    // the stored argument widened again, sign-extended if it was signed
+    uint64_t widen(uintptr_t arg, uint8_t kind)
+    {
+        return kind == LOG_ARG_SIGNED ? static_cast<uint64_t>(static_cast<int64_t>(static_cast<intptr_t>(arg))) : arg;
+    }
+} // namespace
+
+size_t pico_tcp::log_format(const LogRecord &record, char *buf, size_t size)
+{
+    Line line{buf, size, 0};
+    if (size)
+    {
+        buf[0] = '\0';
+    }
+    size_t next = 0;
+    const char *p = record.fmt;
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            const char *end = strchr(p, '%');
+            const size_t n = end ? static_cast<size_t>(end - p) : strlen(p);
+            line.text(p, n);
+            p += n;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion, no '*'
+        const char *start = p;
+        const char *q = p + 1;
+        q += strspn(q, "-+ #0");
+        q += strspn(q, "0123456789");
+        if (*q == '.')
+        {
+            ++q;
+            q += strspn(q, "0123456789");
+        }
+        const char *length = q;
+        q += strspn(q, "hljzt");
+        const char conversion = *q;
+        if (!conversion)
+        {
+            line.text(start, strlen(start));
+            break;
+        }
+        p = q + 1;
+        if (conversion == '%' && q == start + 1)
+        {
+            line.text("%", 1);
+            continue;
+        }
+
+        const uint8_t kind = next < LOG_ARGS_MAX ? record.kinds[next] : uint8_t(LOG_ARG_NONE);
+        const uintptr_t arg = next < LOG_ARGS_MAX ? record.args[next] : 0;
+        ++next;
+        const bool integer = kind == LOG_ARG_SIGNED || kind == LOG_ARG_UNSIGNED;
+        // the flags, width and precision, then the conversion with its own type
+        char spec[16];
+        const size_t spec_len = static_cast<size_t>(length - start);
+        const size_t length_len = static_cast<size_t>(q - length);
+        bool fits = spec_len + 4 <= sizeof(spec);
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            fits &= integer;
+            break;
+        case 'c':
+            fits &= integer && length_len == 0;
+            break;
+        case 's':
+            fits &= kind == LOG_ARG_STRING && length_len == 0;
+            break;
+        default:
+            // floating point, %p and %n have no argument of their type here
+            fits = false;
+            break;
+        }
+        if (!fits)
+        {
+            line.text(start, static_cast<size_t>(p - start));
+            continue;
+        }
+        memcpy(spec, start, spec_len);
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            memcpy(spec + spec_len, "lld", 4);
+            line.put(spec, static_cast<long long>(log_narrow(widen(arg, kind), length, length_len, sizeof(long), true)));
+            break;
+        case 'c':
+            memcpy(spec + spec_len, "c", 2);
+            line.put(spec, static_cast<int>(static_cast<unsigned char>(arg)));
+            break;
+        case 's':
+            memcpy(spec + spec_len, "s", 2);
+            line.put(spec, reinterpret_cast<const char *>(arg));
+            break;
+        default:
+            spec[spec_len] = 'l';
+            spec[spec_len + 1] = 'l';
+            spec[spec_len + 2] = conversion;
+            spec[spec_len + 3] = '\0';
+            line.put(spec, static_cast<unsigned long long>(
+                               log_narrow(widen(arg, kind), length, length_len, sizeof(long), false)));
+            break;
+        }
+    }
+    return line.at;
+}
+
+size_t pico_tcp::log_drain_stdio(size_t max)
+{
+    PROFILE_SCOPE(PROFILE_LOG_DRAIN);
+    size_t printed = 0;
+    if (PICOW_LOG_RAW && !base_printed)
+    {
+        printf("#B %lx\n", (unsigned long)reinterpret_cast<uintptr_t>(LOG_BASE_MARK));
+        base_printed = true;
+    }
+    for (unsigned core = 0; core < 2; ++core)
+    {
+        LogRing &ring = log_rings[core];
+        const uint32_t dropped = ring.dropped();
+        if (dropped != dropped_seen[core])
+        {
+            printf("[log] core %u: %lu records dropped\n", core, (unsigned long)(dropped - dropped_seen[core]));
+            dropped_seen[core] = dropped;
+        }
+        LogRecord r;
+        while (printed < max && ring.pop(r))
+        {
+            if (PICOW_LOG_RAW)
+            {
+                printf("#L %u %lx %lx %lx %lx %lx %lx\n", core, (unsigned long)r.t_us,
+                       (unsigned long)reinterpret_cast<uintptr_t>(r.fmt), (unsigned long)r.args[0],
+                       (unsigned long)r.args[1], (unsigned long)r.args[2], (unsigned long)r.args[3]);
+            }
+            else
+            {
+                char line[LOG_LINE_MAX];
+                log_format(r, line, sizeof(line));
+                printf("[%10lu c%u] %s", (unsigned long)r.t_us, core, line);
+            }
+            ++printed;
+        }
+    }
+    return printed;
+}
+
+uint32_t pico_tcp::log_dropped()
+{
+    return log_rings[0].dropped() + log_rings[1].dropped();
+}
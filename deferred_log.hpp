@@ -0,0 +1,170 @@
+#pragma once
+// deferred_log.hpp - printf-style logging that formats later, outside the hot paths
+//
+// LOG_printf(fmt, ...) stores the address of the format string, the time and
+// up to LOG_ARGS_MAX raw arguments in a lock-free ring of the calling core,
+// a few dozen cycles, and returns. log_drain_stdio() formats and prints the
+// records afterwards, from the core 1 main loop between polls, so neither the
+// lwIP callbacks nor anything on core 0 waits for printf and the console.
+//
+// A core logs both from its loop and from interrupts (the lwIP callbacks in
+// the background build, the motion tick), so the ring has two producers per
+// core. The push runs with that core's interrupts masked, which makes it one
+// producer again for the few cycles it takes.
+//
+// Nothing is copied but the arguments, so the format has to be a string
+// literal and the arguments integers of up to pointer size or string
+// literals; anything else does not compile. Each argument is stored with its
+// kind, and the drain hands printf every conversion an argument of exactly
+// the type it names. A conversion that does not fit its argument (%s for an
+// integer, a missing argument, floating point, %p, %n) is printed as written.
+// When a ring is full the record is dropped and counted, and the next drain
+// says so.
+//
+// With -DPICOW_LOG_SYNC=ON LOG_printf is printf again, to compare the callback
+// timings of the two in a PICOW_PROFILE build. With -DPICOW_LOG_RAW=ON the
+// drain does not format either: it prints each record as a line of hex
+// numbers, and tools/picow_logfmt formats them on the host, looking the
+// format strings up in the firmware's ELF file.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+#include "spsc_ring.hpp"
+
+extern "C"
+{
+#include "hardware/sync.h"
+#include "pico/time.h"
+}
+
+#ifndef PICOW_LOG_SYNC
+#define PICOW_LOG_SYNC 0
+#endif
+
+#ifndef PICOW_LOG_RAW
+#define PICOW_LOG_RAW 0
+#endif
+
+namespace pico_tcp
+{
+
+    constexpr size_t LOG_ARGS_MAX = 4;
+    constexpr size_t LOG_RING_SIZE = 64; // records per core
+    constexpr size_t LOG_DRAIN_MAX = 8;  // records printed per main loop pass
+    constexpr size_t LOG_LINE_MAX = 160; // formatted message, longer ones are cut
+
+    enum LogArgKind : uint8_t
+    {
+        LOG_ARG_NONE, // past the last argument
+        LOG_ARG_SIGNED,
+        LOG_ARG_UNSIGNED,
+        LOG_ARG_STRING,
+    };
+
+    struct LogRecord
+    {
+        const char *fmt;
+        uint32_t t_us;
+        uintptr_t args[LOG_ARGS_MAX];
+        uint8_t kinds[LOG_ARGS_MAX]; // LogArgKind
+    };
+
+    using LogRing = SpscRing<LogRecord, LOG_RING_SIZE>;
+
+    // printed by a raw drain and looked for by picow_logfmt in the ELF file
+    inline constexpr char LOG_BASE_MARK[] = "picow deferred log base";
+
+    // one per core, indexed by get_core_num()
+    extern LogRing log_rings[2];
+
+    template <typename T>
+    constexpr uint8_t log_kind()
+    {
+        if constexpr (std::is_pointer<T>::value)
+        {
+            static_assert(std::is_same<std::remove_cv_t<std::remove_pointer_t<T>>, char>::value,
+                          "LOG_printf takes integers and string literals");
+            return LOG_ARG_STRING;
+        }
+        else if constexpr (std::is_enum<T>::value)
+        {
+            return log_kind<std::underlying_type_t<T>>();
+        }
+        else
+        {
+            static_assert(std::is_integral<T>::value, "LOG_printf takes integers and string literals");
+            static_assert(sizeof(T) <= sizeof(uintptr_t), "LOG_printf integers must fit a pointer");
+            return std::is_signed<T>::value ? LOG_ARG_SIGNED : LOG_ARG_UNSIGNED;
+        }
+    }
+
+    template <typename T>
+    inline uintptr_t log_arg(T value)
+    {
+        if constexpr (std::is_pointer<T>::value)
+        {
+            return reinterpret_cast<uintptr_t>(value);
+        }
+        else
+        {
+            // sign-extended, so a signed kind can be widened again
+            return static_cast<uintptr_t>(static_cast<intptr_t>(value));
+        }
+    }
+
+    // An argument as printf would read it for a conversion with the length
+    // modifier length[0..n) ("", "hh", "h", "l", "ll", "j", "z" or "t") on a
+    // target whose long, size_t and pointers are word bytes wide.
+    inline uint64_t log_narrow(uint64_t value, const char *length, size_t n, unsigned word, bool is_signed)
+    {
+        unsigned bytes = 4;
+        if (n == 2)
+            bytes = length[0] == 'h' ? 1 : 8;
+        else if (n == 1)
+            bytes = length[0] == 'h' ? 2 : length[0] == 'j' ? 8 : word;
+        if (bytes == 8)
+        {
+            return value;
+        }
+        const unsigned shift = 64 - 8 * bytes;
+        return is_signed ? static_cast<uint64_t>(static_cast<int64_t>(value << shift) >> shift)
+                         : (value << shift) >> shift;
+    }
+
+    template <typename... Args>
+    inline void log_deferred(const char *fmt, Args... args)
+    {
+        static_assert(sizeof...(Args) <= LOG_ARGS_MAX, "too many LOG_printf arguments");
+        const LogRecord record{fmt, time_us_32(), {log_arg(args)...}, {log_kind<Args>()...}};
+        const uint32_t status = save_and_disable_interrupts();
+        log_rings[get_core_num()].push(record);
+        restore_interrupts(status);
+    }
+
+    // Print up to max pending records, core 0's before core 1's, and a line
+    // for every run of dropped records. Core 1 only. Returns the number
+    // printed.
+    //
+    // In a PICOW_LOG_RAW build a record is printed as
+    //   #L <core> <t_us> <fmt> <arg0> <arg1> <arg2> <arg3>
+    // in hex, and the first drain prints "#B <address>", the address of
+    // LOG_BASE_MARK, from which picow_logfmt works out where the image was
+    // loaded (it moves on the host, not on the device).
+    size_t log_drain_stdio(size_t max = LOG_DRAIN_MAX);
+
+    // The record's message as printf would print it with the arguments
+    // logged, into buf, cut to size - 1 characters. Returns the length.
+    size_t log_format(const LogRecord &record, char *buf, size_t size);
+
+    // Records dropped on a full ring since boot, both cores.
+    uint32_t log_dropped();
+} // namespace pico_tcp
+
+#if PICOW_LOG_SYNC
+#define LOG_printf printf
+#else
+#define LOG_printf(...) ::pico_tcp::log_deferred(__VA_ARGS__)
+#endif
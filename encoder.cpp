@@ -0,0 +1,96 @@
+// encoder.cpp
+#include "encoder.hpp"
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+
+#include "quadrature_encoder.pio.h"
+
+namespace
+{
+    // instructions per sample, worst case: the update loop plus an increment
+    constexpr uint32_t CYCLES_PER_SAMPLE = 10;
+} // namespace
+
+QuadratureEncoder::QuadratureEncoder(uint pin_a) : pin_a_(pin_a), pio_(nullptr), sm_(-1), dma_{-1, -1}, count_(0)
+{
+}
+
+bool QuadratureEncoder::start(uint32_t max_step_rate)
+{
+    // the jump table needs offset 0; pio0 first, the cyw43 driver prefers pio1
+    return running() || start_on(pio0, max_step_rate) || start_on(pio1, max_step_rate);
+}
+
+bool QuadratureEncoder::start_on(PIO pio, uint32_t max_step_rate)
+{
+    if (!pio_can_add_program_at_offset(pio, &quadrature_encoder_program, 0))
+    {
+        return false;
+    }
+    const int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0)
+    {
+        return false;
+    }
+    dma_[0] = dma_claim_unused_channel(false);
+    dma_[1] = dma_[0] < 0 ? -1 : dma_claim_unused_channel(false);
+    if (dma_[1] < 0)
+    {
+        if (dma_[0] >= 0)
+        {
+            dma_channel_unclaim(dma_[0]);
+        }
+        dma_[0] = -1;
+        pio_sm_unclaim(pio, sm);
+        return false;
+    }
+    pio_add_program_at_offset(pio, &quadrature_encoder_program, 0);
+
+    const uint pins[2] = {pin_a_, pin_a_ + 1};
+    pio_sm_set_consecutive_pindirs(pio, sm, pin_a_, 2, false);
+    for (uint pin : pins)
+    {
+        pio_gpio_init(pio, pin);
+        gpio_pull_up(pin);
+    }
+
+    pio_sm_config c = quadrature_encoder_program_get_default_config(0);
+    sm_config_set_in_pins(&c, pin_a_);
+    // IN shifts left, no autopush: the program pushes the count itself
+    sm_config_set_in_shift(&c, false, false, 32);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    // fast enough to see every edge at max_step_rate, no faster
+    uint64_t div256 = (static_cast<uint64_t>(clock_get_hz(clk_sys)) << 8) /
+                      (static_cast<uint64_t>(CYCLES_PER_SAMPLE) * (max_step_rate ? max_step_rate : 1));
+    if (div256 < 256)
+    {
+        div256 = 256;
+    }
+    else if (div256 > 0xffffff)
+    {
+        div256 = 0xffffff;
+    }
+    sm_config_set_clkdiv_int_frac(&c, static_cast<uint16_t>(div256 >> 8), static_cast<uint8_t>(div256 & 0xff));
+    pio_sm_init(pio, sm, 0, &c);
+
+    // Each channel copies pushes into count_ until its transfer count runs
+    // out, then triggers the other one; a channel reloads its count when it is
+    // triggered, so the pair never stops.
+    for (int i = 0; i < 2; ++i)
+    {
+        dma_channel_config d = dma_channel_get_default_config(dma_[i]);
+        channel_config_set_transfer_data_size(&d, DMA_SIZE_32);
+        channel_config_set_read_increment(&d, false);
+        channel_config_set_write_increment(&d, false);
+        channel_config_set_dreq(&d, pio_get_dreq(pio, sm, false));
+        channel_config_set_chain_to(&d, dma_[1 - i]);
+        dma_channel_configure(dma_[i], &d, &count_, &pio->rxf[sm], 0xffffffffu, false);
+    }
+    dma_channel_start(dma_[0]);
+    pio_sm_set_enabled(pio, sm, true);
+
+    pio_ = pio;
+    sm_ = sm;
+    return true;
+}
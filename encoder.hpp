@@ -0,0 +1,48 @@
+#pragma once
+// encoder.hpp - quadrature wheel encoder, counted by PIO and read through DMA
+//
+// The state machine (quadrature_encoder.pio) counts every edge of A and B and
+// pushes the count after each sample. Two DMA channels, each chained to the
+// other, copy the pushes into count_ and re-arm one another, so the count in
+// RAM follows the wheel with no interrupt per edge and no CPU time at all.
+// Reading it is one load; the motion tick does that once per tick.
+//
+// The count is signed and wraps at 32 bits; the difference of two counts,
+// taken as int32_t, is the motion between them.
+
+#include <cstdint>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+class QuadratureEncoder
+{
+public:
+    // A on pin_a, B on pin_a + 1.
+    explicit QuadratureEncoder(uint pin_a);
+
+    // Load the program, claim a state machine and two DMA channels and start
+    // counting from 0. max_step_rate is the fastest edge rate to follow, in
+    // edges per second; the state machine is clocked just fast enough for it.
+    // Returns false, with nothing claimed, if no PIO block has room for the
+    // program or no DMA channels are free.
+    bool start(uint32_t max_step_rate);
+
+    bool running() const { return sm_ >= 0; }
+
+    // Edges since start(), forward counting up.
+    uint32_t count() const { return count_; }
+
+    // Where the DMA keeps the count, for reading it with one load.
+    const volatile uint32_t *count_word() const { return &count_; }
+
+private:
+    bool start_on(PIO pio, uint32_t max_step_rate);
+
+    uint pin_a_;
+    PIO pio_;
+    int sm_;
+    int dma_[2];
+    // written by DMA only
+    volatile uint32_t count_;
+};
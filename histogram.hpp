@@ -0,0 +1,97 @@
+#pragma once
+// histogram.hpp - fixed-bucket log-linear histogram for latency samples
+//
+// Each power of two is split into 2^SubBits equal buckets, so a recorded
+// value is known to within 1 / 2^SubBits of itself whatever its magnitude.
+// Values below 2^SubBits get a bucket each. Recording is a count-leading-zeros
+// and an increment; there is no allocation and no division.
+
+#include <array>
+#include <cstdint>
+
+template <unsigned SubBits>
+class LogHistogram
+{
+public:
+    static constexpr unsigned BUCKETS = (33 - SubBits) << SubBits;
+
+    void add(uint32_t value)
+    {
+        counts_[bucket_of(value)]++;
+        if (count_ == 0 || value < min_)
+            min_ = value;
+        if (value > max_)
+            max_ = value;
+        count_++;
+        total_ += value;
+    }
+
+    void reset() { *this = LogHistogram(); }
+
+    uint32_t count() const { return count_; }
+    uint32_t min() const { return min_; }
+    uint32_t max() const { return max_; }
+    uint32_t mean() const { return count_ ? static_cast<uint32_t>(total_ / count_) : 0; }
+    uint32_t bucket_count(unsigned bucket) const { return counts_[bucket]; }
+
+    // Upper bound of the bucket holding the given percentile (0..100),
+    // clamped to the largest recorded value.
+    uint32_t percentile(unsigned pct) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+        const uint64_t rank = (static_cast<uint64_t>(count_) * pct + 99) / 100;
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < BUCKETS; ++b)
+        {
+            seen += counts_[b];
+            if (seen >= rank && seen > 0)
+            {
+                const uint32_t upper = bucket_upper(b);
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    static unsigned bucket_of(uint32_t value)
+    {
+        if (value < (1u << SubBits))
+        {
+            return value;
+        }
+        const unsigned msb = 31 - __builtin_clz(value);
+        const unsigned shift = msb - SubBits;
+        return ((msb - SubBits + 1) << SubBits) + ((value >> shift) & ((1u << SubBits) - 1));
+    }
+
+    static uint32_t bucket_lower(unsigned bucket)
+    {
+        if (bucket < (1u << SubBits))
+        {
+            return bucket;
+        }
+        const unsigned msb = (bucket >> SubBits) - 1 + SubBits;
+        const uint32_t sub = bucket & ((1u << SubBits) - 1);
+        return (1u << msb) | (sub << (msb - SubBits));
+    }
+
+    static uint32_t bucket_upper(unsigned bucket)
+    {
+        if (bucket < (1u << SubBits))
+        {
+            return bucket;
+        }
+        const unsigned msb = (bucket >> SubBits) - 1 + SubBits;
+        return bucket_lower(bucket) + ((1u << (msb - SubBits)) - 1);
+    }
+
+private:
+    std::array<uint32_t, BUCKETS> counts_ = {};
+    uint32_t count_ = 0;
+    uint32_t min_ = 0;
+    uint32_t max_ = 0;
+    uint64_t total_ = 0;
+};
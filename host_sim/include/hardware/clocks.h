@@ -0,0 +1,20 @@
+#pragma once
+// Host stand-in for hardware/clocks.h: the simulated system clock is fixed.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    enum clock_index
+    {
+        clk_sys = 5,
+    };
+
+    static inline uint32_t clock_get_hz(enum clock_index /*clk_index*/) { return 125000000u; }
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+// Host stand-in for hardware/dma.h. Channels are claimed and configured but
+// move nothing on their own; sim_pio.cpp delivers a state machine's pushes to
+// the write address of the channel paced by its DREQ.
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define NUM_DMA_CHANNELS 12
+
+    enum dma_channel_transfer_size
+    {
+        DMA_SIZE_8 = 0,
+        DMA_SIZE_16 = 1,
+        DMA_SIZE_32 = 2,
+    };
+
+    typedef struct
+    {
+        uint8_t size;
+        bool read_increment;
+        bool write_increment;
+        uint8_t dreq;
+        uint8_t chain_to;
+    } dma_channel_config;
+
+    static inline dma_channel_config dma_channel_get_default_config(uint channel)
+    {
+        dma_channel_config c = {DMA_SIZE_32, true, false, 0x3f, (uint8_t)channel};
+        return c;
+    }
+
+    static inline void channel_config_set_transfer_data_size(dma_channel_config *c,
+                                                             enum dma_channel_transfer_size size)
+    {
+        c->size = (uint8_t)size;
+    }
+    static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+    static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+    static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = (uint8_t)dreq; }
+    static inline void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) { c->chain_to = (uint8_t)chain_to; }
+
+    int dma_claim_unused_channel(bool required);
+    void dma_channel_unclaim(uint channel);
+    void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                               const volatile void *read_addr, uint transfer_count, bool trigger);
+    void dma_channel_start(uint channel);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+// Host stand-in for hardware/flash.h. Flash is a RAM array at XIP_BASE,
+// loaded from and written back to PICOW_SIM_FLASH if set (see sim_flash.cpp).
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+// board header on the device
+#define PICO_FLASH_SIZE_BYTES (2u * 1024 * 1024)
+
+    extern uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t)sim_flash)
+
+    void flash_range_erase(uint32_t flash_offs, size_t count);
+    void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+// Host stand-in for hardware/gpio.h. Pin writes are recorded with a timestamp
+// in the simulator trace (see sim_hw.cpp).
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define NUM_BANK0_GPIOS 30
+
+    enum gpio_dir
+    {
+        GPIO_IN = 0,
+        GPIO_OUT = 1
+    };
+
+    enum gpio_function
+    {
+        GPIO_FUNC_XIP = 0,
+        GPIO_FUNC_SPI = 1,
+        GPIO_FUNC_UART = 2,
+        GPIO_FUNC_I2C = 3,
+        GPIO_FUNC_PWM = 4,
+        GPIO_FUNC_SIO = 5,
+        GPIO_FUNC_PIO0 = 6,
+        GPIO_FUNC_PIO1 = 7,
+        GPIO_FUNC_GPCK = 8,
+        GPIO_FUNC_USB = 9,
+        GPIO_FUNC_NULL = 0x1f,
+    };
+
+    void gpio_init(uint gpio);
+    void gpio_set_dir(uint gpio, bool out);
+    void gpio_set_function(uint gpio, enum gpio_function fn);
+    void gpio_put(uint gpio, bool value);
+    bool gpio_get(uint gpio);
+    void gpio_put_masked(uint32_t mask, uint32_t value);
+    void gpio_set_mask(uint32_t mask);
+    void gpio_clr_mask(uint32_t mask);
+    void gpio_pull_up(uint gpio);
+
+#ifdef __cplusplus
+}
+#endif
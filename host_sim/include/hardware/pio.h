@@ -0,0 +1,104 @@
+#pragma once
+// Host stand-in for hardware/pio.h. Programs are not executed: sim_pio.cpp
+// keeps track of what was loaded and claimed, and the state machine running
+// the quadrature encoder is replaced by a model of the wheel that pushes the
+// count the program would (see sim_pio.cpp).
+
+#include "pico/types.h"
+#include "hardware/gpio.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_INSTRUCTION_COUNT 32
+
+    typedef struct
+    {
+        volatile uint32_t txf[NUM_PIO_STATE_MACHINES];
+        volatile uint32_t rxf[NUM_PIO_STATE_MACHINES];
+    } pio_hw_t;
+
+    typedef pio_hw_t *PIO;
+
+    extern pio_hw_t sim_pio_hw[NUM_PIOS];
+#define pio0 (&sim_pio_hw[0])
+#define pio1 (&sim_pio_hw[1])
+
+    typedef struct
+    {
+        const uint16_t *instructions;
+        uint8_t length;
+        int8_t origin; // -1 for anywhere
+    } pio_program_t;
+
+    typedef struct
+    {
+        uint32_t clkdiv; // 16.8 fixed point
+        uint wrap_target;
+        uint wrap;
+        uint in_base;
+        bool in_shift_right;
+        bool autopush;
+        uint push_threshold;
+        uint fifo_join;
+    } pio_sm_config;
+
+    enum pio_fifo_join
+    {
+        PIO_FIFO_JOIN_NONE = 0,
+        PIO_FIFO_JOIN_TX = 1,
+        PIO_FIFO_JOIN_RX = 2,
+    };
+
+    static inline uint pio_get_index(PIO pio) { return pio == pio1 ? 1u : 0u; }
+
+    // DREQ_PIO0_TX0 .. DREQ_PIO1_RX3, numbered as on the RP2040
+    static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+    {
+        return pio_get_index(pio) * 8u + (is_tx ? 0u : 4u) + sm;
+    }
+
+    static inline pio_sm_config pio_get_default_sm_config(void)
+    {
+        pio_sm_config c = {1u << 8, 0, 31, 0, true, false, 32, PIO_FIFO_JOIN_NONE};
+        return c;
+    }
+
+    static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap)
+    {
+        c->wrap_target = wrap_target;
+        c->wrap = wrap;
+    }
+
+    static inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) { c->in_base = in_base; }
+
+    static inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold)
+    {
+        c->in_shift_right = shift_right;
+        c->autopush = autopush;
+        c->push_threshold = push_threshold;
+    }
+
+    static inline void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) { c->fifo_join = join; }
+
+    static inline void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac)
+    {
+        c->clkdiv = ((uint32_t)div_int << 8) | div_frac;
+    }
+
+    bool pio_can_add_program_at_offset(PIO pio, const pio_program_t *program, uint offset);
+    uint pio_add_program_at_offset(PIO pio, const pio_program_t *program, uint offset);
+    int pio_claim_unused_sm(PIO pio, bool required);
+    void pio_sm_unclaim(PIO pio, uint sm);
+    void pio_gpio_init(PIO pio, uint pin);
+    int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+    int pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+    void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+// Host stand-in for hardware/pwm.h. Slice configuration and compare levels
+// are recorded in the simulator trace (see sim_hw.cpp).
+
+#include "pico/types.h"
+#include "hardware/gpio.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define NUM_PWM_SLICES 8
+#define PWM_CHAN_A 0
+#define PWM_CHAN_B 1
+
+    static inline uint pwm_gpio_to_slice_num(uint gpio) { return (gpio >> 1u) & 7u; }
+    static inline uint pwm_gpio_to_channel(uint gpio) { return gpio & 1u; }
+
+    void pwm_set_wrap(uint slice_num, uint16_t wrap);
+    void pwm_set_clkdiv(uint slice_num, float divider);
+    void pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract);
+    void pwm_set_enabled(uint slice_num, bool enabled);
+    void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+    void pwm_set_both_levels(uint slice_num, uint16_t level_a, uint16_t level_b);
+    static inline void pwm_set_gpio_level(uint gpio, uint16_t level)
+    {
+        pwm_set_chan_level(pwm_gpio_to_slice_num(gpio), pwm_gpio_to_channel(gpio), level);
+    }
+
+#ifdef __cplusplus
+}
+#endif
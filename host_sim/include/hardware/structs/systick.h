@@ -0,0 +1,28 @@
+#pragma once
+// Host stand-in for the Cortex-M0+ SysTick registers. The current value
+// counts down at the nominal 125 MHz system clock from the host's monotonic
+// clock and wraps at 24 bits, like the real counter; csr and rvr are plain
+// storage.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+
+struct sim_systick_hw_t
+{
+    struct current_value
+    {
+        operator uint32_t() const;
+        current_value &operator=(uint32_t) { return *this; } // writes clear the counter on the device
+    };
+
+    uint32_t csr;
+    uint32_t rvr;
+    current_value cvr;
+    uint32_t calib;
+};
+
+extern sim_systick_hw_t sim_systick;
+#define systick_hw (&sim_systick)
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+// Host stand-in for hardware/sync.h. __sev()/__wfe() behave like the ARM
+// event register: one latched event flag shared by both "cores".
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void __sev(void);
+    void __wfe(void);
+    static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+    static inline void __mem_fence_acquire(void) { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+    static inline void __mem_fence_release(void) { __atomic_thread_fence(__ATOMIC_RELEASE); }
+
+    // Like the pico_time function: wait for an event, returns true if until passed.
+    bool best_effort_wfe_or_timeout(absolute_time_t until);
+
+    uint get_core_num(void);
+
+    // Masks the simulated alarm interrupts (repeating timer callbacks) of all
+    // cores until the matching restore_interrupts().
+    uint32_t save_and_disable_interrupts(void);
+    void restore_interrupts(uint32_t status);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+// Host stand-in for hardware/watchdog.h. An expired watchdog ends the
+// simulator with status 3 instead of resetting (see sim_multicore.cpp).
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+    void watchdog_update(void);
+    bool watchdog_caused_reboot(void);
+
+#ifdef __cplusplus
+}
+#endif
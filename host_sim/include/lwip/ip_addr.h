@@ -0,0 +1,30 @@
+#pragma once
+// Host stand-in for lwip/ip_addr.h (IPv4 only).
+
+#include "lwip/arch.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct ip4_addr
+    {
+        u32_t addr;
+    } ip4_addr_t;
+    typedef ip4_addr_t ip_addr_t;
+
+#define IPADDR_TYPE_V4 0U
+#define IPADDR_TYPE_ANY 46U
+#define IP_ADDR_ANY ((const ip_addr_t *)0)
+#define IP_ANY_TYPE IP_ADDR_ANY
+#define ip4_addr_get_u32(a) ((a)->addr)
+#define ip4_addr_isany_val(a) ((a).addr == 0)
+#define ip_addr_cmp(a, b) ((a)->addr == (b)->addr)
+
+    char *ip4addr_ntoa(const ip4_addr_t *addr);
+#define ipaddr_ntoa(a) ip4addr_ntoa(a)
+
+#ifdef __cplusplus
+}
+#endif
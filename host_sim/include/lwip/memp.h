@@ -0,0 +1,44 @@
+#pragma once
+// Host stand-in for lwip/memp.h. Only the pools sim_lwip.cpp can account
+// for exist, sized with lwIP's defaults unless lwipopts.h overrides them.
+
+#include "lwipopts.h"
+
+#ifndef MEMP_NUM_UDP_PCB
+#define MEMP_NUM_UDP_PCB 4
+#endif
+#ifndef MEMP_NUM_TCP_PCB
+#define MEMP_NUM_TCP_PCB 5
+#endif
+#ifndef MEMP_NUM_TCP_PCB_LISTEN
+#define MEMP_NUM_TCP_PCB_LISTEN 8
+#endif
+#ifndef MEMP_NUM_TCP_SEG
+#define MEMP_NUM_TCP_SEG 16
+#endif
+#ifndef MEMP_NUM_PBUF
+#define MEMP_NUM_PBUF 16
+#endif
+#ifndef PBUF_POOL_SIZE
+#define PBUF_POOL_SIZE 16
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        MEMP_UDP_PCB,
+        MEMP_TCP_PCB,
+        MEMP_TCP_PCB_LISTEN,
+        MEMP_TCP_SEG,
+        MEMP_PBUF,
+        MEMP_PBUF_POOL,
+        MEMP_MAX
+    } memp_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+// Host stand-in for lwip/netif.h. The simulator exposes one interface on
+// the loopback address.
+
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct netif
+    {
+        struct netif *next;
+        ip4_addr_t ip_addr;
+        ip4_addr_t netmask;
+        ip4_addr_t gw;
+    };
+
+    extern struct netif *netif_list;
+    extern struct netif *netif_default;
+
+#define netif_ip4_addr(n) ((const ip4_addr_t *)&((n)->ip_addr))
+#define netif_ip4_netmask(n) ((const ip4_addr_t *)&((n)->netmask))
+#define netif_ip4_gw(n) ((const ip4_addr_t *)&((n)->gw))
+
+    void netif_set_addr(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask,
+                        const ip4_addr_t *gw);
+
+#ifdef __cplusplus
+}
+#endif
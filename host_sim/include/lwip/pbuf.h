@@ -0,0 +1,24 @@
+#pragma once
+// Host stand-in for lwip/pbuf.h. Only the fields the firmware reads exist.
+
+#include "lwip/err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct pbuf
+    {
+        struct pbuf *next;
+        void *payload;
+        u16_t tot_len;
+        u16_t len;
+    };
+
+    u8_t pbuf_free(struct pbuf *p);
+    u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+// Host stand-in for lwIP's statistics. Only the TCP protocol counters and
+// the heap and pool usage exist; sim_lwip.cpp counts what the shim can see.
+
+#include "lwipopts.h"
+#include "lwip/arch.h"
+#include "lwip/memp.h"
+
+#ifndef TCP_STATS
+#define TCP_STATS 1
+#endif
+#ifndef MEM_STATS
+#define MEM_STATS 1
+#endif
+#ifndef MEMP_STATS
+#define MEMP_STATS 1
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct stats_proto
+    {
+        u16_t xmit;
+        u16_t recv;
+        u16_t fw;
+        u16_t drop;
+        u16_t chkerr;
+        u16_t lenerr;
+        u16_t memerr;
+        u16_t rterr;
+        u16_t proterr;
+        u16_t opterr;
+        u16_t err;
+        u16_t cachehit;
+    };
+
+    // lwip/mem.h, for a MEM_SIZE under 64 KB
+    typedef u16_t mem_size_t;
+
+    struct stats_mem
+    {
+        const char *name;
+        u16_t err;
+        mem_size_t avail;
+        mem_size_t used;
+        mem_size_t max;
+        u16_t illegal;
+    };
+
+    struct stats_
+    {
+        struct stats_proto tcp;
+        struct stats_mem mem;
+        struct stats_mem *memp[MEMP_MAX];
+    };
+
+    extern struct stats_ lwip_stats;
+
+#ifdef __cplusplus
+}
+#endif
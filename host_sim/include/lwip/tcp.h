@@ -0,0 +1,91 @@
+#pragma once
+// Host stand-in for the lwIP raw TCP API, implemented on top of non-blocking
+// POSIX sockets (see sim_lwip.cpp). Callbacks run from cyw43_arch_poll(),
+// just like on the device in poll mode.
+
+#include "lwipopts.h"
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct tcp_pcb;
+
+    typedef err_t (*tcp_accept_fn)(void *arg, struct tcp_pcb *newpcb, err_t err);
+    typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+    typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, u16_t len);
+    typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *tpcb);
+    typedef void (*tcp_err_fn)(void *arg, err_t err);
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+    struct tcp_pcb *tcp_new_ip_type(u8_t type);
+    err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+    struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog);
+    void tcp_arg(struct tcp_pcb *pcb, void *arg);
+    void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept);
+    void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+    void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent);
+    void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval);
+    void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err);
+    err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags);
+    err_t tcp_output(struct tcp_pcb *pcb);
+    void tcp_recved(struct tcp_pcb *pcb, u16_t len);
+    err_t tcp_close(struct tcp_pcb *pcb);
+    void tcp_abort(struct tcp_pcb *pcb);
+    u16_t tcp_sndbuf(const struct tcp_pcb *pcb);
+    void tcp_nagle_disable(struct tcp_pcb *pcb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+// The shim's pcb. Only remote_ip is lwIP's; the rest is sim_lwip.cpp's own.
+// C++ even where the firmware includes this header inside extern "C".
+extern "C++"
+{
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+struct tcp_pcb
+{
+    struct Segment
+    {
+        const uint8_t *data;
+        std::vector<uint8_t> copy;
+        size_t len;
+        size_t off;
+        u16_t segs; // TCP_SEG (and PBUF without a copy) held
+        u16_t heap; // heap bytes held
+    };
+
+    int fd = -1;
+    bool listening = false;
+    bool dead = false;
+    u16_t port = 0;
+    ip_addr_t remote_ip = {0}; // as in lwIP's pcb, which the firmware reads
+    void *arg = nullptr;
+    tcp_accept_fn accept = nullptr;
+    tcp_recv_fn recv = nullptr;
+    tcp_sent_fn sent = nullptr;
+    tcp_poll_fn poll = nullptr;
+    tcp_err_fn err = nullptr;
+    u8_t poll_interval = 0;
+    uint64_t next_poll_us = 0;
+    std::deque<Segment> txq;
+    size_t queued = 0;
+    size_t unreported = 0; // handed to the kernel, sent callback still due
+    std::vector<uint8_t> held; // lost on the way, delivered at held_until
+    uint64_t held_until = 0;
+};
+}
+#endif
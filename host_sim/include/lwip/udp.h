@@ -0,0 +1,24 @@
+#pragma once
+// Host stand-in for the lwIP raw UDP API (see sim_lwip.cpp).
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct udp_pcb;
+
+    typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+    struct udp_pcb *udp_new_ip_type(u8_t type);
+    err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+    void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+    void udp_remove(struct udp_pcb *pcb);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+// Host stand-in for pico/async_context.h: "when pending" workers only, run
+// from cyw43_arch_poll() like the poll flavour of the real context.
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct async_context async_context_t;
+    typedef struct async_when_pending_worker async_when_pending_worker_t;
+
+    struct async_when_pending_worker
+    {
+        async_when_pending_worker_t *next;
+        void (*do_work)(async_context_t *context, async_when_pending_worker_t *worker);
+        bool work_pending;
+        void *user_data;
+    };
+
+    bool async_context_add_when_pending_worker(async_context_t *context, async_when_pending_worker_t *worker);
+    bool async_context_remove_when_pending_worker(async_context_t *context, async_when_pending_worker_t *worker);
+    void async_context_set_work_pending(async_context_t *context, async_when_pending_worker_t *worker);
+
+#ifdef __cplusplus
+}
+#endif
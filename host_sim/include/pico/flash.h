@@ -0,0 +1,17 @@
+#pragma once
+// Host stand-in for pico/flash.h. There is no XIP to protect: func runs
+// straight away on the calling thread.
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    bool flash_safe_execute_core_init(void);
+    int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+// Host stand-in for pico/multicore.h. Core 1 is a std::thread.
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void multicore_launch_core1(void (*entry)(void));
+    void multicore_launch_core1_with_stack(void (*entry)(void), uint32_t *stack_bottom, size_t stack_size_bytes);
+    void multicore_reset_core1(void);
+
+#ifdef __cplusplus
+}
+#endif
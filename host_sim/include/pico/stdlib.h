@@ -0,0 +1,25 @@
+#pragma once
+// Host stand-in for pico/stdlib.h.
+
+#include <stdio.h>
+
+#include "pico/types.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+// pico/platform.h
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    bool stdio_init_all(void);
+
+    // Next character from stdin, or PICO_ERROR_TIMEOUT if none arrives in time.
+    int getchar_timeout_us(uint32_t timeout_us);
+
+#ifdef __cplusplus
+}
+#endif
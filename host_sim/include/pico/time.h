@@ -0,0 +1,49 @@
+#pragma once
+// Host stand-in for pico/time.h. The simulated clock is CLOCK_MONOTONIC,
+// counted from process start.
+
+#include "pico/types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    uint64_t time_us_64(void);
+    static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+    static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+    static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+    static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+    static inline absolute_time_t make_timeout_time_us(uint64_t us) { return time_us_64() + us; }
+    static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return time_us_64() + 1000ull * ms; }
+    static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+    {
+        return (int64_t)(to - from);
+    }
+    static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+    static inline bool time_reached(absolute_time_t t) { return time_us_64() >= t; }
+
+    void sleep_us(uint64_t us);
+    void sleep_ms(uint32_t ms);
+    void sleep_until(absolute_time_t t);
+
+    // Repeating timers run on a thread of their own that stands in for the
+    // alarm interrupt of the core that added them (see sim_multicore.cpp).
+    typedef struct repeating_timer repeating_timer_t;
+    typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+    struct repeating_timer
+    {
+        int64_t delay_us;
+        repeating_timer_callback_t callback;
+        void *user_data;
+        volatile bool cancelled;
+    };
+
+    // delay_us < 0 schedules from the start of the previous callback, > 0 from its end.
+    bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data,
+                                repeating_timer_t *out);
+    bool cancel_repeating_timer(repeating_timer_t *timer);
+
+#ifdef __cplusplus
+}
+#endif
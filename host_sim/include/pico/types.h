@@ -0,0 +1,23 @@
+#pragma once
+// Host stand-in for pico/types.h.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+#define PICO_OK 0
+#define PICO_ERROR_NONE 0
+#define PICO_ERROR_GENERIC -1
+#define PICO_ERROR_TIMEOUT -2
+#define PICO_ERROR_NO_DATA -3
+#define PICO_ERROR_NOT_PERMITTED -4
+#define PICO_ERROR_INVALID_ARG -5
+#define PICO_ERROR_IO -6
+#define PICO_ERROR_BADAUTH -7
+#define PICO_ERROR_CONNECT_FAILED -8
+
+// hardware/platform_defs.h on the device
+#define SYS_CLK_HZ 125000000u
@@ -0,0 +1,51 @@
+#pragma once
+// Host stand-in for the header pioasm generates from quadrature_encoder.pio
+// (pico_generate_pio_header in the firmware build). Same program, assembled
+// by hand; the simulator never runs it, sim_pio.cpp models what it counts.
+
+#include "hardware/pio.h"
+
+#define quadrature_encoder_wrap_target 15
+#define quadrature_encoder_wrap 23
+
+static const uint16_t quadrature_encoder_program_instructions[] = {
+    0x000f, //  0: jmp    15
+    0x000e, //  1: jmp    14
+    0x0015, //  2: jmp    21
+    0x000f, //  3: jmp    15
+    0x0015, //  4: jmp    21
+    0x000f, //  5: jmp    15
+    0x000f, //  6: jmp    15
+    0x000e, //  7: jmp    14
+    0x000e, //  8: jmp    14
+    0x000f, //  9: jmp    15
+    0x000f, // 10: jmp    15
+    0x0015, // 11: jmp    21
+    0x000f, // 12: jmp    15
+    0x0015, // 13: jmp    21
+    0x008f, // 14: jmp    y--, 15
+            //     .wrap_target
+    0xa0c2, // 15: mov    isr, y
+    0x8000, // 16: push   noblock
+    0x60c2, // 17: out    isr, 2
+    0x4002, // 18: in     pins, 2
+    0xa0e6, // 19: mov    osr, isr
+    0xa0a6, // 20: mov    pc, isr
+    0xa04a, // 21: mov    y, ~y
+    0x0097, // 22: jmp    y--, 23
+    0xa04a, // 23: mov    y, ~y
+            //     .wrap
+};
+
+static const pio_program_t quadrature_encoder_program = {
+    quadrature_encoder_program_instructions,
+    24,
+    0,
+};
+
+static inline pio_sm_config quadrature_encoder_program_get_default_config(uint offset)
+{
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + quadrature_encoder_wrap_target, offset + quadrature_encoder_wrap);
+    return c;
+}
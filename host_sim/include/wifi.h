@@ -0,0 +1,5 @@
+#pragma once
+// Host stand-in for the untracked wifi.h credentials file.
+
+char ssid[] = "picow-host-sim";
+char pass[] = "picow-host-sim";
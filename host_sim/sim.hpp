@@ -0,0 +1,79 @@
+#pragma once
+// sim.hpp - simulator-only hooks shared by the host stand-ins and host tools
+
+#include <cstdint>
+#include <vector>
+
+namespace sim
+{
+    enum EventKind : uint8_t
+    {
+        EV_GPIO_DIR,
+        EV_GPIO_FUNC,
+        EV_GPIO,
+        EV_PWM_WRAP,
+        EV_PWM_DIV16, // divider in 1/16 steps
+        EV_PWM_ENABLE,
+        EV_PWM_LEVEL_A,
+        EV_PWM_LEVEL_B,
+    };
+
+    struct TraceEvent
+    {
+        uint64_t t_us;
+        EventKind kind;
+        uint16_t index; // gpio or slice
+        uint32_t value;
+    };
+
+    // Copy of everything recorded so far.
+    std::vector<TraceEvent> trace_snapshot();
+    void trace_clear();
+
+    // Current output level of all bank 0 pins.
+    uint32_t gpio_state();
+
+    // Duty cycle of the PWM channel on gpio, 0..1, from its level and wrap.
+    double pwm_duty(unsigned gpio);
+
+    // Write the trace (if requested) and end the process.
+    [[noreturn]] void shutdown(int status);
+
+    // Call shutdown(0) once PICOW_SIM_RUN_MS has passed.
+    void check_run_time();
+
+    // Stop the wall clock: time_us_64() returns start_us, and from then on
+    // only what set_time_us() says. For replaying at virtual speed.
+    void use_manual_clock(uint64_t start_us);
+    void set_time_us(uint64_t t_us);
+
+    // Set by watchdog_enable(). flash_safe_execute() aborts once it is: on
+    // the device the erase would park core 0, which feeds the watchdog, for
+    // up to most of its timeout.
+    void set_watchdog_enabled();
+    bool watchdog_enabled();
+} // namespace sim
+
+namespace sim
+{
+    // Run every pending lwIP callback once (the body of cyw43_arch_poll()).
+    void lwip_poll();
+
+    // Block until a socket is ready, an lwIP timer is due, lwip_wake() is
+    // called or until_us passes (the body of cyw43_arch_wait_for_work_until()).
+    void lwip_wait_until(uint64_t until_us);
+
+    // Wake a thread blocked in lwip_wait_until(). Safe from any thread.
+    void lwip_wake();
+
+    // True while the simulated WiFi link is up with an address; the lwIP
+    // shim moves no data otherwise.
+    bool link_up();
+
+    // With PICOW_SIM_POWERSAVE, the radio dozes as cyw43_wifi_pm() set it up:
+    // received data is held until the time this returns. now_us when awake.
+    uint64_t radio_rx_at(uint64_t now_us);
+
+    // Data went over the air, which keeps a PM2 radio awake for a while.
+    void radio_traffic();
+} // namespace sim
@@ -0,0 +1,341 @@
+// sim_cyw43.cpp - host implementation of the cyw43_arch API
+//
+// There is no radio: the network is the host's loopback interface, reached
+// through one simulated access point. Joins and DHCP take scripted times and
+// complete while the firmware polls, like the real chip. Environment:
+//
+//   PICOW_SIM_JOIN_FAILURES=<n>  the first n scanning joins fail
+//   PICOW_SIM_SCAN_MS=<ms>       time for a join that has to scan (default 0)
+//   PICOW_SIM_FAST_JOIN_MS=<ms>  time for a join given BSSID and channel (default 0)
+//   PICOW_SIM_DHCP_MS=<ms>       time from association to a DHCP lease (default 0)
+//   PICOW_SIM_AP_CHANNEL=<n>     channel of the access point (default 6); change
+//                                it between runs to make a cached join miss
+//   PICOW_SIM_AP_BSSID=<n>       last byte of the access point's BSSID (default 1);
+//                                change it between runs to have another AP answer
+//   PICOW_SIM_LINK_DROP=<at_ms>:<for_ms>[,...]
+//                                the access point disappears at at_ms after start
+//                                for for_ms; the link drops and joins fail meanwhile
+//   PICOW_SIM_LEASE_CHANGES=1    every lease after an outage is a new address
+//   PICOW_SIM_POWERSAVE=1        the radio dozes as cyw43_wifi_pm() asks: in PM1
+//                                at once, in PM2 after its sleep return time
+//                                without traffic; received data then waits for
+//                                the next beacon (every 102.4 ms)
+#include "sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+
+extern "C"
+{
+#include "pico/cyw43_arch.h"
+}
+
+struct async_context
+{
+    async_when_pending_worker_t *workers = nullptr;
+};
+
+namespace
+{
+    uint8_t AP_BSSID[6] = {0x02, 0x00, 0x5e, 0x00, 0x00, 0x01};
+
+    int join_failures_left = -1;
+    uint64_t scan_us = 0;
+    uint64_t fast_join_us = 0;
+    uint64_t dhcp_us = 0;
+    uint32_t ap_channel = 6;
+    bool lease_changes = false;
+
+    constexpr uint64_t BEACON_US = 102400;
+    constexpr uint64_t BEACON_AWAKE_US = 2000; // around each beacon, to fetch what the AP buffered
+    bool powersave = false;
+    uint32_t pm_value = CYW43_DEFAULT_PM;
+    uint64_t last_traffic_us = 0;
+
+    struct Outage
+    {
+        uint64_t from_us;
+        uint64_t until_us;
+    };
+    std::vector<Outage> outages;
+
+    // the link as the driver sees it; events due at a time are applied by
+    // advance_link() when the firmware looks
+    int link_status = CYW43_LINK_DOWN;
+    int join_result = CYW43_LINK_DOWN; // what the pending join ends in if the AP is there
+    uint64_t join_due_us = UINT64_MAX;
+    uint64_t lease_due_us = UINT64_MAX;
+    uint32_t lease_count = 0;
+
+    uint64_t env_ms(const char *name, uint64_t fallback)
+    {
+        const char *s = getenv(name);
+        return 1000ull * (s ? strtoull(s, nullptr, 0) : fallback);
+    }
+
+    void set_sim_address(uint32_t addr)
+    {
+        ip4_addr_t ip = {addr}, mask = {addr ? htonl(0xff000000u) : 0}, gw = {addr};
+        netif_set_addr(netif_default, &ip, &mask, &gw);
+    }
+
+    void parse_outages()
+    {
+        const char *s = getenv("PICOW_SIM_LINK_DROP");
+        while (s && *s)
+        {
+            char *end;
+            const uint64_t at = strtoull(s, &end, 0);
+            const uint64_t len = *end == ':' ? strtoull(end + 1, &end, 0) : 0;
+            outages.push_back({1000 * at, 1000 * (at + len)});
+            s = *end == ',' ? end + 1 : end;
+            if (*end && *end != ',')
+            {
+                break;
+            }
+        }
+    }
+
+    bool ap_present(uint64_t t_us)
+    {
+        for (const Outage &o : outages)
+        {
+            if (t_us >= o.from_us && t_us < o.until_us)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool associated() { return link_status == CYW43_LINK_JOIN && join_due_us == UINT64_MAX; }
+
+    void advance_link()
+    {
+        const uint64_t now = time_us_64();
+        if (associated() && !ap_present(now))
+        {
+            // like a deauth: the interface keeps its address, the link is gone
+            link_status = CYW43_LINK_DOWN;
+            lease_due_us = UINT64_MAX;
+            return;
+        }
+        if (now >= join_due_us)
+        {
+            join_due_us = UINT64_MAX;
+            link_status = ap_present(now) ? join_result : CYW43_LINK_NONET;
+            if (link_status == CYW43_LINK_JOIN)
+            {
+                lease_due_us = now + dhcp_us;
+            }
+        }
+        if (now >= lease_due_us)
+        {
+            lease_due_us = UINT64_MAX;
+            const uint32_t host = lease_changes ? 1 + lease_count : 1;
+            lease_count++;
+            set_sim_address(htonl(INADDR_LOOPBACK - 1 + host));
+        }
+    }
+
+    void start_join(int result, uint64_t after_us)
+    {
+        link_status = CYW43_LINK_JOIN;
+        join_result = result;
+        join_due_us = time_us_64() + after_us;
+        lease_due_us = UINT64_MAX;
+    }
+
+    async_context_t context;
+    std::atomic<bool> any_work_pending{false};
+
+    void run_pending_workers()
+    {
+        if (!any_work_pending.exchange(false))
+        {
+            return;
+        }
+        for (async_when_pending_worker_t *w = context.workers; w; w = w->next)
+        {
+            if (w->work_pending)
+            {
+                w->work_pending = false;
+                w->do_work(&context, w);
+            }
+        }
+    }
+} // namespace
+
+cyw43_t cyw43_state;
+
+bool sim::link_up() { return cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_UP; }
+
+uint64_t sim::radio_rx_at(uint64_t now_us)
+{
+    const uint32_t mode = pm_value & 0xf;
+    if (!powersave || mode == CYW43_NO_POWERSAVE_MODE)
+    {
+        return now_us;
+    }
+    const uint64_t awake_us = mode == CYW43_PM2_POWERSAVE_MODE ? 10000ull * ((pm_value >> 4) & 0xff) : 0;
+    if (now_us < last_traffic_us + awake_us)
+    {
+        return now_us;
+    }
+    // the access point buffers it and tells the radio in the next beacon
+    const uint64_t phase = now_us % BEACON_US;
+    return phase < BEACON_AWAKE_US ? now_us : now_us - phase + BEACON_US;
+}
+
+void sim::radio_traffic() { last_traffic_us = time_us_64(); }
+
+extern "C"
+{
+    int cyw43_arch_init(void)
+    {
+        const char *s = getenv("PICOW_SIM_JOIN_FAILURES");
+        join_failures_left = s ? atoi(s) : 0;
+        scan_us = env_ms("PICOW_SIM_SCAN_MS", 0);
+        fast_join_us = env_ms("PICOW_SIM_FAST_JOIN_MS", 0);
+        dhcp_us = env_ms("PICOW_SIM_DHCP_MS", 0);
+        ap_channel = static_cast<uint32_t>(env_ms("PICOW_SIM_AP_CHANNEL", 6) / 1000);
+        AP_BSSID[5] = static_cast<uint8_t>(env_ms("PICOW_SIM_AP_BSSID", 1) / 1000);
+        lease_changes = getenv("PICOW_SIM_LEASE_CHANGES") != nullptr;
+        powersave = getenv("PICOW_SIM_POWERSAVE") != nullptr;
+        parse_outages();
+        // no address until DHCP hands one out
+        set_sim_address(0);
+        return 0;
+    }
+
+    void cyw43_arch_deinit(void) { link_status = CYW43_LINK_DOWN; }
+
+    void cyw43_arch_enable_sta_mode(void) {}
+
+    int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth)
+    {
+        return cyw43_wifi_join(&cyw43_state, strlen(ssid), reinterpret_cast<const uint8_t *>(ssid), strlen(pw),
+                               reinterpret_cast<const uint8_t *>(pw), auth, nullptr, CYW43_CHANNEL_NONE);
+    }
+
+    int cyw43_wifi_join(cyw43_t * /*self*/, size_t /*ssid_len*/, const uint8_t * /*ssid*/, size_t /*key_len*/,
+                        const uint8_t * /*key*/, uint32_t /*auth_type*/, const uint8_t *bssid, uint32_t channel)
+    {
+        if (bssid && channel != CYW43_CHANNEL_NONE)
+        {
+            // targeted: only the right AP on the right channel answers
+            const bool found = memcmp(bssid, AP_BSSID, sizeof(AP_BSSID)) == 0 && channel == ap_channel;
+            start_join(found ? CYW43_LINK_JOIN : CYW43_LINK_NONET, fast_join_us);
+        }
+        else if (join_failures_left > 0)
+        {
+            --join_failures_left;
+            start_join(CYW43_LINK_FAIL, scan_us);
+        }
+        else
+        {
+            start_join(CYW43_LINK_JOIN, scan_us);
+        }
+        return 0;
+    }
+
+    int cyw43_wifi_leave(cyw43_t * /*self*/, int /*itf*/)
+    {
+        link_status = CYW43_LINK_DOWN;
+        join_due_us = UINT64_MAX;
+        lease_due_us = UINT64_MAX;
+        return 0;
+    }
+
+    int cyw43_wifi_get_bssid(cyw43_t * /*self*/, uint8_t bssid[6])
+    {
+        advance_link();
+        if (!associated())
+        {
+            return -1;
+        }
+        memcpy(bssid, AP_BSSID, sizeof(AP_BSSID));
+        return 0;
+    }
+
+    int cyw43_ioctl(cyw43_t * /*self*/, uint32_t cmd, size_t len, uint8_t *buf, uint32_t /*iface*/)
+    {
+        if (cmd != CYW43_IOCTL_GET_CHANNEL || len < 4 || !associated())
+        {
+            return -1;
+        }
+        for (int i = 0; i < 4; ++i)
+        {
+            buf[i] = static_cast<uint8_t>(ap_channel >> (8 * i));
+        }
+        return 0;
+    }
+
+    int cyw43_wifi_pm(cyw43_t * /*self*/, uint32_t pm)
+    {
+        pm_value = pm;
+        return 0;
+    }
+
+    void cyw43_arch_gpio_put(uint /*wl_gpio*/, bool /*value*/) {}
+
+    async_context_t *cyw43_arch_async_context(void) { return &context; }
+
+    bool async_context_add_when_pending_worker(async_context_t *ctx, async_when_pending_worker_t *worker)
+    {
+        worker->next = ctx->workers;
+        ctx->workers = worker;
+        return true;
+    }
+
+    bool async_context_remove_when_pending_worker(async_context_t *ctx, async_when_pending_worker_t *worker)
+    {
+        for (async_when_pending_worker_t **w = &ctx->workers; *w; w = &(*w)->next)
+        {
+            if (*w == worker)
+            {
+                *w = worker->next;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void async_context_set_work_pending(async_context_t * /*ctx*/, async_when_pending_worker_t *worker)
+    {
+        worker->work_pending = true;
+        any_work_pending = true;
+        sim::lwip_wake();
+    }
+
+    void cyw43_arch_poll(void)
+    {
+        sim::check_run_time();
+        sim::lwip_poll();
+        run_pending_workers();
+    }
+
+    void cyw43_arch_wait_for_work_until(absolute_time_t until)
+    {
+        if (!any_work_pending)
+        {
+            // a join or lease falling due is work, as the chip's interrupt is
+            sim::lwip_wait_until(std::min<uint64_t>(until, std::min(join_due_us, lease_due_us)));
+        }
+    }
+
+    int cyw43_tcpip_link_status(cyw43_t * /*self*/, int /*itf*/)
+    {
+        advance_link();
+        if (associated())
+        {
+            return netif_default->ip_addr.addr ? CYW43_LINK_UP : CYW43_LINK_NOIP;
+        }
+        return link_status;
+    }
+}
@@ -0,0 +1,92 @@
+// sim_flash.cpp - host implementation of the flash programming API
+//
+// Erase and program behave like NOR flash: erase sets bytes to 0xff, program
+// can only clear bits. With PICOW_SIM_FLASH=<file> the contents are loaded at
+// start and written back after every program, so they survive a restart of
+// the simulator the way they survive a reset of the device.
+// flash_safe_execute() refuses to run once the watchdog is enabled.
+#include "sim.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+#include "hardware/flash.h"
+#include "pico/flash.h"
+}
+
+uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+
+namespace
+{
+    const char *flash_path() { return getenv("PICOW_SIM_FLASH"); }
+
+    struct Loader
+    {
+        Loader()
+        {
+            memset(sim_flash, 0xff, sizeof(sim_flash));
+            const char *path = flash_path();
+            FILE *f = path ? fopen(path, "rb") : nullptr;
+            if (f)
+            {
+                const size_t n = fread(sim_flash, 1, sizeof(sim_flash), f);
+                (void)n;
+                fclose(f);
+            }
+        }
+    } loader;
+
+    void write_back()
+    {
+        const char *path = flash_path();
+        FILE *f = path ? fopen(path, "wb") : nullptr;
+        if (f)
+        {
+            fwrite(sim_flash, 1, sizeof(sim_flash), f);
+            fclose(f);
+        }
+    }
+} // namespace
+
+extern "C"
+{
+    void flash_range_erase(uint32_t flash_offs, size_t count)
+    {
+        if (flash_offs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE || flash_offs + count > sizeof(sim_flash))
+        {
+            fprintf(stderr, "sim: bad flash erase %#x+%zu\n", flash_offs, count);
+            abort();
+        }
+        memset(sim_flash + flash_offs, 0xff, count);
+    }
+
+    void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+    {
+        if (flash_offs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE || flash_offs + count > sizeof(sim_flash))
+        {
+            fprintf(stderr, "sim: bad flash program %#x+%zu\n", flash_offs, count);
+            abort();
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            sim_flash[flash_offs + i] &= data[i];
+        }
+        write_back();
+    }
+
+    bool flash_safe_execute_core_init(void) { return true; }
+
+    int flash_safe_execute(void (*func)(void *), void *param, uint32_t /*enter_exit_timeout_ms*/)
+    {
+        if (sim::watchdog_enabled())
+        {
+            fprintf(stderr, "sim: flash written with the watchdog enabled, core 0 would stop feeding it\n");
+            abort();
+        }
+        func(param);
+        return PICO_OK;
+    }
+}
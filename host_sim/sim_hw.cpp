@@ -0,0 +1,305 @@
+// sim_hw.cpp - host implementation of the pico time, GPIO and PWM APIs
+//
+// Every pin and PWM write is appended to an in-memory trace with a microsecond
+// timestamp. Set PICOW_SIM_TRACE=<file> to have the trace written out as CSV
+// (t_us,event,index,value) when the process exits, and PICOW_SIM_RUN_MS=<ms>
+// to end the run after a fixed time, so runs are repeatable.
+#include "sim.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+extern "C"
+{
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+#include "hardware/structs/systick.h"
+}
+
+sim_systick_hw_t sim_systick;
+
+// The linker script symbols mem_stats.cpp reads. The host has no such
+// regions, so every one of them is the same address and measures 0 bytes.
+extern "C"
+{
+    uint32_t sim_no_region[1];
+    extern uint32_t __StackBottom[1] __attribute__((alias("sim_no_region")));
+    extern uint32_t __StackTop[1] __attribute__((alias("sim_no_region")));
+    extern char __data_start__[1] __attribute__((alias("sim_no_region")));
+    extern char __data_end__[1] __attribute__((alias("sim_no_region")));
+    extern char __bss_start__[1] __attribute__((alias("sim_no_region")));
+    extern char __bss_end__[1] __attribute__((alias("sim_no_region")));
+    extern char __flash_binary_start[1] __attribute__((alias("sim_no_region")));
+    extern char __flash_binary_end[1] __attribute__((alias("sim_no_region")));
+}
+
+sim_systick_hw_t::current_value::operator uint32_t() const
+{
+    static const auto boot = std::chrono::steady_clock::now();
+    const uint64_t ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - boot).count());
+    // 125 cycles per microsecond, counting down
+    return static_cast<uint32_t>(0xffffff - ((ns / 8) & 0xffffff));
+}
+
+namespace
+{
+    // Function-local statics: the firmware's global Motor and Servo objects
+    // write pins from their constructors, before this file's globals would
+    // be initialised.
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<sim::TraceEvent> trace;
+        uint32_t gpio_out = 0;
+        uint32_t gpio_oe = 0;
+        uint16_t pwm_wrap[NUM_PWM_SLICES] = {};
+        uint16_t pwm_level[NUM_PWM_SLICES][2] = {};
+
+        ~State();
+    };
+
+    State &state()
+    {
+        static State s;
+        return s;
+    }
+
+    void record(sim::EventKind kind, uint index, uint32_t value)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.trace.push_back({time_us_64(), kind, static_cast<uint16_t>(index), value});
+    }
+
+    void dump_trace(State &st)
+    {
+        const char *path = getenv("PICOW_SIM_TRACE");
+        if (!path)
+        {
+            return;
+        }
+        FILE *f = fopen(path, "w");
+        if (!f)
+        {
+            return;
+        }
+        static const char *const names[] = {"gpio_dir", "gpio_func", "gpio", "pwm_wrap", "pwm_div16",
+                                            "pwm_enable", "pwm_level_a", "pwm_level_b"};
+        fprintf(f, "t_us,event,index,value\n");
+        std::lock_guard<std::mutex> lock(st.mutex);
+        for (const auto &e : st.trace)
+        {
+            fprintf(f, "%llu,%s,%u,%u\n", static_cast<unsigned long long>(e.t_us), names[e.kind], e.index,
+                    e.value);
+        }
+        fclose(f);
+    }
+
+    State::~State() { dump_trace(*this); }
+
+    std::atomic<bool> manual_clock{false};
+    std::atomic<uint64_t> manual_time_us{0};
+    std::atomic<bool> watchdog_on{false};
+} // namespace
+
+std::vector<sim::TraceEvent> sim::trace_snapshot()
+{
+    State &st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    return st.trace;
+}
+
+void sim::trace_clear()
+{
+    State &st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    st.trace.clear();
+}
+
+void sim::shutdown(int status)
+{
+    fflush(stdout);
+    dump_trace(state());
+    // skip static destructors, the other "core" is still running
+    _exit(status);
+}
+
+void sim::check_run_time()
+{
+    static const uint64_t limit_us = [] {
+        const char *s = getenv("PICOW_SIM_RUN_MS");
+        return s ? 1000ull * strtoull(s, nullptr, 0) : 0ull;
+    }();
+    if (limit_us && time_us_64() >= limit_us)
+    {
+        shutdown(0);
+    }
+}
+
+void sim::use_manual_clock(uint64_t start_us)
+{
+    manual_time_us.store(start_us);
+    manual_clock.store(true);
+}
+
+void sim::set_time_us(uint64_t t_us) { manual_time_us.store(t_us); }
+
+void sim::set_watchdog_enabled() { watchdog_on.store(true); }
+
+bool sim::watchdog_enabled() { return watchdog_on.load(); }
+
+uint32_t sim::gpio_state()
+{
+    State &st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    return st.gpio_out;
+}
+
+double sim::pwm_duty(unsigned gpio)
+{
+    State &st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    const uint slice = pwm_gpio_to_slice_num(gpio);
+    const double level = st.pwm_level[slice][pwm_gpio_to_channel(gpio)];
+    const double top = st.pwm_wrap[slice] + 1.0;
+    return level >= top ? 1.0 : level / top;
+}
+
+extern "C"
+{
+    uint64_t time_us_64(void)
+    {
+        if (manual_clock.load(std::memory_order_relaxed))
+        {
+            return manual_time_us.load(std::memory_order_relaxed);
+        }
+        static const auto boot = std::chrono::steady_clock::now();
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count());
+    }
+
+    void sleep_us(uint64_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+    void sleep_ms(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+    void sleep_until(absolute_time_t t)
+    {
+        const uint64_t now = time_us_64();
+        if (t > now)
+        {
+            sleep_us(t - now);
+        }
+    }
+
+    bool stdio_init_all(void)
+    {
+        setvbuf(stdout, nullptr, _IOLBF, 0);
+        return true;
+    }
+
+    int getchar_timeout_us(uint32_t timeout_us)
+    {
+        pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        unsigned char c;
+        if (poll(&pfd, 1, static_cast<int>(timeout_us / 1000)) == 1 && read(STDIN_FILENO, &c, 1) == 1)
+        {
+            return c;
+        }
+        return PICO_ERROR_TIMEOUT;
+    }
+
+    void gpio_init(uint gpio)
+    {
+        gpio_set_dir(gpio, GPIO_IN);
+        gpio_put(gpio, false);
+        gpio_set_function(gpio, GPIO_FUNC_SIO);
+    }
+
+    void gpio_set_dir(uint gpio, bool out)
+    {
+        {
+            State &st = state();
+            std::lock_guard<std::mutex> lock(st.mutex);
+            st.gpio_oe = out ? (st.gpio_oe | (1u << gpio)) : (st.gpio_oe & ~(1u << gpio));
+        }
+        record(sim::EV_GPIO_DIR, gpio, out);
+    }
+
+    void gpio_set_function(uint gpio, enum gpio_function fn) { record(sim::EV_GPIO_FUNC, gpio, fn); }
+
+    void gpio_put(uint gpio, bool value) { gpio_put_masked(1u << gpio, value ? (1u << gpio) : 0u); }
+
+    bool gpio_get(uint gpio) { return (sim::gpio_state() >> gpio) & 1u; }
+
+    // one trace event per changed pin, all carrying the same timestamp, the
+    // same way the single SIO register write changes them on the same cycle
+    void gpio_put_masked(uint32_t mask, uint32_t value)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        const uint64_t now = time_us_64();
+        const uint32_t next = (st.gpio_out & ~mask) | (value & mask);
+        for (uint gpio = 0; gpio < NUM_BANK0_GPIOS; ++gpio)
+        {
+            if (mask & (1u << gpio))
+            {
+                st.trace.push_back({now, sim::EV_GPIO, static_cast<uint16_t>(gpio), (next >> gpio) & 1u});
+            }
+        }
+        st.gpio_out = next;
+    }
+
+    void gpio_set_mask(uint32_t mask) { gpio_put_masked(mask, mask); }
+    void gpio_clr_mask(uint32_t mask) { gpio_put_masked(mask, 0); }
+    void gpio_pull_up(uint /*gpio*/) {}
+
+    void pwm_set_wrap(uint slice_num, uint16_t wrap)
+    {
+        {
+            State &st = state();
+            std::lock_guard<std::mutex> lock(st.mutex);
+            st.pwm_wrap[slice_num] = wrap;
+        }
+        record(sim::EV_PWM_WRAP, slice_num, wrap);
+    }
+
+    void pwm_set_clkdiv(uint slice_num, float divider)
+    {
+        record(sim::EV_PWM_DIV16, slice_num, static_cast<uint32_t>(divider * 16.0f));
+    }
+
+    void pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract)
+    {
+        record(sim::EV_PWM_DIV16, slice_num, (static_cast<uint32_t>(integer) << 4) | (fract & 0xfu));
+    }
+
+    void pwm_set_enabled(uint slice_num, bool enabled) { record(sim::EV_PWM_ENABLE, slice_num, enabled); }
+
+    void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level)
+    {
+        {
+            State &st = state();
+            std::lock_guard<std::mutex> lock(st.mutex);
+            st.pwm_level[slice_num][chan] = level;
+        }
+        record(chan ? sim::EV_PWM_LEVEL_B : sim::EV_PWM_LEVEL_A, slice_num, level);
+    }
+
+    void pwm_set_both_levels(uint slice_num, uint16_t level_a, uint16_t level_b)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        const uint64_t now = time_us_64();
+        st.pwm_level[slice_num][0] = level_a;
+        st.pwm_level[slice_num][1] = level_b;
+        st.trace.push_back({now, sim::EV_PWM_LEVEL_A, static_cast<uint16_t>(slice_num), level_a});
+        st.trace.push_back({now, sim::EV_PWM_LEVEL_B, static_cast<uint16_t>(slice_num), level_b});
+    }
+}
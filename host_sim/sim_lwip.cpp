@@ -0,0 +1,740 @@
+// sim_lwip.cpp - the lwIP raw TCP and UDP APIs on top of non-blocking POSIX sockets
+//
+// This is a shim, not a port: there is no TCP state machine here, the host
+// kernel does the real work. What the shim preserves is the calling model the
+// firmware is written against:
+//   - callbacks only run from cyw43_arch_poll(), on the polling thread
+//   - received data arrives as pbuf chains; PICOW_SIM_PBUF_LEN caps the length
+//     of a single pbuf so code that walks chains gets exercised
+//   - tcp_write() without TCP_WRITE_FLAG_COPY keeps a reference to the caller's
+//     buffer until the bytes are handed to the kernel, which is reported back
+//     through the sent callback on the next poll, like an ACK on the device
+//     (never from inside tcp_write()/tcp_output())
+//   - tcp_close()/tcp_abort() free the pcb as far as the caller is concerned;
+//     the memory is reclaimed after the current poll pass
+//   - lwip_stats.mem and lwip_stats.memp account for the heap and pools the
+//     way lwIP would: a write takes TCP_SEG, PBUF and heap until it is handed
+//     to the kernel, and fails with ERR_MEM when a pool is exhausted
+//   - PICOW_SIM_LOSS=<percent> loses that share of what arrives. A lost
+//     datagram is gone. A lost TCP read comes again after RETRANSMIT_US, as
+//     the peer's retransmission would, and everything behind it waits
+#include "sim.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// the kernel's TCP_MSS is not the one lwipopts.h configures
+#undef TCP_MSS
+
+extern "C"
+{
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "pico/time.h"
+}
+
+struct stats_ lwip_stats;
+
+struct udp_pcb
+{
+    int fd = -1;
+    u16_t port = 0;
+    udp_recv_fn recv = nullptr;
+    void *recv_arg = nullptr;
+};
+
+namespace
+{
+    constexpr uint64_t TCP_SLOW_TICK_US = 500000;
+    // the peer's retransmission timeout; 200 ms is the least Linux waits
+    constexpr uint64_t RETRANSMIT_US = 200000;
+
+    // lwIP's heap cost of one segment: the header pbuf and its reserved
+    // link, IP and TCP header space. Approximate, for the high-water marks.
+    constexpr size_t SEG_HEAP_BYTES = 72;
+
+    struct stats_mem pool_stats[MEMP_MAX] = {
+        {"UDP_PCB", 0, MEMP_NUM_UDP_PCB, 0, 0, 0},
+        {"TCP_PCB", 0, MEMP_NUM_TCP_PCB, 0, 0, 0},
+        {"TCP_PCB_LISTEN", 0, MEMP_NUM_TCP_PCB_LISTEN, 0, 0, 0},
+        {"TCP_SEG", 0, MEMP_NUM_TCP_SEG, 0, 0, 0},
+        {"PBUF_REF/ROM", 0, MEMP_NUM_PBUF, 0, 0, 0},
+        {"PBUF_POOL", 0, PBUF_POOL_SIZE, 0, 0, 0},
+    };
+
+    // what lwip_init() does on the device
+    const bool stats_ready = [] {
+        lwip_stats.mem.name = "HEAP";
+        lwip_stats.mem.avail = MEM_SIZE;
+        for (int i = 0; i < MEMP_MAX; ++i)
+        {
+            lwip_stats.memp[i] = &pool_stats[i];
+        }
+        return true;
+    }();
+
+    // Whether n more fit, counting a failed allocation if not.
+    bool mem_fits(struct stats_mem &m, size_t n)
+    {
+        if (m.used + n > m.avail)
+        {
+            m.err++;
+            return false;
+        }
+        return true;
+    }
+
+    void mem_take(struct stats_mem &m, size_t n)
+    {
+        m.used = static_cast<mem_size_t>(m.used + n);
+        m.max = std::max(m.max, m.used);
+    }
+
+    void mem_give(struct stats_mem &m, size_t n) { m.used = static_cast<mem_size_t>(m.used - n); }
+
+    // The host always has memory: pcbs and rx pbufs are counted, and a
+    // failure is recorded where the device would have run out, but the
+    // allocation goes ahead.
+    void pool_count(memp_t pool, size_t n)
+    {
+        mem_fits(pool_stats[pool], n);
+        mem_take(pool_stats[pool], n);
+    }
+
+    void release(const tcp_pcb::Segment &seg)
+    {
+        mem_give(pool_stats[MEMP_TCP_SEG], seg.segs);
+        if (seg.copy.empty())
+        {
+            mem_give(pool_stats[MEMP_PBUF], seg.segs);
+        }
+        mem_give(lwip_stats.mem, seg.heap);
+    }
+
+    std::vector<tcp_pcb *> pcbs;
+    std::vector<udp_pcb *> udp_pcbs;
+    struct netif sim_netif = {nullptr, {htonl(INADDR_LOOPBACK)}, {htonl(0xff000000u)}, {htonl(INADDR_LOOPBACK)}};
+    int wake_fd = -1;
+
+    size_t pbuf_len_limit()
+    {
+        static size_t limit = [] {
+            const char *s = getenv("PICOW_SIM_PBUF_LEN");
+            const long v = s ? strtol(s, nullptr, 0) : 0;
+            return v > 0 ? static_cast<size_t>(v) : static_cast<size_t>(TCP_MSS);
+        }();
+        return limit;
+    }
+
+    // PICOW_SIM_PORT_MAP=<device>:<host>[,...] listens on another host port,
+    // e.g. 80:8080 for the control page without root
+    u16_t host_port(u16_t port)
+    {
+        const char *s = getenv("PICOW_SIM_PORT_MAP");
+        while (s && *s)
+        {
+            char *end;
+            const long from = strtol(s, &end, 0);
+            if (*end != ':')
+            {
+                break;
+            }
+            const long to = strtol(end + 1, &end, 0);
+            if (from == port)
+            {
+                return static_cast<u16_t>(to);
+            }
+            s = *end == ',' ? end + 1 : nullptr;
+        }
+        return port;
+    }
+
+    // Whether the next arrival is lost, with a fixed seed so runs repeat.
+    bool lost()
+    {
+        static const double rate = [] {
+            const char *s = getenv("PICOW_SIM_LOSS");
+            return s ? strtod(s, nullptr) / 100.0 : 0.0;
+        }();
+        static std::mt19937 rng(1);
+        return rate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < rate;
+    }
+
+    struct pbuf *pbuf_chain(const uint8_t *data, size_t len)
+    {
+        struct pbuf *head = nullptr;
+        struct pbuf **tail = &head;
+        size_t remaining = len;
+        while (remaining > 0)
+        {
+            const size_t n = std::min(remaining, pbuf_len_limit());
+            auto *p = static_cast<struct pbuf *>(malloc(sizeof(struct pbuf) + n));
+            pool_count(MEMP_PBUF_POOL, 1);
+            p->next = nullptr;
+            p->payload = reinterpret_cast<uint8_t *>(p + 1);
+            p->len = static_cast<u16_t>(n);
+            p->tot_len = static_cast<u16_t>(remaining);
+            memcpy(p->payload, data, n);
+            *tail = p;
+            tail = &p->next;
+            data += n;
+            remaining -= n;
+        }
+        return head;
+    }
+
+    void kill(tcp_pcb *pcb)
+    {
+        if (pcb->fd >= 0)
+        {
+            close(pcb->fd);
+            pcb->fd = -1;
+        }
+        pcb->dead = true;
+        for (const auto &seg : pcb->txq)
+        {
+            release(seg);
+        }
+        pcb->txq.clear();
+    }
+
+    // Hand queued bytes to the kernel. They are reported as sent by service().
+    void flush(tcp_pcb *pcb)
+    {
+        size_t done = 0;
+        while (!pcb->txq.empty() && pcb->fd >= 0)
+        {
+            auto &seg = pcb->txq.front();
+            const uint8_t *base = seg.copy.empty() ? seg.data : seg.copy.data();
+            const ssize_t n = send(pcb->fd, base + seg.off, seg.len - seg.off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                break;
+            }
+            seg.off += static_cast<size_t>(n);
+            done += static_cast<size_t>(n);
+            lwip_stats.tcp.xmit++;
+            if (seg.off == seg.len)
+            {
+                release(seg);
+                pcb->txq.pop_front();
+            }
+        }
+        pcb->queued -= done;
+        pcb->unreported += done;
+        if (done)
+        {
+            sim::radio_traffic();
+        }
+    }
+
+    void report_sent(tcp_pcb *pcb)
+    {
+        while (pcb->unreported > 0 && pcb->sent && !pcb->dead)
+        {
+            const u16_t chunk = static_cast<u16_t>(std::min<size_t>(pcb->unreported, 0xffff));
+            pcb->unreported -= chunk;
+            pcb->sent(pcb->arg, pcb, chunk);
+        }
+    }
+
+    void deliver(tcp_pcb *pcb, const uint8_t *data, size_t len)
+    {
+        lwip_stats.tcp.recv++;
+        sim::radio_traffic();
+        // the peer's data carries the ACK for whatever it answers, and
+        // lwIP handles that before passing the data up
+        report_sent(pcb);
+        struct pbuf *p = pbuf_chain(data, len);
+        if (pcb->recv)
+        {
+            pcb->recv(pcb->arg, pcb, p, ERR_OK);
+        }
+        else
+        {
+            pbuf_free(p);
+        }
+    }
+
+    void receive(tcp_pcb *pcb, uint64_t now)
+    {
+        if (!pcb->held.empty())
+        {
+            // nothing behind a lost segment arrives before it does
+            if (now < pcb->held_until)
+            {
+                return;
+            }
+            const std::vector<uint8_t> held = std::move(pcb->held);
+            pcb->held.clear();
+            deliver(pcb, held.data(), held.size());
+        }
+        uint8_t buf[4096];
+        for (int reads = 0; reads < 16 && !pcb->dead; ++reads)
+        {
+            const ssize_t n = recv(pcb->fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0 && lost())
+            {
+                pcb->held.assign(buf, buf + n);
+                pcb->held_until = now + RETRANSMIT_US;
+                break;
+            }
+            if (n > 0)
+            {
+                deliver(pcb, buf, static_cast<size_t>(n));
+            }
+            else if (n == 0)
+            {
+                if (pcb->recv)
+                {
+                    pcb->recv(pcb->arg, pcb, nullptr, ERR_OK);
+                }
+                else
+                {
+                    tcp_close(pcb);
+                }
+                break;
+            }
+            else
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    tcp_err_fn err = pcb->err;
+                    void *arg = pcb->arg;
+                    kill(pcb);
+                    if (err)
+                    {
+                        err(arg, ERR_RST);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    // While the WiFi link is down nothing moves: connections stall and
+    // pending accepts wait, only the poll timers keep running. While the
+    // radio dozes (rx_awake false) received data waits for its wake-up.
+    void service(tcp_pcb *pcb, uint64_t now, bool link_up, bool rx_awake)
+    {
+        if (pcb->listening)
+        {
+            if (!link_up)
+            {
+                return;
+            }
+            sockaddr_in addr;
+            socklen_t addr_len = sizeof(addr);
+            int fd;
+            while (!pcb->dead &&
+                   (fd = accept4(pcb->fd, reinterpret_cast<sockaddr *>(&addr), &addr_len, SOCK_NONBLOCK)) >= 0)
+            {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                auto *newpcb = new tcp_pcb;
+                pool_count(MEMP_TCP_PCB, 1);
+                newpcb->fd = fd;
+                newpcb->arg = pcb->arg;
+                newpcb->remote_ip.addr = addr.sin_addr.s_addr;
+                pcbs.push_back(newpcb);
+                const err_t err = pcb->accept ? pcb->accept(pcb->arg, newpcb, ERR_OK) : static_cast<err_t>(ERR_VAL);
+                if (err != ERR_OK && err != ERR_ABRT && !newpcb->dead)
+                {
+                    tcp_abort(newpcb);
+                }
+                addr_len = sizeof(addr);
+            }
+            return;
+        }
+
+        if (link_up)
+        {
+            flush(pcb);
+            report_sent(pcb);
+            if (rx_awake)
+            {
+                receive(pcb, now);
+            }
+        }
+
+        if (!pcb->dead && pcb->poll && pcb->poll_interval && now >= pcb->next_poll_us)
+        {
+            pcb->next_poll_us = now + pcb->poll_interval * TCP_SLOW_TICK_US;
+            pcb->poll(pcb->arg, pcb);
+        }
+    }
+
+    // datagrams that arrive while the link is down are lost, while the radio
+    // dozes they wait
+    void service(udp_pcb *pcb, bool link_up, bool rx_awake)
+    {
+        uint8_t buf[2048];
+        for (int reads = 0; reads < 16 && pcb->fd >= 0 && (rx_awake || !link_up); ++reads)
+        {
+            sockaddr_in addr;
+            socklen_t addr_len = sizeof(addr);
+            const ssize_t n =
+                recvfrom(pcb->fd, buf, sizeof(buf), MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+            if (n < 0)
+            {
+                break;
+            }
+            if (!link_up || lost())
+            {
+                continue;
+            }
+            sim::radio_traffic();
+            ip_addr_t from = {addr.sin_addr.s_addr};
+            struct pbuf *p = pbuf_chain(buf, static_cast<size_t>(n));
+            if (pcb->recv)
+            {
+                pcb->recv(pcb->recv_arg, pcb, p, &from, ntohs(addr.sin_port));
+            }
+            else
+            {
+                pbuf_free(p);
+            }
+        }
+    }
+} // namespace
+
+struct netif *netif_list = &sim_netif;
+struct netif *netif_default = &sim_netif;
+
+void sim::lwip_poll()
+{
+    const uint64_t now = time_us_64();
+    const bool link_up = sim::link_up();
+    const bool rx_awake = sim::radio_rx_at(now) <= now;
+    // callbacks may append pcbs (accept), so index rather than iterate
+    for (size_t i = 0; i < pcbs.size(); ++i)
+    {
+        if (!pcbs[i]->dead)
+        {
+            service(pcbs[i], now, link_up, rx_awake);
+        }
+    }
+    for (size_t i = 0; i < udp_pcbs.size(); ++i)
+    {
+        service(udp_pcbs[i], link_up, rx_awake);
+    }
+    pcbs.erase(std::remove_if(pcbs.begin(), pcbs.end(),
+                              [](tcp_pcb *pcb) {
+                                  if (pcb->dead)
+                                  {
+                                      mem_give(pool_stats[pcb->listening ? MEMP_TCP_PCB_LISTEN : MEMP_TCP_PCB], 1);
+                                      delete pcb;
+                                      return true;
+                                  }
+                                  return false;
+                              }),
+               pcbs.end());
+}
+
+void sim::lwip_wait_until(uint64_t until_us)
+{
+    if (wake_fd < 0)
+    {
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+    }
+    std::vector<pollfd> fds;
+    fds.push_back({wake_fd, POLLIN, 0});
+    uint64_t next_timer = until_us;
+    const bool link_up = sim::link_up();
+    // a dozing radio does not see received data before it wakes up
+    const uint64_t rx_at = sim::radio_rx_at(time_us_64());
+    const bool rx_awake = rx_at <= time_us_64();
+    if (!rx_awake)
+    {
+        next_timer = std::min(next_timer, rx_at);
+    }
+    for (tcp_pcb *pcb : pcbs)
+    {
+        if (pcb->dead || pcb->fd < 0)
+        {
+            continue;
+        }
+        if (!link_up)
+        {
+            if (pcb->poll && pcb->poll_interval)
+            {
+                next_timer = std::min(next_timer, pcb->next_poll_us);
+            }
+            continue;
+        }
+        // held data waits for its retransmission, and everything behind it with it
+        const bool held = !pcb->held.empty();
+        if (held)
+        {
+            next_timer = std::min(next_timer, pcb->held_until);
+        }
+        const short rx = (rx_awake && !held) || pcb->listening ? POLLIN : 0;
+        fds.push_back({pcb->fd, static_cast<short>(rx | (pcb->txq.empty() ? 0 : POLLOUT)), 0});
+        if (pcb->poll && pcb->poll_interval)
+        {
+            next_timer = std::min(next_timer, pcb->next_poll_us);
+        }
+        if (pcb->unreported)
+        {
+            next_timer = 0;
+        }
+    }
+    for (udp_pcb *pcb : udp_pcbs)
+    {
+        if (pcb->fd >= 0 && rx_awake)
+        {
+            fds.push_back({pcb->fd, POLLIN, 0});
+        }
+    }
+    const uint64_t now = time_us_64();
+    const int timeout_ms = next_timer > now ? static_cast<int>((next_timer - now + 999) / 1000) : 0;
+    if (poll(fds.data(), fds.size(), timeout_ms) > 0 && (fds[0].revents & POLLIN))
+    {
+        uint64_t v;
+        (void)!read(wake_fd, &v, sizeof(v));
+    }
+}
+
+void sim::lwip_wake()
+{
+    if (wake_fd >= 0)
+    {
+        const uint64_t one = 1;
+        (void)!write(wake_fd, &one, sizeof(one));
+    }
+}
+
+extern "C"
+{
+    u8_t pbuf_free(struct pbuf *p)
+    {
+        u8_t count = 0;
+        while (p)
+        {
+            struct pbuf *next = p->next;
+            mem_give(pool_stats[MEMP_PBUF_POOL], 1);
+            free(p);
+            p = next;
+            ++count;
+        }
+        return count;
+    }
+
+    u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset)
+    {
+        u16_t copied = 0;
+        for (; p && copied < len; p = p->next)
+        {
+            if (offset >= p->len)
+            {
+                offset = static_cast<u16_t>(offset - p->len);
+                continue;
+            }
+            const u16_t n = std::min<u16_t>(static_cast<u16_t>(p->len - offset), static_cast<u16_t>(len - copied));
+            memcpy(static_cast<uint8_t *>(dataptr) + copied, static_cast<const uint8_t *>(p->payload) + offset, n);
+            copied = static_cast<u16_t>(copied + n);
+            offset = 0;
+        }
+        return copied;
+    }
+
+    char *ip4addr_ntoa(const ip4_addr_t *addr)
+    {
+        static char buf[INET_ADDRSTRLEN];
+        in_addr a;
+        a.s_addr = addr->addr;
+        return const_cast<char *>(inet_ntop(AF_INET, &a, buf, sizeof(buf)));
+    }
+
+    void netif_set_addr(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask,
+                        const ip4_addr_t *gw)
+    {
+        netif->ip_addr = *ipaddr;
+        netif->netmask = *netmask;
+        netif->gw = *gw;
+    }
+
+    struct tcp_pcb *tcp_new_ip_type(u8_t /*type*/)
+    {
+        auto *pcb = new tcp_pcb;
+        pool_count(MEMP_TCP_PCB, 1);
+        pcbs.push_back(pcb);
+        return pcb;
+    }
+
+    err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t * /*ipaddr*/, u16_t port)
+    {
+        pcb->port = host_port(port);
+        return ERR_OK;
+    }
+
+    struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
+    {
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(pcb->port);
+        if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, backlog) != 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        pcb->fd = fd;
+        pcb->listening = true;
+        // lwIP moves a listening pcb to the smaller listen pool
+        mem_give(pool_stats[MEMP_TCP_PCB], 1);
+        pool_count(MEMP_TCP_PCB_LISTEN, 1);
+        return pcb;
+    }
+
+    void tcp_arg(struct tcp_pcb *pcb, void *arg) { pcb->arg = arg; }
+    void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept) { pcb->accept = accept; }
+    void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) { pcb->recv = recv; }
+    void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) { pcb->sent = sent; }
+    void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) { pcb->err = err; }
+
+    void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
+    {
+        pcb->poll = poll;
+        pcb->poll_interval = interval;
+        pcb->next_poll_us = time_us_64() + interval * TCP_SLOW_TICK_US;
+    }
+
+    err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags)
+    {
+        if (pcb->dead || pcb->fd < 0)
+        {
+            return ERR_CONN;
+        }
+        // one TCP_SEG and header pbuf per MSS; the data either stays where it
+        // is behind a PBUF_REF/ROM or is copied onto the heap
+        const bool copy = apiflags & TCP_WRITE_FLAG_COPY;
+        const size_t segs = (len + TCP_MSS - 1) / TCP_MSS;
+        const size_t heap = segs * SEG_HEAP_BYTES + (copy ? len : 0);
+        if (pcb->queued + len > TCP_SND_BUF || !mem_fits(pool_stats[MEMP_TCP_SEG], segs) ||
+            (!copy && !mem_fits(pool_stats[MEMP_PBUF], segs)) || !mem_fits(lwip_stats.mem, heap))
+        {
+            lwip_stats.tcp.memerr++;
+            return ERR_MEM;
+        }
+        tcp_pcb::Segment seg{static_cast<const uint8_t *>(dataptr), {}, len, 0, static_cast<u16_t>(segs),
+                             static_cast<u16_t>(heap)};
+        if (copy)
+        {
+            seg.copy.assign(seg.data, seg.data + len);
+        }
+        else
+        {
+            mem_take(pool_stats[MEMP_PBUF], segs);
+        }
+        mem_take(pool_stats[MEMP_TCP_SEG], segs);
+        mem_take(lwip_stats.mem, heap);
+        pcb->txq.push_back(std::move(seg));
+        pcb->queued += len;
+        return ERR_OK;
+    }
+
+    err_t tcp_output(struct tcp_pcb *pcb)
+    {
+        flush(pcb);
+        return ERR_OK;
+    }
+
+    void tcp_recved(struct tcp_pcb * /*pcb*/, u16_t /*len*/) {}
+
+    err_t tcp_close(struct tcp_pcb *pcb)
+    {
+        flush(pcb);
+        kill(pcb);
+        return ERR_OK;
+    }
+
+    void tcp_abort(struct tcp_pcb *pcb)
+    {
+        if (pcb->fd >= 0)
+        {
+            // linger with zero timeout makes close() send a RST, like lwIP does
+            linger l = {1, 0};
+            setsockopt(pcb->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        }
+        tcp_err_fn err = pcb->err;
+        void *arg = pcb->arg;
+        kill(pcb);
+        if (err)
+        {
+            err(arg, ERR_ABRT);
+        }
+    }
+
+    u16_t tcp_sndbuf(const struct tcp_pcb *pcb)
+    {
+        return static_cast<u16_t>(TCP_SND_BUF - std::min<size_t>(pcb->queued, TCP_SND_BUF));
+    }
+
+    void tcp_nagle_disable(struct tcp_pcb * /*pcb*/) {}
+
+    struct udp_pcb *udp_new_ip_type(u8_t /*type*/)
+    {
+        auto *pcb = new udp_pcb;
+        pcb->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (pcb->fd < 0)
+        {
+            delete pcb;
+            return nullptr;
+        }
+        pool_count(MEMP_UDP_PCB, 1);
+        udp_pcbs.push_back(pcb);
+        return pcb;
+    }
+
+    err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t * /*ipaddr*/, u16_t port)
+    {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(host_port(port));
+        if (bind(pcb->fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            return ERR_USE;
+        }
+        pcb->port = port;
+        return ERR_OK;
+    }
+
+    void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg)
+    {
+        pcb->recv = recv;
+        pcb->recv_arg = recv_arg;
+    }
+
+    void udp_remove(struct udp_pcb *pcb)
+    {
+        udp_pcbs.erase(std::remove(udp_pcbs.begin(), udp_pcbs.end(), pcb), udp_pcbs.end());
+        close(pcb->fd);
+        mem_give(pool_stats[MEMP_UDP_PCB], 1);
+        delete pcb;
+    }
+}
@@ -0,0 +1,162 @@
+// sim_multicore.cpp - host implementation of the two-core API
+//
+// Core 1 is a std::thread; the ARM event register behind __sev()/__wfe() is a
+// latched flag guarded by a condition variable. A repeating timer gets a
+// thread of its own, so unlike a real alarm interrupt its callback runs
+// concurrently with the core that added it rather than pre-empting it.
+// The watchdog is one more thread that ends the process when it expires.
+#include "sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+extern "C"
+{
+#include "pico/multicore.h"
+#include "pico/time.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+}
+
+namespace
+{
+    std::mutex event_mutex;
+    std::condition_variable event_cv;
+    bool event_flag = false;
+    thread_local uint core_num = 0;
+    // held while a timer callback runs or interrupts are disabled
+    std::recursive_mutex irq_mutex;
+
+    std::atomic<uint64_t> watchdog_deadline_us{0};
+    std::atomic<uint32_t> watchdog_delay_us{0};
+} // namespace
+
+extern "C"
+{
+    void multicore_launch_core1(void (*entry)(void))
+    {
+        std::thread([entry] {
+            core_num = 1;
+            entry();
+        }).detach();
+    }
+
+    void multicore_launch_core1_with_stack(void (*entry)(void), uint32_t * /*stack_bottom*/,
+                                           size_t /*stack_size_bytes*/)
+    {
+        multicore_launch_core1(entry);
+    }
+
+    void multicore_reset_core1(void) {}
+
+    void __sev(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(event_mutex);
+            event_flag = true;
+        }
+        event_cv.notify_all();
+    }
+
+    void __wfe(void)
+    {
+        std::unique_lock<std::mutex> lock(event_mutex);
+        event_cv.wait(lock, [] { return event_flag; });
+        event_flag = false;
+    }
+
+    bool best_effort_wfe_or_timeout(absolute_time_t until)
+    {
+        const uint64_t now = time_us_64();
+        if (now >= until)
+        {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(event_mutex);
+        const bool woken =
+            event_cv.wait_for(lock, std::chrono::microseconds(until - now), [] { return event_flag; });
+        event_flag = false;
+        return !woken;
+    }
+
+    uint get_core_num(void) { return core_num; }
+
+    uint32_t save_and_disable_interrupts(void)
+    {
+        irq_mutex.lock();
+        return 0;
+    }
+
+    void restore_interrupts(uint32_t /*status*/) { irq_mutex.unlock(); }
+
+    bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data,
+                                repeating_timer_t *out)
+    {
+        out->delay_us = delay_us;
+        out->callback = callback;
+        out->user_data = user_data;
+        out->cancelled = false;
+        const uint owner = core_num;
+        std::thread([out, owner] {
+            core_num = owner;
+            const uint64_t period = static_cast<uint64_t>(out->delay_us < 0 ? -out->delay_us : out->delay_us);
+            uint64_t next = time_us_64() + period;
+            while (!out->cancelled)
+            {
+                sleep_until(next);
+                if (out->cancelled)
+                {
+                    break;
+                }
+                bool again;
+                {
+                    std::lock_guard<std::recursive_mutex> irq(irq_mutex);
+                    again = out->callback(out);
+                }
+                if (!again)
+                {
+                    break;
+                }
+                // fixed rate for a negative delay, but a host scheduling hiccup
+                // does not turn into a burst of catch-up callbacks
+                next = (out->delay_us < 0 ? std::max(next, time_us_64() - period) : time_us_64()) + period;
+            }
+        }).detach();
+        return true;
+    }
+
+    bool cancel_repeating_timer(repeating_timer_t *timer)
+    {
+        const bool was_running = !timer->cancelled;
+        timer->cancelled = true;
+        return was_running;
+    }
+
+    void watchdog_enable(uint32_t delay_ms, bool /*pause_on_debug*/)
+    {
+        const bool started = watchdog_delay_us.exchange(delay_ms * 1000) != 0;
+        sim::set_watchdog_enabled();
+        watchdog_update();
+        if (started)
+        {
+            return;
+        }
+        std::thread([] {
+            while (time_us_64() < watchdog_deadline_us.load())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            fprintf(stderr, "sim: watchdog expired, the device would reset now\n");
+            sim::shutdown(3);
+        }).detach();
+    }
+
+    void watchdog_update(void) { watchdog_deadline_us.store(time_us_64() + watchdog_delay_us.load()); }
+
+    bool watchdog_caused_reboot(void) { return false; }
+}
@@ -0,0 +1,231 @@
+// sim_pio.cpp - host implementation of the PIO and DMA APIs, with a wheel
+//
+// Programs are not executed. Loading and claiming are tracked like the SDK
+// does, so running out of instruction memory, state machines or channels
+// behaves the same; the only program the firmware loads is the quadrature
+// encoder, and an enabled state machine is taken to be running it.
+//
+// That state machine is replaced by a model of the car's wheel
+// (sim_plant.hpp) on a thread of its own. It reads the TB6612 inputs and the
+// motor's PWM duty from the GPIO and PWM stand-ins, integrates the motor in
+// 50 us steps, counts the encoder edges with the program's table and stores
+// the count where the DMA channel paced by the state machine's RX DREQ
+// writes, which is what the two chained channels do on the device.
+//
+//   PICOW_SIM_BATTERY_V=<volts>  motor supply, 7.4 by default
+//   PICOW_SIM_LOAD_NM=<N m>      constant load at the wheel against forward
+//   PICOW_SIM_NO_ENCODER=1       no room for the program, the firmware runs
+//                                speed commands on feedforward alone
+#include "sim.hpp"
+#include "sim_plant.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+extern "C"
+{
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+}
+
+#include "actuation.hpp"
+
+pio_hw_t sim_pio_hw[NUM_PIOS];
+
+namespace
+{
+    constexpr double STEP_S = 50e-6;
+    constexpr auto PERIOD = std::chrono::microseconds(200);
+
+    struct Channel
+    {
+        bool claimed;
+        volatile void *write_addr;
+        uint8_t dreq;
+    };
+
+    struct State
+    {
+        std::mutex mutex;
+        uint32_t used[NUM_PIOS] = {};   // instruction memory
+        uint8_t claimed[NUM_PIOS] = {}; // state machines
+        Channel channels[NUM_DMA_CHANNELS] = {};
+        bool wheel_started = false;
+    };
+
+    State &state()
+    {
+        static State s;
+        return s;
+    }
+
+    double env_double(const char *name, double fallback)
+    {
+        const char *s = getenv(name);
+        return s ? strtod(s, nullptr) : fallback;
+    }
+
+    volatile uint32_t *dma_target(uint dreq)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        for (const Channel &ch : st.channels)
+        {
+            if (ch.claimed && ch.dreq == dreq && ch.write_addr)
+            {
+                return static_cast<volatile uint32_t *>(ch.write_addr);
+            }
+        }
+        return nullptr;
+    }
+
+    void run_wheel(PIO pio, uint sm)
+    {
+        sim::MotorParams params;
+        params.battery_v = env_double("PICOW_SIM_BATTERY_V", params.battery_v);
+        params.load_nm = env_double("PICOW_SIM_LOAD_NM", params.load_nm);
+        sim::WheelPlant wheel(params, ENCODER_COUNTS_PER_REV, WHEEL_CIRCUMFERENCE_UM);
+        sim::QuadratureCounter counter;
+        const uint dreq = pio_get_dreq(pio, sm, false);
+
+        uint64_t t_us = time_us_64();
+        double pending_s = 0.0;
+        while (true)
+        {
+            std::this_thread::sleep_for(PERIOD);
+            const uint64_t now = time_us_64();
+            pending_s += (now - t_us) * 1e-6;
+            t_us = now;
+
+            // the inputs hold for the whole interval, as they did since the last look
+            const uint32_t pins = sim::gpio_state();
+            const sim::Bridge bridge = sim::bridge_from_pins((pins >> MOTOR_IN1_PIN) & 1u, (pins >> MOTOR_IN2_PIN) & 1u,
+                                                             (pins >> MOTOR_STBY_PIN) & 1u);
+            const double duty = sim::pwm_duty(MOTOR_PWM_PIN);
+            for (; pending_s >= STEP_S; pending_s -= STEP_S)
+            {
+                wheel.step(STEP_S, bridge, duty);
+                counter.sample(wheel.pins());
+            }
+
+            volatile uint32_t *count = dma_target(dreq);
+            if (count)
+            {
+                *count = counter.count();
+            }
+        }
+    }
+} // namespace
+
+extern "C"
+{
+    bool pio_can_add_program_at_offset(PIO pio, const pio_program_t *program, uint offset)
+    {
+        if (getenv("PICOW_SIM_NO_ENCODER"))
+        {
+            return false;
+        }
+        if (offset + program->length > PIO_INSTRUCTION_COUNT)
+        {
+            return false;
+        }
+        const uint32_t mask = (program->length >= 32 ? ~0u : (1u << program->length) - 1u) << offset;
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        return (st.used[pio_get_index(pio)] & mask) == 0;
+    }
+
+    uint pio_add_program_at_offset(PIO pio, const pio_program_t *program, uint offset)
+    {
+        const uint32_t mask = (program->length >= 32 ? ~0u : (1u << program->length) - 1u) << offset;
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.used[pio_get_index(pio)] |= mask;
+        return offset;
+    }
+
+    int pio_claim_unused_sm(PIO pio, bool /*required*/)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        uint8_t &claimed = st.claimed[pio_get_index(pio)];
+        for (int sm = 0; sm < NUM_PIO_STATE_MACHINES; ++sm)
+        {
+            if (!(claimed & (1u << sm)))
+            {
+                claimed |= static_cast<uint8_t>(1u << sm);
+                return sm;
+            }
+        }
+        return -1;
+    }
+
+    void pio_sm_unclaim(PIO pio, uint sm)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.claimed[pio_get_index(pio)] &= static_cast<uint8_t>(~(1u << sm));
+    }
+
+    void pio_gpio_init(PIO pio, uint pin) { gpio_set_function(pin, pio == pio1 ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0); }
+
+    int pio_sm_set_consecutive_pindirs(PIO /*pio*/, uint /*sm*/, uint pin_base, uint pin_count, bool is_out)
+    {
+        for (uint pin = pin_base; pin < pin_base + pin_count; ++pin)
+        {
+            gpio_set_dir(pin, is_out);
+        }
+        return PICO_OK;
+    }
+
+    int pio_sm_init(PIO /*pio*/, uint /*sm*/, uint /*initial_pc*/, const pio_sm_config * /*config*/) { return PICO_OK; }
+
+    void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+    {
+        State &st = state();
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            if (!enabled || st.wheel_started)
+            {
+                return;
+            }
+            st.wheel_started = true;
+        }
+        std::thread(run_wheel, pio, sm).detach();
+    }
+
+    int dma_claim_unused_channel(bool /*required*/)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        for (int i = 0; i < NUM_DMA_CHANNELS; ++i)
+        {
+            if (!st.channels[i].claimed)
+            {
+                st.channels[i] = {true, nullptr, 0x3f};
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void dma_channel_unclaim(uint channel)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.channels[channel] = {};
+    }
+
+    void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                               const volatile void * /*read_addr*/, uint /*transfer_count*/, bool /*trigger*/)
+    {
+        State &st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.channels[channel].write_addr = write_addr;
+        st.channels[channel].dreq = config->dreq;
+    }
+
+    void dma_channel_start(uint /*channel*/) {}
+}
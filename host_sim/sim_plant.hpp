@@ -0,0 +1,147 @@
+#pragma once
+// sim_plant.hpp - a DC motor driving one wheel, and the encoder on it
+//
+// Good enough to close a speed loop against, not a vehicle model. The motor
+// is the usual averaged DC model seen from the wheel: the TB6612 drives it
+// with PWM in slow decay (shorted during the off time), so the average
+// terminal voltage is duty * battery, and the winding inductance is left out
+// since its time constant is far below a motion tick:
+//
+//   i = (v - ke * w) / r
+//   J dw/dt = kt * i - friction * sign(w) - viscous * w - load
+//
+// with kt = ke. The car's mass is folded into J, friction holds the wheel
+// until the torque overcomes it. Short brake is v = 0, coast is i = 0.
+//
+// The encoder produces A and B in quadrature, counts_per_rev edges per wheel
+// turn; QuadratureCounter counts them with the same table as
+// quadrature_encoder.pio.
+//
+// Header-only: used by the simulator (sim_pio.cpp) and by tools/picow_speed.
+
+#include <cmath>
+#include <cstdint>
+
+namespace sim
+{
+    struct MotorParams
+    {
+        double battery_v = 7.4;   // two Li-ion cells
+        double r_ohm = 2.0;       // winding plus driver
+        double ke = 0.18;         // V per rad/s at the wheel, also N m per A
+        double inertia = 1.2e-3;  // kg m^2 at the wheel, car included
+        double friction_nm = 0.02;
+        double viscous_nms = 1e-4;
+        double load_nm = 0.0;     // a slope or a drag, against forward
+    };
+
+    // What the TB6612 does with its inputs.
+    enum class Bridge : uint8_t
+    {
+        Forward,
+        Reverse,
+        Brake,
+        Coast,
+    };
+
+    inline Bridge bridge_from_pins(bool in1, bool in2, bool stby)
+    {
+        if (!stby || (!in1 && !in2))
+        {
+            return Bridge::Coast;
+        }
+        if (in1 && in2)
+        {
+            return Bridge::Brake;
+        }
+        return in1 ? Bridge::Forward : Bridge::Reverse;
+    }
+
+    class WheelPlant
+    {
+    public:
+        static constexpr double PI = 3.14159265358979323846;
+
+        WheelPlant(const MotorParams &params, uint32_t counts_per_rev, uint32_t circumference_um)
+            : p_(params), counts_per_rev_(counts_per_rev), radius_m_(circumference_um * 1e-6 / (2.0 * PI))
+        {
+        }
+
+        MotorParams &params() { return p_; }
+
+        // Advance by dt seconds with the bridge in mode at duty 0..1.
+        void step(double dt, Bridge mode, double duty)
+        {
+            double i = 0.0;
+            switch (mode)
+            {
+            case Bridge::Forward:
+                i = (duty * p_.battery_v - p_.ke * w_) / p_.r_ohm;
+                break;
+            case Bridge::Reverse:
+                i = (-duty * p_.battery_v - p_.ke * w_) / p_.r_ohm;
+                break;
+            case Bridge::Brake:
+                i = -p_.ke * w_ / p_.r_ohm;
+                break;
+            case Bridge::Coast:
+                break;
+            }
+            current_ = i;
+            const double drive = p_.ke * i - p_.load_nm - p_.viscous_nms * w_;
+            if (w_ == 0.0 && std::fabs(drive) <= p_.friction_nm)
+            {
+                return; // static friction holds
+            }
+            // friction opposes the motion, or from rest the torque
+            const bool positive = w_ != 0.0 ? w_ > 0.0 : drive > 0.0;
+            const double w = w_ + dt * (drive - (positive ? p_.friction_nm : -p_.friction_nm)) / p_.inertia;
+            // crossing zero, the wheel stops unless the torque can turn it the other way
+            const bool crossed = (w_ > 0.0 && w < 0.0) || (w_ < 0.0 && w > 0.0);
+            w_ = crossed && std::fabs(drive) <= p_.friction_nm ? 0.0 : w;
+            angle_ += dt * w_;
+        }
+
+        double omega() const { return w_; } // rad/s
+        double current() const { return current_; }
+        double speed_mm_s() const { return w_ * radius_m_ * 1000.0; }
+
+        // Encoder edges so far, forward counting up.
+        int64_t edges() const { return static_cast<int64_t>(std::floor(angle_ / (2.0 * PI) * counts_per_rev_)); }
+
+        // A and B as the pins read them: B << 1 | A.
+        uint8_t pins() const
+        {
+            // B leads A going forward, which the table counts up
+            static const uint8_t PHASES[4] = {0b00, 0b10, 0b11, 0b01};
+            return PHASES[edges() & 3];
+        }
+
+    private:
+        MotorParams p_;
+        uint32_t counts_per_rev_;
+        double radius_m_;
+        double w_ = 0.0;
+        double angle_ = 0.0;
+        double current_ = 0.0;
+    };
+
+    // The counting done by quadrature_encoder.pio, one sample at a time.
+    class QuadratureCounter
+    {
+    public:
+        void sample(uint8_t pins)
+        {
+            // index = previous << 2 | current, as the program's jump table
+            static const int8_t TABLE[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+            count_ += static_cast<uint32_t>(static_cast<int32_t>(TABLE[(prev_ << 2) | pins]));
+            prev_ = pins;
+        }
+
+        uint32_t count() const { return count_; }
+
+    private:
+        uint8_t prev_ = 0;
+        uint32_t count_ = 0;
+    };
+} // namespace sim
@@ -0,0 +1,206 @@
+#pragma once
+// journal.hpp - RAM rings of the last setpoints and encoder counts
+//
+// Core 0 records every setpoint it hands to the motion profile, and every
+// trajectory point as the motion tick takes it in, in a CommandJournal. The
+// encoder counts the speed loop reads go to a CountJournal of their own, a
+// block of consecutive ticks at a time, so a closed loop does not push the
+// setpoints out. Recording is a fence, a store per word and an index store,
+// no allocation and no waiting. Core 1 copies entries out for download while
+// recording goes on; an entry that may have been overwritten during the copy
+// is discarded rather than returned torn.
+//
+// Entries are numbered from boot. Entry i lives in slot i % N until entry
+// i + N replaces it.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "control_protocol.hpp"
+
+namespace pico_tcp
+{
+
+    constexpr size_t JOURNAL_ENTRIES = 256;
+    // 64 blocks of COUNT_BLOCK_TICKS: two seconds of closed loop
+    constexpr size_t COUNT_JOURNAL_BLOCKS = 64;
+
+    // An entry as the words a JournalRing stores.
+    inline void journal_pack(const JournalEntry &entry, uint32_t *words)
+    {
+        words[0] = entry.t_us;
+        words[1] = entry.tick;
+        words[2] = static_cast<uint16_t>(entry.drive) | (static_cast<uint32_t>(entry.steer) << 16);
+        words[3] = entry.source | (static_cast<uint32_t>(entry.flags) << 8) | (static_cast<uint32_t>(entry.lead_ms) << 16);
+        words[4] = entry.point_t_us;
+    }
+
+    inline void journal_unpack(const uint32_t *words, JournalEntry &entry)
+    {
+        entry.t_us = words[0];
+        entry.tick = words[1];
+        entry.drive = static_cast<int16_t>(words[2] & 0xffff);
+        entry.steer = static_cast<uint16_t>(words[2] >> 16);
+        entry.source = static_cast<uint8_t>(words[3]);
+        entry.flags = static_cast<uint8_t>(words[3] >> 8);
+        entry.lead_ms = static_cast<uint16_t>(words[3] >> 16);
+        entry.point_t_us = words[4];
+    }
+
+    inline void journal_pack(const CountBlock &block, uint32_t *words)
+    {
+        words[0] = block.tick;
+        words[1] = block.count;
+        uint8_t bytes[COUNT_BLOCK_TICKS] = {block.n};
+        for (size_t i = 1; i < COUNT_BLOCK_TICKS; ++i)
+        {
+            bytes[i] = static_cast<uint8_t>(block.delta[i - 1]);
+        }
+        for (size_t w = 0; w < COUNT_BLOCK_TICKS / 4; ++w)
+        {
+            words[2 + w] = bytes[4 * w] | (static_cast<uint32_t>(bytes[4 * w + 1]) << 8) |
+                           (static_cast<uint32_t>(bytes[4 * w + 2]) << 16) |
+                           (static_cast<uint32_t>(bytes[4 * w + 3]) << 24);
+        }
+    }
+
+    inline void journal_unpack(const uint32_t *words, CountBlock &block)
+    {
+        const auto byte = [words](size_t i) { return static_cast<uint8_t>(words[2 + i / 4] >> (8 * (i % 4))); };
+        block.tick = words[0];
+        block.count = words[1];
+        block.n = byte(0);
+        for (size_t i = 1; i < COUNT_BLOCK_TICKS; ++i)
+        {
+            block.delta[i - 1] = static_cast<int8_t>(byte(i));
+        }
+    }
+
+    // Single writer ring of Entry, stored as Words words by journal_pack().
+    template <typename Entry, size_t Words, size_t N>
+    class JournalRing
+    {
+        static_assert((N & (N - 1)) == 0, "a journal's size must be a power of two");
+
+    public:
+        // Single writer.
+        void record(const Entry &entry)
+        {
+            uint32_t words[Words];
+            journal_pack(entry, words);
+            const uint32_t head = head_.load(std::memory_order_relaxed);
+            auto &slot = slots_[head & (N - 1)];
+            // pairs with the fence in read(): a reader that sees any of the
+            // new words also sees head at its current value
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t w = 0; w < Words; ++w)
+            {
+                slot[w].store(words[w], std::memory_order_relaxed);
+            }
+            head_.store(head + 1, std::memory_order_release);
+        }
+
+        // Entries recorded since boot.
+        uint32_t recorded() const { return head_.load(std::memory_order_acquire); }
+
+        // Copy up to max entries starting at index from (or at the oldest one
+        // still held, if from was overwritten). first is set to the index of
+        // out[0]. Returns the number of entries copied.
+        size_t read(uint32_t from, Entry *out, size_t max, uint32_t &first) const
+        {
+            const uint32_t head = head_.load(std::memory_order_acquire);
+            // the slot after head may be mid-write, so only N - 1 are safe
+            const uint32_t oldest = head >= N ? head - N + 1 : 0;
+            if (from < oldest || from > head)
+            {
+                from = oldest;
+            }
+            size_t count = head - from < max ? head - from : max;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const auto &slot = slots_[(from + i) & (N - 1)];
+                uint32_t words[Words];
+                for (size_t w = 0; w < Words; ++w)
+                {
+                    words[w] = slot[w].load(std::memory_order_relaxed);
+                }
+                journal_unpack(words, out[i]);
+            }
+
+            // drop whatever the writer may have started to replace meanwhile
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint32_t now = head_.load(std::memory_order_relaxed);
+            const uint32_t valid = now >= N ? now - N + 1 : 0;
+            if (from < valid)
+            {
+                const size_t lost = valid - from < count ? valid - from : count;
+                for (size_t i = lost; i < count; ++i)
+                {
+                    out[i - lost] = out[i];
+                }
+                count -= lost;
+                from += static_cast<uint32_t>(lost);
+            }
+            first = from;
+            return count;
+        }
+
+    private:
+        std::array<std::array<std::atomic<uint32_t>, Words>, N> slots_ = {};
+        std::atomic<uint32_t> head_{0};
+    };
+
+    using CommandJournal = JournalRing<JournalEntry, 5, JOURNAL_ENTRIES>;
+    static_assert(COUNT_BLOCK_TICKS % 4 == 0, "n and the deltas fill whole words");
+    using CountJournal = JournalRing<CountBlock, 2 + COUNT_BLOCK_TICKS / 4, COUNT_JOURNAL_BLOCKS>;
+
+    // Core 0: packs the counts of consecutive ticks into a CountBlock and
+    // records it when it is full, when a tick is skipped, when a step does not
+    // fit a delta, or on flush().
+    class CountRecorder
+    {
+    public:
+        explicit CountRecorder(CountJournal &journal) : journal_(journal) {}
+
+        // The count read by tick number tick + 1.
+        void add(uint32_t tick, uint32_t count)
+        {
+            const int32_t step = static_cast<int32_t>(count - last_);
+            if (block_.n && (tick != block_.tick + block_.n || step < INT8_MIN || step > INT8_MAX))
+            {
+                flush();
+            }
+            if (block_.n == 0)
+            {
+                block_.tick = tick;
+                block_.count = count;
+            }
+            else
+            {
+                block_.delta[block_.n - 1] = static_cast<int8_t>(step);
+            }
+            last_ = count;
+            if (++block_.n == COUNT_BLOCK_TICKS)
+            {
+                flush();
+            }
+        }
+
+        // Record the counts added since the last block.
+        void flush()
+        {
+            if (block_.n)
+            {
+                journal_.record(block_);
+                block_.n = 0;
+            }
+        }
+
+    private:
+        CountJournal &journal_;
+        CountBlock block_ = {};
+        uint32_t last_ = 0;
+    };
+} // namespace pico_tcp
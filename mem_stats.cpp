@@ -0,0 +1,236 @@
+// mem_stats.cpp
+#include "mem_stats.hpp"
+#include "control_protocol.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+extern "C"
+{
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+
+    // from the SDK's linker script (memmap_default.ld)
+    extern uint32_t __StackBottom[];
+    extern uint32_t __StackTop[];
+    extern char __data_start__[];
+    extern char __data_end__[];
+    extern char __bss_start__[];
+    extern char __bss_end__[];
+    extern char __flash_binary_start[];
+    extern char __flash_binary_end[];
+}
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Stack
+    {
+        const char *name;
+        const uint32_t *bottom;
+        const uint32_t *top;
+    };
+
+    struct Static
+    {
+        const char *name;
+        uint32_t bytes;
+    };
+
+    Stack stacks[MEM_STACKS_MAX];
+    size_t stack_count = 0;
+    Static statics[MEM_STATICS_MAX];
+    size_t static_count = 0;
+
+    struct Section
+    {
+        const char *name;
+        const char *start;
+        const char *end;
+    };
+
+    const Section sections[] = {
+        {".data", __data_start__, __data_end__},
+        {".bss", __bss_start__, __bss_end__},
+        {"flash", __flash_binary_start, __flash_binary_end},
+    };
+    constexpr size_t SECTION_COUNT = sizeof(sections) / sizeof(sections[0]);
+
+#if LWIP_STATS && MEM_STATS
+    constexpr size_t HEAP_ROWS = 1;
+#else
+    constexpr size_t HEAP_ROWS = 0;
+#endif
+#if LWIP_STATS && MEMP_STATS
+    constexpr size_t POOL_ROWS = MEMP_MAX;
+#else
+    constexpr size_t POOL_ROWS = 0;
+#endif
+
+    const char *const KIND_NAMES[] = {"heap", "pool", "stack", "section", "static"};
+} // namespace
+
+void pico_tcp::stack_paint(uint32_t *bottom, uint32_t *top)
+{
+    for (uint32_t *p = bottom; p < top; ++p)
+    {
+        *p = STACK_PAINT;
+    }
+}
+
+size_t pico_tcp::stack_high_water(const uint32_t *bottom, const uint32_t *top)
+{
+    const uint32_t *p = bottom;
+    while (p < top && *p == STACK_PAINT)
+    {
+        ++p;
+    }
+    return static_cast<size_t>(top - p) * sizeof(uint32_t);
+}
+
+void pico_tcp::mem_paint_core0_stack()
+{
+    // Paint in place rather than through stack_paint(), whose frame would
+    // lie in the painted range. Stay well clear of this frame; nothing below
+    // it is live.
+    volatile uint32_t marker = 0;
+    uint32_t *limit = const_cast<uint32_t *>(&marker) - 64;
+    if (limit > __StackTop)
+    {
+        limit = __StackTop;
+    }
+    for (volatile uint32_t *p = __StackBottom; p < limit; ++p)
+    {
+        *p = STACK_PAINT;
+    }
+    mem_register_stack("core0_stack", __StackBottom, __StackTop);
+}
+
+void pico_tcp::mem_register_stack(const char *name, const uint32_t *bottom, const uint32_t *top)
+{
+    if (stack_count < MEM_STACKS_MAX)
+    {
+        stacks[stack_count++] = {name, bottom, top};
+    }
+}
+
+void pico_tcp::mem_register_static(const char *name, size_t bytes)
+{
+    if (static_count < MEM_STATICS_MAX)
+    {
+        statics[static_count++] = {name, static_cast<uint32_t>(bytes)};
+    }
+}
+
+size_t pico_tcp::mem_row_count()
+{
+    return HEAP_ROWS + POOL_ROWS + stack_count + SECTION_COUNT + static_count;
+}
+
+bool pico_tcp::mem_row(size_t index, MemRow &out)
+{
+    out = MemRow();
+#if LWIP_STATS && MEM_STATS
+    if (index < HEAP_ROWS)
+    {
+        out.name = "lwip_heap";
+        out.kind = MEM_ROW_HEAP;
+        out.used = lwip_stats.mem.used;
+        out.max = lwip_stats.mem.max;
+        out.size = lwip_stats.mem.avail;
+        out.errors = lwip_stats.mem.err;
+        return true;
+    }
+#endif
+    index -= HEAP_ROWS;
+#if LWIP_STATS && MEMP_STATS
+    if (index < POOL_ROWS)
+    {
+        // filled in by lwip_init(); LWIP_STATS builds also have the names
+        const struct stats_mem *m = lwip_stats.memp[index];
+        out.kind = MEM_ROW_POOL;
+        if (!m)
+        {
+            out.name = "?";
+            return true;
+        }
+        out.name = m->name;
+        out.used = m->used;
+        out.max = m->max;
+        out.size = m->avail;
+        out.errors = m->err;
+        return true;
+    }
+#endif
+    index -= POOL_ROWS;
+    if (index < stack_count)
+    {
+        const Stack &s = stacks[index];
+        out.name = s.name;
+        out.kind = MEM_ROW_STACK;
+        out.used = out.max = static_cast<uint32_t>(stack_high_water(s.bottom, s.top));
+        out.size = static_cast<uint32_t>((s.top - s.bottom) * sizeof(uint32_t));
+        return true;
+    }
+    index -= stack_count;
+    if (index < SECTION_COUNT)
+    {
+        const Section &s = sections[index];
+        out.name = s.name;
+        out.kind = MEM_ROW_SECTION;
+        out.used = out.max = out.size = static_cast<uint32_t>(s.end - s.start);
+        return true;
+    }
+    index -= SECTION_COUNT;
+    if (index < static_count)
+    {
+        out.name = statics[index].name;
+        out.kind = MEM_ROW_STATIC;
+        out.used = out.max = out.size = statics[index].bytes;
+        return true;
+    }
+    return false;
+}
+
+size_t pico_tcp::encode_mem_row(uint8_t index, uint8_t *out, size_t cap)
+{
+    MemRow row;
+    if (!mem_row(index, row))
+    {
+        return 0;
+    }
+    size_t name_len = strlen(row.name);
+    if (name_len > MEM_REPORT_NAME_MAX)
+    {
+        name_len = MEM_REPORT_NAME_MAX;
+    }
+    if (cap < MEM_REPORT_HEADER_SIZE + name_len)
+    {
+        return 0;
+    }
+    out[0] = index;
+    out[1] = static_cast<uint8_t>(mem_row_count());
+    out[2] = row.kind;
+    out[3] = static_cast<uint8_t>(name_len);
+    write_u32(out + 4, row.used);
+    write_u32(out + 8, row.max);
+    write_u32(out + 12, row.size);
+    write_u32(out + 16, row.errors);
+    memcpy(out + MEM_REPORT_HEADER_SIZE, row.name, name_len);
+    return MEM_REPORT_HEADER_SIZE + name_len;
+}
+
+void pico_tcp::mem_dump_stdio()
+{
+    printf("memory           kind         used       max      size  errors\n");
+    MemRow row;
+    for (size_t i = 0; mem_row(i, row); ++i)
+    {
+        printf("%-16s %-8s %8lu %9lu %9lu %7lu\n", row.name, KIND_NAMES[row.kind], (unsigned long)row.used,
+               (unsigned long)row.max, (unsigned long)row.size, (unsigned long)row.errors);
+    }
+#if !LWIP_STATS
+    printf("(no lwIP heap and pool rows without LWIP_STATS)\n");
+#endif
+}
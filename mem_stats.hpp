@@ -0,0 +1,75 @@
+#pragma once
+// mem_stats.hpp - where the RAM goes: lwIP heap and pools, stacks, statics
+//
+// One table of rows, each a named region with its current use, high-water
+// mark, capacity and allocation failures:
+//   - the lwIP heap and every memp pool (PBUF_POOL, TCP_SEG, ...), from
+//     lwip_stats; only in builds with LWIP_STATS (all but NDEBUG builds)
+//   - both cores' stacks, painted with STACK_PAINT at boot; the high-water
+//     mark is the deepest word no longer holding the pattern
+//   - .data, .bss and the flash image, from the linker script symbols
+//   - the large statics, registered at boot with their sizeof
+// The per-object breakdown of the whole image comes from the link map at
+// build time instead (tools/map_footprint.cmake).
+//
+// Rows are read with FRAME_MEM_QUERY, one per query like the profile stages,
+// and printed once at boot and with 'm' on the USB console.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pico_tcp
+{
+
+    constexpr uint32_t STACK_PAINT = 0x57AC57AC;
+    constexpr size_t MEM_STACKS_MAX = 2;
+    constexpr size_t MEM_STATICS_MAX = 12;
+
+    enum MemRowKind : uint8_t
+    {
+        MEM_ROW_HEAP,    // lwIP heap, bytes
+        MEM_ROW_POOL,    // lwIP memp pool, elements
+        MEM_ROW_STACK,   // bytes; used and max are the high-water mark
+        MEM_ROW_SECTION, // linker section, bytes; used == size
+        MEM_ROW_STATIC,  // registered object, bytes; used == size
+    };
+
+    struct MemRow
+    {
+        const char *name;
+        uint8_t kind; // MemRowKind
+        uint32_t used;
+        uint32_t max;
+        uint32_t size;
+        uint32_t errors; // failed allocations
+    };
+
+    // Fill [bottom, top) with STACK_PAINT.
+    void stack_paint(uint32_t *bottom, uint32_t *top);
+
+    // Bytes of [bottom, top) that were ever written since painting; the
+    // stack grows down, so unused words are the ones at the bottom.
+    size_t stack_high_water(const uint32_t *bottom, const uint32_t *top);
+
+    // Paint the unused part of the calling core 0 stack and register it.
+    // Call first thing in main().
+    void mem_paint_core0_stack();
+
+    // Register a stack painted by the caller (core 1's, before launching it).
+    void mem_register_stack(const char *name, const uint32_t *bottom, const uint32_t *top);
+
+    // Register a static object for the sizeof table; name must outlive it.
+    void mem_register_static(const char *name, size_t bytes);
+
+    size_t mem_row_count();
+
+    // Row index, current values. Returns false past the end.
+    bool mem_row(size_t index, MemRow &out);
+
+    // Payload of a FRAME_MEM_REPORT for row index, 0 if there is no such
+    // row. See control_protocol.hpp.
+    size_t encode_mem_row(uint8_t index, uint8_t *out, size_t cap);
+
+    // Print every row to stdout.
+    void mem_dump_stdio();
+} // namespace pico_tcp
@@ -0,0 +1,168 @@
+#pragma once
+// motion_profile.hpp - jerk-limited setpoint ramps in fixed point
+//
+// A RampAxis moves its output towards a target at no more than a maximum
+// rate, and changes that rate by no more than a maximum jerk per tick, so a
+// step in the setpoint becomes an S-shaped ramp instead of a current spike.
+// Near the target the rate is capped at the fastest rate that can still be
+// shed one jerk step per tick before arriving, so the output does not
+// overshoot: after a tick at rate r, braking covers r^2 / (2 * jerk) - r / 2
+// more, so r + that must stay within the distance, which gives
+// r = sqrt(2 * jerk * distance + jerk^2 / 4) - jerk / 2.
+//
+// Values are Q16.16 internally and the tick costs the same every time: a few
+// multiplies and a 32-step integer square root, no division and no floats.
+//
+// The target is written by the actuation loop and read by the tick, which runs
+// from a timer interrupt on the same core; both sides only load and store
+// single words.
+
+#include <atomic>
+#include <cstdint>
+
+constexpr uint32_t MOTION_TICK_HZ = 1000;
+
+// Limits in output units: rate per second and rate change per second.
+// A jerk of 0 removes the jerk limit and leaves a plain slew-rate limit.
+struct MotionLimits
+{
+    uint32_t rate_per_s;
+    uint32_t jerk_per_s2;
+};
+
+class RampAxis
+{
+public:
+    RampAxis(int32_t initial, const MotionLimits &limits)
+        : pos_(to_q16(initial)), rate_(0), target_(initial), jump_seq_(0), seen_jump_seq_(0)
+    {
+        set_limits(limits);
+    }
+
+    // Only call while the tick is not running (before the timer is started).
+    void set_limits(const MotionLimits &limits)
+    {
+        max_rate_ = static_cast<int32_t>((static_cast<uint64_t>(limits.rate_per_s) << 16) / MOTION_TICK_HZ);
+        max_jerk_ = static_cast<int32_t>((static_cast<uint64_t>(limits.jerk_per_s2) << 16) /
+                                         (static_cast<uint64_t>(MOTION_TICK_HZ) * MOTION_TICK_HZ));
+        if (limits.jerk_per_s2 && max_jerk_ == 0)
+        {
+            max_jerk_ = 1;
+        }
+    }
+
+    // Ramp towards target from the next tick on.
+    void set_target(int32_t target) { target_.store(target, std::memory_order_relaxed); }
+
+    // Go to target on the next tick without ramping (emergency brake).
+    void jump_to(int32_t target)
+    {
+        target_.store(target, std::memory_order_relaxed);
+        jump_seq_.store(jump_seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Continue from value at rest, holding it until the next set_target().
+    // Only while the tick cannot run (masked or not started).
+    void restart_at(int32_t value)
+    {
+        pos_ = to_q16(value);
+        rate_ = 0;
+        target_.store(value, std::memory_order_relaxed);
+        seen_jump_seq_ = jump_seq_.load(std::memory_order_relaxed);
+    }
+
+    int32_t target() const { return target_.load(std::memory_order_relaxed); }
+
+    // Advance one tick. Returns the output rounded to a whole unit.
+    int32_t step()
+    {
+        const uint32_t jump_seq = jump_seq_.load(std::memory_order_acquire);
+        const int32_t target = to_q16(target_.load(std::memory_order_relaxed));
+        if (jump_seq != seen_jump_seq_)
+        {
+            seen_jump_seq_ = jump_seq;
+            pos_ = target;
+            rate_ = 0;
+            return output();
+        }
+
+        const int32_t error = target - pos_;
+        if (max_jerk_ == 0)
+        {
+            // slew-rate limit only
+            rate_ = clamp(error, -max_rate_, max_rate_);
+            pos_ += rate_;
+            return output();
+        }
+
+        const uint32_t distance = static_cast<uint32_t>(error < 0 ? -error : error);
+        // fastest rate that can still be brought to zero within distance
+        const uint64_t jerk = static_cast<uint64_t>(max_jerk_);
+        uint32_t stop_rate = isqrt(2ull * jerk * distance + ((jerk * jerk) >> 2)) - static_cast<uint32_t>(jerk >> 1);
+        if (stop_rate > static_cast<uint32_t>(max_rate_))
+        {
+            stop_rate = static_cast<uint32_t>(max_rate_);
+        }
+        const int32_t wanted = error < 0 ? -static_cast<int32_t>(stop_rate) : static_cast<int32_t>(stop_rate);
+        const uint32_t last_speed = static_cast<uint32_t>(rate_ < 0 ? -rate_ : rate_);
+        rate_ += clamp(wanted - rate_, -max_jerk_, max_jerk_);
+
+        // arrive instead of creeping up on the target in sub-unit steps, if
+        // dropping to rest from the last rate is within one jerk step
+        const uint32_t speed = static_cast<uint32_t>(rate_ < 0 ? -rate_ : rate_);
+        if (distance <= speed && last_speed <= static_cast<uint32_t>(max_jerk_))
+        {
+            pos_ = target;
+            rate_ = 0;
+        }
+        else
+        {
+            pos_ += rate_;
+        }
+        return output();
+    }
+
+    int32_t output() const { return (pos_ + (1 << 15)) >> 16; }
+
+    // Current rate in units per second, rounded towards zero.
+    int32_t rate_per_s() const
+    {
+        return static_cast<int32_t>((static_cast<int64_t>(rate_) * static_cast<int64_t>(MOTION_TICK_HZ)) / 65536);
+    }
+
+    bool settled() const { return rate_ == 0 && pos_ == to_q16(target()); }
+
+private:
+    static constexpr int32_t to_q16(int32_t v) { return static_cast<int32_t>(static_cast<uint32_t>(v) << 16); }
+
+    static constexpr int32_t clamp(int32_t v, int32_t lo, int32_t hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+    // floor(sqrt(v)), fixed 32 iterations
+    static uint32_t isqrt(uint64_t v)
+    {
+        uint64_t root = 0;
+        uint64_t bit = 1ull << 62;
+        for (int i = 0; i < 32; ++i)
+        {
+            if (v >= root + bit)
+            {
+                v -= root + bit;
+                root = (root >> 1) + bit;
+            }
+            else
+            {
+                root >>= 1;
+            }
+            bit >>= 2;
+        }
+        return static_cast<uint32_t>(root);
+    }
+
+    int32_t pos_;  // Q16.16 output
+    int32_t rate_; // Q16.16 output units per tick
+    int32_t max_rate_;
+    int32_t max_jerk_; // Q16.16 per tick per tick
+    std::atomic<int32_t> target_;
+    std::atomic<uint32_t> jump_seq_;
+    uint32_t seen_jump_seq_;
+};
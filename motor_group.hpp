@@ -0,0 +1,136 @@
+#pragma once
+// motor_group.hpp - drive several TB6612 motors with shared register writes
+//
+// All direction and standby pins of the group change in one gpio_put_masked()
+// call, so every H-bridge switches on the same cycle and none of them ever
+// sees half of a direction change. PWM levels of motors on the same slice go
+// out in one pwm_set_both_levels() call. A slice latches new levels at its
+// next wrap, so the duty follows the direction pins within one PWM period.
+//
+// The masks and slice layout are worked out in the constructor; drive() and
+// brake() are branch-light loops over the motors with no per-call setup.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "SparkFun_TB6612.h"
+
+extern "C"
+{
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+}
+
+template <size_t N>
+class MotorGroup
+{
+public:
+    // The motors stay owned by the caller and must outlive the group.
+    explicit MotorGroup(const std::array<Motor *, N> &motors) : motors_(motors)
+    {
+        pin_mask_ = 0;
+        standby_bits_ = 0;
+        brake_bits_ = 0;
+        slice_count_ = 0;
+        for (size_t i = 0; i < N; ++i)
+        {
+            Motor &m = *motors_[i];
+            standby_bits_ |= 1u << m.Standby;
+            brake_bits_ |= m.DirMask;
+            pin_mask_ |= m.DirMask | (1u << m.Standby);
+
+            const uint slice = pwm_gpio_to_slice_num(m.PWM);
+            const uint chan = pwm_gpio_to_channel(m.PWM);
+            size_t s = 0;
+            while (s < slice_count_ && slices_[s].slice != slice)
+            {
+                ++s;
+            }
+            if (s == slice_count_)
+            {
+                slices_[s] = {slice, NONE, NONE};
+                ++slice_count_;
+            }
+            (chan == PWM_CHAN_A ? slices_[s].motor_a : slices_[s].motor_b) = static_cast<uint8_t>(i);
+        }
+    }
+
+    // Speeds in -DEFAULTSPEED..DEFAULTSPEED, one per motor in constructor
+    // order. Takes every motor out of standby in the same write.
+    void drive(const std::array<int, N> &speeds)
+    {
+        uint32_t bits = standby_bits_;
+        for (size_t i = 0; i < N; ++i)
+        {
+            Motor &m = *motors_[i];
+            const int speed = speeds[i] * m.Offset;
+            if (speed >= 0)
+            {
+                bits |= m.FwdBits;
+                m.Level = speed;
+                m.Direction = 1;
+            }
+            else
+            {
+                bits |= m.RevBits;
+                m.Level = -speed;
+                m.Direction = -1;
+            }
+            levels_[i] = MotorScale::level(static_cast<uint32_t>(m.Level));
+        }
+        write(bits);
+    }
+
+    // Short-brake every motor at once.
+    void brake()
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            motors_[i]->Level = 0;
+            motors_[i]->Direction = 0;
+            levels_[i] = 0;
+        }
+        write(standby_bits_ | brake_bits_);
+    }
+
+private:
+    static constexpr uint8_t NONE = 0xff;
+
+    // motors driven by the two channels of one slice, NONE if not in the group
+    struct SliceMotors
+    {
+        uint slice;
+        uint8_t motor_a;
+        uint8_t motor_b;
+    };
+
+    void write(uint32_t bits)
+    {
+        gpio_put_masked(pin_mask_, bits);
+        for (size_t s = 0; s < slice_count_; ++s)
+        {
+            const SliceMotors &sm = slices_[s];
+            if (sm.motor_a != NONE && sm.motor_b != NONE)
+            {
+                pwm_set_both_levels(sm.slice, levels_[sm.motor_a], levels_[sm.motor_b]);
+            }
+            else if (sm.motor_a != NONE)
+            {
+                pwm_set_chan_level(sm.slice, PWM_CHAN_A, levels_[sm.motor_a]);
+            }
+            else
+            {
+                pwm_set_chan_level(sm.slice, PWM_CHAN_B, levels_[sm.motor_b]);
+            }
+        }
+    }
+
+    std::array<Motor *, N> motors_;
+    std::array<uint16_t, N> levels_ = {};
+    std::array<SliceMotors, N> slices_ = {};
+    size_t slice_count_;
+    uint32_t pin_mask_;     // every direction and standby pin of the group
+    uint32_t standby_bits_; // standby pins, high = driver enabled
+    uint32_t brake_bits_;   // In1 and In2 of every motor
+};
@@ -5,150 +5,609 @@
  */
 
 #include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
 
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
-#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
 
-#include "SparkFun_TB6612.h"
-// TODO: make a header file for this
-#include "servo.cpp"
+#include "actuation.hpp"
+#include "encoder.hpp"
+#include "journal.hpp"
 #include "tcp_server.hpp"
+#include "udp_server.hpp"
+#include "seqlock.hpp"
+#include "telemetry.hpp"
+#include "trajectory.hpp"
+#include "profiling.hpp"
+#include "mem_stats.hpp"
+#include "deferred_log.hpp"
+#include "wifi_link.hpp"
+#include "power_policy.hpp"
 
 // includes the char ssid[] and char pass[]
 #include "wifi.h"
 
-Motor motor(26, 27, 28, 1, 5);
-Servo servo(5);
+Motor motor(MOTOR_IN1_PIN, MOTOR_IN2_PIN, MOTOR_PWM_PIN, 1, MOTOR_STBY_PIN);
+Servo servo(SERVO_PWM_PIN);
+DriveTrain drive_train({&motor});
+Actuation actuation(drive_train, servo);
+// counted by PIO and DMA, read by the motion tick for the speed loop
+QuadratureEncoder wheel_encoder(ENCODER_A_PIN);
+
+// Core 0 runs actuation only, core 1 owns the cyw43 chip, lwIP, the servers
+// and all logging. They share nothing but the two SeqLocks, the telemetry and
+// command stamp rings and the trajectory player's inbox below, so WiFi bursts
+// and printf on core 1 cannot stall a PWM update on core 0.
+
+// latest command, written by core 1, read by core 0
+struct Setpoint
+{
+    int16_t drive;
+    uint16_t steer;
+    uint8_t flags;  // pico_tcp::ControlFlags
+    uint8_t source; // pico_tcp::COMMAND_SOURCE_* or TCP client slot
+    uint16_t seq;   // from the command, for its CommandStamp
+    uint32_t arrival_us;
+};
+SeqLock<Setpoint> setpoint_channel;
 
-// is responsible for connecting to the wifi
-int connect_to_wifi(int retries)
+// time from a command arriving in the network callback to the motion tick
+// writing it to the PWM compare registers
+struct LatencyStats
 {
-    if (cyw43_arch_init())
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+
+    void add(uint32_t us)
     {
-        printf("failed to initialise\n");
-        return 1;
+        if (count == 0 || us < min_us)
+            min_us = us;
+        if (us > max_us)
+            max_us = us;
+        total_us += us;
+        count++;
     }
-    printf("initialized\n");
+};
+// written by core 0 after every command written to the PWM, read by core 1
+// for reporting
+SeqLock<LatencyStats> latency_channel;
+
+// samples pushed by core 0 every TELEMETRY_PERIOD_US, drained by core 1
+pico_tcp::TelemetryRing telemetry_ring;
+
+// every setpoint core 0 hands to the ramps and every trajectory point it
+// takes in, and apart from them the encoder counts the speed loop read; both
+// downloadable over TCP
+pico_tcp::CommandJournal journal;
+pico_tcp::CountJournal count_journal;
+
+// when each command arrived, reached the ramps and was first written to the
+// PWM; pushed by the motion tick, drained by core 1
+pico_tcp::CommandStampRing command_stamps;
 
-    cyw43_arch_enable_sta_mode();
+// timed setpoints, pushed by core 1 as they arrive and played out by the
+// motion tick; a live command stops playback
+pico_tcp::TrajectoryPlayer trajectory;
+static_assert(pico_tcp::TRAJECTORY_LEAD_MAX_MS < DEADMAN_TIMEOUT_MS, "buffering a trajectory would trip the failsafe");
 
-    while (retries-- > 0)
+// Both cores have to make progress for the hardware watchdog to be fed: the
+// motion tick on core 0 and, once it has started, the core 1 main loop. A
+// stuck core resets the chip, which boots with the motor braked.
+constexpr uint32_t WATCHDOG_TIMEOUT_MS = 500;
+// the core 1 loop wakes at least every housekeeping period (100 ms)
+constexpr uint32_t CORE1_STALL_US = 300000;
+// incremented by every iteration of the core 1 main loop, 0 until it runs
+std::atomic<uint32_t> core1_heartbeat{0};
+// Set by core 1 once it is done with flash. Joining may rewrite the AP cache,
+// and the erase parks core 0 with interrupts off for up to 400 ms, so core 0
+// enables the watchdog only after this. The servers are not started before
+// it either, so the motor is still braked from actuation.start().
+std::atomic<bool> flash_done{false};
+
+// Core 0 state. The ramps run from a repeating timer on core 0 and are the
+// only writers of the actuators once the timer is started.
+repeating_timer_t motion_timer;
+// longest motion tick since the last telemetry sample, written by the tick
+volatile uint16_t motion_tick_max_us = 0;
+// the stamp of the latest setpoint, completed by the first tick that applies
+// it; written with the tick masked
+pico_tcp::CommandStamp pending_stamp;
+uint32_t pending_stamp_tick = 0;
+volatile bool stamp_pending = false;
+// arrival -> PWM write of every completed stamp, written with the tick masked
+LatencyStats command_latency = {};
+// the encoder counts of the last ticks, by tick; when the speed loop closes
+// the speed it starts from was measured over them, so they are journaled then
+constexpr size_t RECENT_COUNTS = 32;
+static_assert(RECENT_COUNTS > SPEED_WINDOW_TICKS + 1, "the counts the speed at engagement was measured over");
+std::array<std::pair<uint32_t, uint32_t>, RECENT_COUNTS> recent_counts;
+bool counts_journaled = false;
+// written by the motion tick only
+pico_tcp::CountRecorder count_recorder(count_journal);
+
+static uint16_t saturate_u16(uint32_t v)
+{
+    return v > 0xffff ? 0xffff : static_cast<uint16_t>(v);
+}
+
+// core 0, with the tick masked or from it: the setpoint of the pending stamp
+// has been written to the PWM
+static void complete_stamp()
+{
+    pending_stamp.write_us = time_us_32();
+    stamp_pending = false;
+    command_stamps.push(pending_stamp);
+    command_latency.add(pending_stamp.write_us - pending_stamp.arrival_us);
+    latency_channel.write(command_latency);
+}
+
+// core 0, timer interrupt: one step of both ramps, then write whatever changed
+bool motion_tick(repeating_timer_t * /*timer*/)
+{
+    PROFILE_SCOPE(pico_tcp::PROFILE_MOTION_TICK);
+    const uint32_t start = time_us_32();
+
+    const uint32_t tick = actuation.ticks();
+    // the points core 1 queued since the last tick; the player plays nothing
+    // else and runs on the tick count, so a replay that takes the journaled
+    // points in on the same ticks plays the same setpoints
+    pico_tcp::TrajectoryEntry in;
+    while (trajectory.take(in))
+    {
+        journal.record({start, tick, in.point.drive, in.point.steer, pico_tcp::COMMAND_SOURCE_TRAJECTORY, in.flags,
+                        in.lead_ms, in.point.t_us});
+    }
+    const pico_tcp::TrajectoryOutput out = trajectory.step(pico_tcp::trajectory_time_us(tick));
+    if (out.action != pico_tcp::TrajectoryAction::None)
+    {
+        actuation.set_setpoint(out.action == pico_tcp::TrajectoryAction::Set ? out.drive : 0, out.steer, out.flags);
+    }
+    actuation.tick();
+
+    // the speed loop's output depends on the wheel, so its input is journaled
+    // for as long as it drives the motor
+    if (actuation.has_encoder())
     {
-        switch (cyw43_arch_wifi_connect_timeout_ms(ssid, pass, CYW43_AUTH_WPA2_AES_PSK, 3333))
+        const uint32_t count = actuation.encoder_count();
+        recent_counts[tick % RECENT_COUNTS] = {tick, count};
+        if (actuation.closed_loop())
+        {
+            for (uint32_t back = SPEED_WINDOW_TICKS + 1; !counts_journaled && back > 0; --back)
+            {
+                const auto &recent = recent_counts[(tick - back) % RECENT_COUNTS];
+                if (recent.first == tick - back)
+                {
+                    count_recorder.add(recent.first, recent.second);
+                }
+            }
+            count_recorder.add(tick, count);
+        }
+        else if (counts_journaled)
         {
-        case PICO_ERROR_BADAUTH:
-            printf("failed to connect wrong password, retrying...\n");
-            break;
-        case PICO_ERROR_CONNECT_FAILED:
-            printf("failed to connect, connection failed, retrying...\n");
-            break;
-        case PICO_ERROR_TIMEOUT:
-            printf("failed to connect, connection timed out, retrying...\n");
-            break;
-        case 0:
-            printf("succesfully connected\n");
-            goto connected;
+            // the loop opened: the counts it ended with go out now, not with
+            // the next block
+            count_recorder.flush();
         }
+        counts_journaled = actuation.closed_loop();
     }
-    // NOTE: I know this is very stupid but I've always dreamt of using a goto
-    // if we fail too many times we fall through here
-    return 1;
-    // if we succed the goto takes us here
-connected:
-    return 0;
-}
 
-volatile int motor_drive = 0;
-int last_motor_drive = motor_drive - 1;
-void loop_motor()
-{
-    if (last_motor_drive == motor_drive)
+    // a trajectory point reached is stamped on the tick that wrote it
+    if (trajectory.reached())
     {
-        return;
+        command_stamps.push({static_cast<uint16_t>(trajectory.point().t_us), pico_tcp::COMMAND_SOURCE_TRAJECTORY,
+                             out.flags, trajectory.point_arrival_us(), start, time_us_32()});
     }
 
-    printf("motor drive: %d\n", motor_drive);
-    if (motor_drive == 0)
+    // the first tick after the handoff has just written the new setpoint
+    if (stamp_pending && actuation.ticks() > pending_stamp_tick)
     {
-        motor.brake();
+        complete_stamp();
     }
-    else
+
+    const uint16_t took = saturate_u16(time_us_32() - start);
+    if (took > motion_tick_max_us)
     {
-        motor.drive(motor_drive);
+        motion_tick_max_us = took;
     }
+    return true;
+}
 
-    last_motor_drive = motor_drive;
+// core 0: snapshot the actuators plus the apply statistics gathered in acc
+// since the previous sample, then start a new period
+void push_sample(pico_tcp::TelemetrySample &acc)
+{
+    acc.t_us = time_us_32();
+    // the motion tick writes the actuators, keep it out for a consistent snapshot
+    const uint32_t irq = save_and_disable_interrupts();
+    acc.motor_level = static_cast<int16_t>(motor.direction() < 0 ? -motor.level() : motor.level());
+    acc.motor_dir = static_cast<int8_t>(motor.direction());
+    acc.servo_angle = static_cast<uint8_t>(servo.angle());
+    acc.servo_pulse = servo.pulse_us();
+    acc.apply_max_us = motion_tick_max_us;
+    motion_tick_max_us = 0;
+    acc.failsafe_trips = static_cast<uint16_t>(actuation.failsafe_trips());
+    acc.failsafe_latency_max_us = saturate_u16(actuation.failsafe_latency_max_us());
+    acc.trajectory_depth = static_cast<uint8_t>(std::min<size_t>(trajectory.depth(), 0xff));
+    acc.trajectory_state = static_cast<uint8_t>(trajectory.state());
+    acc.trajectory_lead_ms = saturate_u16(trajectory.lead_us(pico_tcp::trajectory_time_us(actuation.ticks())) / 1000);
+    acc.trajectory_underruns = static_cast<uint16_t>(trajectory.underruns());
+    acc.wheel_speed = static_cast<int16_t>(actuation.wheel_speed());
+    acc.speed_target = static_cast<int16_t>(actuation.speed_target());
+    acc.drive_mode = actuation.closed_loop()  ? pico_tcp::DRIVE_MODE_SPEED
+                     : actuation.speed_mode() ? pico_tcp::DRIVE_MODE_SPEED_OPEN
+                                              : pico_tcp::DRIVE_MODE_PWM;
+    restore_interrupts(irq);
+    // never waits: a full ring means core 1 is behind and the sample is dropped
+    telemetry_ring.push(acc);
+    acc.applies = 0;
+    acc.latency_max_us = 0;
 }
 
-volatile int servo_dir = 90;
-int last_servo_dir = servo_dir - 1;
-void loop_servo()
+// core 0: feed the watchdog if the motion tick and core 1 both moved on
+// since the last check
+void check_progress(uint32_t &last_ticks, uint32_t &last_beat, uint32_t &beat_us)
 {
-    if (last_servo_dir == servo_dir)
+    const uint32_t irq = save_and_disable_interrupts();
+    const uint32_t ticks = actuation.ticks();
+    restore_interrupts(irq);
+    const uint32_t beat = core1_heartbeat.load(std::memory_order_relaxed);
+    const uint32_t now = time_us_32();
+    if (beat != last_beat)
     {
-        return;
+        last_beat = beat;
+        beat_us = now;
+    }
+    if (ticks != last_ticks && (beat == 0 || now - beat_us < CORE1_STALL_US))
+    {
+        watchdog_update();
     }
+    last_ticks = ticks;
+}
 
-    printf("servo_dir: %d\n", servo_dir);
-    servo.set_angle(servo_dir);
+// core 0: hand every new setpoint to the ramps as soon as core 1 publishes it
+// and sample the actuators at a fixed rate in between
+void actuation_loop()
+{
+    PROFILE_INIT_CORE();
+
+    pico_tcp::TelemetrySample acc = {};
+    uint32_t applied_seq = setpoint_channel.sequence();
+    absolute_time_t next_sample = make_timeout_time_us(pico_tcp::TELEMETRY_PERIOD_US);
+
+    // initial setpoints (brake, servo centred)
+    actuation.start();
+
+    // lets core 1 park this core while it writes the WiFi cache to flash
+    flash_safe_execute_core_init();
 
-    last_servo_dir = servo_dir;
+    // negative delay: fixed rate, measured from one tick's start to the next
+    add_repeating_timer_us(-static_cast<int64_t>(1000000 / MOTION_TICK_HZ), &motion_tick, nullptr, &motion_timer);
+
+    uint32_t last_ticks = actuation.ticks();
+    uint32_t last_beat = 0;
+    uint32_t beat_us = time_us_32();
+    bool watchdog_on = false;
+
+    while (true)
+    {
+        if (setpoint_channel.sequence() != applied_seq)
+        {
+            Setpoint sp;
+            applied_seq = setpoint_channel.read(sp);
+
+            // with the tick masked, so both axes change on the same tick and
+            // the journal knows which one; the tick records trajectory
+            // points, so masked it is also the journal's only writer
+            pico_tcp::JournalEntry entry = {};
+            const uint32_t irq = save_and_disable_interrupts();
+            const uint32_t handoff_us = time_us_32();
+            trajectory.stop();
+            actuation.set_setpoint(sp.drive, sp.steer, sp.flags);
+            entry.tick = actuation.ticks();
+            pending_stamp = {sp.seq, sp.source, sp.flags, sp.arrival_us, handoff_us, 0};
+            if (sp.flags & pico_tcp::CONTROL_FLAG_BRAKE)
+            {
+                // set_setpoint() has already braked, the tick only does the servo;
+                // the tick is masked, so this is the only producer right now
+                complete_stamp();
+            }
+            else
+            {
+                pending_stamp_tick = entry.tick;
+                stamp_pending = true;
+            }
+            entry.t_us = time_us_32();
+            entry.drive = sp.drive;
+            entry.steer = sp.steer;
+            entry.source = sp.source;
+            entry.flags = sp.flags;
+            journal.record(entry);
+            restore_interrupts(irq);
+
+            const uint32_t arrival_to_profile = time_us_32() - sp.arrival_us;
+            acc.applies++;
+            acc.latency_max_us = std::max(acc.latency_max_us, saturate_u16(arrival_to_profile));
+        }
+
+        if (time_reached(next_sample))
+        {
+            PROFILE_SCOPE(pico_tcp::PROFILE_SAMPLE);
+            if (!watchdog_on && flash_done.load(std::memory_order_acquire))
+            {
+                watchdog_enable(WATCHDOG_TIMEOUT_MS, true);
+                watchdog_on = true;
+            }
+            check_progress(last_ticks, last_beat, beat_us);
+            push_sample(acc);
+            next_sample = delayed_by_us(next_sample, pico_tcp::TELEMETRY_PERIOD_US);
+        }
+
+        // core 1 signals every publish with __sev(), the timeout covers sampling
+        if (setpoint_channel.sequence() == applied_seq)
+        {
+            best_effort_wfe_or_timeout(next_sample);
+        }
+    }
 }
 
-void loop_server()
+// core 1: runs in the lwIP context for every control command received by either server
+void on_command(void * /*arg*/, uint8_t source, const pico_tcp::ControlCommand &cmd, uint32_t arrival_us)
 {
+    Setpoint sp;
+    sp.drive = (cmd.flags & pico_tcp::CONTROL_FLAG_BRAKE) ? 0 : cmd.drive;
+    sp.steer = cmd.steer;
+    sp.flags = cmd.flags;
+    sp.source = source;
+    sp.seq = cmd.seq;
+    sp.arrival_us = arrival_us;
+    setpoint_channel.write(sp);
+    // wake core 0
+    __sev();
 }
 
-int main()
+// core 1: runs in the lwIP context for every trajectory batch from the controller
+void on_trajectory(void * /*arg*/, uint8_t /*source*/, const pico_tcp::TrajectoryBatch &batch)
 {
-    stdio_init_all();
-    printf("\n\n---------------\n");
+    const uint32_t arrival_us = time_us_32();
+    for (uint8_t i = 0; i < batch.count; ++i)
+    {
+        pico_tcp::TrajectoryEntry entry;
+        entry.point = batch.points[i];
+        entry.flags = 0;
+        if (i == 0)
+        {
+            entry.flags |= batch.flags & (pico_tcp::TRAJECTORY_FLAG_START | pico_tcp::TRAJECTORY_FLAG_BRAKE_ON_UNDERRUN |
+                                          pico_tcp::TRAJECTORY_FLAG_SPEED);
+        }
+        if (i == batch.count - 1)
+        {
+            entry.flags |= batch.flags & pico_tcp::TRAJECTORY_FLAG_END;
+        }
+        entry.lead_ms = batch.lead_ms;
+        entry.arrival_us = arrival_us;
+        // never waits: a full inbox means the client is too far ahead
+        trajectory.push(entry);
+    }
+}
 
-    if (connect_to_wifi(10))
+// core 1: print what core 0 wrote to the PWM since the last report
+void report_latency(LatencyStats &last)
+{
+    LatencyStats stats;
+    latency_channel.read(stats);
+    if (stats.count == last.count)
+    {
+        return;
+    }
+
+    Setpoint sp;
+    setpoint_channel.read(sp);
+    const uint32_t n = stats.count - last.count;
+    printf("motor drive: %d servo_dir: %u\n", sp.drive, sp.steer);
+    printf("cmd->pwm latency n=%lu avg=%luus min=%luus max=%luus (min/max since boot)\n", (unsigned long)n,
+           (unsigned long)((stats.total_us - last.total_us) / n), (unsigned long)stats.min_us,
+           (unsigned long)stats.max_us);
+    last = stats;
+}
+
+// core 1 gets its own stack, lwIP and printf need more than the default
+static uint32_t core1_stack[2048];
+
+void core1_main()
+{
+    PROFILE_INIT_CORE();
+
+    pico_tcp::WifiLink link(ssid, pass, CYW43_AUTH_WPA2_AES_PSK);
+    const int joined = link.connect(10);
+    // no more flash writes after this, core 0 may enable the watchdog
+    flash_done.store(true, std::memory_order_release);
+    if (joined)
     {
         printf("failed connection :(");
         cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, true);
-        return 1;
+        return;
     }
 
     // Optionally pass netif pointer for nicer logging. Here we use netif_list from lwIP.
+    // Static: the client pool with its TX rings and parsers is most of the
+    // 8 KB core 1 stack.
     extern struct netif *netif_list;
-    pico_tcp::TcpServer server(netif_list);
+    static pico_tcp::TcpServer server(netif_list);
+    server.set_command_handler(&on_command, nullptr);
+    server.set_trajectory_handler(&on_trajectory, nullptr);
+    server.set_journal(&journal, &count_journal);
+    // power save off while someone drives, aggressive while nobody is connected
+    pico_tcp::PowerPolicy power;
+    server.set_power_policy(&power);
 
     if (!server.start())
     {
         printf("Server failed to start\n");
         cyw43_arch_deinit();
-        return 1;
+        return;
     }
     printf("server started");
 
+    // preferred transport for steering, the TCP server stays as a fallback
+    pico_tcp::UdpControlServer udp_server;
+    udp_server.set_command_handler(&on_command, nullptr);
+    // only the TCP controller's host may steer over UDP
+    udp_server.set_tcp_server(&server);
+    if (!udp_server.start())
+    {
+        printf("UDP control channel failed to start\n");
+    }
+    link.mark(pico_tcp::BOOT_PHASE_LISTEN);
+    link.print_boot_times();
+    power.begin(to_ms_since_boot(get_absolute_time()));
+    pico_tcp::mem_register_static("tcp_server", sizeof(server));
+    pico_tcp::mem_register_static("log_rings", sizeof(pico_tcp::log_rings));
+    pico_tcp::mem_dump_stdio();
+
+    pico_tcp::TelemetryStream telemetry(telemetry_ring);
+    pico_tcp::CommandStampStream stamps(command_stamps);
+
     bool led_on = false;
     bool exit = false;
-    const uint64_t loop_time = 100000;
-    absolute_time_t next_loop;
+    // housekeeping (LED, telemetry, latency report) has its own slow schedule, commands
+    // are handed to core 0 straight from the network callback
+    const uint64_t housekeeping_time = 100000;
+    const uint32_t report_every = 10;
+    uint32_t housekeeping_ticks = 0;
+    LatencyStats reported = {};
+    uint32_t commands_seen = 0;
+    absolute_time_t next_housekeeping = get_absolute_time();
 
     while (!exit || !server.is_complete())
     {
-        next_loop = get_absolute_time() + loop_time;
+        core1_heartbeat.store(core1_heartbeat.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (time_reached(next_housekeeping))
+        {
+            PROFILE_SCOPE(pico_tcp::PROFILE_HOUSEKEEPING);
+            next_housekeeping = delayed_by_us(next_housekeeping, housekeeping_time);
+
+            cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
+            led_on = !led_on;
+
+            telemetry.service(server, udp_server);
+            stamps.service(server);
+
+            if (++housekeeping_ticks % report_every == 0)
+            {
+                report_latency(reported);
+            }
+
+            // 'p' on the console dumps the stage timings, 'm' the memory table,
+            // 'w' the WiFi power modes
+            switch (getchar_timeout_us(0))
+            {
+            case 'p':
+                pico_tcp::profile_dump_stdio();
+                break;
+            case 'm':
+                pico_tcp::mem_dump_stdio();
+                break;
+            case 'w':
+                power.dump_stdio(to_ms_since_boot(get_absolute_time()));
+                break;
+            default:
+                break;
+            }
+        }
 
-        cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
-        led_on = !led_on;
+        {
+            PROFILE_SCOPE(pico_tcp::PROFILE_POLL);
+            cyw43_arch_poll();
+        }
 
-        loop_motor();
-        loop_servo();
+        // rejoins in the background, nothing here waits for the radio
+        const pico_tcp::LinkEvent link_event = link.poll();
+        if (link_event == pico_tcp::LinkEvent::Restored || link_event == pico_tcp::LinkEvent::Readdressed)
+        {
+            power.reapply();
+        }
+        if (link_event == pico_tcp::LinkEvent::Readdressed)
+        {
+            // connections to the old address are gone, listen on the new one
+            cyw43_arch_lwip_begin();
+            server.close();
+            if (!server.start())
+            {
+                printf("Server failed to restart\n");
+            }
+            cyw43_arch_lwip_end();
+        }
+        const uint32_t commands = server.commands_received() + udp_server.commands_applied();
+        if (commands != commands_seen)
+        {
+            commands_seen = commands;
+            link.note_command();
+        }
+        power.update(to_ms_since_boot(get_absolute_time()),
+                     {server.client_count(), commands + server.trajectory_batches()});
 
-        cyw43_arch_poll();
+        // what the callbacks logged, printed out here; a full batch means
+        // there may be more, so come straight back
+        if (pico_tcp::log_drain_stdio() == pico_tcp::LOG_DRAIN_MAX)
+        {
+            continue;
+        }
 
-        // waits for `loop_time` us
-        cyw43_arch_wait_for_work_until(next_loop);
+        // sleeps until housekeeping is due or the radio needs attention
+        PROFILE_SCOPE(pico_tcp::PROFILE_WAIT);
+        cyw43_arch_wait_for_work_until(next_housekeeping);
+    }
+    while (pico_tcp::log_drain_stdio())
+    {
     }
 
     int status = server.last_status();
     printf("Done. status=%d\n", status);
 
-    motor.brake();
+    on_command(nullptr, pico_tcp::COMMAND_SOURCE_LOCAL, pico_tcp::ControlCommand{0, 0, 90, pico_tcp::CONTROL_FLAG_BRAKE},
+               time_us_32());
+    // an orderly exit, core 0 carries on alone
+    core1_heartbeat.store(0, std::memory_order_relaxed);
     cyw43_arch_deinit();
+}
+
+int main()
+{
+    pico_tcp::mem_paint_core0_stack();
+    stdio_init_all();
+    printf("\n\n---------------\n");
+    if (watchdog_caused_reboot())
+    {
+        printf("rebooted by the watchdog\n");
+    }
+
+    pico_tcp::stack_paint(core1_stack, core1_stack + count_of(core1_stack));
+    pico_tcp::mem_register_stack("core1_stack", core1_stack, core1_stack + count_of(core1_stack));
+    pico_tcp::mem_register_static("telemetry_ring", sizeof(telemetry_ring));
+    pico_tcp::mem_register_static("journal", sizeof(journal));
+    pico_tcp::mem_register_static("count_journal", sizeof(count_journal));
+    pico_tcp::mem_register_static("trajectory", sizeof(trajectory));
+
+    // before core 1 starts the cyw43 driver, which takes a PIO block and DMA channels of its own
+    if (wheel_encoder.start(ENCODER_MAX_STEP_RATE))
+    {
+        actuation.set_encoder(wheel_encoder.count_word());
+    }
+    else
+    {
+        printf("no PIO state machine or DMA channels for the wheel encoder, speed setpoints run open loop\n");
+    }
+    multicore_launch_core1_with_stack(&core1_main, core1_stack, sizeof(core1_stack));
+
+    actuation_loop();
     return 0;
 }
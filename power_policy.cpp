@@ -0,0 +1,181 @@
+// power_policy.cpp
+#include "power_policy.hpp"
+
+#include <cstdio>
+
+#include "pico/cyw43_arch.h"
+
+using namespace pico_tcp;
+
+namespace
+{
+    const char *const MODE_NAMES[] = {"idle", "connected", "active"};
+
+    size_t mode_index(PowerMode mode) { return static_cast<size_t>(mode); }
+} // namespace
+
+const char *pico_tcp::power_mode_name(PowerMode mode)
+{
+    return mode < PowerMode::Count ? MODE_NAMES[mode_index(mode)] : "?";
+}
+
+uint32_t pico_tcp::power_mode_pm_value(PowerMode mode)
+{
+    switch (mode)
+    {
+    case PowerMode::Idle:
+        return CYW43_AGGRESSIVE_PM;
+    case PowerMode::Active:
+        return CYW43_NONE_PM;
+    default:
+        return CYW43_DEFAULT_PM;
+    }
+}
+
+void PowerPolicy::begin(uint32_t now_ms)
+{
+    since_ms_ = now_ms;
+    last_client_ms_ = now_ms;
+    apply();
+}
+
+void PowerPolicy::update(uint32_t now_ms, const PowerInputs &in)
+{
+    const uint32_t fresh = in.commands - commands_seen_;
+    if (fresh)
+    {
+        commands_seen_ = in.commands;
+        // several commands seen in one pass came in one burst, each counts
+        streak_ = streak_ && now_ms - last_command_ms_ <= POWER_ACTIVE_GAP_MS ? streak_ + fresh : fresh;
+        last_command_ms_ = now_ms;
+        if (streak_ >= POWER_ACTIVE_STREAK)
+        {
+            streaming_ = true;
+            last_stream_ms_ = now_ms;
+        }
+    }
+    if (in.clients || fresh)
+    {
+        last_client_ms_ = now_ms;
+    }
+
+    PowerMode want;
+    if (streaming_ && now_ms - last_stream_ms_ < POWER_ACTIVE_HOLD_MS)
+    {
+        want = PowerMode::Active;
+    }
+    else if (now_ms - last_client_ms_ >= POWER_IDLE_AFTER_MS)
+    {
+        want = PowerMode::Idle;
+    }
+    else
+    {
+        want = PowerMode::Connected;
+    }
+    if (want != mode_)
+    {
+        enter(want, now_ms);
+    }
+}
+
+void PowerPolicy::enter(PowerMode mode, uint32_t now_ms)
+{
+    ms_in_[mode_index(mode_)] += now_ms - since_ms_;
+    log_[transitions_ % POWER_LOG_SIZE] = {now_ms, mode_, mode};
+    transitions_++;
+    mode_ = mode;
+    since_ms_ = now_ms;
+    apply();
+}
+
+void PowerPolicy::apply()
+{
+    if (cyw43_wifi_pm(&cyw43_state, power_mode_pm_value(mode_)) != 0)
+    {
+        errors_++;
+    }
+}
+
+void PowerPolicy::reapply()
+{
+    apply();
+}
+
+uint32_t PowerPolicy::ms_in(PowerMode mode, uint32_t now_ms) const
+{
+    if (mode >= PowerMode::Count)
+    {
+        return 0;
+    }
+    return ms_in_[mode_index(mode)] + (mode == mode_ ? now_ms - since_ms_ : 0);
+}
+
+size_t PowerPolicy::recent(PowerTransition *out, size_t max) const
+{
+    size_t count = transitions_ < POWER_LOG_SIZE ? transitions_ : POWER_LOG_SIZE;
+    if (count > max)
+    {
+        count = max;
+    }
+    const uint32_t first = transitions_ - static_cast<uint32_t>(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = log_[(first + i) % POWER_LOG_SIZE];
+    }
+    return count;
+}
+
+size_t PowerPolicy::encode_report(uint32_t now_ms, uint8_t *out) const
+{
+    PowerTransition log[POWER_LOG_SIZE];
+    const size_t count = recent(log, POWER_LOG_SIZE);
+    out[0] = static_cast<uint8_t>(mode_);
+    out[1] = static_cast<uint8_t>(POWER_REPORT_MODES);
+    out[2] = static_cast<uint8_t>(count);
+    out[3] = 0;
+    write_u32(out + 4, now_ms);
+    write_u32(out + 8, transitions_);
+    write_u32(out + 12, errors_);
+    uint8_t *p = out + POWER_REPORT_HEADER_SIZE;
+    for (size_t m = 0; m < POWER_REPORT_MODES; ++m, p += 4)
+    {
+        write_u32(p, ms_in(static_cast<PowerMode>(m), now_ms));
+    }
+    for (size_t i = 0; i < count; ++i, p += POWER_TRANSITION_SIZE)
+    {
+        write_u32(p, log[i].t_ms);
+        p[4] = static_cast<uint8_t>(log[i].from);
+        p[5] = static_cast<uint8_t>(log[i].to);
+        write_u16(p + 6, 0);
+    }
+    return static_cast<size_t>(p - out);
+}
+
+void PowerPolicy::dump_stdio(uint32_t now_ms) const
+{
+    printf("power mode: %s, %lu transitions, %lu errors\n", power_mode_name(mode_), (unsigned long)transitions_,
+           (unsigned long)errors_);
+    // shares of the time since begin()
+    uint32_t total = 0;
+    for (size_t m = 0; m < POWER_REPORT_MODES; ++m)
+    {
+        total += ms_in(static_cast<PowerMode>(m), now_ms);
+    }
+    if (total == 0)
+    {
+        total = 1;
+    }
+    for (size_t m = 0; m < POWER_REPORT_MODES; ++m)
+    {
+        const uint32_t ms = ms_in(static_cast<PowerMode>(m), now_ms);
+        printf("  %-10s %10lu ms %5lu.%lu%%\n", MODE_NAMES[m], (unsigned long)ms,
+               (unsigned long)(1000ull * ms / total / 10), (unsigned long)(1000ull * ms / total % 10));
+    }
+    PowerTransition log[POWER_LOG_SIZE];
+    const size_t count = recent(log, POWER_LOG_SIZE);
+    for (size_t i = 0; i < count; ++i)
+    {
+        printf("  at %9lu ms  %s -> %s\n", (unsigned long)log[i].t_ms, power_mode_name(log[i].from),
+               power_mode_name(log[i].to));
+    }
+}
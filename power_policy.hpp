@@ -0,0 +1,121 @@
+#pragma once
+// power_policy.hpp - cyw43 power save that follows what the clients do
+//
+// The chip's default power save (PM2) dozes between beacons once it has had
+// no traffic for 200 ms, and a command that arrives while it dozes waits for
+// the next wake-up. Fine for a car parked with a phone attached, not while
+// someone is steering it. With nobody connected even PM2 wakes more than
+// needed.
+//
+// The policy runs on core 1 from the main loop and picks one of three modes:
+//   Idle       no clients for POWER_IDLE_AFTER_MS: aggressive power save (PM1)
+//   Connected  clients, but no steady command stream: the SDK default (PM2)
+//   Active     a stream of commands: power save off
+// A stream is POWER_ACTIVE_STREAK or more commands, each within
+// POWER_ACTIVE_GAP_MS of the one before. Active starts with a stream and lasts
+// until no command continued one for POWER_ACTIVE_HOLD_MS, so a pause at a
+// corner does not cost the next command a wake-up. Single commands, or
+// commands trickling in slower than the gap, leave the mode alone.
+//
+// Every change goes to the chip with cyw43_wifi_pm() and is logged with its
+// time; the time spent in each mode is summed. The log is read with
+// FRAME_POWER_QUERY and printed with 'w' on the USB console.
+//
+// The decisions depend only on the inputs handed to update(), so the class
+// runs unchanged on the host against a stand-in cyw43_wifi_pm()
+// (tools/picow_power.cpp).
+
+#include <cstddef>
+#include <cstdint>
+
+#include "control_protocol.hpp"
+
+namespace pico_tcp
+{
+
+    constexpr uint32_t POWER_ACTIVE_GAP_MS = 250; // slower than 4 Hz is not a stream
+    constexpr uint32_t POWER_ACTIVE_STREAK = 5;
+    constexpr uint32_t POWER_ACTIVE_HOLD_MS = 2000;
+    constexpr uint32_t POWER_IDLE_AFTER_MS = 5000;
+    constexpr size_t POWER_LOG_SIZE = POWER_REPORT_TRANSITIONS_MAX;
+
+    enum class PowerMode : uint8_t
+    {
+        Idle,
+        Connected,
+        Active,
+        Count,
+    };
+    static_assert(static_cast<size_t>(PowerMode::Count) == POWER_REPORT_MODES, "FRAME_POWER_REPORT has a slot per mode");
+
+    const char *power_mode_name(PowerMode mode);
+
+    // The cyw43_wifi_pm() argument for a mode.
+    uint32_t power_mode_pm_value(PowerMode mode);
+
+    // What the policy looks at, sampled by the main loop.
+    struct PowerInputs
+    {
+        size_t clients;    // TCP clients connected
+        uint32_t commands; // control commands and trajectory batches so far, any transport
+    };
+
+    struct PowerTransition
+    {
+        uint32_t t_ms; // since boot
+        PowerMode from;
+        PowerMode to;
+    };
+
+    class PowerPolicy
+    {
+    public:
+        // Put the chip in the Connected mode, the one it boots in. Call once
+        // the link is up.
+        void begin(uint32_t now_ms);
+
+        // Look at the inputs and switch modes if needed. Cheap; call from
+        // every iteration of the main loop.
+        void update(uint32_t now_ms, const PowerInputs &in);
+
+        // Send the current mode to the chip again, after a rejoin.
+        void reapply();
+
+        PowerMode mode() const { return mode_; }
+        uint32_t transitions() const { return transitions_; }
+
+        // cyw43_wifi_pm() calls that failed.
+        uint32_t errors() const { return errors_; }
+
+        // Milliseconds spent in mode up to now_ms.
+        uint32_t ms_in(PowerMode mode, uint32_t now_ms) const;
+
+        // The newest transitions, oldest first; returns how many were copied.
+        size_t recent(PowerTransition *out, size_t max) const;
+
+        // FRAME_POWER_REPORT payload into out (POWER_REPORT_PAYLOAD_MAX
+        // bytes). Returns its length.
+        size_t encode_report(uint32_t now_ms, uint8_t *out) const;
+
+        // The table printed by 'w' on the console.
+        void dump_stdio(uint32_t now_ms) const;
+
+    private:
+        void enter(PowerMode mode, uint32_t now_ms);
+        void apply();
+
+        PowerMode mode_ = PowerMode::Connected;
+        uint32_t since_ms_ = 0; // mode_ entered
+        uint32_t ms_in_[static_cast<size_t>(PowerMode::Count)] = {};
+        uint32_t transitions_ = 0;
+        uint32_t errors_ = 0;
+        PowerTransition log_[POWER_LOG_SIZE] = {};
+
+        uint32_t commands_seen_ = 0;
+        uint32_t last_command_ms_ = 0;
+        uint32_t streak_ = 0;
+        bool streaming_ = false;      // seen a stream since boot
+        uint32_t last_stream_ms_ = 0; // last command that was part of one
+        uint32_t last_client_ms_ = 0; // last update() that saw a client or command
+    };
+} // namespace pico_tcp
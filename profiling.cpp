@@ -0,0 +1,88 @@
+// profiling.cpp
+#include "profiling.hpp"
+#include "control_protocol.hpp"
+
+#include <cstdio>
+
+extern "C"
+{
+#include "hardware/clocks.h"
+}
+
+using namespace pico_tcp;
+
+static_assert(LogHistogram<0>::BUCKETS == PROFILE_BUCKETS, "report layout assumes log2 buckets");
+
+#if PICOW_PROFILE
+LogHistogram<0> pico_tcp::profile_stages[PROFILE_STAGE_COUNT];
+#endif
+
+const char *pico_tcp::profile_stage_name(uint8_t stage)
+{
+    static const char *const names[PROFILE_STAGE_COUNT] = {
+        "apply_motor", "apply_servo", "sample", "motion_tick", "poll",
+        "housekeeping", "wait", "tcp_accept", "tcp_recv", "tcp_sent", "log_drain",
+    };
+    return stage < PROFILE_STAGE_COUNT ? names[stage] : "?";
+}
+
+size_t pico_tcp::encode_profile_stage(uint8_t stage, uint8_t *out, size_t cap)
+{
+#if PICOW_PROFILE
+    if (stage >= PROFILE_STAGE_COUNT || cap < PROFILE_REPORT_PAYLOAD_SIZE)
+    {
+        return 0;
+    }
+    const LogHistogram<0> &h = profile_stages[stage];
+    out[0] = stage;
+    out[1] = PROFILE_STAGE_COUNT;
+    write_u16(out + 2, static_cast<uint16_t>(PROFILE_BUCKETS));
+    write_u32(out + 4, clock_get_hz(clk_sys));
+    write_u32(out + 8, h.count());
+    write_u32(out + 12, h.min());
+    write_u32(out + 16, h.max());
+    write_u32(out + 20, h.mean());
+    for (unsigned b = 0; b < LogHistogram<0>::BUCKETS; ++b)
+    {
+        write_u32(out + PROFILE_REPORT_HEADER_SIZE + 4 * b, h.bucket_count(b));
+    }
+    return PROFILE_REPORT_PAYLOAD_SIZE;
+#else
+    (void)stage;
+    (void)out;
+    (void)cap;
+    return 0;
+#endif
+}
+
+void pico_tcp::profile_dump_stdio()
+{
+#if PICOW_PROFILE
+    const uint32_t per_us = clock_get_hz(clk_sys) / 1000000;
+    printf("stage         count     min_us    mean_us   max_us   (cycles / %lu)\n", (unsigned long)per_us);
+    for (uint8_t stage = 0; stage < PROFILE_STAGE_COUNT; ++stage)
+    {
+        const LogHistogram<0> &h = profile_stages[stage];
+        printf("%-12s %8lu %9lu %9lu %9lu\n", profile_stage_name(stage), (unsigned long)h.count(),
+               (unsigned long)(h.min() / per_us), (unsigned long)(h.mean() / per_us),
+               (unsigned long)(h.max() / per_us));
+        if (h.count() == 0)
+        {
+            continue;
+        }
+        // log2 histogram, <=upper bound in cycles:count
+        printf("  ");
+        for (unsigned b = 0; b < LogHistogram<0>::BUCKETS; ++b)
+        {
+            if (h.bucket_count(b))
+            {
+                printf(" <=%lu:%lu", (unsigned long)LogHistogram<0>::bucket_upper(b),
+                       (unsigned long)h.bucket_count(b));
+            }
+        }
+        printf("\n");
+    }
+#else
+    printf("profiling not compiled in, configure with -DPICOW_PROFILE=ON\n");
+#endif
+}
@@ -0,0 +1,100 @@
+#pragma once
+// profiling.hpp - per-stage cycle timing, compiled in with -DPICOW_PROFILE=ON
+//
+// PROFILE_SCOPE(stage) times the rest of the enclosing block with the SysTick
+// counter of the running core (one count per system clock cycle) and adds the
+// result to that stage's log2 histogram. Without PICOW_PROFILE the macros
+// expand to nothing and no profiling state exists.
+//
+// Every stage is recorded by one core only. The dumps read the core 0 stages
+// from core 1 without synchronisation, so a sample that lands during a dump
+// may show up in some fields and not yet in others.
+//
+// SysTick is 24 bits wide: a single stage longer than 2^24 cycles (134 ms at
+// 125 MHz) wraps and is recorded short.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "histogram.hpp"
+
+#ifndef PICOW_PROFILE
+#define PICOW_PROFILE 0
+#endif
+
+#if PICOW_PROFILE
+extern "C"
+{
+#include "hardware/structs/systick.h"
+}
+#endif
+
+namespace pico_tcp
+{
+
+    enum ProfileStage : uint8_t
+    {
+        // core 0
+        PROFILE_APPLY_MOTOR,
+        PROFILE_APPLY_SERVO,
+        PROFILE_SAMPLE,
+        PROFILE_MOTION_TICK, // includes APPLY_MOTOR and APPLY_SERVO
+        // core 1 main loop
+        PROFILE_POLL,
+        PROFILE_HOUSEKEEPING,
+        PROFILE_WAIT,
+        // core 1 lwIP callbacks, nested inside PROFILE_POLL in poll mode
+        PROFILE_TCP_ACCEPT,
+        PROFILE_TCP_RECV,
+        PROFILE_TCP_SENT,
+        // core 1 main loop, printing what the callbacks logged (deferred_log.hpp)
+        PROFILE_LOG_DRAIN,
+        PROFILE_STAGE_COUNT
+    };
+
+    const char *profile_stage_name(uint8_t stage);
+
+    // Payload of a FRAME_PROFILE_REPORT for one stage, 0 if the stage does not
+    // exist or the build has no profiling. See control_protocol.hpp.
+    size_t encode_profile_stage(uint8_t stage, uint8_t *out, size_t cap);
+
+    // Print every stage to stdout.
+    void profile_dump_stdio();
+
+#if PICOW_PROFILE
+    // Start the SysTick counter of the calling core, free running at clk_sys.
+    inline void profile_init_core()
+    {
+        systick_hw->rvr = 0x00ffffff;
+        systick_hw->cvr = 0;
+        systick_hw->csr = 0x5; // ENABLE | CLKSOURCE (processor clock), no interrupt
+    }
+
+    // Counts down.
+    inline uint32_t profile_cycles() { return systick_hw->cvr; }
+
+    extern LogHistogram<0> profile_stages[PROFILE_STAGE_COUNT];
+
+    class ProfileScope
+    {
+    public:
+        explicit ProfileScope(ProfileStage stage) : stage_(stage), start_(profile_cycles()) {}
+        ~ProfileScope() { profile_stages[stage_].add((start_ - profile_cycles()) & 0x00ffffff); }
+
+        ProfileScope(const ProfileScope &) = delete;
+        ProfileScope &operator=(const ProfileScope &) = delete;
+
+    private:
+        ProfileStage stage_;
+        uint32_t start_;
+    };
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) ::pico_tcp::ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+#define PROFILE_INIT_CORE() ::pico_tcp::profile_init_core()
+#else
+#define PROFILE_SCOPE(stage) ((void)0)
+#define PROFILE_INIT_CORE() ((void)0)
+#endif
+} // namespace pico_tcp
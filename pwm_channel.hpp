@@ -0,0 +1,100 @@
+#pragma once
+// pwm_channel.hpp - compile-time PWM slice configuration
+//
+// A slice counts clk_sys / (INT + FRAC/16) ticks per second and wraps after
+// wrap + 1 of them. PwmConfig<clock, frequency> picks the smallest divider
+// for which the period still fits the 16-bit counter, which leaves the
+// largest possible wrap and therefore the finest duty resolution. Everything
+// is computed by the compiler; applying a level at run time is a table
+// lookup or a multiply and a shift.
+
+#include <array>
+#include <cstdint>
+
+extern "C"
+{
+#include "hardware/pwm.h"
+}
+
+template <uint32_t ClockHz, uint32_t FreqHz, uint32_t MinSteps = 256>
+struct PwmConfig
+{
+    static_assert(FreqHz > 0 && FreqHz <= ClockHz / 2, "PWM frequency out of range");
+
+    // period in 1/16 clock cycles, the divider's resolution
+    static constexpr uint64_t PERIOD_16 = static_cast<uint64_t>(ClockHz) * 16 / FreqHz;
+
+    // 8.4 fixed point divider, at least 1.0
+    static constexpr uint32_t DIV_16 =
+        PERIOD_16 <= 16u * 65536u ? 16u : static_cast<uint32_t>((PERIOD_16 + 65535u) / 65536u);
+    static_assert(DIV_16 < 256u * 16u, "PWM frequency too low for the clock divider");
+    static constexpr uint8_t DIV_INT = static_cast<uint8_t>(DIV_16 >> 4);
+    static constexpr uint8_t DIV_FRAC = static_cast<uint8_t>(DIV_16 & 15u);
+
+    // counts per period; a level of TOP is 100% duty
+    static constexpr uint32_t TOP = static_cast<uint32_t>((PERIOD_16 + DIV_16 / 2) / DIV_16);
+    static_assert(TOP >= MinSteps && TOP <= 65536u, "not enough duty resolution at this frequency");
+    static constexpr uint16_t WRAP = static_cast<uint16_t>(TOP - 1);
+
+    // PWM period in nanoseconds as actually configured
+    static constexpr uint64_t PERIOD_NS = static_cast<uint64_t>(TOP) * DIV_16 * 1000000000ull / 16u / ClockHz;
+
+    // Level giving a high time of us microseconds, rounded to the nearest count.
+    static constexpr uint16_t level_for_us(uint32_t us)
+    {
+        const uint64_t level = (static_cast<uint64_t>(us) * 1000u * TOP + PERIOD_NS / 2) / PERIOD_NS;
+        return static_cast<uint16_t>(level > TOP ? TOP : level);
+    }
+
+    // Run the slice driving gpio at this configuration.
+    static void apply(uint gpio)
+    {
+        const uint slice = pwm_gpio_to_slice_num(gpio);
+        pwm_set_clkdiv_int_frac(slice, DIV_INT, DIV_FRAC);
+        pwm_set_wrap(slice, WRAP);
+        pwm_set_enabled(slice, true);
+    }
+};
+
+// Maps a duty of 0..MaxIn onto 0..Config::TOP with a multiply and a shift.
+// The factor is rounded up so MaxIn lands exactly on TOP.
+template <typename Config, uint32_t MaxIn>
+struct PwmScale
+{
+    static constexpr uint32_t FACTOR = static_cast<uint32_t>((static_cast<uint64_t>(Config::TOP) << 16) / MaxIn + 1);
+    static_assert(static_cast<uint64_t>(MaxIn) * FACTOR < (1ull << 32), "scale overflows 32 bits");
+
+    static constexpr uint16_t level(uint32_t in)
+    {
+        return static_cast<uint16_t>(((in > MaxIn ? MaxIn : in) * FACTOR) >> 16);
+    }
+    static_assert(level(0) == 0 && level(MaxIn) == Config::TOP, "scale has to span 0..TOP");
+};
+
+constexpr uint pwm_slice_of(uint gpio)
+{
+    return (gpio >> 1) & 7u;
+}
+
+// True if no GPIO appears twice.
+template <size_t N>
+constexpr bool pins_distinct(const std::array<uint, N> &pins)
+{
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = i + 1; j < N; ++j)
+            if (pins[i] == pins[j])
+                return false;
+    return true;
+}
+
+// True if no two PWM outputs share a slice. Both channels of a slice share
+// divider and wrap, so outputs that need their own frequency must not.
+template <size_t N>
+constexpr bool slices_distinct(const std::array<uint, N> &pwm_pins)
+{
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = i + 1; j < N; ++j)
+            if (pwm_slice_of(pwm_pins[i]) == pwm_slice_of(pwm_pins[j]))
+                return false;
+    return true;
+}
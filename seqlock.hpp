@@ -0,0 +1,80 @@
+#pragma once
+// seqlock.hpp - lock-free single producer / single consumer snapshot
+//
+// The writer never waits and the reader always gets a value that was
+// published as a whole, never half of one write and half of the next. Used to
+// hand state between the two cores without a spin lock, so neither side can
+// be stalled by the other.
+//
+// The payload is stored as relaxed 32-bit atomics so a concurrent read is
+// well-defined; the sequence counter is odd while a write is in progress.
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock payload must be trivially copyable");
+
+public:
+    SeqLock() : seq_(0)
+    {
+        for (auto &w : words_)
+        {
+            w.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Publish a new value. Only one core may write.
+    void write(const T &value)
+    {
+        uint32_t buf[WORDS] = {};
+        memcpy(buf, &value, sizeof(T));
+
+        const uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i)
+        {
+            words_[i].store(buf[i], std::memory_order_relaxed);
+        }
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Copy the latest value into out. Returns its sequence number, which
+    // grows by 2 per write, so a reader can tell whether anything changed.
+    uint32_t read(T &out) const
+    {
+        uint32_t buf[WORDS];
+        for (;;)
+        {
+            const uint32_t before = seq_.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                continue; // write in progress
+            }
+            for (size_t i = 0; i < WORDS; ++i)
+            {
+                buf[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == before)
+            {
+                memcpy(&out, buf, sizeof(T));
+                return before;
+            }
+        }
+    }
+
+    // Sequence number of the latest completed write.
+    uint32_t sequence() const { return seq_.load(std::memory_order_acquire) & ~1u; }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> seq_;
+    std::atomic<uint32_t> words_[WORDS];
+};
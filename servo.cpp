@@ -1,41 +1,32 @@
-#include "pico/stdlib.h"
-#include "hardware/pwm.h"
+// servo.cpp - compile-time checks of the Servo level table
+#include "servo.hpp"
 
-class Servo
+namespace servo_checks
 {
-public:
-    Servo(uint gpio, uint16_t min_us = 1000, uint16_t max_us = 2000)
-        : gpio_(gpio), min_pulse_(min_us), max_pulse_(max_us)
+    // The table has to produce the same duty cycles as the original
+    // 125 MHz / 64 / 39062 configuration, level = pulse * 39062 / 20000, to
+    // within one count of that configuration. The original truncated, so
+    // compare against its exact value.
+    constexpr bool matches_legacy_formula(uint16_t min_us, uint16_t max_us)
     {
-        gpio_set_function(gpio_, GPIO_FUNC_PWM);
-        slice_num_ = pwm_gpio_to_slice_num(gpio_);
-
-        // Configure for ~50Hz (20ms period)
-        pwm_set_clkdiv(slice_num_, 64);     // divide 125 MHz by 64
-        pwm_set_wrap(slice_num_, WRAP_VAL); // gives ~50 Hz period
-        pwm_set_enabled(slice_num_, true);
-    }
-
-    void set_angle(uint16_t angle)
-    {
-        if (angle > 180)
-            angle = 180;
-
-        // Map 0–180° → min_pulse_–max_pulse_ (in microseconds)
-        uint32_t pulse = min_pulse_ + ((uint32_t)(max_pulse_ - min_pulse_) * angle) / 180;
-
-        // Convert microseconds → level (duty cycle)
-        uint32_t level = (pulse * WRAP_VAL) / PERIOD_US;
-
-        pwm_set_gpio_level(gpio_, (uint16_t)level);
+        constexpr uint64_t LEGACY_WRAP = 39062;
+        constexpr uint64_t LEGACY_PERIOD_US = 20000;
+        const Servo::LevelTable levels = Servo::make_levels(min_us, max_us);
+        for (uint16_t angle = 0; angle <= Servo::MAX_ANGLE; ++angle)
+        {
+            // levels[a] / TOP against pulse * LEGACY_WRAP / LEGACY_PERIOD_US / (LEGACY_WRAP + 1),
+            // both scaled by TOP * LEGACY_PERIOD_US * (LEGACY_WRAP + 1)
+            const uint64_t now = static_cast<uint64_t>(levels[angle]) * (LEGACY_WRAP + 1) * LEGACY_PERIOD_US;
+            const uint64_t before = Servo::pulse_for(angle, min_us, max_us) * LEGACY_WRAP * Servo::Pwm::TOP;
+            const uint64_t diff = now > before ? now - before : before - now;
+            if (diff > Servo::Pwm::TOP * LEGACY_PERIOD_US)
+                return false;
+        }
+        return true;
     }
 
-private:
-    static constexpr uint32_t PERIOD_US = 20000; // 20 ms period
-    static constexpr uint32_t WRAP_VAL = 39062;  // 125 MHz / 64 / 50 Hz
-
-    uint gpio_;
-    uint slice_num_;
-    uint16_t min_pulse_;
-    uint16_t max_pulse_;
-};
\ No newline at end of file
+    static_assert(Servo::Pwm::TOP > 65000, "servo PWM should use nearly the full 16-bit counter");
+    static_assert(Servo::Pwm::PERIOD_NS > 19990000 && Servo::Pwm::PERIOD_NS < 20010000, "servo period is not 20 ms");
+    static_assert(matches_legacy_formula(1000, 2000), "servo levels differ from the original formula");
+    static_assert(matches_legacy_formula(500, 2500), "servo levels differ from the original formula");
+} // namespace servo_checks
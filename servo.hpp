@@ -0,0 +1,61 @@
+#pragma once
+// servo.hpp - hobby servo on one PWM channel, angle in whole degrees
+
+#include <array>
+
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+
+#include "pwm_channel.hpp"
+
+class Servo
+{
+public:
+    using Pwm = PwmConfig<SYS_CLK_HZ, 50>; // 20 ms period
+    static constexpr uint16_t MAX_ANGLE = 180;
+    using LevelTable = std::array<uint16_t, MAX_ANGLE + 1>;
+
+    // PWM level for every whole degree, pulse widths mapped linearly from
+    // min_us at 0° to max_us at MAX_ANGLE.
+    static constexpr LevelTable make_levels(uint16_t min_us, uint16_t max_us)
+    {
+        LevelTable levels = {};
+        for (uint16_t angle = 0; angle <= MAX_ANGLE; ++angle)
+        {
+            levels[angle] = Pwm::level_for_us(pulse_for(angle, min_us, max_us));
+        }
+        return levels;
+    }
+
+    static constexpr uint32_t pulse_for(uint16_t angle, uint16_t min_us, uint16_t max_us)
+    {
+        return min_us + (static_cast<uint32_t>(max_us - min_us) * angle) / MAX_ANGLE;
+    }
+
+    Servo(uint gpio, uint16_t min_us = 1000, uint16_t max_us = 2000)
+        : gpio_(gpio), min_pulse_(min_us), max_pulse_(max_us), angle_(0), levels_(make_levels(min_us, max_us))
+    {
+        gpio_set_function(gpio_, GPIO_FUNC_PWM);
+        Pwm::apply(gpio_);
+    }
+
+    void set_angle(uint16_t angle)
+    {
+        if (angle > MAX_ANGLE)
+            angle = MAX_ANGLE;
+
+        pwm_set_gpio_level(gpio_, levels_[angle]);
+        angle_ = angle;
+    }
+
+    // Last applied angle in degrees and pulse width in microseconds
+    uint16_t angle() const { return angle_; }
+    uint16_t pulse_us() const { return static_cast<uint16_t>(pulse_for(angle_, min_pulse_, max_pulse_)); }
+
+private:
+    uint gpio_;
+    uint16_t min_pulse_;
+    uint16_t max_pulse_;
+    uint16_t angle_;
+    LevelTable levels_;
+};
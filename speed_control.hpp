@@ -0,0 +1,193 @@
+#pragma once
+// speed_control.hpp - closed-loop wheel speed in fixed point
+//
+// Open-loop PWM gives a speed that depends on the battery, the load and the
+// floor. With a wheel encoder the motion tick closes the loop instead:
+//
+//   SpeedEstimator  encoder count -> wheel speed, the count difference over
+//                   the last SPEED_WINDOW_TICKS ticks scaled to mm/s
+//   SpeedController PID from the speed error to a drive level, with
+//                   feedforward from the target, anti-windup and the
+//                   derivative taken on the measurement
+//   SpeedLoop       both of them behind a RampAxis that limits the target's
+//                   acceleration and jerk, the way DRIVE_LIMITS does for PWM
+//
+// Everything runs once per motion tick (MOTION_TICK_HZ) and costs the same
+// every time: integer multiplies and shifts, no division and no floats. Gains
+// are Q16.16; the integral and derivative gains are per tick, so they are
+// tied to MOTION_TICK_HZ.
+//
+// The classes know nothing about the hardware. Actuation feeds them the
+// encoder count and writes their output to the motor; tools/picow_speed runs
+// the same code against a motor model on the host.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "motion_profile.hpp"
+
+// speed from the count difference over this many ticks (a power of two)
+constexpr size_t SPEED_WINDOW_TICKS = 16;
+static_assert((SPEED_WINDOW_TICKS & (SPEED_WINDOW_TICKS - 1)) == 0, "SPEED_WINDOW_TICKS must be a power of two");
+
+// with a zero target and the wheel slower than this, brake instead of regulating
+constexpr int32_t SPEED_STOP_MM_S = 30;
+
+constexpr int32_t speed_q16(double v)
+{
+    return static_cast<int32_t>(v * 65536.0 + (v < 0 ? -0.5 : 0.5));
+}
+
+// Q16.16, drive levels per mm/s
+struct SpeedGains
+{
+    int32_t kff; // of the target
+    int32_t kp;  // of the error
+    int32_t ki;  // of the error, summed every tick
+    int32_t kd;  // of the change of the measured speed from one tick to the next
+};
+
+class SpeedEstimator
+{
+public:
+    SpeedEstimator(uint32_t counts_per_rev, uint32_t circumference_um)
+        : scale_(static_cast<int32_t>((static_cast<uint64_t>(circumference_um) * MOTION_TICK_HZ << 16) /
+                                      (1000ull * counts_per_rev * SPEED_WINDOW_TICKS))),
+          next_(0), primed_(false), speed_(0)
+    {
+    }
+
+    // Once per tick with the encoder count. Returns the speed in mm/s.
+    int32_t update(uint32_t count)
+    {
+        if (!primed_)
+        {
+            for (uint32_t &c : history_)
+            {
+                c = count;
+            }
+            primed_ = true;
+        }
+        // the counter wraps, the difference over a window does not
+        const int32_t delta = static_cast<int32_t>(count - history_[next_]);
+        history_[next_] = count;
+        next_ = (next_ + 1) & (SPEED_WINDOW_TICKS - 1);
+        speed_ = static_cast<int32_t>((static_cast<int64_t>(delta) * scale_ + (1 << 15)) >> 16);
+        return speed_;
+    }
+
+    int32_t speed() const { return speed_; }
+
+private:
+    int32_t scale_; // Q16.16 mm/s per count of difference over the window
+    uint32_t history_[SPEED_WINDOW_TICKS];
+    size_t next_; // oldest count, overwritten next
+    bool primed_;
+    int32_t speed_;
+};
+
+class SpeedController
+{
+public:
+    SpeedController(const SpeedGains &gains, int32_t output_max)
+        : gains_(gains), max_(output_max << 16), integral_(0), last_measured_(0)
+    {
+    }
+
+    // Start from output with the wheel at measured and on target, so taking
+    // over from open-loop PWM does not step the motor.
+    void reset(int32_t output, int32_t measured)
+    {
+        integral_ = clamp((output << 16) - gains_.kff * measured, -max_, max_);
+        last_measured_ = measured;
+    }
+
+    // One tick: the drive level for target with the wheel at measured.
+    int32_t update(int32_t target, int32_t measured)
+    {
+        const int32_t error = target - measured;
+        const int32_t fixed = gains_.kff * target + gains_.kp * error - gains_.kd * (measured - last_measured_);
+        last_measured_ = measured;
+
+        const int32_t integral = clamp(integral_ + gains_.ki * error, -max_, max_);
+        const int32_t out = fixed + integral;
+        // anti-windup: while the output is saturated, only let the integral
+        // move back towards the range
+        if (!((out > max_ && error > 0) || (out < -max_ && error < 0)))
+        {
+            integral_ = integral;
+        }
+        return (clamp(fixed + integral_, -max_, max_) + (1 << 15)) >> 16;
+    }
+
+    // The drive level with feedforward only, for running without a sensor.
+    int32_t feedforward(int32_t target) const
+    {
+        return (clamp(gains_.kff * target, -max_, max_) + (1 << 15)) >> 16;
+    }
+
+private:
+    static constexpr int32_t clamp(int32_t v, int32_t lo, int32_t hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+    SpeedGains gains_;
+    int32_t max_;      // Q16.16 output limit
+    int32_t integral_; // Q16.16 drive levels
+    int32_t last_measured_;
+};
+
+class SpeedLoop
+{
+public:
+    SpeedLoop(const MotionLimits &limits, const SpeedGains &gains, int32_t output_max, uint32_t counts_per_rev,
+              uint32_t circumference_um)
+        : target_(0, limits), estimator_(counts_per_rev, circumference_um), controller_(gains, output_max), ramped_(0)
+    {
+    }
+
+    // Every tick, whether the loop drives the motor or not, so the speed is
+    // current when it takes over.
+    int32_t measure(uint32_t count) { return estimator_.update(count); }
+
+    // Take over from open-loop PWM at drive: the target ramps from the
+    // measured speed and the controller starts from drive. Only with the tick
+    // masked.
+    void engage(int32_t drive)
+    {
+        const int32_t speed = estimator_.speed();
+        target_.restart_at(speed);
+        controller_.reset(drive, speed);
+        ramped_ = speed;
+    }
+
+    // Ramp towards mm_s from the next tick on.
+    void set_target(int32_t mm_s) { target_.set_target(mm_s); }
+
+    // One tick: step the ramp and return the drive level. Without feedback
+    // the output is the feedforward alone.
+    int32_t step(bool feedback)
+    {
+        ramped_ = target_.step();
+        if (!feedback)
+        {
+            return controller_.feedforward(ramped_);
+        }
+        const int32_t speed = estimator_.speed();
+        if (ramped_ == 0 && speed > -SPEED_STOP_MM_S && speed < SPEED_STOP_MM_S)
+        {
+            // stopped: brake rather than hold zero with a humming motor
+            controller_.reset(0, speed);
+            return 0;
+        }
+        return controller_.update(ramped_, speed);
+    }
+
+    // mm/s
+    int32_t speed() const { return estimator_.speed(); }
+    int32_t target() const { return ramped_; }
+
+private:
+    RampAxis target_;
+    SpeedEstimator estimator_;
+    SpeedController controller_;
+    int32_t ramped_; // the target as of the last step
+};
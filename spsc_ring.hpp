@@ -0,0 +1,68 @@
+#pragma once
+// spsc_ring.hpp - lock-free single producer / single consumer queue
+//
+// For streams where every element matters to the consumer but the producer
+// must never wait: push() fails (and counts the drop) when the queue is full.
+// One core pushes, the other pops.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    // Producer side. Returns false and counts a drop if the ring is full.
+    bool push(const T &value)
+    {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == N)
+        {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        items_[head & (N - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T &out)
+    {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        out = items_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: the element pop() would return, left in place.
+    bool peek(T &out) const
+    {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        out = items_[tail & (N - 1)];
+        return true;
+    }
+
+    size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+
+    // Elements rejected by push() so far.
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    std::array<T, N> items_;
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> dropped_{0};
+};
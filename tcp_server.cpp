@@ -1,27 +1,45 @@
 // tcp_server.cpp
 #include "tcp_server.hpp"
+#include "profiling.hpp"
+#include "mem_stats.hpp"
+#include "deferred_log.hpp"
 #include <cstdio>
-#include <cstdlib>
 #include <cstring>
+#include <initializer_list>
 
 using namespace pico_tcp;
 
-#define DEBUG_printf printf
+// most of these run in lwIP callbacks, which must not wait for the console
+#define DEBUG_printf LOG_printf
 
 TcpServer::TcpServer(struct netif *netif)
     : server_pcb_(nullptr),
-      client_pcb_(nullptr),
+      http_pcb_(nullptr),
+      controller_(nullptr),
       complete_(false),
       last_status_(-1),
-      sent_len_(0),
-      recv_len_(0),
-      run_count_(0),
-      netif_(netif)
+      commands_received_(0),
+      commands_rejected_(0),
+      trajectory_batches_(0),
+      tx_backpressure_(0),
+      tx_dropped_(0),
+      http_requests_(0),
+      on_command_(nullptr),
+      on_command_arg_(nullptr),
+      on_trajectory_(nullptr),
+      on_trajectory_arg_(nullptr),
+      journal_(nullptr),
+      counts_(nullptr),
+      power_(nullptr),
+      netif_(netif),
+      bench_()
 {
-    // buffers zero-initialised by default constructor of std::array? no guarantee for POD, but
-    // we'll explicitly clear recv buffer for determinism:
-    buffer_sent_.fill(0);
-    buffer_recv_.fill(0);
+    for (size_t i = 0; i < MAX_CLIENTS; ++i)
+    {
+        clients_[i].server = this;
+        clients_[i].pcb = nullptr;
+        clients_[i].index = static_cast<uint8_t>(i);
+    }
 }
 
 TcpServer::~TcpServer()
@@ -39,126 +57,658 @@ bool TcpServer::start()
 
     if (netif_)
     {
-        DEBUG_printf("Starting server at %s on port %u\n", ip4addr_ntoa(netif_ip4_addr(netif_)), TCP_PORT);
+        // not deferred: the ip4addr_ntoa() buffer is reused
+        printf("Starting server at %s on port %u\n", ip4addr_ntoa(netif_ip4_addr(netif_)), TCP_PORT);
     }
     else
     {
         DEBUG_printf("Starting server on port %u\n", TCP_PORT);
     }
 
+    server_pcb_ = listen_on(TCP_PORT, &TcpServer::accept_cb);
+    if (!server_pcb_)
+    {
+        return false;
+    }
+
+    // the car drives without the page, so this one may fail
+    http_pcb_ = listen_on(HTTP_PORT, &TcpServer::http_accept_cb);
+    if (http_pcb_)
+    {
+        DEBUG_printf("Control page on port %u\n", HTTP_PORT);
+    }
+    return true;
+}
+
+struct tcp_pcb *TcpServer::listen_on(uint16_t port, tcp_accept_fn accept)
+{
     struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb)
     {
         DEBUG_printf("failed to create pcb\n");
-        return false;
+        return nullptr;
     }
 
-    err_t err = tcp_bind(pcb, NULL, TCP_PORT);
+    err_t err = tcp_bind(pcb, NULL, port);
     if (err)
     {
-        DEBUG_printf("failed to bind to port %u (err %d)\n", TCP_PORT, err);
+        DEBUG_printf("failed to bind to port %u (err %d)\n", port, err);
         tcp_close(pcb);
-        return false;
+        return nullptr;
     }
 
-    server_pcb_ = tcp_listen_with_backlog(pcb, 1);
-    if (!server_pcb_)
+    struct tcp_pcb *listen_pcb = tcp_listen_with_backlog(pcb, MAX_CLIENTS);
+    if (!listen_pcb)
     {
-        DEBUG_printf("failed to listen\n");
+        DEBUG_printf("failed to listen on port %u\n", port);
         tcp_close(pcb);
-        return false;
+        return nullptr;
     }
 
     // store pointer to this instance in tcp_arg
-    tcp_arg(server_pcb_, this);
-    tcp_accept(server_pcb_, &TcpServer::accept_cb);
-    return true;
+    tcp_arg(listen_pcb, this);
+    tcp_accept(listen_pcb, accept);
+    return listen_pcb;
 }
 
 err_t TcpServer::close()
 {
-    // close client first
+    // close clients first
     err_t err = ERR_OK;
-    if (client_pcb_)
-    {
-        tcp_arg(client_pcb_, nullptr);
-        tcp_poll(client_pcb_, nullptr, 0);
-        tcp_sent(client_pcb_, nullptr);
-        tcp_recv(client_pcb_, nullptr);
-        tcp_err(client_pcb_, nullptr);
-        err = tcp_close(client_pcb_);
-        if (err != ERR_OK)
+    for (Client &client : clients_)
+    {
+        if (client.pcb && close_client(client) != ERR_OK)
         {
-            DEBUG_printf("close failed %d, aborting client\n", err);
-            tcp_abort(client_pcb_);
             err = ERR_ABRT;
         }
-        client_pcb_ = nullptr;
     }
-    if (server_pcb_)
+    for (struct tcp_pcb **listener : {&server_pcb_, &http_pcb_})
     {
-        tcp_arg(server_pcb_, nullptr);
-        tcp_close(server_pcb_);
-        server_pcb_ = nullptr;
+        if (*listener)
+        {
+            tcp_arg(*listener, nullptr);
+            tcp_close(*listener);
+            *listener = nullptr;
+        }
     }
     return err;
 }
 
+size_t TcpServer::client_count() const
+{
+    size_t n = 0;
+    for (const Client &client : clients_)
+    {
+        if (client.pcb)
+        {
+            ++n;
+        }
+    }
+    return n;
+}
+
+size_t TcpServer::broadcast(uint8_t type, const void *payload, uint16_t len)
+{
+    return send_to_all(0, type, payload, len, nullptr);
+}
+
+size_t TcpServer::publish(Subscription topic, uint8_t type, const void *payload, uint16_t len, uint32_t &dropped)
+{
+    return send_to_all(topic, type, payload, len, &dropped);
+}
+
+// Send to every client, or to the subscribers of topic if it is non-zero.
+size_t TcpServer::send_to_all(uint8_t topic, uint8_t type, const void *payload, uint16_t len, uint32_t *dropped)
+{
+    size_t sent = 0;
+    for (Client &client : clients_)
+    {
+        if (!client.pcb || client.mode == ClientMode::Http || (topic && !(client.subscriptions & topic)))
+        {
+            continue;
+        }
+        uint8_t *dst = begin_frame(client, type, len);
+        if (dst)
+        {
+            memcpy(dst, payload, len);
+            if (send_frame(client) == ERR_OK)
+            {
+                ++sent;
+                continue;
+            }
+        }
+        if (dropped)
+        {
+            ++*dropped;
+        }
+    }
+    return sent;
+}
+
 void TcpServer::result_and_close(int status)
 {
     last_status_ = status;
     if (status == 0)
     {
-        DEBUG_printf("test success\n");
+        DEBUG_printf("server stopped\n");
     }
     else
     {
-        DEBUG_printf("test failed %d\n", status);
+        DEBUG_printf("server failed %d\n", status);
     }
     complete_ = true;
     close();
 }
 
-err_t TcpServer::send_data(struct tcp_pcb *tpcb)
+TcpServer::Client *TcpServer::acquire()
 {
-    // fill buffer with random bytes
-    for (size_t i = 0; i < BUF_SIZE; ++i)
+    for (Client &client : clients_)
     {
-        buffer_sent_[i] = static_cast<uint8_t>(rand() & 0xFF);
+        if (!client.pcb)
+        {
+            return &client;
+        }
     }
-    sent_len_ = 0;
-    DEBUG_printf("Writing %zu bytes to client\n", BUF_SIZE);
+    return nullptr;
+}
 
-    err_t err = tcp_write(tpcb, buffer_sent_.data(), static_cast<u16_t>(BUF_SIZE), TCP_WRITE_FLAG_COPY);
+// Return a slot to the pool. The pcb must already be closed or freed.
+void TcpServer::release(Client &client)
+{
+    client.pcb = nullptr;
+    client.decoder.reset();
+    client.tx.reset();
+    if (bench_.client == &client)
+    {
+        bench_.client = nullptr;
+    }
+    if (controller_ != &client)
+    {
+        return;
+    }
+    controller_ = nullptr;
+    for (Client &other : clients_)
+    {
+        if (other.pcb && other.mode != ClientMode::Http)
+        {
+            other.role = ClientRole::Controller;
+            controller_ = &other;
+            DEBUG_printf("client %u promoted to controller\n", other.index);
+            send_hello(other);
+            break;
+        }
+    }
+}
+
+err_t TcpServer::close_client(Client &client)
+{
+    struct tcp_pcb *pcb = client.pcb;
+    if (!pcb)
+    {
+        return ERR_OK;
+    }
+    // a closing pcb keeps sending queued data, which would still point into
+    // this slot's TX ring after the slot is reused; drop it instead
+    const bool unacked = client.tx.in_flight() > 0;
+    release(client);
+    tcp_arg(pcb, nullptr);
+    tcp_poll(pcb, nullptr, 0);
+    tcp_sent(pcb, nullptr);
+    tcp_recv(pcb, nullptr);
+    tcp_err(pcb, nullptr);
+    if (unacked)
+    {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    err_t err = tcp_close(pcb);
     if (err != ERR_OK)
     {
+        DEBUG_printf("close failed %d, aborting client\n", err);
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+// Reserve a frame with a len byte payload in the client's TX ring. Returns
+// the payload to fill in, or nullptr if the ring is full. The frame starts
+// WS_HEADER_MAX bytes into the slot; send_frame() puts a WebSocket header in
+// front of it if the client needs one.
+uint8_t *TcpServer::begin_frame(Client &client, uint8_t type, uint16_t len)
+{
+    if (len > FRAME_SLOT_PAYLOAD_MAX)
+    {
+        return nullptr;
+    }
+    uint8_t *slot = client.tx.acquire();
+    if (!slot)
+    {
+        tx_backpressure_++;
+        return nullptr;
+    }
+    uint8_t *frame = slot + WS_HEADER_MAX;
+    frame[0] = FRAME_MAGIC;
+    frame[1] = type;
+    write_u16(frame + 2, len);
+    return frame + FRAME_HEADER_SIZE;
+}
+
+// Queue the frame prepared by begin_frame().
+err_t TcpServer::send_frame(Client &client)
+{
+    uint8_t *frame = client.tx.acquire() + WS_HEADER_MAX;
+    size_t total = FRAME_HEADER_SIZE + read_u16(frame + 2);
+    if (client.mode == ClientMode::WebSocket)
+    {
+        // one binary message per frame
+        const size_t header = ws_header_size(total, false);
+        frame -= header;
+        encode_ws_header(WS_OP_BINARY, total, nullptr, frame);
+        total += header;
+    }
+    return write_slot(client, frame, static_cast<u16_t>(total));
+}
+
+// Hand len bytes of the slot returned by acquire() to lwIP and commit it.
+err_t TcpServer::write_slot(Client &client, const uint8_t *data, u16_t len)
+{
+    // no TCP_WRITE_FLAG_COPY: lwIP references the slot until it is acknowledged
+    err_t err = tcp_write(client.pcb, data, len, 0);
+    if (err != ERR_OK)
+    {
+        // slot stays free, the frame is lost
         DEBUG_printf("Failed to write data %d\n", err);
-        result_and_close(-1);
+        tx_dropped_++;
         return err;
     }
+    client.tx.commit(len);
+    tcp_output(client.pcb);
     return ERR_OK;
 }
 
-err_t TcpServer::close_client()
+void TcpServer::send_profile(Client &client, uint8_t stage)
+{
+    uint8_t *payload = begin_frame(client, FRAME_PROFILE_REPORT, PROFILE_REPORT_PAYLOAD_SIZE);
+    if (!payload)
+    {
+        return;
+    }
+    // an empty report tells the client there is nothing (more) to query
+    const size_t len = encode_profile_stage(stage, payload, PROFILE_REPORT_PAYLOAD_SIZE);
+    write_u16(payload - FRAME_HEADER_SIZE + 2, static_cast<uint16_t>(len));
+    send_frame(client);
+}
+
+void TcpServer::send_mem(Client &client, uint8_t row)
+{
+    uint8_t *payload = begin_frame(client, FRAME_MEM_REPORT, MEM_REPORT_HEADER_SIZE + MEM_REPORT_NAME_MAX);
+    if (!payload)
+    {
+        return;
+    }
+    // an empty report ends the table
+    const size_t len = encode_mem_row(row, payload, MEM_REPORT_HEADER_SIZE + MEM_REPORT_NAME_MAX);
+    write_u16(payload - FRAME_HEADER_SIZE + 2, static_cast<uint16_t>(len));
+    send_frame(client);
+}
+
+void TcpServer::send_power(Client &client)
+{
+    uint8_t report[POWER_REPORT_PAYLOAD_MAX];
+    const size_t len = power_ ? power_->encode_report(to_ms_since_boot(get_absolute_time()), report) : 0;
+    uint8_t *payload = begin_frame(client, FRAME_POWER_REPORT, static_cast<uint16_t>(len));
+    if (!payload)
+    {
+        return;
+    }
+    memcpy(payload, report, len);
+    send_frame(client);
+}
+
+void TcpServer::send_time_reply(Client &client, const uint8_t *request)
+{
+    uint8_t *payload = begin_frame(client, FRAME_TIME_REPLY, TIME_REPLY_PAYLOAD_SIZE);
+    if (!payload)
+    {
+        return;
+    }
+    memcpy(payload, request, TIME_SYNC_PAYLOAD_SIZE);
+    write_u32(payload + 8, client.rx_us);
+    write_u32(payload + 12, time_us_32());
+    send_frame(client);
+}
+
+void TcpServer::control(Client &client, const ControlCommand &cmd)
+{
+    if (client.role != ClientRole::Controller)
+    {
+        commands_rejected_++;
+        return;
+    }
+    commands_received_++;
+    // held back until recv_cb has decoded the whole burst, unless it is a brake
+    if (coalescer_.offer(cmd) == CoalesceVerdict::Urgent)
+    {
+        apply(client, cmd);
+    }
+}
+
+void TcpServer::apply(Client &client, const ControlCommand &cmd)
+{
+    if (on_command_)
+    {
+        on_command_(on_command_arg_, client.index, cmd, client.rx_us);
+    }
+}
+
+// FRAME_JOURNAL_DATA or FRAME_COUNT_DATA: as many entries from index from on
+// as fit a slot
+template <size_t EntrySize, typename Entry, size_t Words, size_t N>
+void TcpServer::send_journal(Client &client, uint8_t type, const JournalRing<Entry, Words, N> *journal, uint32_t from,
+                             void (*encode)(const Entry &, uint8_t *))
+{
+    constexpr size_t MAX_ENTRIES = (FRAME_SLOT_PAYLOAD_MAX - JOURNAL_DATA_HEADER_SIZE) / EntrySize;
+    Entry entries[MAX_ENTRIES];
+    uint32_t first = from;
+    uint32_t recorded = 0;
+    size_t count = 0;
+    if (journal)
+    {
+        count = journal->read(from, entries, MAX_ENTRIES, first);
+        recorded = journal->recorded();
+    }
+
+    const uint16_t len = static_cast<uint16_t>(JOURNAL_DATA_HEADER_SIZE + count * EntrySize);
+    uint8_t *payload = begin_frame(client, type, len);
+    if (!payload)
+    {
+        return;
+    }
+    write_u32(payload, first);
+    write_u32(payload + 4, recorded);
+    payload[8] = static_cast<uint8_t>(count);
+    payload[9] = EntrySize;
+    for (size_t i = 0; i < count; ++i)
+    {
+        encode(entries[i], payload + JOURNAL_DATA_HEADER_SIZE + i * EntrySize);
+    }
+    send_frame(client);
+}
+
+void TcpServer::send_hello(Client &client)
 {
-    if (client_pcb_)
+    uint8_t *payload = begin_frame(client, FRAME_HELLO, HELLO_PAYLOAD_SIZE);
+    if (!payload)
     {
-        tcp_arg(client_pcb_, nullptr);
-        tcp_poll(client_pcb_, nullptr, 0);
-        tcp_sent(client_pcb_, nullptr);
-        tcp_recv(client_pcb_, nullptr);
-        tcp_err(client_pcb_, nullptr);
-        err_t err = tcp_close(client_pcb_);
-        if (err != ERR_OK)
+        return;
+    }
+    payload[0] = PROTOCOL_VERSION;
+    payload[1] = client.index;
+    payload[2] = static_cast<uint8_t>(client.role);
+    payload[3] = static_cast<uint8_t>(MAX_CLIENTS);
+    send_frame(client);
+}
+
+// Bytes from a connection to HTTP_PORT: the request head, then WebSocket
+// frames if it upgraded. Returns false if the connection has to be closed.
+bool TcpServer::receive_web(Client &client, uint8_t *data, size_t len)
+{
+    if (client.mode == ClientMode::Http)
+    {
+        if (client.http.complete())
         {
-            tcp_abort(client_pcb_);
-            client_pcb_ = nullptr;
-            return ERR_ABRT;
+            return true; // answered and closing, anything else is ignored
+        }
+        const size_t used = client.http.feed(data, len);
+        if (!client.http.complete())
+        {
+            return true;
+        }
+        if (!http_request(client))
+        {
+            return false;
+        }
+        data += used;
+        len -= used;
+        if (client.mode != ClientMode::WebSocket)
+        {
+            return true;
         }
-        client_pcb_ = nullptr;
-        return ERR_OK;
     }
-    return ERR_OK;
+    if (!client.ws.feed(data, len, &TcpServer::ws_cb, &client))
+    {
+        DEBUG_printf("client %u: bad WebSocket frame\n", client.index);
+        return false;
+    }
+    return true;
+}
+
+// Answer the request head in client.http. Nothing was sent on this
+// connection yet, so the TX ring is empty.
+bool TcpServer::http_request(Client &client)
+{
+    http_requests_++;
+    const HttpRequestParser &req = client.http;
+    char *out = reinterpret_cast<char *>(client.tx.acquire());
+    int n;
+    const bool ws_request = req.is_get() && req.wants_websocket() && strcmp(req.path(), WS_PATH) == 0;
+    // another site's page must not steer the car through the visitor's browser
+    const bool forbidden = ws_request && !req.same_origin();
+    if (ws_request && !forbidden)
+    {
+        char accept[WS_ACCEPT_SIZE + 1];
+        ws_accept_key(req.ws_key(), req.ws_key_len(), accept);
+        accept[WS_ACCEPT_SIZE] = '\0';
+        n = snprintf(out, TX_SLOT_SIZE,
+                     "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %s\r\n\r\n",
+                     accept);
+        if (write_slot(client, reinterpret_cast<uint8_t *>(out), static_cast<u16_t>(n)) != ERR_OK)
+        {
+            return false;
+        }
+        client.mode = ClientMode::WebSocket;
+        assign_role(client);
+        DEBUG_printf("Client %u upgraded to WebSocket as %s\n", client.index,
+                     client.role == ClientRole::Controller ? "controller" : "observer");
+        send_hello(client);
+        return true;
+    }
+
+    // the assets only exist gzipped; every browser accepts that
+    const WebAsset *asset = req.is_get() && !forbidden ? find_web_asset(req.path()) : nullptr;
+    if (asset)
+    {
+        n = snprintf(out, TX_SLOT_SIZE,
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Encoding: gzip\r\n"
+                     "Content-Length: %lu\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Connection: close\r\n\r\n",
+                     asset->content_type, (unsigned long)asset->size);
+    }
+    else
+    {
+        n = snprintf(out, TX_SLOT_SIZE, "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                     forbidden ? "403 Forbidden" : req.is_get() ? "404 Not Found" : "405 Method Not Allowed");
+    }
+    // the path is in the parser's buffer, gone by the time the log is printed
+    DEBUG_printf("client %u: %s %s\n", client.index, forbidden ? WS_PATH : asset ? asset->path : "-",
+                 asset ? "200" : forbidden ? "403" : req.is_get() ? "404" : "405");
+    if (write_slot(client, reinterpret_cast<uint8_t *>(out), static_cast<u16_t>(n)) != ERR_OK)
+    {
+        return false;
+    }
+    client.asset = asset;
+    client.asset_queued = 0;
+    client.close_when_sent = true;
+    http_pump(client);
+    return true;
+}
+
+// Queue as much of the response body as lwIP takes. Called again from
+// sent_cb() as the peer acknowledges.
+void TcpServer::http_pump(Client &client)
+{
+    const WebAsset *asset = client.asset;
+    bool queued = false;
+    while (asset && client.asset_queued < asset->size && !client.tx.full())
+    {
+        const size_t room = tcp_sndbuf(client.pcb);
+        if (room == 0)
+        {
+            break;
+        }
+        const size_t left = asset->size - client.asset_queued;
+        const u16_t n = static_cast<u16_t>(left < room ? left : room);
+        // no TCP_WRITE_FLAG_COPY: lwIP points its pbufs straight at the flash
+        if (tcp_write(client.pcb, asset->data + client.asset_queued, n, 0) != ERR_OK)
+        {
+            break; // send queue full, retried on the next ACK
+        }
+        client.tx.commit_external(n);
+        client.asset_queued += n;
+        queued = true;
+    }
+    if (queued)
+    {
+        tcp_output(client.pcb);
+    }
+}
+
+// A ping answer or close reply; payload is at most 125 bytes.
+void TcpServer::send_ws_control(Client &client, uint8_t opcode, const uint8_t *payload, size_t len)
+{
+    uint8_t *slot = client.tx.acquire();
+    if (!slot)
+    {
+        tx_backpressure_++;
+        return;
+    }
+    const size_t header = encode_ws_header(opcode, len, nullptr, slot);
+    memcpy(slot + header, payload, len);
+    write_slot(client, slot, static_cast<u16_t>(header + len));
+}
+
+// Nothing left to send and everything acknowledged on a connection that
+// closes after its response.
+bool TcpServer::finished(const Client &client)
+{
+    return client.close_when_sent && client.tx.in_flight() == 0 &&
+           (!client.asset || client.asset_queued == client.asset->size);
+}
+
+void TcpServer::bench_start(Client &client, const uint8_t *payload, uint16_t len)
+{
+    if (len < BENCH_START_PAYLOAD_SIZE)
+    {
+        return;
+    }
+    uint16_t size = read_u16(payload);
+    uint16_t iterations = read_u16(payload + 2);
+    uint8_t depth = payload[4];
+    if (size < BENCH_PROBE_MIN)
+        size = BENCH_PROBE_MIN;
+    if (size > BENCH_PROBE_MAX)
+        size = BENCH_PROBE_MAX;
+    if (iterations == 0)
+        iterations = 1;
+    if (depth == 0)
+        depth = 1;
+    if (depth > BENCH_MAX_DEPTH)
+        depth = BENCH_MAX_DEPTH;
+
+    // a new start replaces whatever benchmark was running
+    const uint16_t session = static_cast<uint16_t>(bench_.session + 1);
+    bench_ = BenchState();
+    bench_.client = &client;
+    bench_.session = session;
+    bench_.size = size;
+    bench_.iterations = iterations;
+    bench_.depth = depth;
+    bench_.start = get_absolute_time();
+    DEBUG_printf("benchmark %u: %u x %u bytes, depth %u\n", session, iterations, size, depth);
+    bench_pump();
+}
+
+void TcpServer::bench_echo(Client &client, const uint8_t *payload, uint16_t len)
+{
+    if (bench_.client != &client || len < BENCH_PROBE_MIN || read_u16(payload) != bench_.session)
+    {
+        return;
+    }
+    bench_.rtt.add(time_us_32() - read_u32(payload + 4));
+    bench_.received++;
+    if (bench_.received == bench_.iterations)
+    {
+        bench_.end = get_absolute_time();
+        bench_.report_pending = true;
+    }
+    bench_pump();
+}
+
+// Keep up to depth probes in flight and send the report once all came back.
+// Called whenever a probe returns or TX slots free up.
+void TcpServer::bench_pump()
+{
+    Client *client = bench_.client;
+    if (!client)
+    {
+        return;
+    }
+
+    while (bench_.sent < bench_.iterations && bench_.sent - bench_.received < bench_.depth)
+    {
+        uint8_t *probe = begin_frame(*client, FRAME_BENCH_PROBE, bench_.size);
+        if (!probe)
+        {
+            return; // TX ring full, sent_cb calls back in
+        }
+        write_u16(probe, bench_.session);
+        write_u16(probe + 2, bench_.sent);
+        write_u32(probe + 4, time_us_32());
+        memset(probe + BENCH_PROBE_MIN, static_cast<uint8_t>(bench_.sent), bench_.size - BENCH_PROBE_MIN);
+        if (send_frame(*client) != ERR_OK)
+        {
+            return;
+        }
+        bench_.sent++;
+    }
+
+    if (!bench_.report_pending)
+    {
+        return;
+    }
+    uint8_t *report = begin_frame(*client, FRAME_BENCH_REPORT, BENCH_REPORT_PAYLOAD_SIZE);
+    if (!report)
+    {
+        return;
+    }
+    const uint32_t elapsed = static_cast<uint32_t>(absolute_time_diff_us(bench_.start, bench_.end));
+    const uint32_t bytes = 2u * bench_.received * (FRAME_HEADER_SIZE + bench_.size);
+    const uint32_t rate = elapsed ? static_cast<uint32_t>(uint64_t(bytes) * 1000000u / elapsed) : 0;
+    const LogHistogram<2> &rtt = bench_.rtt;
+    write_u16(report, bench_.received);
+    write_u16(report + 2, bench_.size);
+    write_u32(report + 4, elapsed);
+    write_u32(report + 8, bytes);
+    write_u32(report + 12, rate);
+    write_u32(report + 16, rtt.min());
+    write_u32(report + 20, rtt.percentile(50));
+    write_u32(report + 24, rtt.percentile(90));
+    write_u32(report + 28, rtt.percentile(99));
+    write_u32(report + 32, rtt.max());
+    if (send_frame(*client) == ERR_OK)
+    {
+        DEBUG_printf("benchmark %u done: %lu B/s, rtt p50 %luus p99 %luus\n", bench_.session, (unsigned long)rate,
+                     (unsigned long)rtt.percentile(50), (unsigned long)rtt.percentile(99));
+        bench_.report_pending = false;
+        bench_.client = nullptr;
+    }
 }
 
 /* -----------------------
@@ -167,106 +717,312 @@ err_t TcpServer::close_client()
 
 err_t TcpServer::accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
+    PROFILE_SCOPE(PROFILE_TCP_ACCEPT);
     TcpServer *self = static_cast<TcpServer *>(arg);
     if (!self)
         return ERR_ARG;
+    return self->accept(newpcb, err, ClientMode::Frames);
+}
 
+err_t TcpServer::http_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    PROFILE_SCOPE(PROFILE_TCP_ACCEPT);
+    TcpServer *self = static_cast<TcpServer *>(arg);
+    if (!self)
+        return ERR_ARG;
+    return self->accept(newpcb, err, ClientMode::Http);
+}
+
+err_t TcpServer::accept(struct tcp_pcb *newpcb, err_t err, ClientMode mode)
+{
     if (err != ERR_OK || newpcb == nullptr)
     {
         DEBUG_printf("Failure in accept\n");
-        self->result_and_close(err);
+        result_and_close(err);
         return ERR_VAL;
     }
 
-    DEBUG_printf("Client connected\n");
+    Client *client = acquire();
+    if (!client)
+    {
+        DEBUG_printf("Rejecting client, all %u slots in use\n", static_cast<unsigned>(MAX_CLIENTS));
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    client->pcb = newpcb;
+    client->mode = mode;
+    client->rx_since_poll = true;
+    client->close_when_sent = false;
+    client->subscriptions = 0;
+    client->rx_us = 0;
+    client->decoder.reset();
+    client->http.reset();
+    client->asset = nullptr;
+    client->asset_queued = 0;
+    client->ws.reset();
 
-    self->client_pcb_ = newpcb;
-    tcp_arg(newpcb, self);
+    tcp_arg(newpcb, client);
     tcp_sent(newpcb, &TcpServer::sent_cb);
     tcp_recv(newpcb, &TcpServer::recv_cb);
     tcp_poll(newpcb, &TcpServer::poll_cb, POLL_TIME_S * 2);
     tcp_err(newpcb, &TcpServer::err_cb);
+    tcp_nagle_disable(newpcb);
 
-    return self->send_data(self->client_pcb_);
+    if (mode == ClientMode::Http)
+    {
+        // a page request never controls; a WebSocket gets its role on upgrade
+        client->role = ClientRole::Observer;
+        return ERR_OK;
+    }
+    assign_role(*client);
+    DEBUG_printf("Client %u connected as %s\n", client->index,
+                 client->role == ClientRole::Controller ? "controller" : "observer");
+    send_hello(*client);
+    return ERR_OK;
 }
 
-err_t TcpServer::sent_cb(void *arg, struct tcp_pcb *tpcb, u16_t len)
+bool TcpServer::controller_address(ip_addr_t &out) const
 {
-    TcpServer *self = static_cast<TcpServer *>(arg);
-    if (!self)
+    if (!controller_ || !controller_->pcb)
+    {
+        return false;
+    }
+    out = controller_->pcb->remote_ip;
+    return true;
+}
+
+void TcpServer::assign_role(Client &client)
+{
+    if (controller_)
+    {
+        client.role = ClientRole::Observer;
+    }
+    else
+    {
+        client.role = ClientRole::Controller;
+        controller_ = &client;
+    }
+}
+
+err_t TcpServer::sent_cb(void *arg, struct tcp_pcb * /*tpcb*/, u16_t len)
+{
+    PROFILE_SCOPE(PROFILE_TCP_SENT);
+    Client *client = static_cast<Client *>(arg);
+    if (!client)
         return ERR_ARG;
     DEBUG_printf("tcp_server_sent %u\n", len);
-    self->sent_len_ += len;
-    if (self->sent_len_ >= static_cast<int>(BUF_SIZE))
+    TcpServer *self = client->server;
+    client->tx.on_sent(len);
+    if (client->asset)
+    {
+        self->http_pump(*client);
+    }
+    if (finished(*client))
+    {
+        return self->close_client(*client);
+    }
+    if (self->bench_.client == client)
     {
-        // expect reply
-        self->recv_len_ = 0;
-        DEBUG_printf("Waiting for buffer from client\n");
+        self->bench_pump();
     }
     return ERR_OK;
 }
 
-err_t TcpServer::recv_cb(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+err_t TcpServer::recv_cb(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t /*err*/)
 {
-    TcpServer *self = static_cast<TcpServer *>(arg);
-    if (!self)
+    PROFILE_SCOPE(PROFILE_TCP_RECV);
+    Client *client = static_cast<Client *>(arg);
+    if (!client)
         return ERR_ARG;
 
     if (!p)
     {
-        self->result_and_close(-1);
-        return ERR_OK;
+        // remote closed the connection, free the slot
+        DEBUG_printf("Client %u disconnected\n", client->index);
+        return client->server->close_client(*client);
     }
 
+    bool keep = true;
     if (p->tot_len > 0)
     {
-        DEBUG_printf("tcp_server_recv %u/%d err %d\n", static_cast<unsigned>(p->tot_len), self->recv_len_, err);
-        const uint16_t buffer_left = static_cast<uint16_t>(BUF_SIZE - self->recv_len_);
-        uint16_t to_copy = p->tot_len > buffer_left ? buffer_left : p->tot_len;
-        self->recv_len_ += pbuf_copy_partial(p, self->buffer_recv_.data() + self->recv_len_, to_copy, 0);
+        client->rx_since_poll = true;
+        client->rx_us = time_us_32();
+        client->server->coalescer_.begin();
+        if (client->mode == ClientMode::Frames)
+        {
+            client->decoder.feed(p, &TcpServer::frame_cb, client);
+        }
+        else
+        {
+            // WebSocket payloads are unmasked in place, segment by segment
+            for (struct pbuf *q = p; q && keep; q = q->next)
+            {
+                keep = client->server->receive_web(*client, static_cast<uint8_t *>(q->payload), q->len);
+            }
+        }
+        // only the newest command of everything that just arrived
+        ControlCommand cmd;
+        if (client->server->coalescer_.take(cmd))
+        {
+            client->server->apply(*client, cmd);
+        }
         tcp_recved(tpcb, p->tot_len);
     }
     pbuf_free(p);
+    if (!keep || finished(*client))
+    {
+        return client->server->close_client(*client);
+    }
+    return ERR_OK;
+}
+
+void TcpServer::ws_cb(void *arg, uint8_t opcode, uint8_t *data, size_t len)
+{
+    Client *client = static_cast<Client *>(arg);
+    if (client->close_when_sent)
+    {
+        return; // the close handshake has started
+    }
+    switch (opcode)
+    {
+    case WS_OP_BINARY:
+        client->decoder.feed(data, len, &TcpServer::frame_cb, client);
+        break;
+    case WS_OP_PING:
+        client->server->send_ws_control(*client, WS_OP_PONG, data, len);
+        break;
+    case WS_OP_CLOSE:
+        // echo the status code and close once the reply is acknowledged
+        client->server->send_ws_control(*client, WS_OP_CLOSE, data, len < 2 ? len : 2);
+        client->close_when_sent = true;
+        break;
+    default:
+        break; // text and pong carry nothing for us
+    }
+}
 
-    if (self->recv_len_ == static_cast<int>(BUF_SIZE))
+void TcpServer::frame_cb(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+{
+    Client *client = static_cast<Client *>(arg);
+    TcpServer *self = client->server;
+    switch (type)
     {
-        if (memcmp(self->buffer_sent_.data(), self->buffer_recv_.data(), BUF_SIZE) != 0)
+    case FRAME_CONTROL:
+    {
+        ControlCommand cmd;
+        if (!decode_control(payload, len, cmd))
+        {
+            DEBUG_printf("short control frame %u\n", len);
+            return;
+        }
+        self->control(*client, cmd);
+        break;
+    }
+    case FRAME_TRAJECTORY:
+    {
+        TrajectoryBatch batch;
+        if (!decode_trajectory(payload, len, batch))
         {
-            DEBUG_printf("buffer mismatch\n");
-            self->result_and_close(-1);
-            return ERR_OK;
+            DEBUG_printf("malformed trajectory frame %u\n", len);
+            return;
         }
-        DEBUG_printf("tcp_server_recv buffer ok\n");
-        self->run_count_++;
-        if (self->run_count_ >= TEST_ITERATIONS)
+        if (client->role != ClientRole::Controller)
         {
-            self->result_and_close(0);
-            return ERR_OK;
+            self->commands_rejected_++;
+            return;
         }
-        return self->send_data(self->client_pcb_);
+        self->trajectory_batches_++;
+        if (self->on_trajectory_)
+        {
+            self->on_trajectory_(self->on_trajectory_arg_, client->index, batch);
+        }
+        break;
+    }
+    case FRAME_SUBSCRIBE:
+        if (len >= 1)
+        {
+            client->subscriptions = payload[0];
+        }
+        break;
+    case FRAME_BENCH_START:
+        self->bench_start(*client, payload, len);
+        break;
+    case FRAME_BENCH_ECHO:
+        self->bench_echo(*client, payload, len);
+        break;
+    case FRAME_JOURNAL_QUERY:
+        if (len >= 4)
+        {
+            self->send_journal<JOURNAL_ENTRY_SIZE>(*client, FRAME_JOURNAL_DATA, self->journal_, read_u32(payload),
+                                                   &encode_journal_entry);
+        }
+        break;
+    case FRAME_COUNT_QUERY:
+        if (len >= 4)
+        {
+            self->send_journal<COUNT_BLOCK_SIZE>(*client, FRAME_COUNT_DATA, self->counts_, read_u32(payload),
+                                                 &encode_count_block);
+        }
+        break;
+    case FRAME_PROFILE_QUERY:
+        if (len >= 1)
+        {
+            self->send_profile(*client, payload[0]);
+        }
+        break;
+    case FRAME_MEM_QUERY:
+        if (len >= 1)
+        {
+            self->send_mem(*client, payload[0]);
+        }
+        break;
+    case FRAME_POWER_QUERY:
+        self->send_power(*client);
+        break;
+    case FRAME_TIME_SYNC:
+        if (len >= TIME_SYNC_PAYLOAD_SIZE)
+        {
+            self->send_time_reply(*client, payload);
+        }
+        break;
+    default:
+        DEBUG_printf("unknown frame type %u\n", type);
+        break;
     }
-    return ERR_OK;
 }
 
 err_t TcpServer::poll_cb(void *arg, struct tcp_pcb * /*tpcb*/)
 {
-    TcpServer *self = static_cast<TcpServer *>(arg);
-    if (!self)
+    Client *client = static_cast<Client *>(arg);
+    if (!client)
         return ERR_ARG;
     DEBUG_printf("tcp_server_poll_fn\n");
-    // no response considered error in original example
-    self->result_and_close(-1);
+    // a silent controller blocks everyone else, drop it so control moves on;
+    // observers are read-only and may stay quiet
+    if (client->role == ClientRole::Controller && !client->rx_since_poll)
+    {
+        DEBUG_printf("controller idle, closing\n");
+        return client->server->close_client(*client);
+    }
+    // browsers open spare connections they may never send a request on
+    if (client->mode == ClientMode::Http && !client->http.complete() && !client->rx_since_poll)
+    {
+        return client->server->close_client(*client);
+    }
+    client->rx_since_poll = false;
     return ERR_OK;
 }
 
 void TcpServer::err_cb(void *arg, err_t err)
 {
-    TcpServer *self = static_cast<TcpServer *>(arg);
-    if (!self)
+    Client *client = static_cast<Client *>(arg);
+    if (!client)
         return;
+    // lwIP already freed the pcb
+    client->server->release(*client);
     if (err != ERR_ABRT)
     {
         DEBUG_printf("tcp_client_err_fn %d\n", err);
-        self->result_and_close(err);
     }
 }
@@ -6,6 +6,15 @@
 #include <array>
 #include <cstdbool>
 
+#include "command_coalescer.hpp"
+#include "control_protocol.hpp"
+#include "tx_ring.hpp"
+#include "histogram.hpp"
+#include "journal.hpp"
+#include "power_policy.hpp"
+#include "web_assets.hpp"
+#include "websocket.hpp"
+
 extern "C"
 {
 #include "pico/stdlib.h"
@@ -18,9 +27,46 @@ namespace pico_tcp
 {
 
     constexpr uint16_t TCP_PORT = 4242;
-    constexpr size_t BUF_SIZE = 2048;
-    constexpr int TEST_ITERATIONS = 10;
+    // The control page, and the WebSocket at WS_PATH carrying the same frames.
+    constexpr uint16_t HTTP_PORT = 80;
+    constexpr char WS_PATH[] = "/ws";
     constexpr int POLL_TIME_S = 5;
+    // Concurrent connections. Client state lives in a fixed pool inside
+    // TcpServer, so accepting and closing never allocates.
+    constexpr size_t MAX_CLIENTS = 4;
+    // Largest frame payload that fits a TX slot. Every slot keeps room in
+    // front of the frame for a WebSocket header, so the same frame can go to
+    // either kind of client.
+    constexpr size_t FRAME_SLOT_PAYLOAD_MAX = TX_SLOT_SIZE - WS_HEADER_MAX - FRAME_HEADER_SIZE;
+    // A benchmark probe has to fit one TX slot.
+    constexpr size_t BENCH_PROBE_MAX = FRAME_SLOT_PAYLOAD_MAX;
+    static_assert(POWER_REPORT_PAYLOAD_MAX <= FRAME_SLOT_PAYLOAD_MAX, "a power report must fit one TX slot");
+
+    // The first client to connect controls the car; everyone else observes
+    // until the controller leaves and one of the observers is promoted.
+    enum class ClientRole : uint8_t
+    {
+        Controller,
+        Observer,
+    };
+
+    // What a connection speaks. Connections to TCP_PORT speak frames from the
+    // start; connections to HTTP_PORT get a page and are closed, or upgrade
+    // to a WebSocket and speak frames from then on.
+    enum class ClientMode : uint8_t
+    {
+        Frames,
+        Http,
+        WebSocket,
+    };
+
+    // Called from the lwIP context for every decoded control command. source
+    // is the TCP client slot or a COMMAND_SOURCE_* value; arrival_us is when
+    // the data carrying it reached the receive callback (time_us_32()).
+    using CommandHandler = void (*)(void *arg, uint8_t source, const ControlCommand &cmd, uint32_t arrival_us);
+
+    // Called from the lwIP context for every FRAME_TRAJECTORY from the controller.
+    using TrajectoryHandler = void (*)(void *arg, uint8_t source, const TrajectoryBatch &batch);
 
     class TcpServer
     {
@@ -33,13 +79,40 @@ namespace pico_tcp
         TcpServer(const TcpServer &) = delete;
         TcpServer &operator=(const TcpServer &) = delete;
 
-        // Start listening. Returns true on success.
+        // Start listening on TCP_PORT and HTTP_PORT. Returns true on success;
+        // the page being unavailable is not a failure.
         bool start();
 
         // Close server immediately.
         err_t close();
 
-        // Check if test completed (success or fail).
+        // Install the sink for decoded control commands.
+        void set_command_handler(CommandHandler handler, void *arg)
+        {
+            on_command_ = handler;
+            on_command_arg_ = arg;
+        }
+
+        // Install the sink for trajectory batches. Without one they are ignored.
+        void set_trajectory_handler(TrajectoryHandler handler, void *arg)
+        {
+            on_trajectory_ = handler;
+            on_trajectory_arg_ = arg;
+        }
+
+        // Serve FRAME_JOURNAL_QUERY and FRAME_COUNT_QUERY from these
+        // journals. Without them the replies are empty.
+        void set_journal(const CommandJournal *journal, const CountJournal *counts)
+        {
+            journal_ = journal;
+            counts_ = counts;
+        }
+
+        // Answer FRAME_POWER_QUERY from this policy. Without one the replies
+        // are empty.
+        void set_power_policy(const PowerPolicy *power) { power_ = power; }
+
+        // Check if the server stopped (fatal error).
         bool is_complete() const { return complete_; }
 
         // For the main loop (optional): returns true if server is valid/running.
@@ -48,26 +121,151 @@ namespace pico_tcp
         // Get last result (0 == success, nonzero == failure). Only valid after complete.
         int last_status() const { return last_status_; }
 
+        // Number of control commands decoded so far.
+        uint32_t commands_received() const { return commands_received_; }
+
+        // Trajectory batches from the controller so far.
+        uint32_t trajectory_batches() const { return trajectory_batches_; }
+
+        // Controller commands replaced by a newer one in the same receive
+        // burst, dropped as older than one already seen in it, and brakes
+        // applied ahead of their burst (command_coalescer.hpp).
+        uint32_t commands_coalesced() const { return coalescer_.coalesced(); }
+        uint32_t commands_stale() const { return coalescer_.stale(); }
+        uint32_t commands_urgent() const { return coalescer_.urgent(); }
+
+        // Control commands ignored because they came from an observer.
+        uint32_t commands_rejected() const { return commands_rejected_; }
+
+        // Currently connected clients.
+        size_t client_count() const;
+
+        bool has_controller() const { return controller_ != nullptr; }
+
+        // Address of the controller's host. Returns false when there is none.
+        bool controller_address(ip_addr_t &out) const;
+
+        // Send one frame to every connected client. The payload is copied into
+        // each client's TX ring and goes to lwIP from there without another
+        // copy. Returns the number of clients it was queued for; the others
+        // had a full ring (counted in tx_backpressure()) or a full send queue.
+        size_t broadcast(uint8_t type, const void *payload, uint16_t len);
+
+        // Like broadcast(), but only to clients subscribed to topic. Clients
+        // whose TX ring was full are added to dropped.
+        size_t publish(Subscription topic, uint8_t type, const void *payload, uint16_t len, uint32_t &dropped);
+
+        // Frames not sent because the client's TX ring was full.
+        uint32_t tx_backpressure() const { return tx_backpressure_; }
+
+        // Frames not sent because tcp_write() failed.
+        uint32_t tx_dropped() const { return tx_dropped_; }
+
+        // HTTP requests answered, WebSocket upgrades included.
+        uint32_t http_requests() const { return http_requests_; }
+
     private:
+        // Per-connection state, one slot of the pool. A slot is free when pcb is null.
+        struct Client
+        {
+            TcpServer *server;
+            struct tcp_pcb *pcb;
+            ClientRole role;
+            ClientMode mode;
+            bool rx_since_poll;
+            bool close_when_sent; // close once everything queued is acknowledged
+            uint8_t index;
+            uint8_t subscriptions; // Subscription bits
+            uint32_t rx_us;        // the data being decoded reached recv_cb
+            FrameDecoder decoder;
+            TxRing tx;
+            HttpRequestParser http;
+            const WebAsset *asset; // response body being sent
+            uint32_t asset_queued; // bytes of it handed to tcp_write()
+            WsDecoder ws;
+        };
+
+        // Benchmark mode: probes of a client-chosen size are sent to one client
+        // and echoed back; RTTs go into the histogram and are reported when
+        // all probes came back.
+        struct BenchState
+        {
+            Client *client; // null when no benchmark runs
+            uint16_t session;
+            uint16_t size;
+            uint16_t iterations;
+            uint16_t sent;
+            uint16_t received;
+            uint8_t depth;
+            bool report_pending;
+            absolute_time_t start;
+            absolute_time_t end;
+            LogHistogram<2> rtt;
+        };
+
         // Instance state (mirrors original struct)
         struct tcp_pcb *server_pcb_;
-        struct tcp_pcb *client_pcb_;
+        struct tcp_pcb *http_pcb_;
+        std::array<Client, MAX_CLIENTS> clients_;
+        Client *controller_;
         bool complete_;
         int last_status_;
-        std::array<uint8_t, BUF_SIZE> buffer_sent_;
-        std::array<uint8_t, BUF_SIZE> buffer_recv_;
-        int sent_len_;
-        int recv_len_;
-        int run_count_;
+        uint32_t commands_received_;
+        uint32_t commands_rejected_;
+        uint32_t trajectory_batches_;
+        uint32_t tx_backpressure_;
+        uint32_t tx_dropped_;
+        uint32_t http_requests_;
+        CommandHandler on_command_;
+        void *on_command_arg_;
+        CommandCoalescer coalescer_; // of the receive callback running
+        TrajectoryHandler on_trajectory_;
+        void *on_trajectory_arg_;
+        const CommandJournal *journal_;
+        const CountJournal *counts_;
+        const PowerPolicy *power_;
         struct netif *netif_; // optional pointer for logging ip
+        BenchState bench_;
 
         // Private helpers
+        struct tcp_pcb *listen_on(uint16_t port, tcp_accept_fn accept);
         void result_and_close(int status);
-        err_t send_data(struct tcp_pcb *tpcb);
-        err_t close_client();
+        err_t close_client(Client &client);
+        void release(Client &client);
+        Client *acquire();
+        err_t accept(struct tcp_pcb *newpcb, err_t err, ClientMode mode);
+        void assign_role(Client &client);
+        size_t send_to_all(uint8_t topic, uint8_t type, const void *payload, uint16_t len, uint32_t *dropped);
+        uint8_t *begin_frame(Client &client, uint8_t type, uint16_t len);
+        err_t send_frame(Client &client);
+        err_t write_slot(Client &client, const uint8_t *data, u16_t len);
+        void send_hello(Client &client);
+        void send_profile(Client &client, uint8_t stage);
+        template <size_t EntrySize, typename Entry, size_t Words, size_t N>
+        void send_journal(Client &client, uint8_t type, const JournalRing<Entry, Words, N> *journal, uint32_t from,
+                          void (*encode)(const Entry &, uint8_t *));
+        void send_mem(Client &client, uint8_t row);
+        void send_power(Client &client);
+        void send_time_reply(Client &client, const uint8_t *request);
+        void control(Client &client, const ControlCommand &cmd);
+        void apply(Client &client, const ControlCommand &cmd);
+
+        bool receive_web(Client &client, uint8_t *data, size_t len);
+        bool http_request(Client &client);
+        void http_pump(Client &client);
+        void send_ws_control(Client &client, uint8_t opcode, const uint8_t *payload, size_t len);
+        static bool finished(const Client &client);
+
+        void bench_start(Client &client, const uint8_t *payload, uint16_t len);
+        void bench_echo(Client &client, const uint8_t *payload, uint16_t len);
+        void bench_pump();
+
+        static void frame_cb(void *arg, uint8_t type, const uint8_t *payload, uint16_t len);
+        static void ws_cb(void *arg, uint8_t opcode, uint8_t *data, size_t len);
 
         // C-style callback wrappers (must be static)
         static err_t accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err);
+        static err_t http_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err);
         static err_t recv_cb(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
         static err_t sent_cb(void *arg, struct tcp_pcb *tpcb, u16_t len);
         static err_t poll_cb(void *arg, struct tcp_pcb *tpcb);
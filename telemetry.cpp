@@ -0,0 +1,77 @@
+// telemetry.cpp
+#include "telemetry.hpp"
+
+extern "C"
+{
+#include "lwip/stats.h"
+}
+
+using namespace pico_tcp;
+
+void TelemetryStream::service(TcpServer &server, const UdpControlServer &udp)
+{
+    TelemetrySample sample;
+    while (ring_.size() > 0)
+    {
+        uint8_t *header = buffer_.data();
+        uint8_t count = 0;
+        while (count < TELEMETRY_BATCH && ring_.pop(sample))
+        {
+            encode_sample(sample, header + TELEMETRY_HEADER_SIZE + count * TELEMETRY_SAMPLE_SIZE);
+            count++;
+        }
+
+        write_u16(header, batch_++);
+        header[2] = count;
+        header[3] = TELEMETRY_SAMPLE_SIZE;
+        write_u32(header + 4, ring_.dropped());
+        write_u32(header + 8, batches_dropped_);
+#if LWIP_STATS && TCP_STATS
+        write_u32(header + 12, lwip_stats.tcp.xmit);
+        write_u32(header + 16, lwip_stats.tcp.recv);
+        write_u32(header + 20, lwip_stats.tcp.drop);
+        write_u32(header + 24, lwip_stats.tcp.memerr);
+#else
+        write_u32(header + 12, 0);
+        write_u32(header + 16, 0);
+        write_u32(header + 20, 0);
+        write_u32(header + 24, 0);
+#endif
+        write_u32(header + 28, server.commands_coalesced() + udp.commands_coalesced());
+        write_u32(header + 32, server.commands_stale() + udp.commands_dropped());
+        write_u32(header + 36, server.commands_urgent() + udp.commands_urgent());
+        write_u32(header + 40, server.commands_rejected() + udp.datagrams_rejected());
+
+        // called from the main loop, not from an lwIP callback
+        cyw43_arch_lwip_begin();
+        server.publish(SUBSCRIBE_TELEMETRY, FRAME_TELEMETRY, header,
+                       static_cast<uint16_t>(TELEMETRY_HEADER_SIZE + count * TELEMETRY_SAMPLE_SIZE), batches_dropped_);
+        cyw43_arch_lwip_end();
+    }
+}
+
+void CommandStampStream::service(TcpServer &server)
+{
+    CommandStamp stamp;
+    while (ring_.size() > 0)
+    {
+        uint8_t *header = buffer_.data();
+        uint8_t count = 0;
+        while (count < COMMAND_STAMP_BATCH && ring_.pop(stamp))
+        {
+            encode_command_stamp(stamp, header + COMMAND_STAMPS_HEADER_SIZE + count * COMMAND_STAMP_SIZE);
+            count++;
+        }
+
+        header[0] = count;
+        header[1] = COMMAND_STAMP_SIZE;
+        write_u16(header + 2, 0);
+        write_u32(header + 4, ring_.dropped());
+
+        cyw43_arch_lwip_begin();
+        server.publish(SUBSCRIBE_COMMAND_STAMPS, FRAME_COMMAND_STAMPS, header,
+                       static_cast<uint16_t>(COMMAND_STAMPS_HEADER_SIZE + count * COMMAND_STAMP_SIZE),
+                       batches_dropped_);
+        cyw43_arch_lwip_end();
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+// telemetry.hpp - batched vehicle telemetry for subscribed clients
+//
+// The actuation core pushes one TelemetrySample per period into a lock-free
+// ring and never waits: if the ring is full the sample is dropped and counted.
+// The network core drains the ring, packs the samples into FRAME_TELEMETRY
+// batches and queues each batch once per subscriber. A subscriber whose TX
+// ring is full misses that batch, which is counted as well.
+//
+// Command stamps take the same path: the motion tick pushes one CommandStamp
+// per setpoint once it has written the PWM, and CommandStampStream batches
+// them into FRAME_COMMAND_STAMPS for the clients subscribed to them.
+
+#include <array>
+#include <cstdint>
+
+#include "control_protocol.hpp"
+#include "spsc_ring.hpp"
+#include "tcp_server.hpp"
+#include "udp_server.hpp"
+
+namespace pico_tcp
+{
+
+    constexpr uint32_t TELEMETRY_PERIOD_US = 10000; // 100 Hz
+    constexpr size_t TELEMETRY_BATCH = 6;
+    constexpr size_t TELEMETRY_RING_SIZE = 64;
+
+    static_assert(TELEMETRY_HEADER_SIZE + TELEMETRY_BATCH * TELEMETRY_SAMPLE_SIZE <= FRAME_SLOT_PAYLOAD_MAX,
+                  "a telemetry batch has to fit one TX slot");
+
+    using TelemetryRing = SpscRing<TelemetrySample, TELEMETRY_RING_SIZE>;
+
+    constexpr size_t COMMAND_STAMP_BATCH = 14;
+    constexpr size_t COMMAND_STAMP_RING_SIZE = 32;
+
+    static_assert(COMMAND_STAMPS_HEADER_SIZE + COMMAND_STAMP_BATCH * COMMAND_STAMP_SIZE <= FRAME_SLOT_PAYLOAD_MAX,
+                  "a command stamp batch has to fit one TX slot");
+
+    using CommandStampRing = SpscRing<CommandStamp, COMMAND_STAMP_RING_SIZE>;
+
+    class TelemetryStream
+    {
+    public:
+        explicit TelemetryStream(TelemetryRing &ring) : ring_(ring) {}
+
+        // Drain the ring and publish everything in it, with the command
+        // counters of both servers. Call from the network core.
+        void service(TcpServer &server, const UdpControlServer &udp);
+
+        uint32_t batches_dropped() const { return batches_dropped_; }
+
+    private:
+        TelemetryRing &ring_;
+        uint16_t batch_ = 0;
+        uint32_t batches_dropped_ = 0;
+        std::array<uint8_t, TELEMETRY_HEADER_SIZE + TELEMETRY_BATCH * TELEMETRY_SAMPLE_SIZE> buffer_;
+    };
+
+    class CommandStampStream
+    {
+    public:
+        explicit CommandStampStream(CommandStampRing &ring) : ring_(ring) {}
+
+        // Drain the ring and publish everything in it. Call from the network core.
+        void service(TcpServer &server);
+
+        uint32_t batches_dropped() const { return batches_dropped_; }
+
+    private:
+        CommandStampRing &ring_;
+        uint32_t batches_dropped_ = 0;
+        std::array<uint8_t, COMMAND_STAMPS_HEADER_SIZE + COMMAND_STAMP_BATCH * COMMAND_STAMP_SIZE> buffer_;
+    };
+} // namespace pico_tcp
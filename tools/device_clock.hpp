@@ -0,0 +1,106 @@
+#pragma once
+// device_clock.hpp - the device clock as seen from a client tool
+//
+// FRAME_TIME_SYNC exchanges, NTP-style: every reply gives an offset and a
+// round trip, and the exchange with the shortest round trip of a window is
+// the best offset. Device times are 32-bit microseconds and unwrapped here.
+
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <chrono>
+#include <cstdint>
+
+inline uint64_t now_us()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+// Send a FRAME_TIME_SYNC stamped with now_us().
+inline void send_time_sync(int fd)
+{
+    uint8_t payload[pico_tcp::TIME_SYNC_PAYLOAD_SIZE];
+    const uint64_t t0 = now_us();
+    pico_tcp::write_u32(payload, static_cast<uint32_t>(t0));
+    pico_tcp::write_u32(payload + 4, static_cast<uint32_t>(t0 >> 32));
+    send_frame(fd, pico_tcp::FRAME_TIME_SYNC, payload, sizeof(payload));
+}
+
+struct DeviceClock
+{
+    // device time, unwrapped from 32 bits
+    bool have_device_time = false;
+    uint32_t last32 = 0;
+    int64_t last64 = 0;
+
+    // offset = device - client, from the exchange with the shortest round trip
+    bool have_offset = false;
+    int64_t offset = 0;
+    int64_t offset_rtt = 0;
+    int64_t window_offset = 0;
+    int64_t window_rtt = -1;
+    int64_t first_offset = 0;
+    uint64_t first_offset_at = 0;
+    uint64_t last_offset_at = 0;
+    uint32_t syncs = 0;
+
+    int64_t unwrap(uint32_t t)
+    {
+        if (!have_device_time)
+        {
+            have_device_time = true;
+            last32 = t;
+            last64 = t;
+        }
+        // stamps come in roughly in order; anything within 35 minutes unwraps
+        const int64_t t64 = last64 + static_cast<int32_t>(t - last32);
+        if (t64 > last64)
+        {
+            last32 = t;
+            last64 = t64;
+        }
+        return t64;
+    }
+
+    // A FRAME_TIME_REPLY payload, just received.
+    void on_reply(const uint8_t *payload)
+    {
+        const uint64_t t3 = now_us();
+        const uint64_t t0 =
+            static_cast<uint64_t>(pico_tcp::read_u32(payload)) | (static_cast<uint64_t>(pico_tcp::read_u32(payload + 4)) << 32);
+        const int64_t t1 = unwrap(pico_tcp::read_u32(payload + 8));
+        const int64_t t2 = unwrap(pico_tcp::read_u32(payload + 12));
+        const int64_t rtt = static_cast<int64_t>(t3 - t0) - (t2 - t1);
+        const int64_t off = ((t1 - static_cast<int64_t>(t0)) + (t2 - static_cast<int64_t>(t3))) / 2;
+        syncs++;
+        if (window_rtt < 0 || rtt < window_rtt)
+        {
+            window_rtt = rtt;
+            window_offset = off;
+        }
+    }
+
+    // Adopt the best exchange of the window that just ended.
+    void end_window()
+    {
+        if (window_rtt < 0)
+        {
+            return;
+        }
+        if (!have_offset)
+        {
+            first_offset = window_offset;
+            first_offset_at = now_us();
+        }
+        have_offset = true;
+        offset = window_offset;
+        offset_rtt = window_rtt;
+        last_offset_at = now_us();
+        window_rtt = -1;
+    }
+
+    // A client time on the device's time line.
+    int64_t to_device(uint64_t client_us) const { return static_cast<int64_t>(client_us) + offset; }
+};
@@ -0,0 +1,99 @@
+#!/bin/sh
+# journal_replay.sh - runs on the simulator, journaled and replayed on the host
+#
+#   journal_replay.sh <picow_host_sim> <tools dir> <port>
+#
+# Starts the simulator with a PWM trace and drives it with a client while
+# picow_journal --follow downloads the journal and the encoder counts, then
+# runs both through picow_replay. Twice: a trajectory with picow_trajectory, and speed steps
+# with picow_speed --takeover against the simulator's wheel, the loop closing
+# on a wheel the first step set going with PWM. Checks that
+#   - the journal holds each of the trajectory's points once
+#     (COMMAND_SOURCE_TRAJECTORY), not an entry per tick of playback
+#   - the count journal holds the encoder counts of the speed loop, and the
+#     command journal its setpoints only
+#   - picow_replay has a count for every tick that closes the speed loop
+#   - the replay writes the same GPIO and PWM values in the same order as
+#     the simulator did from the first setpoint on
+# Exits 1 on any failure.
+set -u
+sim=$1
+tools=$2
+port=$3
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+check() {
+    if [ "$1" -eq 0 ]; then
+        echo "ok   $2"
+    else
+        echo "FAIL $2"
+        failures=$((failures + 1))
+    fi
+}
+
+# run <name> <run ms> <follow s> <client...>: the simulator, the client as the
+# controller and the journal download, then the replay
+run() {
+    name=$1
+    env PICOW_SIM_PORT_MAP="4242:$port,4243:$((port + 1)),80:$((port + 2))" PICOW_SIM_RUN_MS=$2 \
+        PICOW_SIM_TRACE="$dir/$name.sim.csv" "$sim" >"$dir/$name.sim.log" 2>&1 &
+    follow=$3
+    shift 3
+    sleep 0.5
+    # the first client is the controller
+    "$@" >"$dir/$name.client.log" 2>&1 &
+    sleep 0.2
+    "$tools/picow_journal" 127.0.0.1 --port "$port" --follow "$follow" --counts "$dir/$name.counts.csv" \
+        >"$dir/$name.csv"
+    wait
+    tail -1 "$dir/$name.client.log"
+    PICOW_SIM_TRACE="$dir/$name.replay.csv" "$tools/picow_replay" "$dir/$name.csv" --counts "$dir/$name.counts.csv" \
+        --tail-ms 200 2>"$dir/$name.replay.log"
+    replayed=$?
+    cat "$dir/$name.replay.log"
+}
+
+# entries from <source> in the journal
+entries() {
+    awk -F, -v source="$2" '$3 == source' "$dir/$1.csv" | wc -l
+}
+
+# lines after the header of <file>
+lines() {
+    echo $(($(wc -l <"$1") - 1))
+}
+
+# same_writes <name>: the replay's writes are the simulator's
+same_writes() {
+    # the first setpoint, and where the replay's clock starts (its boot writes)
+    t0=$(awk -F, 'NR == 2 { print $1 }' "$dir/$1.csv")
+    start=$(awk -F, 'NR == 2 { print $1 }' "$dir/$1.replay.csv")
+    awk -F, -v t0="$t0" 'NR > 1 && $1 >= t0 && $2 ~ /^(gpio|pwm_level_a|pwm_level_b)$/ { print $2, $3, $4 }' \
+        "$dir/$1.sim.csv" >"$dir/$1.sim.txt"
+    awk -F, -v t0="$start" 'NR > 1 && $1 > t0 && $2 ~ /^(gpio|pwm_level_a|pwm_level_b)$/ { print $2, $3, $4 }' \
+        "$dir/$1.replay.csv" >"$dir/$1.replay.txt"
+    n=$(wc -l <"$dir/$1.replay.txt")
+    echo "     $n writes replayed, $(wc -l <"$dir/$1.sim.txt") in the simulator's trace"
+    [ "$n" -ge 500 ] && head -n "$n" "$dir/$1.sim.txt" | cmp -s - "$dir/$1.replay.txt"
+}
+
+run trajectory 4000 3 "$tools/picow_trajectory" 127.0.0.1 --port "$port" --seconds 2 --mode trajectory
+points=$(sed -n 's/^trajectory, \([0-9]*\) points.*/\1/p' "$dir/trajectory.client.log")
+echo "     $points points sent, $(entries trajectory 254) journaled"
+[ -n "$points" ] && [ "$points" -gt 0 ] && [ "$(entries trajectory 254)" -eq "$points" ]
+check $? "the journal holds every trajectory point once"
+same_writes trajectory
+check $? "trajectory: the replay writes what the simulator wrote"
+
+run speed 10000 8 "$tools/picow_speed" 127.0.0.1 --port "$port" --takeover
+echo "     $(lines "$dir/speed.counts.csv") encoder counts, $(lines "$dir/speed.csv") journal entries"
+[ "$(lines "$dir/speed.counts.csv")" -ge 4000 ] && [ "$(lines "$dir/speed.csv")" -lt 1000 ]
+check $? "the count journal holds the encoder counts of the speed loop, the command journal its setpoints"
+[ $replayed -eq 0 ]
+check $? "the replay has a count for every tick of the speed loop"
+same_writes speed
+check $? "speed steps: the replay writes what the simulator wrote"
+
+[ $failures -eq 0 ]
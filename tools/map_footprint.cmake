@@ -0,0 +1,120 @@
+# map_footprint.cmake - where the flash and RAM go, per subsystem, from the link map
+#
+# include() this file and call picow_add_map_footprint(<target>) after
+# pico_add_extra_outputs(<target>), which has the linker write <target>.elf.map.
+# Every build then prints the image split into the application's own objects,
+# lwIP, the CYW43 driver, the rest of the Pico SDK and the C/C++ runtime, and
+# writes the same table with the application split per object file next to
+# the map as <target>.footprint.txt.
+#
+# Flash is everything placed in XIP flash (code, rodata, the web assets);
+# RAM is .data, .bss, the heap and stack reservations and code copied to
+# RAM. The flash copy of .data is not counted twice.
+#
+# The same file is the build step, run as
+#   cmake -DMAP=<file.map> -DOUTPUT=<file.txt> [-DEXPECT=<file.txt>] -P map_footprint.cmake
+# With EXPECT it fails unless the table it wrote is that file; ctest runs it
+# that way on map_footprint_sample.map, whose sections cover each group and
+# the lines that must not count.
+
+if (CMAKE_SCRIPT_MODE_FILE)
+    cmake_minimum_required(VERSION 3.13)
+
+    # Input sections: " .name  0xaddr  0xsize  object", with a long name on a
+    # line of its own. Symbol lines have no size and do not match.
+    file(STRINGS ${MAP} lines REGEX
+            "^Linker script and memory map|^ ([.][^ ]+|COMMON)$|^ ([.][^ ]+|COMMON)? +0x[0-9a-f]+ +0x[0-9a-f]+ +[^ ]")
+
+    set(groups "")
+    set(started FALSE)
+    foreach (line IN LISTS lines)
+        if (line STREQUAL "Linker script and memory map")
+            # what comes before is the discarded sections list
+            set(started TRUE)
+            continue()
+        endif ()
+        if (NOT started OR NOT line MATCHES "0x([0-9a-f]+) +0x([0-9a-f]+) +(.+)$")
+            continue()
+        endif ()
+        set(addr 0x${CMAKE_MATCH_1})
+        set(size 0x${CMAKE_MATCH_2})
+        set(object "${CMAKE_MATCH_3}")
+        math(EXPR size "${size}")
+        if (size EQUAL 0)
+            continue()
+        endif ()
+        math(EXPR region "${addr} >> 28")
+        if (region EQUAL 1)
+            set(region flash)
+        elseif (region EQUAL 2)
+            set(region ram)
+        else ()
+            # debug info and other unallocated sections
+            continue()
+        endif ()
+
+        if (object MATCHES "lib(c|g|m|nosys|stdc[+][+]|supc[+][+]|gcc)(_nano)?[.]a")
+            set(group "libc")
+        elseif (object MATCHES "/lwip/")
+            set(group "lwip")
+        elseif (object MATCHES "cyw43")
+            set(group "cyw43")
+        elseif (object MATCHES "pico-sdk|pico_sdk|/rp2_common/|/rp2040/|/common/|/boot_stage2/")
+            set(group "pico-sdk")
+        else ()
+            get_filename_component(name "${object}" NAME)
+            string(REGEX REPLACE "[.]obj$|[.]o$" "" name "${name}")
+            set(group "app:${name}")
+        endif ()
+        string(MAKE_C_IDENTIFIER "${group}" key)
+        if (NOT DEFINED ${key}_flash)
+            list(APPEND groups "${group}")
+            set(${key}_flash 0)
+            set(${key}_ram 0)
+        endif ()
+        math(EXPR ${key}_${region} "${${key}_${region}} + ${size}")
+    endforeach ()
+
+    set(summary "")
+    set(detail "")
+    set(total_flash 0)
+    set(total_ram 0)
+    set(app_flash 0)
+    set(app_ram 0)
+    list(SORT groups)
+    foreach (group IN LISTS groups)
+        string(MAKE_C_IDENTIFIER "${group}" key)
+        math(EXPR total_flash "${total_flash} + ${${key}_flash}")
+        math(EXPR total_ram "${total_ram} + ${${key}_ram}")
+        if (group MATCHES "^app:")
+            math(EXPR app_flash "${app_flash} + ${${key}_flash}")
+            math(EXPR app_ram "${app_ram} + ${${key}_ram}")
+        else ()
+            string(APPEND summary "  ${group}\t${${key}_flash}\t${${key}_ram}\n")
+        endif ()
+        string(APPEND detail "${group}\t${${key}_flash}\t${${key}_ram}\n")
+    endforeach ()
+    set(summary "  app\t${app_flash}\t${app_ram}\n${summary}  total\t${total_flash}\t${total_ram}\n")
+
+    get_filename_component(name ${MAP} NAME)
+    message("footprint of ${name} (bytes)\n  subsystem\tflash\tram\n${summary}")
+    file(WRITE ${OUTPUT} "# generated by tools/map_footprint.cmake from ${name}\n"
+            "# subsystem\tflash\tram\n${summary}\n# object\tflash\tram\n${detail}")
+    if (DEFINED EXPECT)
+        file(READ ${OUTPUT} written)
+        file(READ ${EXPECT} expected)
+        if (NOT written STREQUAL expected)
+            message(FATAL_ERROR "${OUTPUT} differs from ${EXPECT}")
+        endif ()
+    endif ()
+    return()
+endif ()
+
+set(PICOW_MAP_FOOTPRINT ${CMAKE_CURRENT_LIST_FILE})
+
+function(picow_add_map_footprint target)
+    add_custom_command(TARGET ${target} POST_BUILD
+            COMMAND ${CMAKE_COMMAND} -DMAP=$<TARGET_FILE:${target}>.map
+                    -DOUTPUT=${CMAKE_CURRENT_BINARY_DIR}/${target}.footprint.txt -P ${PICOW_MAP_FOOTPRINT}
+            VERBATIM)
+endfunction()
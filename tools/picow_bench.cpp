@@ -0,0 +1,368 @@
+// picow_bench.cpp - Linux client for the TcpServer benchmark mode
+//
+//   picow_bench <host> [--port N] [--size N] [--iterations N] [--depth N]
+//   picow_bench <host> --transport tcp|udp|both [--port N] [--udp-port N] [--seconds N] [--rate HZ]
+//
+// Connects to the car (or picow_host_sim), starts a benchmark, echoes every
+// probe straight back and prints the report the device sends at the end.
+//
+// With --transport it compares the command paths instead: synchronised with
+// the device clock (device_clock.hpp), it drives for --seconds (default 10)
+// at --rate (default 50) commands per second over TCP, over UDP or both in
+// turn, and matches the command stamps with the send times. A command takes
+// effect when it or a newer one is written to the PWM: a lost datagram waits
+// for the next one, a TCP segment behind a retransmission for all of it, and
+// the newest of what then arrives at once supersedes the rest. For each
+// transport it prints the send-to-effect latency p50/p99/max, the commands
+// applied, superseded and never in effect. Against picow_host_sim,
+// PICOW_SIM_LOSS drops datagrams and delays TCP segments by a retransmission.
+#include "control_protocol.hpp"
+#include "device_clock.hpp"
+#include "histogram.hpp"
+#include "tool_common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <random>
+#include <utility>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Session
+    {
+        int fd;
+        bool done;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Session *session = static_cast<Session *>(arg);
+        switch (type)
+        {
+        case FRAME_BENCH_PROBE:
+            send_frame(session->fd, FRAME_BENCH_ECHO, payload, len);
+            break;
+        case FRAME_BENCH_REPORT:
+            if (len < BENCH_REPORT_PAYLOAD_SIZE)
+                break;
+            printf("iterations %u, payload %u bytes\n", read_u16(payload), read_u16(payload + 2));
+            printf("elapsed    %lu us, %lu bytes, %lu bytes/s\n", (unsigned long)read_u32(payload + 4),
+                   (unsigned long)read_u32(payload + 8), (unsigned long)read_u32(payload + 12));
+            printf("rtt us     min %lu  p50 %lu  p90 %lu  p99 %lu  max %lu\n", (unsigned long)read_u32(payload + 16),
+                   (unsigned long)read_u32(payload + 20), (unsigned long)read_u32(payload + 24),
+                   (unsigned long)read_u32(payload + 28), (unsigned long)read_u32(payload + 32));
+            session->done = true;
+            break;
+        case FRAME_HELLO:
+            if (len >= HELLO_PAYLOAD_SIZE && payload[0] != PROTOCOL_VERSION)
+            {
+                fprintf(stderr, "device speaks protocol %u, expected %u\n", payload[0], PROTOCOL_VERSION);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    struct Transport
+    {
+        const char *name;
+        uint8_t source = 0;
+        std::deque<std::pair<uint16_t, uint64_t>> pending; // seq and send time, in send order
+        uint32_t sent = 0;
+        uint32_t applied = 0;
+        uint32_t superseded = 0;
+        LogHistogram<2> effect;
+    };
+
+    struct LatencySession
+    {
+        int fd = -1;
+        int client = -1;
+        bool controller = false;
+        DeviceClock clock;
+        Transport *transport = nullptr;
+    };
+
+    void on_latency_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        LatencySession *s = static_cast<LatencySession *>(arg);
+        switch (type)
+        {
+        case FRAME_HELLO:
+            if (len >= HELLO_PAYLOAD_SIZE)
+            {
+                s->client = payload[1];
+                s->controller = payload[2] == 0;
+            }
+            break;
+        case FRAME_TIME_REPLY:
+            if (len >= TIME_REPLY_PAYLOAD_SIZE)
+                s->clock.on_reply(payload);
+            break;
+        case FRAME_COMMAND_STAMPS:
+        {
+            Transport *t = s->transport;
+            if (!t || len < COMMAND_STAMPS_HEADER_SIZE)
+                break;
+            const uint8_t count = payload[0], size = payload[1];
+            for (uint8_t i = 0; i < count && COMMAND_STAMPS_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+            {
+                CommandStamp stamp;
+                decode_command_stamp(payload + COMMAND_STAMPS_HEADER_SIZE + size_t(i) * size, stamp);
+                if (stamp.source != t->source)
+                {
+                    continue;
+                }
+                auto it = std::find_if(t->pending.begin(), t->pending.end(),
+                                       [&](const std::pair<uint16_t, uint64_t> &p) { return p.first == stamp.seq; });
+                if (it == t->pending.end())
+                {
+                    continue;
+                }
+                // this command and every older one still waiting are in effect now
+                const int64_t write = s->clock.unwrap(stamp.write_us);
+                for (auto p = t->pending.begin(); p != it + 1; ++p)
+                {
+                    const int64_t us = write - s->clock.to_device(p->second);
+                    t->effect.add(static_cast<uint32_t>(us < 0 ? 0 : us));
+                }
+                t->superseded += static_cast<uint32_t>(it - t->pending.begin());
+                t->applied++;
+                t->pending.erase(t->pending.begin(), it + 1);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    bool pump_latency(LatencySession &s, FrameDecoder &decoder, int timeout_ms)
+    {
+        pollfd pfd = {s.fd, POLLIN, 0};
+        return poll(&pfd, 1, timeout_ms) <= 0 || pump_frames(s.fd, decoder, &on_latency_frame, &s);
+    }
+
+    bool pump_latency_for(LatencySession &s, FrameDecoder &decoder, unsigned ms)
+    {
+        const uint64_t end = now_us() + ms * 1000ull;
+        while (now_us() < end)
+        {
+            if (!pump_latency(s, decoder, 1))
+                return false;
+        }
+        return true;
+    }
+
+    // Drive over one transport, the clock kept in sync over TCP meanwhile.
+    bool drive(LatencySession &s, FrameDecoder &decoder, Transport &t, int ufd, unsigned seconds, unsigned rate,
+               uint16_t seq)
+    {
+        s.transport = &t;
+        const uint64_t period_us = 1000000 / rate;
+        const uint64_t start = now_us();
+        const uint64_t end = start + seconds * 1000000ull;
+        uint64_t next_command = start;
+        uint64_t next_sync = start + 100000;
+        uint64_t next_window = start + 1000000;
+        // the stamps of the last commands come with the next housekeeping pass
+        while (now_us() < end + 300000)
+        {
+            const uint64_t now = now_us();
+            if (now < end && now >= next_command)
+            {
+                ControlCommand cmd = {};
+                cmd.seq = seq;
+                cmd.drive = static_cast<int16_t>(200 * sin(t.sent * 0.05));
+                cmd.steer = static_cast<uint16_t>(90 + 60 * sin(t.sent * 0.03));
+                uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+                encode_control(cmd, frame, sizeof(frame));
+                t.pending.emplace_back(seq, now_us());
+                if (ufd >= 0)
+                {
+                    send(ufd, frame, sizeof(frame), 0);
+                }
+                else
+                {
+                    send_frame(s.fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+                }
+                ++seq;
+                ++t.sent;
+                next_command += period_us;
+            }
+            if (now >= next_sync)
+            {
+                send_time_sync(s.fd);
+                next_sync += 100000;
+            }
+            if (now >= next_window)
+            {
+                s.clock.end_window();
+                next_window += 1000000;
+            }
+            if (!pump_latency(s, decoder, 1))
+            {
+                fprintf(stderr, "connection closed while driving over %s\n", t.name);
+                return false;
+            }
+        }
+        s.transport = nullptr;
+        return true;
+    }
+
+    int compare_transports(const char *host, unsigned port, unsigned udp_port, const char *which, unsigned seconds,
+                           unsigned rate)
+    {
+        const bool tcp = !strcmp(which, "tcp") || !strcmp(which, "both");
+        const bool udp = !strcmp(which, "udp") || !strcmp(which, "both");
+        if (!tcp && !udp)
+        {
+            fprintf(stderr, "--transport is tcp, udp or both\n");
+            return 2;
+        }
+        LatencySession s;
+        s.fd = connect_tcp(host, static_cast<uint16_t>(port));
+        if (s.fd < 0)
+        {
+            return 1;
+        }
+        FrameDecoder decoder;
+        const uint8_t topics = SUBSCRIBE_COMMAND_STAMPS;
+        send_frame(s.fd, FRAME_SUBSCRIBE, &topics, 1);
+        constexpr int SYNC_BURST = 16;
+        for (int i = 0; i < SYNC_BURST; ++i)
+        {
+            const uint32_t syncs = s.clock.syncs;
+            send_time_sync(s.fd);
+            while (s.clock.syncs == syncs)
+            {
+                if (!pump_frames(s.fd, decoder, &on_latency_frame, &s))
+                {
+                    fprintf(stderr, "connection closed during the clock sync\n");
+                    return 1;
+                }
+            }
+        }
+        s.clock.end_window();
+        if (!s.controller)
+        {
+            fprintf(stderr, "not the controller, commands will be ignored\n");
+            return 1;
+        }
+
+        // far from whatever seq the last run left the servers at
+        std::mt19937 rng(static_cast<unsigned>(time(nullptr)));
+        Transport transports[2];
+        transports[0].name = "tcp";
+        transports[0].source = static_cast<uint8_t>(s.client);
+        transports[1].name = "udp";
+        transports[1].source = COMMAND_SOURCE_UDP;
+        if (tcp && !drive(s, decoder, transports[0], -1, seconds, rate, static_cast<uint16_t>(rng())))
+        {
+            return 1;
+        }
+        if (udp)
+        {
+            const int ufd = udp_socket(host, static_cast<uint16_t>(udp_port));
+            if (ufd < 0)
+            {
+                fprintf(stderr, "cannot open the UDP control channel\n");
+                return 1;
+            }
+            // after a second of silence the UDP server takes any seq
+            if (!pump_latency_for(s, decoder, 1100) ||
+                !drive(s, decoder, transports[1], ufd, seconds, rate, static_cast<uint16_t>(rng())))
+            {
+                return 1;
+            }
+            close(ufd);
+        }
+        close(s.fd);
+
+        printf("clock   best round trip %lld us (+- %lld us on the latencies)\n", (long long)s.clock.offset_rtt,
+               (long long)(s.clock.offset_rtt / 2 + 1));
+        for (const Transport &t : transports)
+        {
+            if (!t.sent)
+                continue;
+            printf("%s     %5lu sent, %5lu applied, %5lu superseded, %5lu never in effect\n", t.name,
+                   (unsigned long)t.sent, (unsigned long)t.applied, (unsigned long)t.superseded,
+                   (unsigned long)t.pending.size());
+            printf("        send to effect us  p50 %lu  p99 %lu  max %lu\n", (unsigned long)t.effect.percentile(50),
+                   (unsigned long)t.effect.percentile(99), (unsigned long)t.effect.max());
+        }
+        return 0;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,
+                "usage: %s <host> [--port N] [--size N] [--iterations N] [--depth N]\n"
+                "       %s <host> --transport tcp|udp|both [--port N] [--udp-port N] [--seconds N] [--rate HZ]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    const char *host = argv[1];
+    const char *transport = nullptr;
+    unsigned port = 4242, udp_port = UDP_CONTROL_PORT, size = 64, iterations = 100, depth = 1, seconds = 10, rate = 50;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--size"))
+            size = v;
+        else if (!strcmp(argv[i], "--iterations"))
+            iterations = v;
+        else if (!strcmp(argv[i], "--depth"))
+            depth = v;
+        else if (!strcmp(argv[i], "--udp-port"))
+            udp_port = v;
+        else if (!strcmp(argv[i], "--transport"))
+            transport = argv[i + 1];
+        else if (!strcmp(argv[i], "--seconds"))
+            seconds = v;
+        else if (!strcmp(argv[i], "--rate"))
+            rate = v ? v : 1;
+    }
+    if (transport)
+    {
+        return compare_transports(host, port, udp_port, transport, seconds, rate);
+    }
+
+    Session session = {connect_tcp(host, static_cast<uint16_t>(port)), false};
+    if (session.fd < 0)
+    {
+        return 1;
+    }
+
+    uint8_t start[BENCH_START_PAYLOAD_SIZE];
+    write_u16(start, static_cast<uint16_t>(size));
+    write_u16(start + 2, static_cast<uint16_t>(iterations));
+    start[4] = static_cast<uint8_t>(depth);
+    send_frame(session.fd, FRAME_BENCH_START, start, sizeof(start));
+
+    FrameDecoder decoder;
+    while (!session.done)
+    {
+        if (!pump_frames(session.fd, decoder, &on_frame, &session))
+        {
+            fprintf(stderr, "connection closed before the report\n");
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,395 @@
+// picow_burst.cpp - bursts of queued-up commands, and what is left of them
+//
+//   picow_burst <host> [--port N] [--bursts N] [--size N] [--udp 1]
+//   picow_burst --bench [--kb N]
+//
+// With a host it plays a controller coming back from a WiFi stall: every
+// burst is --size (default 32) commands with consecutive seqs, shuffled, some
+// of them brakes, sent in one write (one datagram with --udp 1). The device
+// should hand on only the brakes that were the newest command when they were
+// decoded, at once, and the newest command at the end. The command stamps
+// (FRAME_COMMAND_STAMPS) say what reached core 0; a burst passes when no
+// other command did and the last one of the burst is the newest. A burst
+// split across two receive callbacks on the way may legitimately apply one
+// more command, those are counted apart.
+//
+// --bench runs the firmware's FrameDecoder and CommandCoalescer on the host
+// instead: first against a plain restatement of the rules on random bursts,
+// then over --kb (default 64) KB of frames for the parse-and-coalesce cost
+// per KB. It exits 1 if any burst comes out differently from the reference.
+#include "command_coalescer.hpp"
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <vector>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Burst
+    {
+        std::vector<ControlCommand> commands; // in the order sent
+        std::vector<uint16_t> expected;       // what should be applied, in order
+        std::vector<uint16_t> applied;        // what the stamps say was applied
+    };
+
+    std::vector<ControlCommand> make_burst(std::mt19937 &rng, uint16_t first_seq, size_t size)
+    {
+        std::vector<ControlCommand> commands(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            ControlCommand &cmd = commands[i];
+            cmd.seq = static_cast<uint16_t>(first_seq + i);
+            cmd.drive = static_cast<int16_t>(static_cast<int>(rng() % 511) - 255);
+            cmd.steer = static_cast<uint16_t>(rng() % 181);
+            cmd.flags = rng() % 8 == 0 ? CONTROL_FLAG_BRAKE : 0;
+        }
+        // a stalled link delivers in order, a controller juggling two
+        // transports does not
+        std::shuffle(commands.begin(), commands.end(), rng);
+        return commands;
+    }
+
+    // The rules of command_coalescer.hpp, stated the other way round: a brake
+    // goes through if no earlier command of the burst is newer; of the rest
+    // only the newest command (the later one on a tie) does, at the end,
+    // unless that is a brake.
+    std::vector<uint16_t> reference(const std::vector<ControlCommand> &commands)
+    {
+        std::vector<uint16_t> applied;
+        size_t newest = 0;
+        for (size_t i = 0; i < commands.size(); ++i)
+        {
+            bool overtaken = false;
+            for (size_t j = 0; j < i; ++j)
+            {
+                overtaken |= static_cast<int16_t>(commands[i].seq - commands[j].seq) < 0;
+            }
+            if (!overtaken && (commands[i].flags & CONTROL_FLAG_BRAKE))
+            {
+                applied.push_back(commands[i].seq);
+            }
+            if (static_cast<int16_t>(commands[i].seq - commands[newest].seq) >= 0)
+            {
+                newest = i;
+            }
+        }
+        if (!commands.empty() && !(commands[newest].flags & CONTROL_FLAG_BRAKE))
+        {
+            applied.push_back(commands[newest].seq);
+        }
+        return applied;
+    }
+
+    size_t encode_burst(const std::vector<ControlCommand> &commands, uint8_t *out)
+    {
+        size_t n = 0;
+        for (const ControlCommand &cmd : commands)
+        {
+            n += encode_control(cmd, out + n, FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE);
+        }
+        return n;
+    }
+
+    struct Decoded
+    {
+        CommandCoalescer *coalescer;
+        std::vector<uint16_t> *applied;
+    };
+
+    void coalesce_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Decoded *d = static_cast<Decoded *>(arg);
+        ControlCommand cmd;
+        if (type != FRAME_CONTROL || !decode_control(payload, len, cmd))
+        {
+            return;
+        }
+        if (d->coalescer->offer(cmd) == CoalesceVerdict::Urgent && d->applied)
+        {
+            d->applied->push_back(cmd.seq);
+        }
+    }
+
+    // Decode and coalesce one burst the way the servers do.
+    void run_burst(FrameDecoder &decoder, CommandCoalescer &coalescer, const uint8_t *data, size_t len,
+                   std::vector<uint16_t> *applied)
+    {
+        Decoded d = {&coalescer, applied};
+        coalescer.begin();
+        decoder.feed(data, len, &coalesce_frame, &d);
+        ControlCommand cmd;
+        if (coalescer.take(cmd) && applied)
+        {
+            applied->push_back(cmd.seq);
+        }
+    }
+
+    int bench(unsigned kb)
+    {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> buf(64 * (FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE));
+        FrameDecoder decoder;
+        CommandCoalescer coalescer;
+
+        constexpr unsigned CHECKS = 20000;
+        unsigned failed = 0;
+        uint16_t seq = 0xff00; // through the wrap
+        for (unsigned i = 0; i < CHECKS; ++i)
+        {
+            const auto commands = make_burst(rng, seq, 1 + rng() % 64);
+            seq = static_cast<uint16_t>(seq + commands.size());
+            std::vector<uint16_t> applied;
+            run_burst(decoder, coalescer, buf.data(), encode_burst(commands, buf.data()), &applied);
+            const std::vector<uint16_t> expected = reference(commands);
+            if (applied != expected && ++failed <= 5)
+            {
+                fprintf(stderr, "burst of %zu: reference", commands.size());
+                for (uint16_t s : expected)
+                    fprintf(stderr, " %u", s);
+                fprintf(stderr, ", coalescer");
+                for (uint16_t s : applied)
+                    fprintf(stderr, " %u", s);
+                fprintf(stderr, "\n");
+            }
+        }
+        printf("check   %u random bursts, %u differ from the reference\n", CHECKS, failed);
+        expect(failed == 0, "the coalescer applies what the reference does on every burst");
+
+        // one receive callback's worth of frames after a stall, over and over
+        const size_t frames = size_t(kb) * 1024 / (FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE);
+        std::vector<uint8_t> stream(frames * (FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE));
+        std::vector<size_t> bursts;
+        size_t at = 0;
+        while (at < stream.size())
+        {
+            const size_t room = (stream.size() - at) / (FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE);
+            const auto commands = make_burst(rng, seq, std::min<size_t>(room, 1 + rng() % 64));
+            seq = static_cast<uint16_t>(seq + commands.size());
+            const size_t n = encode_burst(commands, stream.data() + at);
+            at += n;
+            bursts.push_back(n);
+        }
+        constexpr int ROUNDS = 50;
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < ROUNDS; ++r)
+        {
+            const uint8_t *p = stream.data();
+            for (size_t n : bursts)
+            {
+                run_burst(decoder, coalescer, p, n, nullptr);
+                p += n;
+            }
+        }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        printf("bench   %zu frames in %zu bursts, %.0f ns per KB, %.1f ns per frame (host)\n", frames, bursts.size(),
+               ns / ROUNDS / (stream.size() / 1024.0), ns / ROUNDS / frames);
+        printf("        coalesced %lu, stale %lu, brakes ahead %lu\n", (unsigned long)coalescer.coalesced(),
+               (unsigned long)coalescer.stale(), (unsigned long)coalescer.urgent());
+        return failures ? 1 : 0;
+    }
+
+    struct Session
+    {
+        int client = -1;
+        bool controller = false;
+        uint8_t source = 0;
+        uint16_t first_seq = 0;
+        size_t size = 0;
+        std::vector<Burst> *bursts = nullptr;
+        uint32_t foreign = 0;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Session *s = static_cast<Session *>(arg);
+        if (type == FRAME_HELLO && len >= HELLO_PAYLOAD_SIZE)
+        {
+            s->client = payload[1];
+            s->controller = payload[2] == 0;
+            return;
+        }
+        if (type != FRAME_COMMAND_STAMPS || len < COMMAND_STAMPS_HEADER_SIZE)
+        {
+            return;
+        }
+        const uint8_t count = payload[0], size = payload[1];
+        for (uint8_t i = 0; i < count && COMMAND_STAMPS_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+        {
+            CommandStamp stamp;
+            decode_command_stamp(payload + COMMAND_STAMPS_HEADER_SIZE + size_t(i) * size, stamp);
+            const size_t burst = static_cast<uint16_t>(stamp.seq - s->first_seq) / s->size;
+            if (stamp.source != s->source || burst >= s->bursts->size())
+            {
+                s->foreign++;
+                continue;
+            }
+            (*s->bursts)[burst].applied.push_back(stamp.seq);
+        }
+    }
+
+    bool pump(int fd, FrameDecoder &decoder, Session &s, int timeout_ms)
+    {
+        pollfd pfd = {fd, POLLIN, 0};
+        return poll(&pfd, 1, timeout_ms) <= 0 || pump_frames(fd, decoder, &on_frame, &s);
+    }
+
+    void pump_for(int fd, FrameDecoder &decoder, Session &s, int ms)
+    {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (std::chrono::steady_clock::now() < end && pump(fd, decoder, s, 1))
+        {
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,
+                "usage: %s <host> [--port N] [--bursts N] [--size N] [--udp 1]\n"
+                "       %s --bench [--kb N]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    const bool bench_mode = !strcmp(argv[1], "--bench");
+    const char *host = argv[1];
+    unsigned port = 4242, count = 100, size = 32, kb = 64;
+    bool udp = false;
+    for (int i = bench_mode ? 1 : 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--bursts"))
+            count = v;
+        else if (!strcmp(argv[i], "--size"))
+            size = std::min(std::max(v, 1u), 64u);
+        else if (!strcmp(argv[i], "--udp"))
+            udp = v != 0;
+        else if (!strcmp(argv[i], "--kb"))
+            kb = v ? v : 1;
+    }
+    if (bench_mode)
+    {
+        return bench(kb);
+    }
+
+    const int fd = connect_tcp(host, static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+    const int ufd = udp ? udp_socket(host, UDP_CONTROL_PORT) : -1;
+    if (udp && ufd < 0)
+    {
+        fprintf(stderr, "cannot open the UDP control channel\n");
+        return 1;
+    }
+    std::vector<Burst> bursts(count);
+    Session s;
+    s.bursts = &bursts;
+    s.size = size;
+    // far from whatever seq the last run left the UDP server at
+    std::mt19937 rng(static_cast<unsigned>(time(nullptr)));
+    s.first_seq = static_cast<uint16_t>(rng());
+    FrameDecoder decoder;
+    const uint8_t topics = SUBSCRIBE_COMMAND_STAMPS;
+    send_frame(fd, FRAME_SUBSCRIBE, &topics, 1);
+    while (s.client < 0)
+    {
+        if (!pump_frames(fd, decoder, &on_frame, &s))
+        {
+            fprintf(stderr, "connection closed\n");
+            return 1;
+        }
+    }
+    if (!udp && !s.controller)
+    {
+        fprintf(stderr, "not the controller, commands will be ignored\n");
+        return 1;
+    }
+    s.source = udp ? COMMAND_SOURCE_UDP : static_cast<uint8_t>(s.client);
+    if (udp)
+    {
+        // after a second of silence the UDP server takes any seq
+        pump_for(fd, decoder, s, 1100);
+    }
+
+    std::vector<uint8_t> buf(size * (FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE));
+    for (unsigned b = 0; b < count; ++b)
+    {
+        Burst &burst = bursts[b];
+        burst.commands = make_burst(rng, static_cast<uint16_t>(s.first_seq + b * size), size);
+        burst.expected = reference(burst.commands);
+        const size_t n = encode_burst(burst.commands, buf.data());
+        if ((udp ? send(ufd, buf.data(), n, 0) : send(fd, buf.data(), n, MSG_NOSIGNAL)) != static_cast<ssize_t>(n))
+        {
+            perror("send");
+            return 1;
+        }
+        // core 0 has to pick up the last burst before the next one
+        pump_for(fd, decoder, s, 20);
+    }
+    // stamps go out with the next housekeeping pass
+    pump_for(fd, decoder, s, 300);
+    close(fd);
+    if (ufd >= 0)
+    {
+        close(ufd);
+    }
+
+    unsigned passed = 0, split = 0, failed = 0, commands = 0, applied = 0;
+    for (const Burst &burst : bursts)
+    {
+        commands += burst.commands.size();
+        applied += burst.applied.size();
+        const bool last_ok = !burst.applied.empty() && !burst.expected.empty() &&
+                             burst.applied.back() == burst.expected.back();
+        bool only_expected = true;
+        for (uint16_t seq : burst.applied)
+        {
+            only_expected &= std::find(burst.expected.begin(), burst.expected.end(), seq) != burst.expected.end();
+        }
+        if (last_ok && only_expected)
+        {
+            passed++;
+        }
+        else if (last_ok)
+        {
+            split++;
+        }
+        else
+        {
+            failed++;
+            if (failed <= 5)
+            {
+                fprintf(stderr, "burst %u: expected", static_cast<unsigned>(&burst - bursts.data()));
+                for (uint16_t seq : burst.expected)
+                    fprintf(stderr, " %u", seq);
+                fprintf(stderr, ", applied");
+                for (uint16_t seq : burst.applied)
+                    fprintf(stderr, " %u", seq);
+                fprintf(stderr, "\n");
+            }
+        }
+    }
+    printf("bursts  %u sent over %s, %u commands, %u reached core 0\n", count, udp ? "UDP" : "TCP", commands, applied);
+    printf("        %u as expected, %u with extra commands (split in transit), %u wrong\n", passed, split, failed);
+    if (s.foreign)
+    {
+        printf("        %lu stamps from other sources ignored\n", (unsigned long)s.foreign);
+    }
+    return failed ? 1 : 0;
+}
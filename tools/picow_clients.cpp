@@ -0,0 +1,322 @@
+// picow_clients.cpp - the client pool and the controller role, TCP and UDP
+//
+//   picow_clients <host> [--port N] [--udp-port N] [--other ADDR] [--loops N]
+//
+// Fills every client slot and checks that
+//   - the first client is the controller and the rest are observers
+//   - one client more is turned away without a HELLO
+//   - an observer's commands are not applied, over TCP or over UDP from
+//     another host (--other, a second local address, 127.0.0.2 by default)
+//   - datagrams from the controller's host are applied
+//   - when the controller leaves, the next client is promoted and sent a
+//     HELLO, and then the other host may steer over UDP
+// then connects and drops clients --loops times (default 200) back to back,
+// closing some before their HELLO arrives and resetting others. A client may
+// be turned away while the last one's slot is still being released, so those
+// are only counted; once things settle every slot must be free again, and
+// not one more. Applied commands are seen in the command stamps. Exits 1 on
+// any failure.
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Stamps
+    {
+        std::vector<CommandStamp> seen;
+    };
+
+    struct Conn
+    {
+        int fd = -1;
+        bool closed = false;
+        int index = -1;
+        int role = -1; // from the latest HELLO
+        int max_clients = -1;
+        unsigned hellos = 0;
+        FrameDecoder decoder;
+        Stamps *stamps = nullptr;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Conn *c = static_cast<Conn *>(arg);
+        if (type == FRAME_HELLO && len >= HELLO_PAYLOAD_SIZE)
+        {
+            c->index = payload[1];
+            c->role = payload[2];
+            c->max_clients = payload[3];
+            c->hellos++;
+        }
+        else if (type == FRAME_COMMAND_STAMPS && c->stamps && len >= COMMAND_STAMPS_HEADER_SIZE)
+        {
+            const uint8_t count = payload[0], size = payload[1];
+            for (uint8_t i = 0; i < count && COMMAND_STAMPS_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+            {
+                CommandStamp stamp;
+                decode_command_stamp(payload + COMMAND_STAMPS_HEADER_SIZE + size_t(i) * size, stamp);
+                c->stamps->seen.push_back(stamp);
+            }
+        }
+    }
+
+    // Read from every open connection for ms milliseconds.
+    void pump(std::vector<Conn *> conns, unsigned ms)
+    {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (std::chrono::steady_clock::now() < end)
+        {
+            std::vector<pollfd> fds;
+            std::vector<Conn *> open;
+            for (Conn *c : conns)
+            {
+                if (c->fd >= 0 && !c->closed)
+                {
+                    fds.push_back({c->fd, POLLIN, 0});
+                    open.push_back(c);
+                }
+            }
+            if (fds.empty() || poll(fds.data(), fds.size(), 5) <= 0)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < fds.size(); ++i)
+            {
+                if (fds[i].revents && !pump_frames(open[i]->fd, open[i]->decoder, &on_frame, open[i]))
+                {
+                    open[i]->closed = true;
+                }
+            }
+        }
+    }
+
+    // A socket of the given type from src (any when null) connected to host:port.
+    int open_from(int type, const char *src, const char *host, uint16_t port)
+    {
+        const int fd = socket(AF_INET, type, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        if (src)
+        {
+            inet_pton(AF_INET, src, &addr.sin_addr);
+            if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+            {
+                perror(src);
+                close(fd);
+                return -1;
+            }
+        }
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = type;
+        addrinfo *res = nullptr;
+        char service[8];
+        snprintf(service, sizeof(service), "%u", port);
+        if (getaddrinfo(host, service, &hints, &res) != 0 || !res || connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+        {
+            if (res)
+                freeaddrinfo(res);
+            close(fd);
+            return -1;
+        }
+        freeaddrinfo(res);
+        if (type == SOCK_STREAM)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return fd;
+    }
+
+    std::unique_ptr<Conn> join(const char *src, const char *host, uint16_t port, Stamps *stamps)
+    {
+        std::unique_ptr<Conn> c(new Conn);
+        c->fd = open_from(SOCK_STREAM, src, host, port);
+        c->closed = c->fd < 0;
+        c->stamps = stamps;
+        pump({c.get()}, 150);
+        return c;
+    }
+
+    void drop(Conn &c, bool reset)
+    {
+        if (reset)
+        {
+            linger l = {1, 0};
+            setsockopt(c.fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        }
+        close(c.fd);
+        c.fd = -1;
+        c.closed = true;
+    }
+
+    void send_control(int fd, bool datagram, uint16_t seq)
+    {
+        ControlCommand cmd = {seq, 120, 90, 0};
+        uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+        encode_control(cmd, frame, sizeof(frame));
+        if (datagram)
+        {
+            send(fd, frame, sizeof(frame), 0);
+        }
+        else
+        {
+            send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+        }
+    }
+
+    bool stamped(const Stamps &s, uint16_t seq, uint8_t source)
+    {
+        for (const CommandStamp &stamp : s.seen)
+        {
+            if (stamp.seq == seq && stamp.source == source)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--port N] [--udp-port N] [--other ADDR] [--loops N]\n", argv[0]);
+        return 2;
+    }
+    const char *host = argv[1];
+    const char *other = "127.0.0.2";
+    unsigned port = 4242, udp_port = UDP_CONTROL_PORT, loops = 200;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--udp-port"))
+            udp_port = v;
+        else if (!strcmp(argv[i], "--other"))
+            other = argv[i + 1];
+        else if (!strcmp(argv[i], "--loops"))
+            loops = v;
+    }
+    const uint16_t tcp_port = static_cast<uint16_t>(port);
+
+    // slot 0 from this host, slot 1 from the other, then this host again
+    Stamps stamps;
+    std::vector<std::unique_ptr<Conn>> clients;
+    clients.push_back(join(nullptr, host, tcp_port, &stamps));
+    if (clients[0]->hellos == 0)
+    {
+        fprintf(stderr, "no HELLO from %s:%u\n", host, port);
+        return 1;
+    }
+    const int max_clients = clients[0]->max_clients;
+    expect(clients[0]->role == 0, "first client is the controller");
+    clients.push_back(join(other, host, tcp_port, nullptr));
+    for (int i = 2; i < max_clients; ++i)
+    {
+        clients.push_back(join(nullptr, host, tcp_port, nullptr));
+    }
+    bool observers = true;
+    for (size_t i = 1; i < clients.size(); ++i)
+    {
+        observers &= clients[i]->hellos == 1 && clients[i]->role == 1;
+    }
+    expect(observers, "the other clients are observers");
+    std::unique_ptr<Conn> extra = join(nullptr, host, tcp_port, nullptr);
+    expect(extra->hellos == 0 && extra->closed, "one client more is turned away");
+    drop(*extra, false);
+
+    std::vector<Conn *> all;
+    for (auto &c : clients)
+    {
+        all.push_back(c.get());
+    }
+    const uint8_t topics = SUBSCRIBE_COMMAND_STAMPS;
+    send_frame(clients[0]->fd, FRAME_SUBSCRIBE, &topics, 1);
+    const int udp_here = open_from(SOCK_DGRAM, nullptr, host, static_cast<uint16_t>(udp_port));
+    const int udp_other = open_from(SOCK_DGRAM, other, host, static_cast<uint16_t>(udp_port));
+    if (udp_here < 0 || udp_other < 0)
+    {
+        fprintf(stderr, "cannot open the UDP sockets\n");
+        return 1;
+    }
+    // far from whatever seq the last run left the servers at
+    uint16_t seq = static_cast<uint16_t>(time(nullptr) * 997);
+    const uint16_t observer_tcp = seq++, other_udp = seq++, controller_udp = seq++;
+    send_control(clients[1]->fd, false, observer_tcp);
+    send_control(udp_other, true, other_udp);
+    pump(all, 50);
+    send_control(udp_here, true, controller_udp);
+    pump(all, 400);
+    expect(!stamped(stamps, observer_tcp, static_cast<uint8_t>(clients[1]->index)), "observer's TCP command ignored");
+    expect(!stamped(stamps, other_udp, COMMAND_SOURCE_UDP), "datagram from an observer's host ignored");
+    expect(stamped(stamps, controller_udp, COMMAND_SOURCE_UDP), "datagram from the controller's host applied");
+
+    // the controller leaves, slot 1 (the other host) takes over
+    drop(*clients[0], false);
+    pump(all, 200);
+    expect(clients[1]->hellos == 2 && clients[1]->role == 0, "next client promoted to controller");
+    send_frame(clients[1]->fd, FRAME_SUBSCRIBE, &topics, 1);
+    clients[1]->stamps = &stamps;
+    // after a second of silence the UDP server lets another peer bind
+    pump(all, 1100);
+    const uint16_t promoted_tcp = seq++, here_udp = seq++, promoted_udp = seq++;
+    send_control(clients[1]->fd, false, promoted_tcp);
+    send_control(udp_here, true, here_udp);
+    pump(all, 50);
+    send_control(udp_other, true, promoted_udp);
+    pump(all, 400);
+    expect(stamped(stamps, promoted_tcp, static_cast<uint8_t>(clients[1]->index)), "promoted client's TCP command applied");
+    expect(!stamped(stamps, here_udp, COMMAND_SOURCE_UDP), "datagram from the old controller's host ignored");
+    expect(stamped(stamps, promoted_udp, COMMAND_SOURCE_UDP), "datagram from the new controller's host applied");
+    close(udp_here);
+    close(udp_other);
+
+    // churn: clients come and go, some before their HELLO, some with a reset;
+    // the controller keeps talking so it is not closed as idle meanwhile
+    unsigned turned_away = 0;
+    for (unsigned i = 0; i < loops; ++i)
+    {
+        send_frame(clients[1]->fd, FRAME_SUBSCRIBE, &topics, 1);
+        Conn c;
+        c.fd = open_from(SOCK_STREAM, nullptr, host, tcp_port);
+        if (c.fd < 0)
+        {
+            turned_away++;
+            continue;
+        }
+        if (i % 3 != 0)
+        {
+            pump({&c}, 20);
+            turned_away += c.hellos == 0;
+        }
+        drop(c, i % 2 == 0);
+    }
+    pump(all, 300);
+    printf("     %u connect/disconnect cycles, %u turned away while a slot was released\n", loops, turned_away);
+    // slot 0 is free again, the others are still held
+    std::unique_ptr<Conn> again = join(nullptr, host, tcp_port, nullptr);
+    expect(again->hellos == 1 && !again->closed, "the freed slot can be taken again, none leaked");
+    std::unique_ptr<Conn> over = join(nullptr, host, tcp_port, nullptr);
+    expect(over->hellos == 0 && over->closed, "and not one more");
+    return failures ? 1 : 0;
+}
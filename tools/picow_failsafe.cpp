@@ -0,0 +1,169 @@
+// picow_failsafe.cpp - the dead-man failsafe, against a device or the simulator
+//
+//   picow_failsafe <host> [--port N] [--cycles N] [--limit-us N]
+//
+// Runs --cycles (default 5) stop-after-burst cycles as the controller: drives
+// at 50 Hz for 300 ms, then goes quiet, as a client that crashes or loses its
+// link would. Reads the device's telemetry throughout and checks that
+//   - the motor runs during the burst and no failsafe trips while commands
+//     keep coming
+//   - every quiet period trips the failsafe exactly once, and the first
+//     sample that counts the trip has the motor braked and the servo centred,
+//     without a ramp in between
+//   - the worst dead-man deadline -> brake time the device reports stays
+//     under --limit-us (default 2000: one 1 ms motion tick plus its runtime)
+// and prints the trips and the worst time.
+//
+// Exits 1 on any failure.
+#include "actuation.hpp"
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Live
+    {
+        std::vector<TelemetrySample> samples;
+        bool controller = false;
+        int client = -1;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Live *live = static_cast<Live *>(arg);
+        if (type == FRAME_HELLO && len >= HELLO_PAYLOAD_SIZE)
+        {
+            live->client = payload[1];
+            live->controller = payload[2] == 0;
+            return;
+        }
+        if (type != FRAME_TELEMETRY || len < TELEMETRY_HEADER_SIZE)
+        {
+            return;
+        }
+        const uint8_t count = payload[2], size = payload[3];
+        for (uint8_t i = 0; i < count && TELEMETRY_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+        {
+            TelemetrySample s;
+            decode_sample(payload + TELEMETRY_HEADER_SIZE + size_t(i) * size, s);
+            live->samples.push_back(s);
+        }
+    }
+
+    double now_ms()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Reads frames for ms, sending a command every 20 ms if drive is set.
+    bool run_for(int fd, FrameDecoder &decoder, Live &live, double ms, bool drive, uint16_t &seq)
+    {
+        const double end = now_ms() + ms;
+        double next = now_ms();
+        while (now_ms() < end)
+        {
+            if (drive && now_ms() >= next)
+            {
+                const ControlCommand cmd = {++seq, 600, 120, 0};
+                uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+                encode_control(cmd, frame, sizeof(frame));
+                send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+                next += 20;
+            }
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 2) > 0 && !pump_frames(fd, decoder, &on_frame, &live))
+            {
+                fprintf(stderr, "connection closed\n");
+                return false;
+            }
+        }
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        fprintf(stderr, "usage: %s <host> [--port N] [--cycles N] [--limit-us N]\n", argv[0]);
+        return 2;
+    }
+    unsigned port = 4242, cycles = 5, limit_us = 2000;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--cycles"))
+            cycles = v;
+        else if (!strcmp(argv[i], "--limit-us"))
+            limit_us = v;
+    }
+
+    const int fd = connect_tcp(argv[1], static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+    Live live;
+    FrameDecoder decoder;
+    const uint8_t topics = SUBSCRIBE_TELEMETRY;
+    send_frame(fd, FRAME_SUBSCRIBE, &topics, 1);
+    uint16_t seq = 0;
+    // the HELLO and the first samples
+    if (!run_for(fd, decoder, live, 300, false, seq) || !live.controller || live.samples.empty())
+    {
+        expect(false, "connected as the controller, with telemetry");
+        return 1;
+    }
+
+    const double quiet_ms = DEADMAN_TIMEOUT_MS + 350;
+    unsigned ran = 0, tripped_once = 0, stopped_at_once = 0;
+    uint16_t worst_us = 0;
+    for (unsigned c = 0; c < cycles; ++c)
+    {
+        const uint16_t trips = live.samples.back().failsafe_trips;
+        const size_t burst = live.samples.size();
+        if (!run_for(fd, decoder, live, 300, true, seq) || !run_for(fd, decoder, live, quiet_ms, false, seq))
+        {
+            break;
+        }
+        // samples arrive in batches: the burst's can come in the quiet period
+        bool running = false;
+        const TelemetrySample *trip = nullptr;
+        for (size_t i = burst; i < live.samples.size(); ++i)
+        {
+            const TelemetrySample &s = live.samples[i];
+            running |= s.motor_level != 0 && !trip;
+            if (!trip && s.failsafe_trips != trips)
+            {
+                trip = &s;
+            }
+        }
+        const TelemetrySample &last = live.samples.back();
+        ran += running;
+        tripped_once += static_cast<uint16_t>(last.failsafe_trips - trips) == 1;
+        stopped_at_once += trip && trip->motor_level == 0 && trip->motor_dir == 0 && trip->servo_angle == 90;
+        worst_us = last.failsafe_latency_max_us;
+        printf("     cycle %u: trips %u -> %u, first tripped sample level %d servo %u\n", c + 1, trips,
+               last.failsafe_trips, trip ? trip->motor_level : 0, trip ? trip->servo_angle : 0);
+    }
+    close(fd);
+
+    printf("     worst deadline -> brake %u us (limit %u us)\n", worst_us, limit_us);
+    expect(ran == cycles, "the motor runs while commands keep coming");
+    expect(tripped_once == cycles, "each quiet period trips the failsafe once, none trips during a burst");
+    expect(stopped_at_once == cycles, "the first tripped sample has the motor braked and the servo centred");
+    expect(worst_us <= limit_us, "the brake is written within the limit after the deadline");
+    return failures ? 1 : 0;
+}
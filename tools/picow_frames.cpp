@@ -0,0 +1,317 @@
+// picow_frames.cpp - the firmware's FrameDecoder on the host, split and coalesced
+//
+//   picow_frames [--kb N] [--seed N]
+//
+// First a check: random streams of frames of every length, with garbage
+// between some of them, are fed to FrameDecoder cut into segments in every
+// way the network can cut them: one segment, every two-way split, byte by
+// byte, random segment sizes and pbuf chains of random pbufs. Every frame
+// has to come out once and intact, in order, and every garbage byte has to
+// be counted as a sync error. The garbage includes magic bytes followed by
+// an impossible length, whose header is staged when a segment ends inside
+// it; the real frame after it must still be found.
+//
+// Then the cost per frame over --kb (default 256) KB of control frames, fed
+// as coalesced segments of 1460 bytes, as pbuf chains of 64-byte pbufs (most
+// frames straddle a boundary and are staged) and one frame per segment.
+// Exits 1 if the check fails.
+#include "control_protocol.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+extern "C"
+{
+#include "lwip/pbuf.h"
+}
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Frame
+    {
+        uint8_t type;
+        std::vector<uint8_t> payload;
+    };
+
+    struct Stream
+    {
+        std::vector<uint8_t> bytes;
+        std::vector<Frame> frames;
+        uint32_t garbage = 0;
+    };
+
+    struct Received
+    {
+        std::vector<Frame> frames;
+    };
+
+    void collect(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        static_cast<Received *>(arg)->frames.push_back(Frame{type, std::vector<uint8_t>(payload, payload + len)});
+    }
+
+    void count(void *arg, uint8_t /*type*/, const uint8_t * /*payload*/, uint16_t /*len*/)
+    {
+        ++*static_cast<size_t *>(arg);
+    }
+
+    uint8_t not_magic(std::mt19937 &rng)
+    {
+        const uint8_t b = static_cast<uint8_t>(rng());
+        return b == FRAME_MAGIC ? 0 : b;
+    }
+
+    // Bytes that can never start a frame, whatever follows them: plain bytes
+    // other than the magic, or a magic byte whose length comes out above
+    // FRAME_MAX_PAYLOAD. "A5 x" takes the next frame's magic and type (never
+    // 0) as its length.
+    void add_garbage(std::mt19937 &rng, Stream &s)
+    {
+        const size_t before = s.bytes.size();
+        switch (rng() % 3)
+        {
+        case 0:
+            for (unsigned n = 1 + rng() % 5; n > 0; --n)
+            {
+                s.bytes.push_back(not_magic(rng));
+            }
+            break;
+        case 1:
+            s.bytes.insert(s.bytes.end(), {FRAME_MAGIC, not_magic(rng), 0xff});
+            break;
+        default:
+            s.bytes.insert(s.bytes.end(), {FRAME_MAGIC, not_magic(rng)});
+            break;
+        }
+        s.garbage += static_cast<uint32_t>(s.bytes.size() - before);
+    }
+
+    Stream make_stream(std::mt19937 &rng, size_t frames, bool garbage)
+    {
+        Stream s;
+        for (size_t i = 0; i < frames; ++i)
+        {
+            if (garbage && rng() % 3 == 0)
+            {
+                add_garbage(rng, s);
+            }
+            Frame f;
+            f.type = static_cast<uint8_t>(1 + rng() % 0xfe);
+            // mostly short ones like real traffic, now and then the longest
+            const size_t len = rng() % 8 == 0 ? FRAME_MAX_PAYLOAD - rng() % 2 : rng() % 24;
+            for (size_t j = 0; j < len; ++j)
+            {
+                f.payload.push_back(static_cast<uint8_t>(rng()));
+            }
+            s.bytes.insert(s.bytes.end(), {FRAME_MAGIC, f.type, static_cast<uint8_t>(len), static_cast<uint8_t>(len >> 8)});
+            s.bytes.insert(s.bytes.end(), f.payload.begin(), f.payload.end());
+            s.frames.push_back(f);
+        }
+        return s;
+    }
+
+    bool same(const std::vector<Frame> &a, const std::vector<Frame> &b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].type != b[i].type || a[i].payload != b[i].payload)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Feed the stream cut at the given offsets (ascending, inside the stream).
+    bool check_cuts(const Stream &s, const std::vector<size_t> &cuts)
+    {
+        FrameDecoder decoder;
+        Received r;
+        size_t from = 0;
+        for (size_t i = 0; i <= cuts.size(); ++i)
+        {
+            const size_t to = i < cuts.size() ? cuts[i] : s.bytes.size();
+            decoder.feed(s.bytes.data() + from, to - from, &collect, &r);
+            from = to;
+        }
+        return same(r.frames, s.frames) && decoder.sync_errors() == s.garbage;
+    }
+
+    // Feed the stream as one pbuf chain of pbufs of random sizes.
+    bool check_chain(std::mt19937 &rng, const Stream &s)
+    {
+        std::vector<pbuf> chain;
+        size_t at = 0;
+        while (at < s.bytes.size())
+        {
+            const size_t n = std::min<size_t>(s.bytes.size() - at, 1 + rng() % 80);
+            chain.push_back(pbuf{nullptr, const_cast<uint8_t *>(s.bytes.data() + at), 0, static_cast<u16_t>(n)});
+            at += n;
+        }
+        u16_t tot = 0;
+        for (size_t i = chain.size(); i-- > 0;)
+        {
+            tot = static_cast<u16_t>(tot + chain[i].len);
+            chain[i].tot_len = tot;
+            chain[i].next = i + 1 < chain.size() ? &chain[i + 1] : nullptr;
+        }
+        FrameDecoder decoder;
+        Received r;
+        if (!chain.empty())
+        {
+            decoder.feed(&chain[0], &collect, &r);
+        }
+        return same(r.frames, s.frames) && decoder.sync_errors() == s.garbage;
+    }
+
+    unsigned check(std::mt19937 &rng)
+    {
+        unsigned runs = 0, failed = 0;
+        auto tally = [&](bool ok, const char *how) {
+            ++runs;
+            if (!ok && ++failed <= 5)
+            {
+                fprintf(stderr, "mismatch: %s\n", how);
+            }
+        };
+
+        // every way to cut short streams in two, and byte by byte
+        for (int i = 0; i < 200; ++i)
+        {
+            const Stream s = make_stream(rng, 1 + rng() % 6, i % 2);
+            tally(check_cuts(s, {}), "one segment");
+            std::vector<size_t> bytes;
+            for (size_t cut = 1; cut < s.bytes.size(); ++cut)
+            {
+                tally(check_cuts(s, {cut}), "split in two");
+                bytes.push_back(cut);
+            }
+            tally(check_cuts(s, bytes), "byte by byte");
+        }
+        // long streams in random segments, as contiguous blocks and as pbuf chains
+        for (int i = 0; i < 2000; ++i)
+        {
+            const Stream s = make_stream(rng, 1 + rng() % 64, i % 2);
+            std::vector<size_t> cuts;
+            for (size_t at = 1 + rng() % 300; at < s.bytes.size(); at += 1 + rng() % 300)
+            {
+                cuts.push_back(at);
+            }
+            tally(check_cuts(s, cuts), "random segments");
+            if (s.bytes.size() <= 0xffff)
+            {
+                tally(check_chain(rng, s), "pbuf chain");
+            }
+        }
+        printf("check   %u streams and cuts, %u wrong\n", runs, failed);
+        return failed;
+    }
+
+    double feed_ns(const std::vector<std::vector<pbuf>> &segments, size_t frames)
+    {
+        constexpr int ROUNDS = 20;
+        FrameDecoder decoder;
+        size_t got = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < ROUNDS; ++r)
+        {
+            for (const std::vector<pbuf> &chain : segments)
+            {
+                decoder.feed(&chain[0], &count, &got);
+            }
+        }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (got != frames * ROUNDS)
+        {
+            fprintf(stderr, "bench: %zu frames decoded, expected %zu\n", got, frames * ROUNDS);
+        }
+        return ns / ROUNDS / frames;
+    }
+
+    // Segments of segment_len bytes, each a chain of pbufs of pbuf_len bytes.
+    std::vector<std::vector<pbuf>> cut(std::vector<uint8_t> &bytes, size_t segment_len, size_t pbuf_len)
+    {
+        std::vector<std::vector<pbuf>> segments;
+        for (size_t at = 0; at < bytes.size(); at += segment_len)
+        {
+            const size_t end = std::min(bytes.size(), at + segment_len);
+            std::vector<pbuf> chain;
+            for (size_t p = at; p < end; p += pbuf_len)
+            {
+                const size_t n = std::min(end - p, pbuf_len);
+                chain.push_back(pbuf{nullptr, bytes.data() + p, static_cast<u16_t>(end - p), static_cast<u16_t>(n)});
+            }
+            for (size_t i = 0; i + 1 < chain.size(); ++i)
+            {
+                chain[i].next = &chain[i + 1];
+            }
+            // moved, not copied: the next pointers point into this buffer
+            segments.push_back(std::move(chain));
+        }
+        return segments;
+    }
+
+    void bench(std::mt19937 &rng, unsigned kb)
+    {
+        constexpr size_t FRAME = FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE;
+        const size_t frames = size_t(kb) * 1024 / FRAME;
+        std::vector<uint8_t> bytes(frames * FRAME);
+        for (size_t i = 0; i < frames; ++i)
+        {
+            const ControlCommand cmd = {static_cast<uint16_t>(i), static_cast<int16_t>(static_cast<int>(rng() % 511) - 255),
+                                        static_cast<uint16_t>(rng() % 181), 0};
+            encode_control(cmd, bytes.data() + i * FRAME, FRAME);
+        }
+        struct Case
+        {
+            const char *name;
+            size_t segment;
+            size_t pbuf;
+        };
+        const Case cases[] = {
+            {"coalesced, 1460-byte segments", 1460, 1460},
+            {"split, 64-byte pbufs", 1460, 64},
+            {"one frame per segment", FRAME, FRAME},
+        };
+        printf("bench   %zu control frames (host)\n", frames);
+        for (const Case &c : cases)
+        {
+            const auto segments = cut(bytes, c.segment, c.pbuf);
+            const double ns = feed_ns(segments, frames);
+            printf("        %-32s %6.1f ns per frame, %7.1f MB/s\n", c.name, ns, FRAME / ns * 1e3);
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    unsigned kb = 256, seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--kb"))
+            kb = v ? v : 1;
+        else if (!strcmp(argv[i], "--seed"))
+            seed = v;
+        else
+        {
+            fprintf(stderr, "usage: %s [--kb N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+    std::mt19937 rng(seed);
+    const unsigned failed = check(rng);
+    bench(rng, kb);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+// picow_journal.cpp - Linux client that downloads the firmware's command journal
+//
+//   picow_journal <host> [--port N] [--follow SECONDS] [--counts FILE] > journal.csv
+//
+// Fetches every entry the device still holds with repeated FRAME_JOURNAL_QUERY
+// frames and prints them as CSV
+// (t_us,tick,source,flags,drive,steer,lead_ms,point_t_us), oldest first.
+// With --counts it also fetches the encoder counts of the speed loop with
+// FRAME_COUNT_QUERY and writes them to FILE, one tick per line (tick,count).
+// tools/picow_replay reads both files back.
+//
+// With --follow it goes on fetching new entries as they are recorded for
+// that many seconds, which captures a run longer than the device holds.
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Download
+    {
+        uint8_t query; // FRAME_JOURNAL_QUERY or FRAME_COUNT_QUERY
+        FILE *out;
+        bool answered;
+        uint32_t first;    // index of the first entry in the last answer
+        uint32_t recorded; // entries recorded on the device since boot
+        uint8_t count;
+        uint32_t skipped; // entries overwritten before we got to them
+        uint32_t next;
+    };
+
+    struct Downloads
+    {
+        Download journal;
+        Download counts;
+    };
+
+    void print_entry(FILE *out, const uint8_t *in)
+    {
+        JournalEntry e;
+        decode_journal_entry(in, e);
+        fprintf(out, "%lu,%lu,%u,%u,%d,%u,%u,%lu\n", (unsigned long)e.t_us, (unsigned long)e.tick, e.source, e.flags,
+                e.drive, e.steer, e.lead_ms, (unsigned long)e.point_t_us);
+    }
+
+    void print_counts(FILE *out, const uint8_t *in)
+    {
+        CountBlock block;
+        decode_count_block(in, block);
+        uint32_t count = block.count;
+        for (uint8_t i = 0; i < block.n && i < COUNT_BLOCK_TICKS; ++i)
+        {
+            count += i ? static_cast<uint32_t>(block.delta[i - 1]) : 0;
+            fprintf(out, "%lu,%lu\n", (unsigned long)(block.tick + i), (unsigned long)count);
+        }
+    }
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Downloads *dls = static_cast<Downloads *>(arg);
+        if ((type != FRAME_JOURNAL_DATA && type != FRAME_COUNT_DATA) || len < JOURNAL_DATA_HEADER_SIZE)
+        {
+            return;
+        }
+        const bool counts = type == FRAME_COUNT_DATA;
+        Download *dl = counts ? &dls->counts : &dls->journal;
+        dl->answered = true;
+        dl->first = read_u32(payload);
+        dl->recorded = read_u32(payload + 4);
+        dl->count = payload[8];
+        const uint8_t entry_size = payload[9];
+        if (entry_size < (counts ? COUNT_BLOCK_SIZE : JOURNAL_ENTRY_SIZE) ||
+            JOURNAL_DATA_HEADER_SIZE + size_t(dl->count) * entry_size > len)
+        {
+            dl->count = 0;
+            return;
+        }
+        if (dl->first > dl->next)
+        {
+            dl->skipped += dl->first - dl->next;
+        }
+        for (uint8_t i = 0; i < dl->count; ++i)
+        {
+            const uint8_t *in = payload + JOURNAL_DATA_HEADER_SIZE + size_t(i) * entry_size;
+            if (counts)
+                print_counts(dl->out, in);
+            else
+                print_entry(dl->out, in);
+        }
+        dl->next = dl->first + dl->count;
+    }
+
+    // Fetch from dl.next until caught up. Returns false if the connection closed.
+    bool fetch(int fd, FrameDecoder &decoder, Downloads &dls, Download &dl)
+    {
+        do
+        {
+            uint8_t from[4];
+            write_u32(from, dl.next);
+            send_frame(fd, dl.query, from, sizeof(from));
+            dl.answered = false;
+            while (!dl.answered)
+            {
+                if (!pump_frames(fd, decoder, &on_frame, &dls))
+                {
+                    fprintf(stderr, "connection closed\n");
+                    return false;
+                }
+            }
+        } while (dl.count > 0 && dl.next < dl.recorded);
+        fflush(dl.out);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--port N] [--follow SECONDS] [--counts FILE]\n", argv[0]);
+        return 2;
+    }
+    unsigned port = 4242, follow = 0;
+    const char *counts_path = nullptr;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--port"))
+            port = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        else if (!strcmp(argv[i], "--follow"))
+            follow = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        else if (!strcmp(argv[i], "--counts"))
+            counts_path = argv[i + 1];
+    }
+
+    Downloads dls = {};
+    dls.journal.query = FRAME_JOURNAL_QUERY;
+    dls.journal.out = stdout;
+    dls.counts.query = FRAME_COUNT_QUERY;
+    if (counts_path)
+    {
+        dls.counts.out = fopen(counts_path, "w");
+        if (!dls.counts.out)
+        {
+            perror(counts_path);
+            return 1;
+        }
+        fprintf(dls.counts.out, "tick,count\n");
+    }
+    const int fd = connect_tcp(argv[1], static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    printf("t_us,tick,source,flags,drive,steer,lead_ms,point_t_us\n");
+    FrameDecoder decoder;
+    const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(follow);
+    while (true)
+    {
+        if (!fetch(fd, decoder, dls, dls.journal) || (counts_path && !fetch(fd, decoder, dls, dls.counts)))
+        {
+            return 1;
+        }
+        if (std::chrono::steady_clock::now() >= end)
+        {
+            break;
+        }
+        // caught up; well inside the time either journal takes to wrap
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    close(fd);
+    if (dls.counts.out)
+    {
+        fclose(dls.counts.out);
+    }
+
+    if (dls.journal.skipped)
+    {
+        fprintf(stderr, "%lu entries were overwritten before download\n", (unsigned long)dls.journal.skipped);
+    }
+    if (dls.counts.skipped)
+    {
+        fprintf(stderr, "%lu count blocks were overwritten before download\n", (unsigned long)dls.counts.skipped);
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+// picow_latency.cpp - where the time between a command and the PWM goes
+//
+//   picow_latency <host> [--port N] [--seconds N] [--rate HZ] [--csv FILE] [--limit-us N]
+//
+// Synchronises with the device clock over FRAME_TIME_SYNC (NTP-style, four
+// timestamps, the exchange with the shortest round trip wins, repeated every
+// second), then drives for --seconds (default 10) at --rate commands per
+// second (default 50) with FRAME_COMMAND_STAMPS subscribed. Every stamp is
+// matched with the time its command was sent and split into
+//   uplink   sent -> device receive callback (clock offset applied)
+//   core1    receive callback -> handoff to the motion profile on core 0
+//   tick     handoff -> first motion tick done writing the PWM
+//   total    sent -> PWM written
+// and the distributions are printed at the end. core1 and tick are device
+// time only; uplink and total are within the offset error printed with them.
+// --csv writes one line per command as well.
+//
+// Exits 1 unless every stamp matches a command sent, the last command and at
+// least 95% of them were stamped (one replaced by the next before a tick ran
+// is never written, so a stalled tick loses a few), no stamp was dropped on
+// the device and the tick stage's p99 stays under --limit-us (default 2000:
+// one 1 ms motion tick plus its runtime).
+#include "control_protocol.hpp"
+#include "device_clock.hpp"
+#include "histogram.hpp"
+#include "tool_common.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Histogram
+    {
+        const char *name;
+        LogHistogram<2> us;
+        uint32_t negative; // below 0, i.e. within the offset error
+    };
+
+    struct Session
+    {
+        int client = -1;
+        bool controller = false;
+
+        DeviceClock clock;
+
+        std::vector<uint64_t> sent_at = std::vector<uint64_t>(65536, 0);
+        uint32_t stamps = 0;
+        uint32_t unmatched = 0;
+        uint16_t last_seq = 0; // of the last command stamped
+        uint32_t dropped = 0;
+        Histogram uplink{"uplink", {}, 0}, core1{"core1", {}, 0}, tick{"tick", {}, 0}, total{"total", {}, 0};
+        FILE *csv = nullptr;
+    };
+
+    void add(Histogram &h, int64_t us)
+    {
+        if (us < 0)
+        {
+            h.negative++;
+            us = 0;
+        }
+        h.us.add(static_cast<uint32_t>(us > 0xffffffff ? 0xffffffff : us));
+    }
+
+    void on_stamps(Session &s, const uint8_t *payload, uint16_t len)
+    {
+        if (len < COMMAND_STAMPS_HEADER_SIZE)
+        {
+            return;
+        }
+        const uint8_t count = payload[0], size = payload[1];
+        s.dropped = read_u32(payload + 4);
+        for (uint8_t i = 0; i < count && COMMAND_STAMPS_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+        {
+            CommandStamp stamp;
+            decode_command_stamp(payload + COMMAND_STAMPS_HEADER_SIZE + size_t(i) * size, stamp);
+            if (stamp.source != s.client)
+            {
+                continue;
+            }
+            s.stamps++;
+            s.last_seq = stamp.seq;
+            const uint64_t sent = s.sent_at[stamp.seq];
+            if (!sent || !s.clock.have_offset)
+            {
+                s.unmatched++;
+                continue;
+            }
+            const int64_t arrival = s.clock.unwrap(stamp.arrival_us);
+            const int64_t handoff = s.clock.unwrap(stamp.handoff_us);
+            const int64_t write = s.clock.unwrap(stamp.write_us);
+            const int64_t sent_dev = s.clock.to_device(sent);
+            add(s.uplink, arrival - sent_dev);
+            add(s.core1, handoff - arrival);
+            add(s.tick, write - handoff);
+            add(s.total, write - sent_dev);
+            if (s.csv)
+            {
+                fprintf(s.csv, "%u,%lld,%lld,%lld,%lld,%lld\n", stamp.seq, (long long)sent, (long long)(arrival - sent_dev),
+                        (long long)(handoff - arrival), (long long)(write - handoff), (long long)(write - sent_dev));
+            }
+        }
+    }
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Session *s = static_cast<Session *>(arg);
+        switch (type)
+        {
+        case FRAME_HELLO:
+            if (len >= HELLO_PAYLOAD_SIZE)
+            {
+                s->client = payload[1];
+                s->controller = payload[2] == 0;
+            }
+            break;
+        case FRAME_TIME_REPLY:
+            if (len >= TIME_REPLY_PAYLOAD_SIZE)
+                s->clock.on_reply(payload);
+            break;
+        case FRAME_COMMAND_STAMPS:
+            on_stamps(*s, payload, len);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Read for up to timeout_ms. Returns false if the connection is gone.
+    bool pump(int fd, FrameDecoder &decoder, Session &s, int timeout_ms)
+    {
+        pollfd pfd = {fd, POLLIN, 0};
+        return poll(&pfd, 1, timeout_ms) <= 0 || pump_frames(fd, decoder, &on_frame, &s);
+    }
+
+    void print(const Histogram &h, const char *note)
+    {
+        printf("%-7s us  min %lu  p50 %lu  p90 %lu  p99 %lu  max %lu%s", h.name, (unsigned long)h.us.min(),
+               (unsigned long)h.us.percentile(50), (unsigned long)h.us.percentile(90),
+               (unsigned long)h.us.percentile(99), (unsigned long)h.us.max(), note);
+        if (h.negative)
+        {
+            printf("  (%lu below 0)", (unsigned long)h.negative);
+        }
+        printf("\n");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--port N] [--seconds N] [--rate HZ] [--csv FILE] [--limit-us N]\n", argv[0]);
+        return 2;
+    }
+    const char *host = argv[1];
+    unsigned port = 4242, seconds = 10, rate = 50, limit_us = 2000;
+    const char *csv = nullptr;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--seconds"))
+            seconds = v;
+        else if (!strcmp(argv[i], "--rate"))
+            rate = v ? v : 1;
+        else if (!strcmp(argv[i], "--csv"))
+            csv = argv[i + 1];
+        else if (!strcmp(argv[i], "--limit-us"))
+            limit_us = v;
+    }
+
+    const int fd = connect_tcp(host, static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+    Session s;
+    if (csv)
+    {
+        s.csv = fopen(csv, "w");
+        if (!s.csv)
+        {
+            perror(csv);
+            return 1;
+        }
+        fprintf(s.csv, "seq,sent_us,uplink_us,core1_us,tick_us,total_us\n");
+    }
+    FrameDecoder decoder;
+    const uint8_t topics = SUBSCRIBE_COMMAND_STAMPS;
+    send_frame(fd, FRAME_SUBSCRIBE, &topics, 1);
+
+    // initial offset: a burst of exchanges, one at a time
+    constexpr int SYNC_BURST = 16;
+    for (int i = 0; i < SYNC_BURST; ++i)
+    {
+        const uint32_t syncs = s.clock.syncs;
+        send_time_sync(fd);
+        while (s.clock.syncs == syncs)
+        {
+            if (!pump_frames(fd, decoder, &on_frame, &s))
+            {
+                fprintf(stderr, "connection closed during the clock sync\n");
+                return 1;
+            }
+        }
+    }
+    s.clock.end_window();
+    if (!s.controller)
+    {
+        fprintf(stderr, "not the controller, commands will be ignored\n");
+        return 1;
+    }
+    printf("clock   offset %lld us, best round trip %lld us\n", (long long)s.clock.offset, (long long)s.clock.offset_rtt);
+
+    const uint64_t period_us = 1000000 / rate;
+    const uint64_t start = now_us();
+    const uint64_t end = start + seconds * 1000000ull;
+    uint64_t next_command = start;
+    uint64_t next_sync = start + 100000;
+    uint64_t next_window = start + 1000000;
+    uint16_t seq = 0;
+    unsigned sent = 0;
+    // the stamps of the last commands come with the next housekeeping pass
+    while (now_us() < end + 300000)
+    {
+        const uint64_t now = now_us();
+        if (now < end && now >= next_command)
+        {
+            ControlCommand cmd = {};
+            cmd.seq = seq;
+            cmd.drive = static_cast<int16_t>(200 * sin(sent * 0.05));
+            cmd.steer = static_cast<uint16_t>(90 + 60 * sin(sent * 0.03));
+            uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+            encode_control(cmd, frame, sizeof(frame));
+            s.sent_at[seq] = now_us();
+            send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+            ++seq;
+            ++sent;
+            next_command += period_us;
+        }
+        // a few exchanges per window, spread between the commands
+        if (now >= next_sync)
+        {
+            send_time_sync(fd);
+            next_sync += 100000;
+        }
+        if (now >= next_window)
+        {
+            s.clock.end_window();
+            next_window += 1000000;
+        }
+        if (!pump(fd, decoder, s, 1))
+        {
+            fprintf(stderr, "connection closed while driving\n");
+            return 1;
+        }
+    }
+    close(fd);
+    if (s.csv)
+    {
+        fclose(s.csv);
+    }
+
+    printf("commands %u sent, %lu stamped, %lu unmatched, %lu stamps dropped on the device\n", sent,
+           (unsigned long)s.stamps, (unsigned long)s.unmatched, (unsigned long)s.dropped);
+    char note[64];
+    snprintf(note, sizeof(note), "  (+- %lld us offset error)", (long long)(s.clock.offset_rtt / 2 + 1));
+    print(s.uplink, note);
+    print(s.core1, "");
+    print(s.tick, "");
+    print(s.total, note);
+    const DeviceClock &c = s.clock;
+    if (c.last_offset_at > c.first_offset_at)
+    {
+        printf("clock   %lu syncs, drift %.1f ppm\n", (unsigned long)c.syncs,
+               1e6 * double(c.offset - c.first_offset) / double(c.last_offset_at - c.first_offset_at));
+    }
+    expect(s.unmatched == 0, "every stamp matches a command sent");
+    expect(sent > 0 && s.last_seq == static_cast<uint16_t>(seq - 1) && s.stamps * 100 >= sent * 95,
+           "the last command and at least 95% of them are stamped");
+    expect(s.dropped == 0, "no stamp is dropped on the device");
+    expect(s.tick.us.percentile(99) <= limit_us, "the PWM is written within the limit after the handoff, p99");
+    return failures ? 1 : 0;
+}
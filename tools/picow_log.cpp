@@ -0,0 +1,356 @@
+// picow_log.cpp - the deferred log ring with two producers, and picow_logfmt
+//
+//   picow_log [--ms N] [--logfmt PATH]
+//
+// Logs on core 0 from the loop and from a repeating timer at once, as the
+// firmware does from its main loop and an interrupt, for --ms (default 500),
+// while another thread drains the ring. Every record carries its producer,
+// a sequence number and a check word. Checks that
+//   - no record is torn, lost without being counted, or comes twice, and
+//     each producer's records come in order
+//   - the records drained and the drops add up to the records logged
+//
+// log_format(), which formats for the drain, must print what printf prints
+// for each conversion with a matching argument, print a conversion as
+// written when its argument does not fit it (%s for an integer, a missing
+// argument, floating point, %p, %n) and cut a long message at the buffer.
+//
+// Then the cost of a log line both ways: printf at the call site, as a
+// PICOW_LOG_SYNC build does, into a line-buffered /dev/null as stdio_init_all
+// sets up stdout (so one write per line, but not the console's own time),
+// against the deferred push at the call site plus the drain's formatting
+// later. The deferred call has to be the cheaper one.
+//
+// With --logfmt, a few messages are drained in the raw format of a
+// PICOW_LOG_RAW build, run through picow_logfmt with this program as the
+// ELF file, and every line must read as printf would have printed it.
+//
+// Exits 1 on any failure.
+#include "deferred_log.hpp"
+#include "tool_common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    const char HAMMER_FMT[] = "producer %u seq %u check %x\n";
+    constexpr uint32_t CHECK = 0x5a5a5a5a;
+    constexpr unsigned LOOP = 0, TIMER = 1;
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> logged[2];
+
+    void log_one(unsigned producer)
+    {
+        const uint32_t seq = logged[producer].load(std::memory_order_relaxed);
+        LOG_printf(HAMMER_FMT, producer, seq, seq ^ CHECK);
+        logged[producer].store(seq + 1, std::memory_order_relaxed);
+    }
+
+    bool on_timer(repeating_timer_t *)
+    {
+        // an interrupt logs a few lines at a time
+        for (int i = 0; i < 8; ++i)
+        {
+            log_one(TIMER);
+        }
+        return !stop.load();
+    }
+
+    struct Drained
+    {
+        uint32_t records[2] = {0, 0};
+        uint32_t next[2] = {0, 0};
+        unsigned torn = 0, out_of_order = 0;
+    };
+
+    void drain(Drained &d)
+    {
+        LogRecord r;
+        while (log_rings[0].pop(r))
+        {
+            const unsigned producer = static_cast<unsigned>(r.args[0]);
+            const uint32_t seq = static_cast<uint32_t>(r.args[1]);
+            if (r.fmt != HAMMER_FMT || producer > TIMER || static_cast<uint32_t>(r.args[2]) != (seq ^ CHECK))
+            {
+                d.torn++;
+                continue;
+            }
+            // drops leave gaps, but never a step back or a repeat
+            d.out_of_order += seq < d.next[producer];
+            d.next[producer] = seq + 1;
+            d.records[producer]++;
+        }
+    }
+
+    void check_producers(unsigned ms)
+    {
+        Drained d;
+        std::atomic<bool> draining{true};
+        std::thread consumer([&] {
+            while (draining.load())
+            {
+                drain(d);
+                std::this_thread::yield();
+            }
+        });
+        repeating_timer_t timer;
+        add_repeating_timer_us(-100, &on_timer, nullptr, &timer);
+        const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (std::chrono::steady_clock::now() < end)
+        {
+            log_one(LOOP);
+        }
+        stop = true;
+        cancel_repeating_timer(&timer);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        draining = false;
+        consumer.join();
+        drain(d);
+
+        const uint32_t total = logged[LOOP] + logged[TIMER];
+        const uint32_t dropped = log_rings[0].dropped();
+        printf("     %u records logged (%u from the timer), %u drained, %u dropped\n", total, logged[TIMER].load(),
+               d.records[LOOP] + d.records[TIMER], dropped);
+        expect(logged[TIMER] > 0 && d.records[TIMER] > 0 && d.records[LOOP] > 0, "both producers got records through");
+        expect(d.torn == 0, "no record is torn");
+        expect(d.out_of_order == 0, "each producer's records come in order, none twice");
+        expect(d.records[LOOP] + d.records[TIMER] + dropped == total, "drained and dropped records add up");
+    }
+
+    // what log_format() makes of a message logged now
+    template <typename... Args>
+    std::string formatted(size_t size, const char *fmt, Args... args)
+    {
+        LOG_printf(fmt, args...);
+        LogRecord r;
+        if (!log_rings[0].pop(r))
+        {
+            return "<not logged>";
+        }
+        char line[LOG_LINE_MAX];
+        const size_t n = log_format(r, line, std::min(size, sizeof(line)));
+        return std::string(line, n);
+    }
+
+    template <typename... Args>
+    bool same_as_printf(const char *fmt, Args... args)
+    {
+        char want[LOG_LINE_MAX];
+        snprintf(want, sizeof(want), fmt, args...);
+        const std::string got = formatted(sizeof(want), fmt, args...);
+        if (got != want)
+        {
+            fprintf(stderr, "want: %sgot:  %s", want, got.c_str());
+        }
+        return got == want;
+    }
+
+    bool as_written(const char *want, const std::string &got)
+    {
+        if (got != want)
+        {
+            fprintf(stderr, "want: %s\ngot:  %s\n", want, got.c_str());
+        }
+        return got == want;
+    }
+
+    void check_format()
+    {
+        bool same = true;
+        same &= same_as_printf("plain text\n");
+        same &= same_as_printf("client %d connected in slot %u\n", 3, 7u);
+        same &= same_as_printf("negative %d, %ld, %hd, %hhd\n", -42, -100000L, static_cast<short>(-5), -3);
+        same &= same_as_printf("narrowed %hu %hhu %hx\n", 70000u, 300u, -1);
+        same &= same_as_printf("hex %08x %X %#x %o\n", 0xbeefu, 255u, 16u, 8u);
+        same &= same_as_printf("string '%s' and '%-6s|' '%.3s'\n", "literal", "pad", "truncated");
+        same &= same_as_printf("char %c, 100%% done, width %5d|%-4u|\n", 'A', 12, 7u);
+        same &= same_as_printf("%u %u %u %u\n", 1u, 2u, 3u, 4u);
+        same &= same_as_printf("enum %d\n", LOG_ARG_STRING);
+        expect(same, "log_format() prints what printf prints");
+
+        bool written = true;
+        written &= as_written("%s is not a string", formatted(LOG_LINE_MAX, "%s is not a string", 42));
+        written &= as_written("%d is a string", formatted(LOG_LINE_MAX, "%d is a string", "text"));
+        written &= as_written("1 and %d", formatted(LOG_LINE_MAX, "%d and %d", 1));
+        written &= as_written("%f %p %n 2", formatted(LOG_LINE_MAX, "%f %p %n %d", 3, "x", 0, 2));
+        written &= as_written("trailing %l", formatted(LOG_LINE_MAX, "trailing %l"));
+        expect(written, "a conversion its argument does not fit is printed as written");
+        expect(as_written("a long ", formatted(8, "a long message %u", 1u)), "a long message is cut at the buffer");
+    }
+
+    double ns_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void bench()
+    {
+        constexpr unsigned ROUNDS = 4000, BATCH = 32;
+        static_assert(BATCH < LOG_RING_SIZE, "a batch fits the ring");
+        FILE *devnull = fopen("/dev/null", "w");
+        if (!devnull)
+        {
+            expect(false, "/dev/null");
+            return;
+        }
+        setvbuf(devnull, nullptr, _IOLBF, 0);
+        double sync_ns = 0, push_ns = 0, format_ns = 0;
+        char line[LOG_LINE_MAX];
+        size_t chars = 0;
+        for (unsigned round = 0; round < ROUNDS; ++round)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < BATCH; ++i)
+            {
+                fprintf(devnull, "client %u connected as %s, slot %d\n", i, "controller", -1);
+            }
+            sync_ns += ns_since(start);
+
+            start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < BATCH; ++i)
+            {
+                LOG_printf("client %u connected as %s, slot %d\n", i, "controller", -1);
+            }
+            push_ns += ns_since(start);
+
+            start = std::chrono::steady_clock::now();
+            LogRecord r;
+            while (log_rings[0].pop(r))
+            {
+                chars += log_format(r, line, sizeof(line));
+            }
+            format_ns += ns_since(start);
+        }
+        fclose(devnull);
+        const double calls = double(ROUNDS) * BATCH;
+        printf("     per log line: printf at the call site %.0f ns; deferred: push %.0f ns at the call site, "
+               "%.0f ns to format in the drain (%zu chars)\n",
+               sync_ns / calls, push_ns / calls, format_ns / calls, chars / size_t(calls));
+        expect(push_ns < sync_ns, "the deferred call costs the caller less than printf");
+    }
+
+    // what printf would have printed after the record's prefix
+    std::vector<std::string> wanted;
+
+    template <typename... Args>
+    void log_both(const char *fmt, Args... args)
+    {
+        char line[256];
+        if constexpr (sizeof...(Args) == 0)
+        {
+            snprintf(line, sizeof(line), "%s", fmt);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), fmt, args...);
+        }
+        wanted.push_back(line);
+        LOG_printf(fmt, args...);
+    }
+
+    void check_logfmt(const char *logfmt)
+    {
+        char self[4096];
+        const ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        char raw[] = "/tmp/picow_log_XXXXXX";
+        const int fd = mkstemp(raw);
+        if (n <= 0 || fd < 0)
+        {
+            expect(false, "raw log file");
+            return;
+        }
+        self[n] = '\0';
+
+        log_both("plain text\n");
+        log_both("client %d connected in slot %u\n", 3, 7u);
+        log_both("negative %d, %ld, %hd\n", -42, -100000L, static_cast<short>(-5));
+        log_both("hex %08x %X %#x\n", 0xbeefu, 255u, 16u);
+        log_both("string '%s' and '%-6s|'\n", "literal", "pad");
+        log_both("char %c, 100%% done, width %5d|\n", 'A', 12);
+        log_both("%u %u %u %u\n", 1u, 2u, 3u, 4u);
+
+        // the drain prints to stdout; send it to the file
+        fflush(stdout);
+        const int saved = dup(1);
+        dup2(fd, 1);
+        while (log_drain_stdio())
+        {
+        }
+        fflush(stdout);
+        dup2(saved, 1);
+        close(saved);
+        close(fd);
+
+        const std::string command = std::string(logfmt) + " " + self + " " + raw;
+        FILE *p = popen(command.c_str(), "r");
+        std::vector<std::string> got;
+        char line[512];
+        bool prefixed = true;
+        while (p && fgets(line, sizeof(line), p))
+        {
+            if (!strncmp(line, "[log]", 5))
+            {
+                continue; // the drops of the first part
+            }
+            // "[<t_us> c0] "
+            const char *text = strstr(line, " c0] ");
+            prefixed &= line[0] == '[' && text != nullptr;
+            got.push_back(text ? text + 5 : line);
+        }
+        const bool ran = p && pclose(p) == 0;
+        unlink(raw);
+
+        unsigned wrong = 0;
+        for (size_t i = 0; i < wanted.size(); ++i)
+        {
+            const bool same = i < got.size() && got[i] == wanted[i];
+            if (!same)
+            {
+                fprintf(stderr, "want: %sgot:  %s", wanted[i].c_str(), i < got.size() ? got[i].c_str() : "nothing\n");
+                wrong++;
+            }
+        }
+        expect(ran && got.size() == wanted.size() && prefixed, "picow_logfmt formats every raw record with its prefix");
+        expect(wrong == 0, "as printf would have, %s arguments included");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    unsigned ms = 500;
+    const char *logfmt = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--ms"))
+            ms = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        else if (!strcmp(argv[i], "--logfmt"))
+            logfmt = argv[i + 1];
+        else
+        {
+            fprintf(stderr, "usage: %s [--ms N] [--logfmt PATH]\n", argv[0]);
+            return 2;
+        }
+    }
+    check_producers(ms);
+    check_format();
+    bench();
+    if (logfmt)
+    {
+        check_logfmt(logfmt);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,308 @@
+// picow_logfmt.cpp - formats the log of a PICOW_LOG_RAW build on the host
+//
+//   picow_logfmt <elf> [log]
+//
+// A PICOW_LOG_RAW build prints each deferred log record unformatted, as
+//   #L <core> <t_us> <fmt> <arg0> <arg1> <arg2> <arg3>
+// in hex (see deferred_log.hpp). This reads such a log from the file or from
+// stdin, e.g. the USB console, looks each format string up in the build's
+// ELF file and prints the record as the firmware would have:
+//   [<t_us> c<core>] <formatted message>
+// %s arguments are looked up the same way. The "#B <address>" line of the
+// first drain gives the address at which the image ran; without one it is
+// taken to be where the ELF file puts it, as on the device. Every other
+// line passes through unchanged.
+//
+// Exits 1 if the ELF file cannot be read.
+#include "deferred_log.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+
+namespace
+{
+    struct Section
+    {
+        uint64_t addr;
+        uint64_t size;
+        uint64_t offset;
+    };
+
+    struct Image
+    {
+        std::vector<uint8_t> bytes;
+        std::vector<Section> sections; // loaded ones with contents
+        unsigned word = 4;             // size of a long and a pointer
+        int64_t bias = 0;              // run address minus ELF address
+    };
+
+    template <typename Ehdr, typename Shdr>
+    bool read_sections(Image &image)
+    {
+        if (image.bytes.size() < sizeof(Ehdr))
+        {
+            return false;
+        }
+        Ehdr eh;
+        memcpy(&eh, image.bytes.data(), sizeof(eh));
+        for (unsigned i = 0; i < eh.e_shnum; ++i)
+        {
+            const uint64_t at = eh.e_shoff + uint64_t(i) * eh.e_shentsize;
+            if (at + sizeof(Shdr) > image.bytes.size())
+            {
+                return false;
+            }
+            Shdr sh;
+            memcpy(&sh, image.bytes.data() + at, sizeof(sh));
+            if ((sh.sh_flags & SHF_ALLOC) && sh.sh_type != SHT_NOBITS && sh.sh_offset + sh.sh_size <= image.bytes.size())
+            {
+                image.sections.push_back({sh.sh_addr, sh.sh_size, sh.sh_offset});
+            }
+        }
+        image.word = sizeof(Shdr::sh_addr);
+        return !image.sections.empty();
+    }
+
+    bool load(const char *path, Image &image)
+    {
+        FILE *f = fopen(path, "rb");
+        if (!f)
+        {
+            return false;
+        }
+        uint8_t buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        {
+            image.bytes.insert(image.bytes.end(), buf, buf + n);
+        }
+        fclose(f);
+        if (image.bytes.size() < EI_NIDENT || memcmp(image.bytes.data(), ELFMAG, SELFMAG) != 0 ||
+            image.bytes[EI_DATA] != ELFDATA2LSB)
+        {
+            return false;
+        }
+        return image.bytes[EI_CLASS] == ELFCLASS64 ? read_sections<Elf64_Ehdr, Elf64_Shdr>(image)
+                                                   : read_sections<Elf32_Ehdr, Elf32_Shdr>(image);
+    }
+
+    // ELF address of the first copy of the mark, 0 if there is none
+    uint64_t find_mark(const Image &image)
+    {
+        const char *mark = pico_tcp::LOG_BASE_MARK;
+        const size_t len = strlen(mark) + 1;
+        for (const Section &s : image.sections)
+        {
+            const uint8_t *start = image.bytes.data() + s.offset;
+            for (const uint8_t *p = start; p + len <= start + s.size; ++p)
+            {
+                if (*p == mark[0] && memcmp(p, mark, len) == 0)
+                {
+                    return s.addr + static_cast<uint64_t>(p - start);
+                }
+            }
+        }
+        return 0;
+    }
+
+    // The NUL-terminated string at a run address, false if it is not in the image.
+    bool string_at(const Image &image, uint64_t address, std::string &out)
+    {
+        const uint64_t a = address - static_cast<uint64_t>(image.bias);
+        for (const Section &s : image.sections)
+        {
+            if (a >= s.addr && a < s.addr + s.size)
+            {
+                const char *p = reinterpret_cast<const char *>(image.bytes.data() + s.offset + (a - s.addr));
+                out.assign(p, strnlen(p, s.addr + s.size - a));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // printf(fmt, args...) with the target's argument slots.
+    std::string format(const Image &image, const std::string &fmt, const uint64_t (&args)[pico_tcp::LOG_ARGS_MAX])
+    {
+        std::string out;
+        size_t next = 0;
+        auto arg = [&]() -> uint64_t { return next < pico_tcp::LOG_ARGS_MAX ? args[next++] : 0; };
+        char buf[256];
+        for (size_t i = 0; i < fmt.size(); ++i)
+        {
+            if (fmt[i] != '%')
+            {
+                out += fmt[i];
+                continue;
+            }
+            // %[flags][width][.precision][length]conversion, the length taken off
+            const size_t start = i;
+            std::string spec = "%";
+            size_t j = i + 1;
+            while (j < fmt.size() && strchr("-+ #0", fmt[j]))
+            {
+                spec += fmt[j++];
+            }
+            for (bool precision = false;; precision = true)
+            {
+                if (j < fmt.size() && fmt[j] == '*')
+                {
+                    spec += std::to_string(static_cast<int32_t>(arg()));
+                    ++j;
+                }
+                while (j < fmt.size() && fmt[j] >= '0' && fmt[j] <= '9')
+                {
+                    spec += fmt[j++];
+                }
+                if (precision || j >= fmt.size() || fmt[j] != '.')
+                {
+                    break;
+                }
+                spec += fmt[j++];
+            }
+            std::string length;
+            while (j < fmt.size() && strchr("hljzt", fmt[j]))
+            {
+                length += fmt[j++];
+            }
+            if (j >= fmt.size())
+            {
+                out += fmt.substr(i);
+                break;
+            }
+            const char conversion = fmt[j];
+            i = j;
+            // the next argument as the target's printf would have read it
+            auto integer = [&](bool is_signed) {
+                return pico_tcp::log_narrow(arg(), length.c_str(), length.size(), image.word, is_signed);
+            };
+            switch (conversion)
+            {
+            case '%':
+                out += '%';
+                continue;
+            case 'd':
+            case 'i':
+                spec += "lld";
+                snprintf(buf, sizeof(buf), spec.c_str(), static_cast<long long>(integer(true)));
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                spec += "ll";
+                spec += conversion;
+                snprintf(buf, sizeof(buf), spec.c_str(), static_cast<unsigned long long>(integer(false)));
+                break;
+            case 'c':
+                spec += 'c';
+                snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(static_cast<uint8_t>(arg())));
+                break;
+            case 'p':
+                snprintf(buf, sizeof(buf), "0x%" PRIx64, arg());
+                break;
+            case 's':
+            {
+                const uint64_t address = arg();
+                std::string s;
+                if (!string_at(image, address, s))
+                {
+                    snprintf(buf, sizeof(buf), "<string 0x%" PRIx64 "?>", address);
+                    break;
+                }
+                spec += 's';
+                snprintf(buf, sizeof(buf), spec.c_str(), s.c_str());
+                break;
+            }
+            default:
+                // no floating point in the log; keep the conversion as it is
+                arg();
+                out += fmt.substr(start, j - start + 1);
+                continue;
+            }
+            out += buf;
+        }
+        return out;
+    }
+
+    // One "#L" line; false if it is not one.
+    bool format_record(const Image &image, const char *line, std::string &out)
+    {
+        unsigned core;
+        unsigned long t_us;
+        uint64_t fmt_address, args[pico_tcp::LOG_ARGS_MAX];
+        if (sscanf(line, "#L %u %lx %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx64, &core, &t_us,
+                   &fmt_address, &args[0], &args[1], &args[2], &args[3]) != 7)
+        {
+            return false;
+        }
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "[%10lu c%u] ", t_us, core);
+        std::string fmt;
+        if (!string_at(image, fmt_address, fmt))
+        {
+            char unknown[64];
+            snprintf(unknown, sizeof(unknown), "<format 0x%" PRIx64 " not in the ELF file>\n", fmt_address);
+            out = prefix + std::string(unknown);
+            return true;
+        }
+        out = prefix + format(image, fmt, args);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <elf> [log]\n", argv[0]);
+        return 2;
+    }
+    Image image;
+    if (!load(argv[1], image))
+    {
+        fprintf(stderr, "%s: not a little-endian ELF file with loaded sections\n", argv[1]);
+        return 1;
+    }
+    const uint64_t mark = find_mark(image);
+    FILE *in = argc > 2 ? fopen(argv[2], "r") : stdin;
+    if (!in)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    char line[512];
+    std::string out;
+    while (fgets(line, sizeof(line), in))
+    {
+        uint64_t base;
+        if (sscanf(line, "#B %" SCNx64, &base) == 1)
+        {
+            if (mark)
+            {
+                image.bias = static_cast<int64_t>(base - mark);
+            }
+            continue;
+        }
+        if (format_record(image, line, out))
+        {
+            fputs(out.c_str(), stdout);
+        }
+        else
+        {
+            fputs(line, stdout);
+        }
+        fflush(stdout);
+    }
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+// picow_mem.cpp - Linux client that prints the firmware's memory table
+//
+//   picow_mem <host> [--port N] [--check]
+//
+// Queries every row with FRAME_MEM_QUERY: the lwIP heap and pools with their
+// use, high-water mark, capacity and failed allocations, the stack high-water
+// marks of both cores, the linker sections and the large statics. Heap and
+// pool rows need a firmware built with LWIP_STATS (any build without NDEBUG).
+//
+// With --check the table must have heap, pool, stack and static rows, no
+// high-water mark over its capacity and no failed allocation; exits 1
+// otherwise.
+#include "control_protocol.hpp"
+#include "mem_stats.hpp"
+#include "tool_common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace pico_tcp;
+
+namespace
+{
+    const char *const KIND_NAMES[] = {"heap", "pool", "stack", "section", "static"};
+
+    struct Row
+    {
+        uint8_t kind;
+        uint32_t max;
+        uint32_t size;
+        uint32_t errors;
+    };
+
+    struct Query
+    {
+        bool answered = false;
+        bool empty = false;
+        uint8_t row_count = 1;
+        std::vector<Row> rows;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Query *query = static_cast<Query *>(arg);
+        if (type != FRAME_MEM_REPORT)
+        {
+            return;
+        }
+        query->answered = true;
+        query->empty = len < MEM_REPORT_HEADER_SIZE || MEM_REPORT_HEADER_SIZE + payload[3] > len;
+        if (query->empty)
+        {
+            return;
+        }
+        query->row_count = payload[1];
+        const uint8_t kind = payload[2];
+        const uint32_t used = read_u32(payload + 4);
+        const uint32_t max = read_u32(payload + 8);
+        const uint32_t size = read_u32(payload + 12);
+        printf("%-16.*s %-8s %8lu %8lu %8lu", payload[3], reinterpret_cast<const char *>(payload + MEM_REPORT_HEADER_SIZE),
+               kind < sizeof(KIND_NAMES) / sizeof(KIND_NAMES[0]) ? KIND_NAMES[kind] : "?", (unsigned long)used,
+               (unsigned long)max, (unsigned long)size);
+        if (size && kind != MEM_ROW_SECTION && kind != MEM_ROW_STATIC)
+        {
+            printf("  %5.1f%%", 100.0 * max / size);
+        }
+        else
+        {
+            printf("        ");
+        }
+        const uint32_t errors = read_u32(payload + 16);
+        query->rows.push_back({kind, max, size, errors});
+        if (errors)
+        {
+            printf("  %lu failed", (unsigned long)errors);
+        }
+        printf("\n");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--port N] [--check]\n", argv[0]);
+        return 2;
+    }
+    unsigned port = 4242;
+    bool check = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--check"))
+            check = true;
+        else if (i + 1 < argc && !strcmp(argv[i], "--port"))
+            port = static_cast<unsigned>(strtoul(argv[++i], nullptr, 0));
+    }
+
+    const int fd = connect_tcp(argv[1], static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    printf("%-16s %-8s %8s %8s %8s  %6s\n", "region", "kind", "used", "max", "size", "peak");
+    FrameDecoder decoder;
+    Query query;
+    for (uint8_t row = 0; row < query.row_count; ++row)
+    {
+        send_frame(fd, FRAME_MEM_QUERY, &row, 1);
+        query.answered = false;
+        while (!query.answered)
+        {
+            if (!pump_frames(fd, decoder, &on_frame, &query))
+            {
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+        }
+        if (query.empty)
+        {
+            break;
+        }
+    }
+    close(fd);
+    if (!check)
+    {
+        return 0;
+    }
+
+    bool kinds[MEM_ROW_STATIC + 1] = {};
+    bool within = true, no_errors = true;
+    for (const Row &row : query.rows)
+    {
+        if (row.kind <= MEM_ROW_STATIC)
+        {
+            kinds[row.kind] = true;
+        }
+        within &= row.size == 0 || row.kind == MEM_ROW_SECTION || row.kind == MEM_ROW_STATIC || row.max <= row.size;
+        no_errors &= row.errors == 0;
+    }
+    expect(kinds[MEM_ROW_HEAP] && kinds[MEM_ROW_POOL] && kinds[MEM_ROW_STACK] && kinds[MEM_ROW_STATIC],
+           "heap, pool, stack and static rows");
+    expect(within, "no high-water mark over its capacity");
+    expect(no_errors, "no failed allocation");
+    return failures ? 1 : 0;
+}
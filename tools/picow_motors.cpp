@@ -0,0 +1,252 @@
+// picow_motors.cpp - direction changes and PWM levels as register writes
+//
+//   picow_motors [--loops N] [--seed N]
+//
+// Motor and MotorGroup run against stand-ins for the GPIO and PWM calls that
+// record each call as one register write. On the device one
+// gpio_put_masked() is one SIO write, so pins changed by it switch on the
+// same cycle, and one pwm_set_both_levels() is one write of a slice's
+// compare register. Checks that
+//   - Motor changes direction, or brakes, with one write of both inputs
+//   - the firmware's DriveTrain changes direction and standby in one write,
+//     followed by one level write
+//   - a group of three motors, two of them on the channels of one slice,
+//     switches every direction and standby pin in one write on each drive()
+//     and brake(), for --loops (default 1000) random speed sets, then sets
+//     the shared slice with a single pwm_set_both_levels() and the other
+//     one with a single channel write, to the levels the speeds ask for
+// Exits 1 on any failure.
+#include "actuation.hpp"
+#include "tool_common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+extern "C"
+{
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+}
+
+namespace
+{
+    struct Write
+    {
+        enum Kind
+        {
+            GPIO,
+            LEVEL,
+            BOTH_LEVELS,
+        } kind;
+        uint32_t mask;  // GPIO: pins written
+        uint32_t value; // GPIO: their new levels
+        uint slice;     // LEVEL, BOTH_LEVELS
+        uint chan;      // LEVEL
+        uint16_t level[2];
+    };
+
+    std::vector<Write> writes;
+    uint32_t pins = 0;
+
+    unsigned count(Write::Kind kind)
+    {
+        unsigned n = 0;
+        for (const Write &w : writes)
+        {
+            n += w.kind == kind;
+        }
+        return n;
+    }
+
+    // pin levels of In1 and In2 for each direction
+    uint32_t dir_bits(uint in1, uint in2, int direction)
+    {
+        return direction > 0 ? 1u << in1 : direction < 0 ? 1u << in2 : (1u << in1) | (1u << in2);
+    }
+} // namespace
+
+// the register writes, recorded
+extern "C"
+{
+    void gpio_init(uint) {}
+    void gpio_set_dir(uint, bool) {}
+    void gpio_set_function(uint, enum gpio_function) {}
+    void gpio_put(uint gpio, bool value) { gpio_put_masked(1u << gpio, value ? 1u << gpio : 0u); }
+    bool gpio_get(uint gpio) { return (pins >> gpio) & 1u; }
+    void gpio_put_masked(uint32_t mask, uint32_t value)
+    {
+        pins = (pins & ~mask) | (value & mask);
+        writes.push_back({Write::GPIO, mask, value, 0, 0, {0, 0}});
+    }
+    void gpio_set_mask(uint32_t mask) { gpio_put_masked(mask, mask); }
+    void gpio_clr_mask(uint32_t mask) { gpio_put_masked(mask, 0); }
+    void gpio_pull_up(uint) {}
+
+    void pwm_set_wrap(uint, uint16_t) {}
+    void pwm_set_clkdiv(uint, float) {}
+    void pwm_set_clkdiv_int_frac(uint, uint8_t, uint8_t) {}
+    void pwm_set_enabled(uint, bool) {}
+    void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level)
+    {
+        Write w = {Write::LEVEL, 0, 0, slice_num, chan, {0, 0}};
+        w.level[chan] = level;
+        writes.push_back(w);
+    }
+    void pwm_set_both_levels(uint slice_num, uint16_t level_a, uint16_t level_b)
+    {
+        writes.push_back({Write::BOTH_LEVELS, 0, 0, slice_num, 0, {level_a, level_b}});
+    }
+}
+
+namespace
+{
+    void check_motor()
+    {
+        Motor motor(MOTOR_IN1_PIN, MOTOR_IN2_PIN, MOTOR_PWM_PIN, 1, MOTOR_STBY_PIN);
+        const uint32_t dir_mask = dir_bits(MOTOR_IN1_PIN, MOTOR_IN2_PIN, 0);
+        const int speeds[] = {100, -100, 200, 0, -1, -255, 255};
+        bool one_write = true, right_pins = true;
+        for (int speed : speeds)
+        {
+            motor.drive(speed);
+            writes.clear();
+            // a direction change, or the same direction again
+            motor.drive(-speed);
+            unsigned dir_writes = 0;
+            for (const Write &w : writes)
+            {
+                if (w.kind == Write::GPIO && (w.mask & dir_mask))
+                {
+                    dir_writes++;
+                    one_write &= (w.mask & dir_mask) == dir_mask;
+                }
+            }
+            one_write &= dir_writes == 1;
+            right_pins &= (pins & dir_mask) == dir_bits(MOTOR_IN1_PIN, MOTOR_IN2_PIN, -speed >= 0 ? 1 : -1);
+        }
+        expect(one_write && right_pins, "Motor::drive() sets In1 and In2 in one write");
+        writes.clear();
+        motor.brake();
+        expect(writes.size() == 2 && writes[0].kind == Write::GPIO && writes[0].mask == dir_mask &&
+                   (pins & dir_mask) == dir_mask,
+               "Motor::brake() sets In1 and In2 in one write");
+    }
+
+    void check_drive_train()
+    {
+        Motor motor(MOTOR_IN1_PIN, MOTOR_IN2_PIN, MOTOR_PWM_PIN, 1, MOTOR_STBY_PIN);
+        DriveTrain drive_train({&motor});
+        const uint32_t mask = dir_bits(MOTOR_IN1_PIN, MOTOR_IN2_PIN, 0) | (1u << MOTOR_STBY_PIN);
+        drive_train.drive({150});
+        writes.clear();
+        drive_train.drive({-150});
+        expect(writes.size() == 2 && writes[0].kind == Write::GPIO && writes[0].mask == mask &&
+                   writes[1].kind == Write::LEVEL && writes[1].slice == pwm_gpio_to_slice_num(MOTOR_PWM_PIN),
+               "DriveTrain reverses with one pin write, then one level write");
+        expect((pins & mask) == (dir_bits(MOTOR_IN1_PIN, MOTOR_IN2_PIN, -1) | (1u << MOTOR_STBY_PIN)) &&
+                   motor.direction() == -1 && motor.level() == 150,
+               "and the pins and the motor agree on the new direction");
+    }
+
+    void check_group(unsigned loops, std::mt19937 &rng)
+    {
+        // a and b on the two channels of slice 1 and sharing a standby pin,
+        // as on a TB6612; c on slice 5 with the other offset
+        struct Pins
+        {
+            uint in1, in2, pwm, stby;
+            int offset;
+        };
+        const Pins p[3] = {{16, 17, 2, 20, 1}, {18, 19, 3, 20, 1}, {21, 22, 10, 9, -1}};
+        Motor a(p[0].in1, p[0].in2, p[0].pwm, p[0].offset, p[0].stby);
+        Motor b(p[1].in1, p[1].in2, p[1].pwm, p[1].offset, p[1].stby);
+        Motor c(p[2].in1, p[2].in2, p[2].pwm, p[2].offset, p[2].stby);
+        MotorGroup<3> group({&a, &b, &c});
+        uint32_t mask = 0, standby = 0;
+        for (const Pins &q : p)
+        {
+            mask |= dir_bits(q.in1, q.in2, 0) | (1u << q.stby);
+            standby |= 1u << q.stby;
+        }
+        const uint shared = pwm_gpio_to_slice_num(p[0].pwm), single = pwm_gpio_to_slice_num(p[2].pwm);
+
+        unsigned pin_writes = 0, level_writes = 0, wrong_pins = 0, wrong_levels = 0, reversals = 0;
+        int last[3] = {0, 0, 0};
+        for (unsigned i = 0; i < loops; ++i)
+        {
+            std::array<int, 3> speeds;
+            for (int &s : speeds)
+            {
+                s = static_cast<int>(rng() % (2 * DEFAULTSPEED + 1)) - DEFAULTSPEED;
+            }
+            const bool braking = rng() % 8 == 0;
+            writes.clear();
+            if (braking)
+            {
+                group.brake();
+            }
+            else
+            {
+                group.drive(speeds);
+            }
+            // one pin write first, then one write per slice
+            pin_writes += count(Write::GPIO) != 1 || writes[0].kind != Write::GPIO || writes[0].mask != mask;
+            level_writes += writes.size() != 3 || count(Write::BOTH_LEVELS) != 1 || count(Write::LEVEL) != 1;
+
+            uint32_t want = standby;
+            uint16_t levels[3];
+            for (int m = 0; m < 3; ++m)
+            {
+                const int s = braking ? 0 : speeds[m] * p[m].offset;
+                const int dir = braking ? 0 : s >= 0 ? 1 : -1;
+                want |= dir_bits(p[m].in1, p[m].in2, dir);
+                levels[m] = MotorScale::level(static_cast<uint32_t>(s < 0 ? -s : s));
+                reversals += dir * last[m] < 0;
+                last[m] = dir;
+            }
+            wrong_pins += (pins & mask) != want;
+            for (const Write &w : writes)
+            {
+                if (w.kind == Write::BOTH_LEVELS)
+                {
+                    wrong_levels += w.slice != shared || w.level[0] != levels[0] || w.level[1] != levels[1];
+                }
+                else if (w.kind == Write::LEVEL)
+                {
+                    wrong_levels += w.slice != single || w.chan != PWM_CHAN_A || w.level[0] != levels[2];
+                }
+            }
+        }
+        printf("     %u drive and brake calls on 3 motors, %u of them reversed a motor\n", loops, reversals);
+        expect(pin_writes == 0, "MotorGroup sets every direction and standby pin in one write, before the levels");
+        expect(wrong_pins == 0, "and leaves each motor's pins in its new direction");
+        expect(level_writes == 0, "the shared slice gets one pwm_set_both_levels(), the other one write");
+        expect(wrong_levels == 0, "with the levels the speeds ask for");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    unsigned loops = 1000, seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--loops"))
+            loops = v;
+        else if (!strcmp(argv[i], "--seed"))
+            seed = v;
+        else
+        {
+            fprintf(stderr, "usage: %s [--loops N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+    std::mt19937 rng(seed);
+    check_motor();
+    check_drive_train();
+    check_group(loops, rng);
+    return failures ? 1 : 0;
+}
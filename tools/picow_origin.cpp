@@ -0,0 +1,157 @@
+// picow_origin.cpp - WebSocket upgrades from another site's page are refused
+//
+//   picow_origin [<host> [--http-port N]]
+//
+// Feeds HttpRequestParser upgrade requests with Host and Origin headers in
+// both orders, split into small segments, and checks same_origin(): no
+// Origin (not a browser) or one naming the Host passes; another site, a
+// longer name that starts with the Host, "null", an Origin without a
+// scheme or too long to keep, and an Origin without a Host do not.
+//
+// With a host, sends upgrade requests to its HTTP port (default 80): without
+// an Origin and with one naming the host they must get 101 Switching
+// Protocols, from another site 403 Forbidden and the connection closed.
+//
+// Exits 1 on any failure.
+#include "tool_common.hpp"
+#include "websocket.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    std::string upgrade(const char *host, const char *origin, bool origin_first)
+    {
+        const std::string h = host ? std::string("Host: ") + host + "\r\n" : "";
+        const std::string o = origin ? std::string("Origin: ") + origin + "\r\n" : "";
+        return "GET /ws HTTP/1.1\r\n" + (origin_first ? o + h : h + o) +
+               "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    }
+
+    bool parse_same_origin(const std::string &request, size_t segment)
+    {
+        HttpRequestParser parser;
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(request.data());
+        for (size_t at = 0; at < request.size() && !parser.complete(); at += segment)
+        {
+            parser.feed(p + at, std::min(segment, request.size() - at));
+        }
+        return parser.complete() && parser.wants_websocket() && parser.same_origin();
+    }
+
+    struct Case
+    {
+        const char *what;
+        const char *host;
+        const char *origin;
+        bool allowed;
+    };
+
+    const std::string long_origin = "http://" + std::string(HttpRequestParser::HOST_MAX, 'a');
+
+    const Case cases[] = {
+        {"no Origin, not a browser", "192.168.4.1", nullptr, true},
+        {"the control page itself", "192.168.4.1", "http://192.168.4.1", true},
+        {"the page on another port", "car.local:8080", "http://car.local:8080", true},
+        {"letters in another case", "Car.Local", "HTTP://car.local", true},
+        {"another site", "192.168.4.1", "http://evil.example", false},
+        {"a name starting with the host", "192.168.4.1", "http://192.168.4.1.evil.example", false},
+        {"a prefix of the host", "192.168.4.1", "http://192.168.4", false},
+        {"the host on another port", "192.168.4.1", "http://192.168.4.1:8080", false},
+        {"an opaque origin", "192.168.4.1", "null", false},
+        {"no scheme", "192.168.4.1", "192.168.4.1", false},
+        {"an Origin too long to keep", long_origin.c_str() + 7, long_origin.c_str(), false},
+        {"an Origin without a Host", nullptr, "http://192.168.4.1", false},
+    };
+
+    void check_parser()
+    {
+        for (const Case &c : cases)
+        {
+            bool right = true;
+            for (bool origin_first : {false, true})
+            {
+                const std::string request = upgrade(c.host, c.origin, origin_first);
+                for (size_t segment : {request.size(), size_t(1), size_t(7)})
+                {
+                    right &= parse_same_origin(request, segment) == c.allowed;
+                }
+            }
+            char what[96];
+            snprintf(what, sizeof(what), "%s: %s", c.what, c.allowed ? "allowed" : "refused");
+            expect(right, what);
+        }
+    }
+
+    // Status line of the answer, empty if there was none; closed tells
+    // whether the server closed the connection after it.
+    std::string ask(const char *host, uint16_t port, const std::string &request, bool &closed)
+    {
+        closed = false;
+        const int fd = connect_tcp(host, port);
+        if (fd < 0)
+        {
+            return "";
+        }
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+        std::string head;
+        char buf[512];
+        pollfd pfd = {fd, POLLIN, 0};
+        while (poll(&pfd, 1, 300) > 0)
+        {
+            const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+            {
+                closed = true;
+                break;
+            }
+            head.append(buf, static_cast<size_t>(n));
+        }
+        close(fd);
+        return head.substr(0, head.find("\r\n"));
+    }
+
+    void check_server(const char *host, uint16_t port)
+    {
+        char authority[64];
+        snprintf(authority, sizeof(authority), "%s:%u", host, port);
+        const std::string self = std::string("http://") + authority;
+        bool closed;
+        std::string status = ask(host, port, upgrade(authority, nullptr, false), closed);
+        expect(status == "HTTP/1.1 101 Switching Protocols", "server: upgrade without an Origin accepted");
+        status = ask(host, port, upgrade(authority, self.c_str(), false), closed);
+        expect(status == "HTTP/1.1 101 Switching Protocols", "server: upgrade from the control page accepted");
+        status = ask(host, port, upgrade(authority, "http://evil.example", false), closed);
+        expect(status == "HTTP/1.1 403 Forbidden" && closed, "server: upgrade from another site refused and closed");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *host = argc > 1 && argv[1][0] != '-' ? argv[1] : nullptr;
+    unsigned port = 80;
+    for (int i = host ? 2 : 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--http-port"))
+            port = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        else
+        {
+            fprintf(stderr, "usage: %s [<host> [--http-port N]]\n", argv[0]);
+            return 2;
+        }
+    }
+    check_parser();
+    if (host)
+    {
+        check_server(host, static_cast<uint16_t>(port));
+    }
+    return failures ? 1 : 0;
+}
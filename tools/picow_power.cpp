@@ -0,0 +1,535 @@
+// picow_power.cpp - the WiFi power policy, replayed and on a device
+//
+//   picow_power --replay [--trace FILE] [--seed N] [--fail-pm N]
+//   picow_power <host> [--port N] [--seconds N] [--rate HZ]
+//
+// --replay runs the firmware's PowerPolicy on the host against a stand-in
+// cyw43_wifi_pm() that records every call, on a virtual clock: update() at
+// every command and every 100 ms in between, like the main loop. The command
+// rate comes from a trace, one line per segment,
+//   <t_ms> <clients> <rate_hz>     from t_ms on, with jittered arrivals
+//   expect <t_ms> <mode>           the mode the policy must be in at t_ms
+//   end <t_ms>
+// and defaults to a built-in session: idle, a phone connecting, driving with
+// a pause, slow pokes, fast driving and leaving. It checks the expectations,
+// that every transition went to the chip with the right value, and that the
+// time in the modes adds up, then prints the transitions, the time in each
+// mode and the commands that arrived in it. --fail-pm N fails every Nth call
+// to the stand-in, which the policy has to count. Exits 1 on any mismatch.
+//
+// With a host it is the controller for three phases of --seconds (default 4)
+// each: connected without commands, driving at --rate (default 20) commands
+// per second, and stopped again. FRAME_TIME_SYNC round trips every 400 ms
+// (rarely enough for PM2 to doze in between) show the wake-up latency of
+// each phase, and FRAME_POWER_REPORT what the device did. Run the simulator
+// with PICOW_SIM_POWERSAVE=1 for dozing to cost anything there.
+#include "control_protocol.hpp"
+#include "power_policy.hpp"
+#include "tool_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+extern "C"
+{
+#include "pico/cyw43_arch.h"
+}
+
+using namespace pico_tcp;
+
+// the stand-in driver --replay runs the policy against
+cyw43_t cyw43_state;
+
+namespace
+{
+    struct PmCall
+    {
+        uint32_t t_ms;
+        uint32_t pm;
+        bool failed;
+    };
+
+    uint32_t mock_now_ms = 0;
+    unsigned mock_fail_every = 0;
+    std::vector<PmCall> pm_calls;
+} // namespace
+
+extern "C" int cyw43_wifi_pm(cyw43_t * /*self*/, uint32_t pm)
+{
+    const bool failed = mock_fail_every && (pm_calls.size() + 1) % mock_fail_every == 0;
+    pm_calls.push_back({mock_now_ms, pm, failed});
+    return failed ? -1 : 0;
+}
+
+namespace
+{
+    const char DEFAULT_TRACE[] = "0      0 0\n"
+                                 "expect 4000 connected\n"
+                                 "expect 6000 idle\n"
+                                 "10000  1 0\n"
+                                 "expect 10200 connected\n"
+                                 "15000  1 20\n"
+                                 "expect 15500 active\n"
+                                 "25000  1 0\n"
+                                 "expect 25900 active\n"
+                                 "26000  1 20\n"
+                                 "40000  1 3\n"
+                                 "expect 41000 active\n"
+                                 "expect 42500 connected\n"
+                                 "expect 49000 connected\n"
+                                 "50000  1 50\n"
+                                 "expect 50300 active\n"
+                                 "60000  0 0\n"
+                                 "expect 61500 active\n"
+                                 "expect 62500 connected\n"
+                                 "expect 66000 idle\n"
+                                 "end 80000\n";
+
+    struct Segment
+    {
+        uint32_t t_ms;
+        uint32_t clients;
+        double rate_hz;
+    };
+
+    struct Expectation
+    {
+        uint32_t t_ms;
+        std::string mode;
+    };
+
+    struct Trace
+    {
+        std::vector<Segment> segments;
+        std::vector<Expectation> expect;
+        uint32_t end_ms = 0;
+    };
+
+    bool parse_trace(const std::string &text, Trace &out)
+    {
+        size_t pos = 0;
+        unsigned line_no = 0;
+        while (pos < text.size())
+        {
+            size_t eol = text.find('\n', pos);
+            if (eol == std::string::npos)
+            {
+                eol = text.size();
+            }
+            std::string line = text.substr(pos, eol - pos);
+            pos = eol + 1;
+            ++line_no;
+            line = line.substr(0, line.find('#'));
+            char word[32];
+            unsigned t, clients;
+            double rate;
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            if (sscanf(line.c_str(), "expect %u %31s", &t, word) == 2)
+            {
+                out.expect.push_back({t, word});
+            }
+            else if (sscanf(line.c_str(), "end %u", &t) == 1)
+            {
+                out.end_ms = t;
+            }
+            else if (sscanf(line.c_str(), "%u %u %lf", &t, &clients, &rate) == 3)
+            {
+                if (!out.segments.empty() && t < out.segments.back().t_ms)
+                {
+                    fprintf(stderr, "trace line %u: segments must be in time order\n", line_no);
+                    return false;
+                }
+                out.segments.push_back({t, clients, rate});
+            }
+            else
+            {
+                fprintf(stderr, "trace line %u: cannot parse \"%s\"\n", line_no, line.c_str());
+                return false;
+            }
+        }
+        if (out.segments.empty())
+        {
+            fprintf(stderr, "trace has no segments\n");
+            return false;
+        }
+        if (!out.end_ms)
+        {
+            out.end_ms = out.segments.back().t_ms + 10000;
+        }
+        std::sort(out.expect.begin(), out.expect.end(),
+                  [](const Expectation &a, const Expectation &b) { return a.t_ms < b.t_ms; });
+        return true;
+    }
+
+    bool read_file(const char *path, std::string &out)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            perror(path);
+            return false;
+        }
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        {
+            out.append(buf, n);
+        }
+        fclose(f);
+        return true;
+    }
+
+    int replay(const Trace &trace, unsigned seed, unsigned fail_every)
+    {
+        constexpr uint32_t HOUSEKEEPING_MS = 100;
+        std::mt19937 rng(seed);
+        // WiFi delivers a stream with up to 40% jitter on every gap
+        std::uniform_real_distribution<double> jitter(0.6, 1.4);
+
+        mock_fail_every = fail_every;
+        pm_calls.clear();
+        PowerPolicy policy;
+        mock_now_ms = trace.segments.front().t_ms;
+        const uint32_t start_ms = mock_now_ms;
+        policy.begin(start_ms);
+
+        unsigned mismatches = 0;
+        uint32_t commands = 0;
+        uint32_t by_mode[POWER_REPORT_MODES] = {};
+        size_t segment = 0;
+        size_t expectation = 0;
+        double next_command_ms = -1;
+        uint32_t next_housekeeping = start_ms;
+        size_t calls_checked = 0;
+
+        for (uint32_t t = start_ms; t <= trace.end_ms; ++t)
+        {
+            mock_now_ms = t;
+            while (segment + 1 < trace.segments.size() && trace.segments[segment + 1].t_ms <= t)
+            {
+                ++segment;
+                next_command_ms = -1;
+            }
+            const Segment &seg = trace.segments[segment];
+            if (seg.rate_hz > 0 && next_command_ms < 0)
+            {
+                next_command_ms = t;
+            }
+
+            bool wake = t >= next_housekeeping;
+            while (seg.rate_hz > 0 && next_command_ms <= t)
+            {
+                // the radio was in this mode when the command came in
+                by_mode[static_cast<size_t>(policy.mode())]++;
+                commands++;
+                next_command_ms += 1000.0 / seg.rate_hz * jitter(rng);
+                wake = true;
+            }
+            if (wake)
+            {
+                if (t >= next_housekeeping)
+                {
+                    next_housekeeping += HOUSEKEEPING_MS;
+                }
+                policy.update(t, {seg.clients, commands});
+            }
+
+            // at most one call per update(), for the mode it left the policy in
+            for (; calls_checked < pm_calls.size(); ++calls_checked)
+            {
+                if (pm_calls[calls_checked].pm != power_mode_pm_value(policy.mode()))
+                {
+                    printf("FAIL at %lu ms: cyw43_wifi_pm(0x%lx) in mode %s\n", (unsigned long)t,
+                           (unsigned long)pm_calls[calls_checked].pm, power_mode_name(policy.mode()));
+                    mismatches++;
+                }
+            }
+            while (expectation < trace.expect.size() && trace.expect[expectation].t_ms <= t)
+            {
+                const Expectation &e = trace.expect[expectation++];
+                const bool ok = e.mode == power_mode_name(policy.mode());
+                printf("%s expect %-9s at %6lu ms, is %s\n", ok ? "ok  " : "FAIL", e.mode.c_str(),
+                       (unsigned long)e.t_ms, power_mode_name(policy.mode()));
+                mismatches += ok ? 0 : 1;
+            }
+        }
+        const uint32_t end_ms = trace.end_ms;
+
+        printf("\ntransitions (%lu):\n", (unsigned long)policy.transitions());
+        for (size_t i = 1; i < pm_calls.size(); ++i)
+        {
+            printf("  %7lu ms  pm 0x%06lx%s\n", (unsigned long)pm_calls[i].t_ms, (unsigned long)pm_calls[i].pm,
+                   pm_calls[i].failed ? "  (failed)" : "");
+        }
+        printf("\nmode          time ms   share   commands\n");
+        uint32_t total = 0;
+        for (size_t m = 0; m < POWER_REPORT_MODES; ++m)
+        {
+            const uint32_t ms = policy.ms_in(static_cast<PowerMode>(m), end_ms);
+            total += ms;
+            printf("%-10s %10lu  %5.1f%%  %9lu\n", power_mode_name(static_cast<PowerMode>(m)), (unsigned long)ms,
+                   100.0 * ms / std::max<uint32_t>(end_ms - start_ms, 1), (unsigned long)by_mode[m]);
+        }
+
+        if (total != end_ms - start_ms)
+        {
+            printf("FAIL: modes add up to %lu ms of %lu\n", (unsigned long)total, (unsigned long)(end_ms - start_ms));
+            mismatches++;
+        }
+        if (pm_calls.size() != policy.transitions() + 1)
+        {
+            printf("FAIL: %zu cyw43_wifi_pm() calls for %lu transitions\n", pm_calls.size(),
+                   (unsigned long)policy.transitions());
+            mismatches++;
+        }
+        const uint32_t failed_calls =
+            static_cast<uint32_t>(std::count_if(pm_calls.begin(), pm_calls.end(), [](const PmCall &c) { return c.failed; }));
+        if (policy.errors() != failed_calls)
+        {
+            printf("FAIL: %lu errors counted, %lu calls failed\n", (unsigned long)policy.errors(),
+                   (unsigned long)failed_calls);
+            mismatches++;
+        }
+        printf("\n%u commands, %s\n", commands, mismatches ? "FAILED" : "all checks passed");
+        return mismatches ? 1 : 0;
+    }
+
+    uint64_t now_us()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    struct Session
+    {
+        bool hello = false;
+        bool controller = false;
+        std::vector<uint32_t> rtt_us; // of the current phase
+        bool have_report = false;
+        std::vector<uint8_t> report;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Session *s = static_cast<Session *>(arg);
+        switch (type)
+        {
+        case FRAME_HELLO:
+            if (len >= HELLO_PAYLOAD_SIZE)
+            {
+                s->hello = true;
+                s->controller = payload[2] == 0;
+            }
+            break;
+        case FRAME_TIME_REPLY:
+            if (len >= TIME_REPLY_PAYLOAD_SIZE)
+            {
+                const uint64_t t0 = read_u32(payload) | static_cast<uint64_t>(read_u32(payload + 4)) << 32;
+                s->rtt_us.push_back(static_cast<uint32_t>(now_us() - t0));
+            }
+            break;
+        case FRAME_POWER_REPORT:
+            s->report.assign(payload, payload + len);
+            s->have_report = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    bool pump(int fd, FrameDecoder &decoder, Session &s, int timeout_ms)
+    {
+        pollfd pfd = {fd, POLLIN, 0};
+        return poll(&pfd, 1, timeout_ms) <= 0 || pump_frames(fd, decoder, &on_frame, &s);
+    }
+
+    void print_report(const std::vector<uint8_t> &r)
+    {
+        if (r.size() < POWER_REPORT_HEADER_SIZE)
+        {
+            printf("no power report (firmware without a power policy?)\n");
+            return;
+        }
+        const size_t modes = r[1];
+        const size_t count = r[2];
+        if (r.size() < POWER_REPORT_HEADER_SIZE + 4 * modes + POWER_TRANSITION_SIZE * count)
+        {
+            printf("short power report\n");
+            return;
+        }
+        const uint32_t now_ms = read_u32(&r[4]);
+        printf("device power mode %s at %lu ms, %lu transitions, %lu errors\n",
+               power_mode_name(static_cast<PowerMode>(r[0])), (unsigned long)now_ms, (unsigned long)read_u32(&r[8]),
+               (unsigned long)read_u32(&r[12]));
+        const uint8_t *p = &r[POWER_REPORT_HEADER_SIZE];
+        for (size_t m = 0; m < modes; ++m, p += 4)
+        {
+            printf("  %-10s %10lu ms\n", power_mode_name(static_cast<PowerMode>(m)), (unsigned long)read_u32(p));
+        }
+        for (size_t i = 0; i < count; ++i, p += POWER_TRANSITION_SIZE)
+        {
+            printf("  %9lu ms ago  %s -> %s\n", (unsigned long)(now_ms - read_u32(p)),
+                   power_mode_name(static_cast<PowerMode>(p[4])), power_mode_name(static_cast<PowerMode>(p[5])));
+        }
+    }
+
+    void print_rtt(const char *phase, std::vector<uint32_t> &rtt)
+    {
+        if (rtt.empty())
+        {
+            printf("%-9s no round trips\n", phase);
+            return;
+        }
+        std::sort(rtt.begin(), rtt.end());
+        printf("%-9s round trip us  n %zu  p50 %lu  p90 %lu  max %lu\n", phase, rtt.size(),
+               (unsigned long)rtt[rtt.size() / 2], (unsigned long)rtt[rtt.size() * 9 / 10],
+               (unsigned long)rtt.back());
+    }
+
+    int live(const char *host, unsigned port, unsigned seconds, unsigned rate)
+    {
+        const int fd = connect_tcp(host, static_cast<uint16_t>(port));
+        if (fd < 0)
+        {
+            return 1;
+        }
+        Session s;
+        FrameDecoder decoder;
+        while (!s.hello)
+        {
+            if (!pump_frames(fd, decoder, &on_frame, &s))
+            {
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+        }
+        if (!s.controller)
+        {
+            fprintf(stderr, "not the controller, commands will be ignored\n");
+            return 1;
+        }
+
+        const struct
+        {
+            const char *name;
+            bool drive;
+        } phases[] = {{"connected", false}, {"driving", true}, {"stopped", false}};
+        uint16_t seq = 0;
+        for (const auto &phase : phases)
+        {
+            s.rtt_us.clear();
+            const uint64_t start = now_us();
+            const uint64_t end = start + seconds * 1000000ull;
+            uint64_t next_command = start;
+            uint64_t next_sync = start + 200000;
+            while (now_us() < end)
+            {
+                const uint64_t now = now_us();
+                if (phase.drive && now >= next_command)
+                {
+                    ControlCommand cmd = {};
+                    cmd.seq = seq;
+                    cmd.drive = static_cast<int16_t>(120 * sin(seq * 0.05));
+                    cmd.steer = 90;
+                    uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+                    encode_control(cmd, frame, sizeof(frame));
+                    send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+                    ++seq;
+                    next_command += 1000000 / rate;
+                }
+                if (now >= next_sync)
+                {
+                    uint8_t payload[TIME_SYNC_PAYLOAD_SIZE];
+                    write_u32(payload, static_cast<uint32_t>(now));
+                    write_u32(payload + 4, static_cast<uint32_t>(now >> 32));
+                    send_frame(fd, FRAME_TIME_SYNC, payload, sizeof(payload));
+                    next_sync += 400000;
+                }
+                if (!pump(fd, decoder, s, 1))
+                {
+                    fprintf(stderr, "connection closed\n");
+                    return 1;
+                }
+            }
+            print_rtt(phase.name, s.rtt_us);
+        }
+
+        send_frame(fd, FRAME_POWER_QUERY, nullptr, 0);
+        const uint64_t deadline = now_us() + 2000000;
+        while (!s.have_report && now_us() < deadline)
+        {
+            if (!pump(fd, decoder, s, 10))
+            {
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+        }
+        close(fd);
+        print_report(s.report);
+        return s.have_report ? 0 : 1;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,
+                "usage: %s --replay [--trace FILE] [--seed N] [--fail-pm N]\n"
+                "       %s <host> [--port N] [--seconds N] [--rate HZ]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    const bool replay_mode = !strcmp(argv[1], "--replay");
+    const char *trace_file = nullptr;
+    unsigned port = 4242, seconds = 4, rate = 20, seed = 1, fail_every = 0;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--seconds"))
+            seconds = v ? v : 1;
+        else if (!strcmp(argv[i], "--rate"))
+            rate = v ? v : 1;
+        else if (!strcmp(argv[i], "--trace"))
+            trace_file = argv[i + 1];
+        else if (!strcmp(argv[i], "--seed"))
+            seed = v;
+        else if (!strcmp(argv[i], "--fail-pm"))
+            fail_every = v;
+    }
+    if (!replay_mode)
+    {
+        return live(argv[1], port, seconds, rate);
+    }
+
+    std::string text = DEFAULT_TRACE;
+    if (trace_file)
+    {
+        text.clear();
+        if (!read_file(trace_file, text))
+        {
+            return 1;
+        }
+    }
+    Trace trace;
+    if (!parse_trace(text, trace))
+    {
+        return 1;
+    }
+    return replay(trace, seed, fail_every);
+}
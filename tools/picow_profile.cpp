@@ -0,0 +1,114 @@
+// picow_profile.cpp - Linux client that prints the firmware's stage timings
+//
+//   picow_profile <host> [--port N]
+//
+// Queries every stage with FRAME_PROFILE_QUERY and prints count, min, mean and
+// max in microseconds plus the non-empty log2 buckets. The firmware has to be
+// built with -DPICOW_PROFILE=ON, otherwise it answers with empty reports.
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace pico_tcp;
+
+namespace
+{
+    const char *const STAGE_NAMES[] = {
+        "apply_motor", "apply_servo", "sample", "motion_tick", "poll",
+        "housekeeping", "wait", "tcp_accept", "tcp_recv", "tcp_sent", "log_drain",
+    };
+
+    struct Query
+    {
+        bool answered;
+        bool empty;
+        uint8_t stage_count;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Query *query = static_cast<Query *>(arg);
+        if (type != FRAME_PROFILE_REPORT)
+        {
+            return;
+        }
+        query->answered = true;
+        query->empty = len < PROFILE_REPORT_HEADER_SIZE;
+        if (query->empty)
+        {
+            return;
+        }
+        const uint8_t stage = payload[0];
+        const uint16_t buckets = read_u16(payload + 2);
+        const uint32_t per_us = read_u32(payload + 4) / 1000000;
+        query->stage_count = payload[1];
+        if (per_us == 0 || PROFILE_REPORT_HEADER_SIZE + 4u * buckets > len)
+        {
+            return;
+        }
+
+        const char *name = stage < sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) ? STAGE_NAMES[stage] : "?";
+        printf("%-12s n=%-8lu min %.2f us  mean %.2f us  max %.2f us\n", name, (unsigned long)read_u32(payload + 8),
+               read_u32(payload + 12) / double(per_us), read_u32(payload + 20) / double(per_us),
+               read_u32(payload + 16) / double(per_us));
+        for (uint16_t b = 0; b < buckets; ++b)
+        {
+            const uint32_t n = read_u32(payload + PROFILE_REPORT_HEADER_SIZE + 4 * b);
+            if (n)
+            {
+                const double upper = b == 0 ? 0.0 : double((uint64_t(1) << b) - 1);
+                printf("    <= %10.2f us  %lu\n", upper / per_us, (unsigned long)n);
+            }
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--port N]\n", argv[0]);
+        return 2;
+    }
+    unsigned port = 4242;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--port"))
+            port = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+    }
+
+    const int fd = connect_tcp(argv[1], static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    FrameDecoder decoder;
+    Query query = {false, false, 1};
+    for (uint8_t stage = 0; stage < query.stage_count; ++stage)
+    {
+        send_frame(fd, FRAME_PROFILE_QUERY, &stage, 1);
+        query.answered = false;
+        while (!query.answered)
+        {
+            if (!pump_frames(fd, decoder, &on_frame, &query))
+            {
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+        }
+        if (query.empty)
+        {
+            if (stage == 0)
+            {
+                fprintf(stderr, "no profile data, build the firmware with -DPICOW_PROFILE=ON\n");
+            }
+            break;
+        }
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,250 @@
+// picow_ramp.cpp - RampAxis against the analytic minimum-time profile
+//
+//   picow_ramp [--seed N] [--csv FILE]
+//
+// A RampAxis limits the rate to V and changes it by at most A per second,
+// so the fastest way to a new target is a trapezoid (or a triangle when the
+// distance is short): speed up at A, cruise at V, and brake at A to arrive at
+// rest. From rest over a distance D that takes
+//   D/V + V/A          if D >= V^2/A
+//   2 sqrt(D/A)        otherwise
+// and from a rate v0 it takes the braking time v0/A first whenever the
+// target is behind the point where braking at A would stop.
+//
+// For DRIVE_LIMITS, STEER_LIMITS and SPEED_LIMITS, steps of many sizes from
+// rest, retargets while cruising (further on, or short of where braking
+// could stop, or behind, a reversal) and jump_to() are run tick by tick and
+// the time until the axis has settled on its target is compared with the
+// analytic one. On the way the rate must stay within V, change by at most
+// A per tick, and a step from rest must not overshoot. --csv writes one line
+// per case. Exits 1 if any case is off by more than 1% + 3 ticks.
+#include "actuation.hpp"
+#include "motion_profile.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+namespace
+{
+    constexpr double TICK_S = 1.0 / MOTION_TICK_HZ;
+
+    // Minimum time to come to rest on a target distance d ahead (d may be
+    // negative, behind) starting at rate v0 (positive towards d > 0).
+    double analytic_s(double d, double v0, double vmax, double a)
+    {
+        if (d < 0)
+        {
+            d = -d;
+            v0 = -v0;
+        }
+        if (v0 < 0 || v0 * v0 / (2 * a) > d)
+        {
+            // moving away, or too fast to stop in time: brake first, then
+            // start over from rest
+            const double brake = std::fabs(v0) / a;
+            const double travel = v0 * std::fabs(v0) / (2 * a);
+            return brake + analytic_s(d - travel, 0, vmax, a);
+        }
+        const double peak = std::min(vmax, std::sqrt(a * d + v0 * v0 / 2));
+        const double up = (peak - v0) / a;
+        const double down = peak / a;
+        const double ramps = (peak * peak - v0 * v0) / (2 * a) + peak * peak / (2 * a);
+        return up + down + (d - ramps) / peak;
+    }
+
+    struct Limits
+    {
+        const char *name;
+        MotionLimits limits;
+        int32_t range; // largest step
+    };
+
+    struct Tally
+    {
+        unsigned cases = 0;
+        unsigned failed = 0;
+        double worst = 0; // largest error beyond the analytic time, in ticks
+        FILE *csv = nullptr;
+    };
+
+    void report(Tally &t, const Limits &l, const char *kind, int32_t from, int32_t to, double v0, int ticks,
+                double expected_s, bool ok, const char *why)
+    {
+        const double expected = expected_s / TICK_S;
+        const double off = ticks - expected;
+        const bool in_time = std::fabs(off) <= 0.01 * expected + 3;
+        t.cases++;
+        t.worst = std::max(t.worst, std::fabs(off));
+        if (!ok || !in_time)
+        {
+            if (++t.failed <= 10)
+            {
+                fprintf(stderr, "%s %s %d -> %d at %.0f/s: %d ticks, analytic %.1f%s%s\n", l.name, kind, from, to, v0,
+                        ticks, expected, ok ? "" : ", ", ok ? "" : why);
+            }
+        }
+        if (t.csv)
+        {
+            fprintf(t.csv, "%s,%s,%d,%d,%.0f,%d,%.1f\n", l.name, kind, from, to, v0, ticks, expected);
+        }
+    }
+
+    // Tick until settled on the target. Checks the rate and acceleration
+    // limits on the way, and that the output never passes the target when
+    // monotonic is set. Returns the ticks taken, or -1 after 60 s.
+    int run(RampAxis &axis, const MotionLimits &m, bool monotonic, int32_t from, bool &ok, const char *&why)
+    {
+        const int32_t target = axis.target();
+        const double vmax = m.rate_per_s, a = m.jerk_per_s2;
+        double last_rate = axis.rate_per_s();
+        for (int tick = 1; tick <= 60 * static_cast<int>(MOTION_TICK_HZ); ++tick)
+        {
+            const int32_t out = axis.step();
+            const double rate = axis.rate_per_s();
+            if (std::fabs(rate) > vmax + 1)
+            {
+                ok = false;
+                why = "rate above the limit";
+            }
+            // rate_per_s() rounds towards zero, one unit per second each way
+            if (std::fabs(rate - last_rate) > a * TICK_S + 2)
+            {
+                ok = false;
+                why = "rate changed faster than the limit";
+            }
+            if (monotonic && (target > from ? out > target : out < target))
+            {
+                ok = false;
+                why = "overshoot";
+            }
+            last_rate = rate;
+            if (axis.settled())
+            {
+                return tick;
+            }
+        }
+        ok = false;
+        why = "never settled";
+        return -1;
+    }
+
+    void check(const Limits &l, std::mt19937 &rng, Tally &t)
+    {
+        const MotionLimits &m = l.limits;
+        const double vmax = m.rate_per_s, a = m.jerk_per_s2;
+
+        // steps from rest, short ones (triangles) to the full range
+        for (int i = 0; i < 200; ++i)
+        {
+            const int32_t distance = 1 + static_cast<int32_t>(rng() % l.range);
+            const int32_t from = static_cast<int32_t>(rng() % (l.range + 1)) - l.range / 2;
+            const int32_t to = rng() % 2 ? from + distance : from - distance;
+            RampAxis axis(from, m);
+            axis.set_target(to);
+            bool ok = true;
+            const char *why = "";
+            const int ticks = run(axis, m, true, from, ok, why);
+            report(t, l, "step", from, to, 0, ticks, analytic_s(to - from, 0, vmax, a), ok, why);
+        }
+
+        // retargets while cruising at full rate towards +range: further on,
+        // short of the stopping point (overshoot unavoidable) and behind
+        const double cruise_ticks = vmax / a * MOTION_TICK_HZ + 50;
+        for (int i = 0; i < 100; ++i)
+        {
+            RampAxis axis(0, m);
+            axis.set_target(100 * l.range);
+            for (int k = 0; k < cruise_ticks; ++k)
+            {
+                axis.step();
+            }
+            const int32_t at = axis.output();
+            const double v0 = axis.rate_per_s();
+            const char *kind;
+            int32_t to;
+            switch (i % 3)
+            {
+            case 0:
+                kind = "further";
+                to = at + static_cast<int32_t>(vmax * vmax / (2 * a)) + 1 + static_cast<int32_t>(rng() % l.range);
+                break;
+            case 1:
+                kind = "short";
+                to = at + static_cast<int32_t>(rng() % static_cast<uint32_t>(vmax * vmax / (2 * a)));
+                break;
+            default:
+                kind = "reversal";
+                to = at - 1 - static_cast<int32_t>(rng() % l.range);
+                break;
+            }
+            axis.set_target(to);
+            bool ok = true;
+            const char *why = "";
+            const int ticks = run(axis, m, false, at, ok, why);
+            report(t, l, kind, at, to, v0, ticks, analytic_s(to - at, v0, vmax, a), ok, why);
+        }
+
+        // jump_to() arrives on the next tick, at rest, from any motion
+        RampAxis axis(0, m);
+        axis.set_target(l.range);
+        for (int k = 0; k < 100; ++k)
+        {
+            axis.step();
+        }
+        axis.jump_to(-l.range / 2);
+        const int32_t out = axis.step();
+        const bool ok = out == -l.range / 2 && axis.settled();
+        report(t, l, "jump", 0, -l.range / 2, 0, ok ? 1 : -1, TICK_S, ok, "jump_to() did not arrive at once");
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    unsigned seed = 1;
+    const char *csv = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--seed"))
+            seed = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        else if (!strcmp(argv[i], "--csv"))
+            csv = argv[i + 1];
+        else
+        {
+            fprintf(stderr, "usage: %s [--seed N] [--csv FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    Tally t;
+    if (csv)
+    {
+        t.csv = fopen(csv, "w");
+        if (!t.csv)
+        {
+            perror(csv);
+            return 1;
+        }
+        fprintf(t.csv, "axis,case,from,to,rate,ticks,analytic_ticks\n");
+    }
+    const Limits axes[] = {
+        {"drive", DRIVE_LIMITS, 510},
+        {"steer", STEER_LIMITS, 180},
+        {"speed", SPEED_LIMITS, 2 * SPEED_MAX_MM_S},
+    };
+    std::mt19937 rng(seed);
+    for (const Limits &l : axes)
+    {
+        const Tally before = t;
+        t.worst = 0;
+        check(l, rng, t);
+        printf("%-6s rate %5u/s, %6u/s^2: %u cases, %u off, worst %.1f ticks from the analytic time\n", l.name,
+               l.limits.rate_per_s, l.limits.jerk_per_s2, t.cases - before.cases, t.failed - before.failed, t.worst);
+    }
+    if (t.csv)
+    {
+        fclose(t.csv);
+    }
+    return t.failed ? 1 : 0;
+}
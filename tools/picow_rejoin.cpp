@@ -0,0 +1,308 @@
+// picow_rejoin.cpp - rejoining after the access point goes away
+//
+//   picow_rejoin [--outage MS]
+//   picow_rejoin <host> [--port N] [--seconds N]
+//
+// Without a host, WifiLink runs in this process against the simulator's
+// cyw43 and lwIP stand-ins, on a virtual clock that moves 1 ms per pass of
+// the main loop. After boot the access point goes away for --outage ms
+// (default 12000); a join to the cached AP takes 40 ms to fail, a scan
+// 300 ms, and the lease after the outage is a new address. Checks that
+//   - poll() reports Lost once, and Readdressed with the new address when
+//     the lease arrives
+//   - the attempts alternate between the cached AP and a scan, and the
+//     pause after each failed one doubles from 250 ms up to 4 s
+//   - no poll() call waits for the radio: the longest one takes under 5 ms
+//     of wall time, and the whole run well under 10 s
+// and prints each attempt with its pause.
+//
+// With a host, usually the simulator started with PICOW_SIM_LINK_DROP and
+// PICOW_SIM_LEASE_CHANGES=1, a controller streams commands at 50 Hz until
+// the server restart after the new lease closes its connection. It then
+// reconnects, must be the controller again and have a command applied
+// within --seconds (default 20). Prints the time from the last command
+// applied before the outage to the first one after it.
+//
+// Exits 1 on any failure.
+#include "control_protocol.hpp"
+#include "sim.hpp"
+#include "tool_common.hpp"
+#include "wifi_link.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    double wall_ms()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    constexpr uint32_t CACHED_JOIN_MS = 40;
+    constexpr uint32_t SCAN_JOIN_MS = 300;
+    constexpr uint32_t OUTAGE_AT_MS = 1000;
+
+    void check_backoff(uint32_t outage_ms)
+    {
+        char drop[32];
+        snprintf(drop, sizeof(drop), "%u:%u", OUTAGE_AT_MS, outage_ms);
+        setenv("PICOW_SIM_LINK_DROP", drop, 1);
+        setenv("PICOW_SIM_LEASE_CHANGES", "1", 1);
+        setenv("PICOW_SIM_FAST_JOIN_MS", "40", 1);
+        setenv("PICOW_SIM_SCAN_MS", "300", 1);
+        setenv("PICOW_SIM_DHCP_MS", "150", 1);
+
+        // boots in real time, then the virtual clock takes over
+        WifiLink link("sim", "password", 0);
+        if (link.connect(1))
+        {
+            expect(false, "boot join");
+            return;
+        }
+        const uint32_t boot_address = link.address();
+        uint64_t t = time_us_64();
+        sim::use_manual_clock(t);
+
+        std::vector<uint64_t> attempts; // start times
+        unsigned lost = 0, readdressed = 0, restored = 0;
+        uint64_t lost_us = 0, readdressed_us = 0;
+        double slowest = 0;
+        const uint64_t end = 1000ull * (OUTAGE_AT_MS + outage_ms + 2 * WIFI_REJOIN_BACKOFF_MAX_MS + 1000);
+        // a poll() that waits for the radio sleeps in wall time; give up on it
+        const double give_up = wall_ms() + 10000;
+        while (t < end && wall_ms() < give_up)
+        {
+            t += 1000;
+            sim::set_time_us(t);
+            const uint32_t before = link.stats().rejoin_attempts;
+            const double start = wall_ms();
+            const LinkEvent event = link.poll();
+            slowest = std::max(slowest, wall_ms() - start);
+            if (link.stats().rejoin_attempts != before)
+            {
+                attempts.push_back(t);
+            }
+            switch (event)
+            {
+            case LinkEvent::Lost:
+                lost++;
+                lost_us = t;
+                break;
+            case LinkEvent::Restored:
+                restored++;
+                break;
+            case LinkEvent::Readdressed:
+                readdressed++;
+                readdressed_us = t;
+                break;
+            case LinkEvent::None:
+                break;
+            }
+        }
+
+        printf("     link lost at %.0f ms, %zu attempts\n", lost_us / 1000.0, attempts.size());
+        bool alternating = true, doubling = true;
+        uint32_t backoff = WIFI_REJOIN_BACKOFF_MS;
+        for (size_t i = 0; i + 1 < attempts.size(); ++i)
+        {
+            // the cached AP first, then a scan, and so on
+            const bool cached = i % 2 == 0;
+            const double gap = (attempts[i + 1] - attempts[i]) / 1000.0;
+            const double pause = gap - (cached ? CACHED_JOIN_MS : SCAN_JOIN_MS);
+            printf("     attempt %zu at %7.0f ms  %-9s  pause %5.0f ms, backoff %4u ms\n", i + 1,
+                   attempts[i] / 1000.0, cached ? "cached AP" : "scan", pause, backoff);
+            // a poll or two to see the failure and start the next attempt;
+            // a join of the wrong kind is 260 ms off
+            alternating &= pause > backoff - 100.0 && pause < backoff + 100.0;
+            doubling &= pause >= backoff && pause <= backoff + 5.0;
+            backoff = std::min(backoff * 2, WIFI_REJOIN_BACKOFF_MAX_MS);
+        }
+        if (!attempts.empty())
+        {
+            printf("     attempt %zu at %7.0f ms  joined\n", attempts.size(), attempts.back() / 1000.0);
+        }
+        printf("     readdressed at %.0f ms, %u restored before the lease, slowest poll() %.3f ms\n",
+               readdressed_us / 1000.0, restored, slowest);
+
+        expect(lost == 1 && lost_us >= 1000ull * OUTAGE_AT_MS, "poll() reports the link lost once");
+        expect(attempts.size() >= 6 && attempts.front() - lost_us < 5000,
+               "rejoining starts at once and keeps going through the outage");
+        expect(alternating, "attempts alternate between the cached AP and a scan");
+        expect(doubling, "the pause doubles from 250 ms up to 4 s");
+        expect(readdressed == 1 && readdressed_us >= 1000ull * (OUTAGE_AT_MS + outage_ms) &&
+                   link.address() != boot_address,
+               "poll() reports Readdressed with the new lease");
+        expect(link.stats().outages == 1 && link.stats().rejoin_attempts == attempts.size(),
+               "LinkStats counts one outage and every attempt");
+        expect(slowest < 5.0 && t >= end, "no poll() call waits for the radio");
+    }
+
+    // end to end against a running simulator
+
+    struct Client
+    {
+        int fd = -1;
+        bool closed = false;
+        int role = -1;
+        unsigned hellos = 0;
+        std::vector<uint16_t> applied;
+        FrameDecoder decoder;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Client *c = static_cast<Client *>(arg);
+        if (type == FRAME_HELLO && len >= HELLO_PAYLOAD_SIZE)
+        {
+            c->role = payload[2];
+            c->hellos++;
+        }
+        else if (type == FRAME_COMMAND_STAMPS && len >= COMMAND_STAMPS_HEADER_SIZE)
+        {
+            const uint8_t count = payload[0], size = payload[1];
+            for (uint8_t i = 0; i < count && COMMAND_STAMPS_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+            {
+                CommandStamp stamp;
+                decode_command_stamp(payload + COMMAND_STAMPS_HEADER_SIZE + size_t(i) * size, stamp);
+                c->applied.push_back(stamp.seq);
+            }
+        }
+    }
+
+    void pump(Client &c, unsigned ms)
+    {
+        pollfd pfd = {c.fd, POLLIN, 0};
+        if (!c.closed && poll(&pfd, 1, static_cast<int>(ms)) > 0 && !pump_frames(c.fd, c.decoder, &on_frame, &c))
+        {
+            c.closed = true;
+        }
+    }
+
+    bool join(Client &c, const char *host, uint16_t port)
+    {
+        c = Client();
+        c.fd = connect_tcp(host, port);
+        if (c.fd < 0)
+        {
+            return false;
+        }
+        for (int i = 0; i < 20 && !c.hellos && !c.closed; ++i)
+        {
+            pump(c, 10);
+        }
+        const uint8_t topics = SUBSCRIBE_COMMAND_STAMPS;
+        send_frame(c.fd, FRAME_SUBSCRIBE, &topics, 1);
+        return c.hellos > 0;
+    }
+
+    void send_command(Client &c, uint16_t seq)
+    {
+        ControlCommand cmd = {seq, 0, 90, 0};
+        uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+        encode_control(cmd, frame, sizeof(frame));
+        send_frame(c.fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+    }
+
+    void check_restart(const char *host, uint16_t port, unsigned seconds)
+    {
+        Client c;
+        if (!join(c, host, port))
+        {
+            expect(false, "connect and HELLO");
+            return;
+        }
+        expect(c.role == 0, "first client is the controller");
+        uint16_t seq = static_cast<uint16_t>(time(nullptr) * 997);
+        const double start = wall_ms();
+        double last_applied = 0, closed_at = 0;
+        size_t seen = 0;
+        while (!c.closed && wall_ms() - start < seconds * 1000.0)
+        {
+            send_command(c, seq++);
+            pump(c, 20);
+            if (c.applied.size() != seen)
+            {
+                seen = c.applied.size();
+                last_applied = wall_ms();
+            }
+        }
+        closed_at = wall_ms();
+        expect(c.closed, "the server restart closes the connection");
+        const bool quiet = closed_at - last_applied > 200;
+        expect(quiet, "after a gap in applied commands, the outage");
+        close(c.fd);
+
+        // the server listens again at once; before the restart has run the
+        // connection may still go to the old listener
+        bool back = false;
+        double first_applied = 0;
+        while (!back && wall_ms() - start < seconds * 1000.0)
+        {
+            if (join(c, host, port) && c.role == 0)
+            {
+                const uint16_t probe = seq++;
+                for (int i = 0; i < 25 && !back && !c.closed; ++i)
+                {
+                    send_command(c, probe);
+                    pump(c, 20);
+                    for (uint16_t s : c.applied)
+                    {
+                        back |= s == probe;
+                    }
+                }
+                first_applied = wall_ms();
+            }
+            if (!back)
+            {
+                close(c.fd);
+                pump(c, 100);
+            }
+        }
+        expect(back, "a new connection is the controller and its command is applied");
+        if (back)
+        {
+            printf("     commands applied again %.0f ms after the last one before the outage, %.0f ms after the restart\n",
+                   first_applied - last_applied, first_applied - closed_at);
+        }
+        close(c.fd);
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *host = argc > 1 && argv[1][0] != '-' ? argv[1] : nullptr;
+    unsigned outage = 12000, port = 4242, seconds = 20;
+    for (int i = host ? 2 : 1; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--outage"))
+            outage = v;
+        else if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--seconds"))
+            seconds = v;
+        else
+        {
+            fprintf(stderr, "usage: %s [--outage MS]\n       %s <host> [--port N] [--seconds N]\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+    if (host)
+    {
+        check_restart(host, static_cast<uint16_t>(port), seconds);
+    }
+    else
+    {
+        check_backoff(outage);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+// picow_replay.cpp - replay a downloaded command journal through the actuation code
+//
+//   PICOW_SIM_TRACE=replay.csv picow_replay journal.csv [--counts FILE] [--tail-ms N]
+//
+// Builds the same Motor, Servo and Actuation the firmware uses, on the host PWM
+// and GPIO stand-ins, and steps it one motion tick at a time on a virtual
+// clock. Every journal entry is handed over at the tick number it was recorded
+// at, so the PWM trace matches what the device wrote, tick for tick. That
+// includes a trajectory: the motion tick journals each point once, as it takes
+// it in (source COMMAND_SOURCE_TRAJECTORY), and the replay queues it in a
+// TrajectoryPlayer of its own on the same tick, which then plays the same
+// setpoints as the device's. After the last entry the ramps run on for
+// --tail-ms (default 1000) so they can settle.
+//
+// The replay starts from the boot state (brake, servo centred); a journal that
+// has wrapped starts mid-run and only matches from the first full ramp on.
+//
+// In speed mode the output depends on the wheel. The device journals the
+// encoder count of every tick that closes the speed loop, and of the ticks
+// its speed was measured over when the loop closed, in a journal of its own;
+// picow_journal --counts downloads them and the replay feeds them from
+// --counts to the speed loop on the same ticks. Without any, speed setpoints
+// are replayed on feedforward, as on a device without an encoder. A tick that
+// closes the loop with no count for it (the count journal wrapped, or was
+// downloaded without --follow) is counted, the first one is reported, and the
+// exit status is 1: the trace is only right up to there.
+//
+// Each tick is timed on the host and a summary goes to stderr, so a change to
+// the ramps or the output path that makes a tick slower shows up when the same
+// journal is replayed before and after it.
+#include "actuation.hpp"
+#include "control_protocol.hpp"
+#include "histogram.hpp"
+#include "sim.hpp"
+#include "trajectory.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace pico_tcp;
+
+namespace
+{
+    bool load_journal(const char *path, std::vector<JournalEntry> &out)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            perror(path);
+            return false;
+        }
+        char line[128];
+        while (fgets(line, sizeof(line), f))
+        {
+            unsigned long t_us, tick, point_t_us;
+            unsigned source, flags, steer, lead_ms;
+            int drive;
+            // the header line does not parse and is skipped
+            if (sscanf(line, "%lu,%lu,%u,%u,%d,%u,%u,%lu", &t_us, &tick, &source, &flags, &drive, &steer, &lead_ms,
+                       &point_t_us) != 8)
+            {
+                continue;
+            }
+            JournalEntry e;
+            e.t_us = static_cast<uint32_t>(t_us);
+            e.tick = static_cast<uint32_t>(tick);
+            e.source = static_cast<uint8_t>(source);
+            e.flags = static_cast<uint8_t>(flags);
+            e.drive = static_cast<int16_t>(drive);
+            e.steer = static_cast<uint16_t>(steer);
+            e.lead_ms = static_cast<uint16_t>(lead_ms);
+            e.point_t_us = static_cast<uint32_t>(point_t_us);
+            out.push_back(e);
+        }
+        fclose(f);
+        return true;
+    }
+
+    bool load_counts(const char *path, std::unordered_map<uint32_t, uint32_t> &out)
+    {
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            perror(path);
+            return false;
+        }
+        char line[64];
+        while (fgets(line, sizeof(line), f))
+        {
+            unsigned long tick, count;
+            // the header line does not parse and is skipped
+            if (sscanf(line, "%lu,%lu", &tick, &count) == 2)
+            {
+                out[static_cast<uint32_t>(tick)] = static_cast<uint32_t>(count);
+            }
+        }
+        fclose(f);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <journal.csv> [--counts FILE] [--tail-ms N]\n", argv[0]);
+        return 2;
+    }
+    uint32_t tail_ticks = MOTION_TICK_HZ;
+    const char *counts_path = nullptr;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--tail-ms"))
+            tail_ticks = static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 0) * MOTION_TICK_HZ / 1000);
+        else if (!strcmp(argv[i], "--counts"))
+            counts_path = argv[i + 1];
+    }
+
+    // setpoints and trajectory points in the order they were handed over,
+    // encoder counts by tick
+    std::vector<JournalEntry> journal;
+    std::unordered_map<uint32_t, uint32_t> counts;
+    if (!load_journal(argv[1], journal) || (counts_path && !load_counts(counts_path, counts)))
+    {
+        return 1;
+    }
+    size_t speed_setpoints = 0;
+    for (const JournalEntry &e : journal)
+    {
+        const uint8_t speed = e.source == COMMAND_SOURCE_TRAJECTORY ? uint8_t(TRAJECTORY_FLAG_SPEED)
+                                                                    : uint8_t(CONTROL_FLAG_SPEED);
+        speed_setpoints += (e.flags & speed) != 0;
+    }
+    if (journal.empty())
+    {
+        fprintf(stderr, "%s: no setpoints\n", argv[1]);
+        return 1;
+    }
+
+    // the trace carries device time, one motion tick per virtual millisecond;
+    // it starts early enough for the counts the speed loop first measured over
+    const uint64_t tick_us = 1000000 / MOTION_TICK_HZ;
+    uint32_t first_tick = journal.front().tick;
+    for (const auto &c : counts)
+    {
+        first_tick = std::min(first_tick, c.first);
+    }
+    const uint64_t t0 = journal.front().t_us - (journal.front().tick - first_tick) * tick_us;
+    sim::use_manual_clock(t0);
+
+    Motor motor(MOTOR_IN1_PIN, MOTOR_IN2_PIN, MOTOR_PWM_PIN, 1, MOTOR_STBY_PIN);
+    Servo servo(SERVO_PWM_PIN);
+    DriveTrain drive_train({&motor});
+    Actuation actuation(drive_train, servo);
+    volatile uint32_t encoder_count = 0;
+    if (!counts.empty())
+    {
+        actuation.set_encoder(&encoder_count);
+    }
+    actuation.start();
+    TrajectoryPlayer trajectory;
+
+    LogHistogram<2> tick_ns;
+    const uint32_t last_tick = journal.back().tick + tail_ticks;
+    size_t next = 0;
+    uint32_t missing = 0, first_missing = 0;
+    for (uint32_t tick = first_tick; tick < last_tick; ++tick)
+    {
+        // recorded when the device had run `tick` ticks, so it goes in before
+        // the next one; in the order recorded, as a live setpoint stops a
+        // trajectory and the points after it start the next
+        while (next < journal.size() && journal[next].tick == tick)
+        {
+            const JournalEntry &e = journal[next++];
+            if (e.source == COMMAND_SOURCE_TRAJECTORY)
+            {
+                if (!trajectory.accept({{e.point_t_us, e.drive, e.steer}, e.flags, e.lead_ms, 0}))
+                {
+                    fprintf(stderr, "tick %lu: trajectory queue full\n", (unsigned long)tick);
+                }
+                continue;
+            }
+            trajectory.stop();
+            actuation.set_setpoint(e.drive, e.steer, e.flags);
+        }
+        const auto count = counts.find(tick);
+        if (count != counts.end())
+        {
+            encoder_count = count->second;
+        }
+
+        sim::set_time_us(t0 + (tick - first_tick + 1) * tick_us);
+        const auto start = std::chrono::steady_clock::now();
+        const TrajectoryOutput out = trajectory.step(trajectory_time_us(tick));
+        if (out.action != TrajectoryAction::None)
+        {
+            actuation.set_setpoint(out.action == TrajectoryAction::Set ? out.drive : 0, out.steer, out.flags);
+        }
+        actuation.tick();
+        const auto took = std::chrono::steady_clock::now() - start;
+        tick_ns.add(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()));
+
+        // the device read the wheel here, the replay has nothing to go on
+        if (actuation.closed_loop() && count == counts.end() && missing++ == 0)
+        {
+            first_missing = tick;
+        }
+    }
+
+    fprintf(stderr, "replayed %zu entries and %zu encoder counts over %lu ticks\n", journal.size(), counts.size(),
+            (unsigned long)tick_ns.count());
+    fprintf(stderr, "tick ns: min %lu mean %lu p99 %lu max %lu\n", (unsigned long)tick_ns.min(),
+            (unsigned long)tick_ns.mean(), (unsigned long)tick_ns.percentile(99), (unsigned long)tick_ns.max());
+    if (speed_setpoints && counts.empty())
+    {
+        fprintf(stderr, "%zu speed setpoints and no encoder counts: replayed on feedforward, as without an encoder\n",
+                speed_setpoints);
+    }
+    if (missing)
+    {
+        fprintf(stderr, "%lu speed loop ticks without an encoder count, the first after tick %lu: "
+                        "the trace diverges from there\n",
+                (unsigned long)missing, (unsigned long)first_missing);
+        return 1;
+    }
+    return 0;
+}
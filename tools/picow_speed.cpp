@@ -0,0 +1,500 @@
+// picow_speed.cpp - the wheel speed loop, against a motor model or a device
+//
+//   picow_speed --bench [--jitter-us N] [--seed N] [--csv FILE] [--settle-ms N] [--overshoot-mm-s N]
+//   picow_speed <host> [--port N] [--open-loop | --takeover] [--csv FILE]
+//
+// --bench runs the firmware's SpeedLoop (speed_control.hpp) with its real
+// gains and limits (actuation.hpp) against the wheel model the simulator
+// uses (host_sim/sim_plant.hpp), on a virtual clock: the motor integrates in
+// 50 us steps, the encoder is counted edge by edge, and the loop runs once
+// per motion tick, each tick late by a random 0..--jitter-us (default 0) the
+// way a busy core 0 would delay the timer interrupt. Every scenario runs
+// closed loop and on feedforward alone, which is what open-loop PWM with a
+// perfect calibration would do. Reported per run, against the true wheel
+// speed:
+//   rms, max   error from the ramped target
+//   steady     mean |error| from the command, from 300 ms after the ramp
+//              arrived until the next command
+//   settle     longest time from a command change until the wheel is within
+//              5% (or 20 mm/s) of it for 100 ms; the rest of the run if never
+//   overshoot  furthest the wheel goes past a new command, in the direction
+//              of the change, before it has settled
+//   estimate   rms error of the encoder speed estimate itself
+// and the host time per loop update. --csv writes every tick of every run.
+// Exits 1 if a closed loop run settles slower than --settle-ms (default 400)
+// or overshoots by more than --overshoot-mm-s (default 50).
+//
+// With a host it drives the device instead: a staircase of speed setpoints
+// at 50 Hz with CONTROL_FLAG_SPEED, or with --open-loop the PWM levels the
+// feedforward would pick for them, and reads the wheel speed back from
+// telemetry. --takeover sends the first step as PWM and the rest with
+// CONTROL_FLAG_SPEED, so the loop takes over a wheel that is already
+// moving. Against the simulator, PICOW_SIM_BATTERY_V and PICOW_SIM_LOAD_NM
+// move the motor away from the feedforward's calibration.
+#include "actuation.hpp"
+#include "control_protocol.hpp"
+#include "sim_plant.hpp"
+#include "speed_control.hpp"
+#include "tool_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    uint64_t now_us()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    // the staircase both modes drive: mm/s from each time on
+    struct Step
+    {
+        double from_s;
+        int32_t mm_s;
+    };
+    const Step STAIRS[] = {{0.0, 0}, {0.3, 500}, {1.8, 1000}, {3.3, 300}, {4.8, -600}, {6.3, 0}};
+    constexpr double STAIRS_END_S = 7.3;
+
+    int32_t stairs(double t_s)
+    {
+        int32_t v = 0;
+        for (const Step &s : STAIRS)
+        {
+            if (t_s >= s.from_s)
+            {
+                v = s.mm_s;
+            }
+        }
+        return v;
+    }
+
+    // ---- bench ----
+
+    struct Scenario
+    {
+        const char *name;
+        double seconds;
+        int32_t (*target)(double t_s);
+        double (*battery_v)(double t_s);
+        double (*load_nm)(double t_s);
+    };
+
+    double nominal_battery(double) { return 7.4; }
+    double no_load(double) { return 0.0; }
+    int32_t cruise(double t_s) { return t_s < 0.2 ? 0 : 800; }
+
+    const Scenario SCENARIOS[] = {
+        {"stairs", STAIRS_END_S, stairs, nominal_battery, no_load},
+        {"crawl", 3.0, [](double t) { return t < 0.2 ? 0 : 80; }, nominal_battery, no_load},
+        {"full battery", 3.0, cruise, [](double) { return 8.4; }, no_load},
+        {"battery sag", 5.0, cruise, [](double t) { return 8.4 - 0.4 * t; }, no_load},
+        {"load step", 5.0, cruise, nominal_battery, [](double t) { return t >= 2.0 && t < 3.5 ? 0.08 : 0.0; }},
+    };
+
+    // steady state starts this long after the ramp arrives
+    constexpr double STEADY_AFTER_S = 0.3;
+    // settled once within tolerance for this long
+    constexpr double SETTLED_FOR_S = 0.1;
+
+    struct Result
+    {
+        uint32_t ticks = 0;
+        double sq = 0, max = 0;
+        double steady_sum = 0;
+        uint32_t steady_n = 0;
+        double settle_max_s = 0;
+        double overshoot = 0;
+        double est_sq = 0;
+    };
+
+    Result run(const Scenario &sc, bool closed, uint32_t jitter_us, std::mt19937 &rng, FILE *csv)
+    {
+        constexpr double DT = 50e-6;
+        constexpr double TICK_S = 1.0 / MOTION_TICK_HZ;
+        sim::WheelPlant wheel(sim::MotorParams{}, ENCODER_COUNTS_PER_REV, WHEEL_CIRCUMFERENCE_UM);
+        sim::QuadratureCounter counter;
+        SpeedLoop loop(SPEED_LIMITS, SPEED_GAINS, DEFAULTSPEED, ENCODER_COUNTS_PER_REV, WHEEL_CIRCUMFERENCE_UM);
+        loop.measure(counter.count());
+        loop.engage(0);
+
+        Result r;
+        uint32_t tick = 0;
+        double tick_at = 0;
+        int32_t drive = 0;
+        int32_t command = 0;
+        double command_at = 0;
+        double arrived_at = -1; // the ramp reached the command, -1 before
+        double inside_since = -1; // within tolerance of the command since, -1 outside
+        bool settled = true;
+        bool rising = true; // direction of the last command change
+        for (double t = 0; t < sc.seconds; t += DT)
+        {
+            if (t >= tick_at)
+            {
+                const double nominal = tick * TICK_S;
+                const int32_t want = sc.target(nominal);
+                if (want != command)
+                {
+                    if (!settled)
+                    {
+                        r.settle_max_s = std::max(r.settle_max_s, nominal - command_at);
+                    }
+                    rising = want > command;
+                    command = want;
+                    command_at = nominal;
+                    arrived_at = inside_since = -1;
+                    settled = false;
+                }
+                loop.set_target(want);
+                loop.measure(counter.count());
+                drive = loop.step(closed);
+
+                const double speed = wheel.speed_mm_s();
+                const double err = speed - loop.target();
+                r.sq += err * err;
+                r.max = std::max(r.max, std::fabs(err));
+                const double est = loop.speed() - speed;
+                r.est_sq += est * est;
+
+                const double from_command = std::fabs(speed - command);
+                if (!settled)
+                {
+                    r.overshoot = std::max(r.overshoot, rising ? speed - command : command - speed);
+                }
+                if (arrived_at < 0 && loop.target() == command)
+                {
+                    arrived_at = nominal;
+                }
+                if (arrived_at >= 0 && nominal - arrived_at >= STEADY_AFTER_S)
+                {
+                    r.steady_sum += from_command;
+                    r.steady_n++;
+                }
+                if (from_command > std::max(20.0, 0.05 * std::abs(command)))
+                {
+                    inside_since = -1;
+                }
+                else if (inside_since < 0)
+                {
+                    inside_since = nominal;
+                }
+                if (!settled && inside_since >= 0 && nominal - inside_since >= SETTLED_FOR_S)
+                {
+                    r.settle_max_s = std::max(r.settle_max_s, inside_since - command_at);
+                    settled = true;
+                }
+                if (csv)
+                {
+                    fprintf(csv, "%s,%s,%.4f,%d,%d,%.1f,%d,%d\n", sc.name, closed ? "closed" : "feedforward", nominal,
+                            command, loop.target(), speed, loop.speed(), drive);
+                }
+                r.ticks++;
+                tick++;
+                // a fixed-rate timer: each tick is late from its own nominal time, lateness does not add up
+                tick_at = tick * TICK_S + (jitter_us ? (rng() % jitter_us) * 1e-6 : 0.0);
+            }
+            wheel.params().battery_v = sc.battery_v(t);
+            wheel.params().load_nm = sc.load_nm(t);
+            const sim::Bridge bridge = drive > 0 ? sim::Bridge::Forward
+                                                 : (drive < 0 ? sim::Bridge::Reverse : sim::Bridge::Brake);
+            wheel.step(DT, bridge, std::abs(drive) / double(DEFAULTSPEED));
+            counter.sample(wheel.pins());
+        }
+        if (!settled)
+        {
+            r.settle_max_s = std::max(r.settle_max_s, sc.seconds - command_at);
+        }
+        return r;
+    }
+
+    void print(const char *mode, const Result &r)
+    {
+        printf("  %-12s rms %6.1f  max %6.0f  steady %6.1f mm/s  settle %4.0f ms  overshoot %4.0f  estimate rms %5.1f "
+               "mm/s\n",
+               mode, std::sqrt(r.sq / r.ticks), r.max, r.steady_n ? r.steady_sum / r.steady_n : NAN,
+               1000 * r.settle_max_s, r.overshoot, std::sqrt(r.est_sq / r.ticks));
+    }
+
+    // host time of one tick's work: estimate plus controller
+    double update_ns()
+    {
+        SpeedLoop loop(SPEED_LIMITS, SPEED_GAINS, DEFAULTSPEED, ENCODER_COUNTS_PER_REV, WHEEL_CIRCUMFERENCE_UM);
+        loop.set_target(700);
+        constexpr uint32_t N = 2000000;
+        uint32_t count = 0;
+        volatile int32_t sink = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < N; ++i)
+        {
+            count += 5 + (i & 1);
+            loop.measure(count);
+            sink = loop.step(true);
+        }
+        const auto took = std::chrono::steady_clock::now() - start;
+        (void)sink;
+        return std::chrono::duration<double, std::nano>(took).count() / N;
+    }
+
+    int bench(uint32_t jitter_us, uint32_t seed, const char *csv_path, uint32_t settle_ms, uint32_t overshoot_mm_s)
+    {
+        FILE *csv = nullptr;
+        if (csv_path)
+        {
+            csv = fopen(csv_path, "w");
+            if (!csv)
+            {
+                perror(csv_path);
+                return 1;
+            }
+            fprintf(csv, "scenario,mode,t_s,command,target,speed,estimate,drive\n");
+        }
+        std::mt19937 rng(seed);
+        printf("speed loop at %lu Hz, %zu-tick estimate, tick jitter 0..%lu us\n", (unsigned long)MOTION_TICK_HZ,
+               SPEED_WINDOW_TICKS, (unsigned long)jitter_us);
+        double settle_worst_s = 0, overshoot_worst = 0;
+        for (const Scenario &sc : SCENARIOS)
+        {
+            printf("%s\n", sc.name);
+            const Result closed = run(sc, true, jitter_us, rng, csv);
+            print("closed loop", closed);
+            print("feedforward", run(sc, false, jitter_us, rng, csv));
+            settle_worst_s = std::max(settle_worst_s, closed.settle_max_s);
+            overshoot_worst = std::max(overshoot_worst, closed.overshoot);
+        }
+        const double ns = update_ns();
+        printf("update: %.0f ns on this host, %.3f%% of a %lu us tick\n", ns, ns / (10.0 * (1000000 / MOTION_TICK_HZ)),
+               (unsigned long)(1000000 / MOTION_TICK_HZ));
+        if (csv)
+        {
+            fclose(csv);
+        }
+        printf("closed loop worst: settle %.0f ms (limit %lu ms), overshoot %.0f mm/s (limit %lu mm/s)\n",
+               1000 * settle_worst_s, (unsigned long)settle_ms, overshoot_worst, (unsigned long)overshoot_mm_s);
+        expect(settle_worst_s * 1000 <= settle_ms, "the closed loop settles within the limit after every command");
+        expect(overshoot_worst <= overshoot_mm_s, "the closed loop overshoots no command by more than the limit");
+        return failures ? 1 : 0;
+    }
+
+    // ---- live ----
+
+    struct Sample
+    {
+        uint32_t t_us; // device
+        int16_t wheel;
+        int16_t target;
+        int16_t level;
+        uint8_t mode;
+    };
+
+    struct Live
+    {
+        std::vector<Sample> samples;
+        int64_t offset_us = INT64_MAX; // client time - device time, smallest seen
+        bool controller = false;
+        int client = -1;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Live *live = static_cast<Live *>(arg);
+        if (type == FRAME_HELLO && len >= HELLO_PAYLOAD_SIZE)
+        {
+            live->client = payload[1];
+            live->controller = payload[2] == 0;
+            return;
+        }
+        if (type != FRAME_TELEMETRY || len < TELEMETRY_HEADER_SIZE)
+        {
+            return;
+        }
+        const uint8_t count = payload[2], size = payload[3];
+        if (size < TELEMETRY_SAMPLE_SIZE)
+        {
+            return; // firmware without the speed loop
+        }
+        const uint64_t received = now_us();
+        for (uint8_t i = 0; i < count && TELEMETRY_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+        {
+            TelemetrySample s;
+            decode_sample(payload + TELEMETRY_HEADER_SIZE + size_t(i) * size, s);
+            live->samples.push_back({s.t_us, s.wheel_speed, s.speed_target, s.motor_level, s.drive_mode});
+            // the newest sample of a batch is the least stale
+            live->offset_us = std::min<int64_t>(live->offset_us, int64_t(received) - s.t_us);
+        }
+    }
+
+    int drive(const char *host, unsigned port, bool open_loop, bool takeover, const char *csv_path)
+    {
+        const int fd = connect_tcp(host, static_cast<uint16_t>(port));
+        if (fd < 0)
+        {
+            return 1;
+        }
+        Live live;
+        FrameDecoder decoder;
+        const uint8_t topics = SUBSCRIBE_TELEMETRY;
+        send_frame(fd, FRAME_SUBSCRIBE, &topics, 1);
+        while (live.client < 0)
+        {
+            if (!pump_frames(fd, decoder, &on_frame, &live))
+            {
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+        }
+        if (!live.controller)
+        {
+            fprintf(stderr, "not the controller, commands will be ignored\n");
+            return 1;
+        }
+
+        // the level the feedforward would pick, as an open-loop client would
+        const auto level_for = [](int32_t mm_s) {
+            return static_cast<int16_t>(std::lround(mm_s * double(SPEED_GAINS.kff) / 65536.0));
+        };
+        constexpr uint64_t PERIOD_US = 20000;
+        const uint64_t start = now_us();
+        uint64_t next = start;
+        uint16_t seq = 0;
+        while (now_us() < start + uint64_t(STAIRS_END_S * 1e6))
+        {
+            if (now_us() >= next)
+            {
+                const double t = (now_us() - start) / 1e6;
+                const int32_t v = stairs(t);
+                const bool pwm = open_loop || (takeover && t < STAIRS[2].from_s);
+                const ControlCommand cmd = {++seq, pwm ? level_for(v) : static_cast<int16_t>(v), 90,
+                                            static_cast<uint8_t>(pwm ? 0 : CONTROL_FLAG_SPEED)};
+                uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+                encode_control(cmd, frame, sizeof(frame));
+                send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+                next += PERIOD_US;
+            }
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 1) > 0 && !pump_frames(fd, decoder, &on_frame, &live))
+            {
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+        }
+        uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+        encode_control({++seq, 0, 90, CONTROL_FLAG_BRAKE}, frame, sizeof(frame));
+        send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+        close(fd);
+
+        if (live.samples.empty())
+        {
+            fprintf(stderr, "no telemetry with wheel speed\n");
+            return 1;
+        }
+        FILE *csv = csv_path ? fopen(csv_path, "w") : nullptr;
+        if (csv)
+        {
+            fprintf(csv, "t_s,command,target,wheel,level,mode\n");
+        }
+        // per step of the staircase: the wheel over its last 40%, settled
+        struct Segment
+        {
+            double sum = 0;
+            uint32_t n = 0;
+        };
+        Segment segments[sizeof(STAIRS) / sizeof(STAIRS[0])];
+        uint32_t modes[3] = {};
+        for (const Sample &s : live.samples)
+        {
+            const double t = (int64_t(s.t_us) + live.offset_us - int64_t(start)) / 1e6;
+            if (t < 0 || t >= STAIRS_END_S)
+            {
+                continue;
+            }
+            modes[std::min<uint8_t>(s.mode, 2)]++;
+            if (csv)
+            {
+                fprintf(csv, "%.3f,%d,%d,%d,%d,%u\n", t, stairs(t), s.target, s.wheel, s.level, s.mode);
+            }
+            for (size_t i = 0; i < sizeof(STAIRS) / sizeof(STAIRS[0]); ++i)
+            {
+                const double end = i + 1 < sizeof(STAIRS) / sizeof(STAIRS[0]) ? STAIRS[i + 1].from_s : STAIRS_END_S;
+                if (t >= end - 0.4 * (end - STAIRS[i].from_s) && t < end)
+                {
+                    segments[i].sum += s.wheel;
+                    segments[i].n++;
+                }
+            }
+        }
+        if (csv)
+        {
+            fclose(csv);
+        }
+        const char *how = open_loop  ? "open loop (PWM)"
+                          : takeover ? "PWM, then closed loop (CONTROL_FLAG_SPEED)"
+                                     : "closed loop (CONTROL_FLAG_SPEED)";
+        printf("%s, %zu samples; pwm %u, speed %u, speed without encoder %u\n", how, live.samples.size(), modes[0],
+               modes[1], modes[2]);
+        double err_sum = 0;
+        uint32_t err_n = 0;
+        for (size_t i = 0; i < sizeof(STAIRS) / sizeof(STAIRS[0]); ++i)
+        {
+            if (!segments[i].n)
+            {
+                continue;
+            }
+            const double mean = segments[i].sum / segments[i].n;
+            printf("  command %5d mm/s  wheel %7.1f mm/s  error %+6.1f\n", STAIRS[i].mm_s, mean, mean - STAIRS[i].mm_s);
+            err_sum += std::fabs(mean - STAIRS[i].mm_s);
+            err_n++;
+        }
+        printf("mean |steady error| %.1f mm/s\n", err_n ? err_sum / err_n : 0.0);
+        return 0;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,
+                "usage: %s --bench [--jitter-us N] [--seed N] [--csv FILE] [--settle-ms N] [--overshoot-mm-s N]\n"
+                "       %s <host> [--port N] [--open-loop | --takeover] [--csv FILE]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    const bool bench_mode = !strcmp(argv[1], "--bench");
+    unsigned port = 4242;
+    uint32_t jitter_us = 0, seed = 1, settle_ms = 400, overshoot_mm_s = 50;
+    bool open_loop = false, takeover = false;
+    const char *csv = nullptr;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--open-loop"))
+            open_loop = true;
+        else if (!strcmp(argv[i], "--takeover"))
+            takeover = true;
+        else if (i + 1 < argc && !strcmp(argv[i], "--port"))
+            port = static_cast<unsigned>(strtoul(argv[++i], nullptr, 0));
+        else if (i + 1 < argc && !strcmp(argv[i], "--jitter-us"))
+            jitter_us = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        else if (i + 1 < argc && !strcmp(argv[i], "--seed"))
+            seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        else if (i + 1 < argc && !strcmp(argv[i], "--csv"))
+            csv = argv[++i];
+        else if (i + 1 < argc && !strcmp(argv[i], "--settle-ms"))
+            settle_ms = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        else if (i + 1 < argc && !strcmp(argv[i], "--overshoot-mm-s"))
+            overshoot_mm_s = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+    }
+    return bench_mode ? bench(jitter_us, seed, csv, settle_ms, overshoot_mm_s) : drive(argv[1], port, open_loop, takeover, csv);
+}
@@ -0,0 +1,126 @@
+// picow_telemetry.cpp - Linux client that records the telemetry stream as CSV
+//
+//   picow_telemetry <host> [--port N] [--seconds N]
+//
+// Subscribes to FRAME_TELEMETRY and prints one CSV line per sample on stdout.
+// Lost batches and the device-side drop counters go to stderr, so stdout can
+// be redirected straight into a file.
+#include "control_protocol.hpp"
+#include "tool_common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+using namespace pico_tcp;
+
+namespace
+{
+    struct Recorder
+    {
+        bool have_batch;
+        uint16_t next_batch;
+        uint32_t batches;
+        uint32_t lost_batches;
+        uint32_t samples_dropped;
+        uint32_t batches_dropped;
+        uint32_t commands_coalesced;
+        uint32_t commands_stale;
+        uint32_t commands_urgent;
+        uint32_t commands_rejected;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Recorder *rec = static_cast<Recorder *>(arg);
+        if (type != FRAME_TELEMETRY || len < TELEMETRY_HEADER_SIZE)
+        {
+            return;
+        }
+        const uint16_t batch = read_u16(payload);
+        const uint8_t count = payload[2];
+        const uint8_t sample_size = payload[3];
+        if (sample_size < TELEMETRY_SAMPLE_SIZE || TELEMETRY_HEADER_SIZE + count * sample_size > len)
+        {
+            fprintf(stderr, "malformed telemetry batch %u\n", batch);
+            return;
+        }
+        if (rec->have_batch && batch != rec->next_batch)
+        {
+            rec->lost_batches += static_cast<uint16_t>(batch - rec->next_batch);
+        }
+        rec->have_batch = true;
+        rec->next_batch = static_cast<uint16_t>(batch + 1);
+        rec->batches++;
+        rec->samples_dropped = read_u32(payload + 4);
+        rec->batches_dropped = read_u32(payload + 8);
+        rec->commands_coalesced = read_u32(payload + 28);
+        rec->commands_stale = read_u32(payload + 32);
+        rec->commands_urgent = read_u32(payload + 36);
+        rec->commands_rejected = read_u32(payload + 40);
+
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            TelemetrySample s;
+            decode_sample(payload + TELEMETRY_HEADER_SIZE + i * sample_size, s);
+            printf("%lu,%d,%d,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", (unsigned long)s.t_us, s.motor_level, s.motor_dir,
+                   s.servo_angle, s.servo_pulse, s.applies, s.apply_max_us, s.latency_max_us, s.failsafe_trips,
+                   s.failsafe_latency_max_us, s.trajectory_depth, s.trajectory_state, s.trajectory_lead_ms,
+                   s.trajectory_underruns);
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--port N] [--seconds N]\n", argv[0]);
+        return 2;
+    }
+    const char *host = argv[1];
+    unsigned port = 4242, seconds = 0;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--seconds"))
+            seconds = v;
+    }
+
+    const int fd = connect_tcp(host, static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+    const uint8_t topics = SUBSCRIBE_TELEMETRY;
+    send_frame(fd, FRAME_SUBSCRIBE, &topics, 1);
+
+    printf("t_us,motor_level,motor_dir,servo_angle,servo_pulse,applies,apply_max_us,latency_max_us,"
+           "failsafe_trips,failsafe_latency_max_us,trajectory_depth,trajectory_state,trajectory_lead_ms,"
+           "trajectory_underruns\n");
+
+    Recorder rec = {};
+    FrameDecoder decoder;
+    const time_t end = time(nullptr) + seconds;
+    while (seconds == 0 || time(nullptr) < end)
+    {
+        if (!pump_frames(fd, decoder, &on_frame, &rec))
+        {
+            fprintf(stderr, "connection closed\n");
+            break;
+        }
+        fflush(stdout);
+    }
+    close(fd);
+
+    fprintf(stderr, "batches %lu, missed %lu, device dropped %lu samples and %lu batches\n",
+            (unsigned long)rec.batches, (unsigned long)rec.lost_batches, (unsigned long)rec.samples_dropped,
+            (unsigned long)rec.batches_dropped);
+    fprintf(stderr, "commands coalesced %lu, stale %lu, brakes ahead of their burst %lu, rejected %lu\n",
+            (unsigned long)rec.commands_coalesced, (unsigned long)rec.commands_stale,
+            (unsigned long)rec.commands_urgent, (unsigned long)rec.commands_rejected);
+    return 0;
+}
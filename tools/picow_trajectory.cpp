@@ -0,0 +1,348 @@
+// picow_trajectory.cpp - the same drive over a jittery link, live or as a trajectory
+//
+//   picow_trajectory <host> [--port N] [--seconds N] [--mode live|trajectory]
+//                    [--rate HZ] [--batch N] [--lead-ms N] [--jitter-ms N] [--trace FILE]
+//
+// Drives a smooth pattern (sine drive and steer) sampled at --rate points per
+// second (default 50). In live mode every point is a FRAME_CONTROL; in
+// trajectory mode (the default) every --batch points (default 2) are a
+// FRAME_TRAJECTORY, played out by the device --lead-ms (default 60) behind
+// their arrival.
+//
+// Packets are held back the way a bad link would: by a delay read from
+// --trace, cycled, or else by a random 0..--jitter-ms (default 30) plus a
+// 120 ms stall every 3 s. A trace is one delay per line in milliseconds, or
+// the CSV written by picow_latency --csv, whose uplink_us column is used, so
+// a link recorded once can be replayed against both modes. Like TCP, a held
+// packet holds back all the ones behind it.
+//
+// The device's telemetry is the output: the motor level and servo angle at
+// 100 Hz. Smoothness is the size of their second differences, which a
+// stalled and then hurried output inflates; the trajectory's depth, lead and
+// underruns are printed as well.
+#include "control_protocol.hpp"
+#include "histogram.hpp"
+#include "tool_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    uint64_t now_us()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    struct Pattern
+    {
+        int16_t drive;
+        uint16_t steer;
+    };
+
+    Pattern pattern(double t_s)
+    {
+        constexpr double PI = 3.14159265358979;
+        return {static_cast<int16_t>(lround(150 * sin(2 * PI * 0.25 * t_s))),
+                static_cast<uint16_t>(lround(90 + 50 * sin(2 * PI * 0.4 * t_s)))};
+    }
+
+    // Delays in microseconds, one per line, or picow_latency's CSV.
+    std::vector<uint32_t> load_trace(const char *path)
+    {
+        std::vector<uint32_t> delays;
+        FILE *f = fopen(path, "r");
+        if (!f)
+        {
+            perror(path);
+            return delays;
+        }
+        char line[256];
+        bool latency_csv = false;
+        while (fgets(line, sizeof(line), f))
+        {
+            if (!strncmp(line, "seq,", 4))
+            {
+                latency_csv = true;
+                continue;
+            }
+            if (latency_csv)
+            {
+                // seq,sent_us,uplink_us,...
+                const char *p = strchr(line, ',');
+                p = p ? strchr(p + 1, ',') : nullptr;
+                if (p)
+                {
+                    const long us = strtol(p + 1, nullptr, 10);
+                    delays.push_back(us > 0 ? static_cast<uint32_t>(us) : 0);
+                }
+            }
+            else if (line[0] != '#' && line[0] != '\n')
+            {
+                const double ms = strtod(line, nullptr);
+                delays.push_back(ms > 0 ? static_cast<uint32_t>(ms * 1000) : 0);
+            }
+        }
+        fclose(f);
+        return delays;
+    }
+
+    struct Output
+    {
+        int32_t motor[2] = {};
+        int32_t servo[2] = {};
+        uint32_t samples = 0;
+        LogHistogram<2> motor_d2;
+        LogHistogram<2> servo_d2;
+        uint64_t motor_d2_sum = 0;
+        uint64_t servo_d2_sum = 0;
+        uint32_t depth_max = 0;
+        uint32_t lead_min_ms = 0xffffffff;
+        uint32_t lead_sum_ms = 0;
+        uint32_t playing = 0;
+        uint16_t underruns_first = 0;
+        uint16_t underruns_last = 0;
+        bool recording = false;
+        bool controller = false;
+        int client = -1;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Output *out = static_cast<Output *>(arg);
+        if (type == FRAME_HELLO && len >= HELLO_PAYLOAD_SIZE)
+        {
+            out->client = payload[1];
+            out->controller = payload[2] == 0;
+            return;
+        }
+        if (type != FRAME_TELEMETRY || len < TELEMETRY_HEADER_SIZE)
+        {
+            return;
+        }
+        const uint8_t count = payload[2], size = payload[3];
+        for (uint8_t i = 0; i < count && TELEMETRY_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+        {
+            TelemetrySample s;
+            decode_sample(payload + TELEMETRY_HEADER_SIZE + size_t(i) * size, s);
+            if (!out->recording)
+            {
+                if (out->samples == 0)
+                {
+                    out->underruns_first = s.trajectory_underruns;
+                }
+                continue;
+            }
+            out->underruns_last = s.trajectory_underruns;
+            if (s.trajectory_state == 2) // playing
+            {
+                out->playing++;
+                out->depth_max = std::max<uint32_t>(out->depth_max, s.trajectory_depth);
+                out->lead_min_ms = std::min<uint32_t>(out->lead_min_ms, s.trajectory_lead_ms);
+                out->lead_sum_ms += s.trajectory_lead_ms;
+            }
+            if (out->samples >= 2)
+            {
+                const uint32_t dm = static_cast<uint32_t>(std::abs(s.motor_level - 2 * out->motor[1] + out->motor[0]));
+                const uint32_t ds = static_cast<uint32_t>(std::abs(s.servo_angle - 2 * out->servo[1] + out->servo[0]));
+                out->motor_d2.add(dm);
+                out->servo_d2.add(ds);
+                out->motor_d2_sum += dm;
+                out->servo_d2_sum += ds;
+            }
+            out->motor[0] = out->motor[1];
+            out->motor[1] = s.motor_level;
+            out->servo[0] = out->servo[1];
+            out->servo[1] = s.servo_angle;
+            out->samples++;
+        }
+    }
+
+    struct Packet
+    {
+        uint64_t due_us; // client time to hand it to the socket
+        uint32_t first;  // point index
+        uint8_t count;
+    };
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,
+                "usage: %s <host> [--port N] [--seconds N] [--mode live|trajectory] [--rate HZ] [--batch N]\n"
+                "       [--lead-ms N] [--jitter-ms N] [--trace FILE]\n",
+                argv[0]);
+        return 2;
+    }
+    const char *host = argv[1];
+    unsigned port = 4242, seconds = 10, rate = 50, batch = 2, lead_ms = 60, jitter_ms = 30;
+    bool live = false;
+    const char *trace = nullptr;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--seconds"))
+            seconds = v;
+        else if (!strcmp(argv[i], "--mode"))
+            live = !strcmp(argv[i + 1], "live");
+        else if (!strcmp(argv[i], "--rate"))
+            rate = v ? v : 1;
+        else if (!strcmp(argv[i], "--batch"))
+            batch = std::min<unsigned>(std::max(v, 1u), TRAJECTORY_BATCH_MAX);
+        else if (!strcmp(argv[i], "--lead-ms"))
+            lead_ms = v;
+        else if (!strcmp(argv[i], "--jitter-ms"))
+            jitter_ms = v;
+        else if (!strcmp(argv[i], "--trace"))
+            trace = argv[i + 1];
+    }
+    if (live)
+    {
+        batch = 1;
+    }
+    std::vector<uint32_t> delays;
+    if (trace)
+    {
+        delays = load_trace(trace);
+        if (delays.empty())
+        {
+            fprintf(stderr, "no delays in %s\n", trace);
+            return 1;
+        }
+    }
+
+    // the whole schedule up front: nominal send time plus the link's delay,
+    // never before the packet in front of it
+    const uint64_t period_us = 1000000 / rate;
+    const uint32_t points = seconds * rate;
+    std::vector<Packet> packets;
+    std::mt19937 rng(7);
+    uint64_t last_due = 0;
+    for (uint32_t first = 0; first < points; first += batch)
+    {
+        const uint64_t nominal = first * period_us;
+        uint64_t delay;
+        if (!delays.empty())
+        {
+            delay = delays[packets.size() % delays.size()];
+        }
+        else
+        {
+            delay = jitter_ms ? rng() % (jitter_ms * 1000) : 0;
+            const uint64_t in_cycle = nominal % 3000000;
+            if (in_cycle >= 2880000)
+            {
+                delay += 3000000 - in_cycle; // released with the end of the stall
+            }
+        }
+        last_due = std::max(last_due, nominal + delay);
+        packets.push_back({last_due, first, static_cast<uint8_t>(std::min<uint32_t>(batch, points - first))});
+    }
+
+    const int fd = connect_tcp(host, static_cast<uint16_t>(port));
+    if (fd < 0)
+    {
+        return 1;
+    }
+    Output out;
+    FrameDecoder decoder;
+    const uint8_t topics = SUBSCRIBE_TELEMETRY;
+    send_frame(fd, FRAME_SUBSCRIBE, &topics, 1);
+    while (out.client < 0)
+    {
+        if (!pump_frames(fd, decoder, &on_frame, &out))
+        {
+            fprintf(stderr, "connection closed\n");
+            return 1;
+        }
+    }
+    if (!out.controller)
+    {
+        fprintf(stderr, "not the controller, commands will be ignored\n");
+        return 1;
+    }
+
+    const uint64_t start = now_us();
+    size_t next = 0;
+    // skip the start-up: buffering and the first ramp
+    const uint64_t record_from = start + 500000;
+    const uint64_t end = start + points * period_us + 300000;
+    while (now_us() < end)
+    {
+        const uint64_t now = now_us() - start;
+        out.recording = now_us() >= record_from && next < packets.size();
+        while (next < packets.size() && packets[next].due_us <= now)
+        {
+            const Packet &p = packets[next];
+            if (live)
+            {
+                const Pattern v = pattern(p.first * period_us / 1e6);
+                uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+                encode_control({static_cast<uint16_t>(p.first), v.drive, v.steer, 0}, frame, sizeof(frame));
+                send_frame(fd, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+            }
+            else
+            {
+                TrajectoryBatch b = {};
+                b.count = p.count;
+                b.flags = static_cast<uint8_t>((next == 0 ? TRAJECTORY_FLAG_START : 0) |
+                                               (next + 1 == packets.size() ? TRAJECTORY_FLAG_END : 0));
+                b.lead_ms = static_cast<uint16_t>(lead_ms);
+                for (uint8_t i = 0; i < p.count; ++i)
+                {
+                    const uint32_t index = p.first + i;
+                    const Pattern v = pattern(index * period_us / 1e6);
+                    b.points[i] = {static_cast<uint32_t>(index * period_us), v.drive, v.steer};
+                }
+                uint8_t payload[TRAJECTORY_HEADER_SIZE + TRAJECTORY_BATCH_MAX * TRAJECTORY_POINT_SIZE];
+                send_frame(fd, FRAME_TRAJECTORY, payload,
+                           static_cast<uint16_t>(encode_trajectory(b, payload, sizeof(payload))));
+            }
+            ++next;
+        }
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1) > 0 && !pump_frames(fd, decoder, &on_frame, &out))
+        {
+            fprintf(stderr, "connection closed\n");
+            return 1;
+        }
+    }
+    close(fd);
+
+    const uint32_t n = out.motor_d2.count();
+    printf("%s, %u points in %zu packets, %s\n", live ? "live" : "trajectory", points, packets.size(),
+           trace ? trace : "synthetic jitter");
+    if (n == 0)
+    {
+        printf("no telemetry\n");
+        return 1;
+    }
+    printf("motor   |d2| mean %.2f  p99 %lu  max %lu\n", double(out.motor_d2_sum) / n,
+           (unsigned long)out.motor_d2.percentile(99), (unsigned long)out.motor_d2.max());
+    printf("servo   |d2| mean %.2f  p99 %lu  max %lu\n", double(out.servo_d2_sum) / n,
+           (unsigned long)out.servo_d2.percentile(99), (unsigned long)out.servo_d2.max());
+    if (!live)
+    {
+        printf("buffer  depth max %lu, lead min %lu ms mean %lu ms, %u underruns, playing %.0f%% of samples\n",
+               (unsigned long)out.depth_max, (unsigned long)(out.playing ? out.lead_min_ms : 0),
+               (unsigned long)(out.playing ? out.lead_sum_ms / out.playing : 0),
+               static_cast<uint16_t>(out.underruns_last - out.underruns_first), 100.0 * out.playing / out.samples);
+    }
+    return 0;
+}
@@ -0,0 +1,317 @@
+// picow_tx.cpp - TxRing on the host: slot reuse, and copy against zero-copy sends
+//
+//   picow_tx [--kb N] [--size N] [--seed N]
+//
+// First a check of TxRing against a model of what lwIP holds on to: frames
+// of random length are committed, some of them external like the web page in
+// flash, and acknowledged in random chunks that end inside a slot, span
+// several slots or wrap the ring. A slot must not be handed out again while
+// any of its bytes is unacknowledged, its contents must be intact until then,
+// and acquire() must fail exactly when every slot is in flight.
+//
+// Then --kb (default 1024) KB of --size (default 236, a full telemetry batch)
+// byte frames are streamed to a local socket through the simulator's lwIP
+// shim, once built in a TxRing slot and written without TCP_WRITE_FLAG_COPY
+// as TcpServer does, and once built on the stack and written with it as
+// before. It prints the throughput, the writes that had to wait (ring full,
+// or ERR_MEM) and the high-water marks of lwIP's heap and segment pools as
+// the shim accounts for them. The shim acknowledges data once the kernel has
+// it, so the throughput is the host's bound rather than the radio's; the heap
+// figures are what the same writes cost on the device.
+// Exits 1 if the check fails.
+#include "control_protocol.hpp"
+#include "sim.hpp"
+#include "tx_ring.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C"
+{
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "lwip/tcp.h"
+#include "pico/time.h"
+}
+
+using namespace pico_tcp;
+
+// the simulator's radio, always up and awake here
+bool sim::link_up() { return true; }
+uint64_t sim::radio_rx_at(uint64_t now_us) { return now_us; }
+void sim::radio_traffic() {}
+
+namespace
+{
+    struct InFlight
+    {
+        const uint8_t *slot; // null for external data
+        size_t len;
+        uint8_t fill;
+    };
+
+    unsigned check(std::mt19937 &rng)
+    {
+        unsigned failed = 0;
+        auto fail = [&](const char *what, unsigned op) {
+            if (++failed <= 5)
+            {
+                fprintf(stderr, "op %u: %s\n", op, what);
+            }
+        };
+
+        TxRing ring;
+        std::deque<InFlight> model;
+        size_t acked = 0; // of model.front()
+        unsigned wraps = 0, spanning = 0, partial = 0;
+        const uint8_t *first = nullptr;
+        for (unsigned op = 0; op < 200000; ++op)
+        {
+            if (rng() % 2)
+            {
+                uint8_t *slot = ring.acquire();
+                if ((slot == nullptr) != (model.size() == TX_SLOTS))
+                {
+                    fail("acquire() disagrees with the slots in flight", op);
+                }
+                if (!slot)
+                {
+                    continue;
+                }
+                for (const InFlight &f : model)
+                {
+                    if (f.slot == slot)
+                    {
+                        fail("slot handed out while still in flight", op);
+                    }
+                }
+                if (!first)
+                {
+                    first = slot;
+                }
+                else if (slot == first)
+                {
+                    wraps++;
+                }
+                const size_t len = 1 + rng() % TX_SLOT_SIZE;
+                const uint8_t fill = static_cast<uint8_t>(rng());
+                if (rng() % 8 == 0)
+                {
+                    ring.commit_external(len);
+                    model.push_back({nullptr, len, 0});
+                }
+                else
+                {
+                    memset(slot, fill, len);
+                    ring.commit(len);
+                    model.push_back({slot, len, fill});
+                }
+            }
+            else if (!model.empty())
+            {
+                size_t queued = 0;
+                for (const InFlight &f : model)
+                {
+                    queued += f.len;
+                }
+                queued -= acked;
+                // mostly small chunks, now and then everything at once
+                const size_t len = rng() % 4 == 0 ? queued : std::min<size_t>(queued, 1 + rng() % 400);
+                ring.on_sent(len);
+                size_t left = len;
+                unsigned freed = 0;
+                while (left > 0)
+                {
+                    InFlight &f = model.front();
+                    const size_t rest = f.len - acked;
+                    if (left < rest)
+                    {
+                        acked += left;
+                        partial++;
+                        break;
+                    }
+                    // lwIP may read a slot until its last byte is acknowledged
+                    if (f.slot)
+                    {
+                        for (size_t i = 0; i < f.len; ++i)
+                        {
+                            if (f.slot[i] != f.fill)
+                            {
+                                fail("slot overwritten before it was acknowledged", op);
+                                break;
+                            }
+                        }
+                    }
+                    left -= rest;
+                    acked = 0;
+                    model.pop_front();
+                    freed++;
+                }
+                spanning += freed > 1;
+                if (ring.in_flight() != model.size())
+                {
+                    fail("in_flight() disagrees with the model", op);
+                }
+            }
+        }
+        ring.reset();
+        if (ring.in_flight() != 0 || !ring.acquire())
+        {
+            fail("reset() left slots in flight", 0);
+        }
+        printf("check   200000 ops, %u ring wraps, %u partial and %u multi-slot acknowledgements, %u wrong\n", wraps,
+               partial, spanning, failed);
+        return failed;
+    }
+
+    struct Stream
+    {
+        struct tcp_pcb *pcb = nullptr;
+        TxRing ring;
+        bool zero_copy = false;
+    };
+
+    err_t on_accept(void *arg, struct tcp_pcb *newpcb, err_t /*err*/)
+    {
+        static_cast<Stream *>(arg)->pcb = newpcb;
+        return ERR_OK;
+    }
+
+    err_t on_sent(void *arg, struct tcp_pcb * /*pcb*/, u16_t len)
+    {
+        static_cast<Stream *>(arg)->ring.on_sent(len);
+        return ERR_OK;
+    }
+
+    void reset_high_water()
+    {
+        lwip_stats.mem.max = lwip_stats.mem.used;
+        lwip_stats.mem.err = 0;
+        for (int i = 0; i < MEMP_MAX; ++i)
+        {
+            lwip_stats.memp[i]->max = lwip_stats.memp[i]->used;
+            lwip_stats.memp[i]->err = 0;
+        }
+    }
+
+    // Stream total bytes in frames of size through one path. Returns false
+    // if the connection could not be set up.
+    bool stream(bool zero_copy, size_t total, size_t size)
+    {
+        Stream s;
+        s.zero_copy = zero_copy;
+        struct tcp_pcb *listener = tcp_new_ip_type(IPADDR_TYPE_ANY);
+        tcp_bind(listener, IP_ANY_TYPE, 0);
+        listener = tcp_listen_with_backlog(listener, 1);
+        if (!listener)
+        {
+            return false;
+        }
+        tcp_arg(listener, &s);
+        tcp_accept(listener, &on_accept);
+        sockaddr_in addr = {};
+        socklen_t addr_len = sizeof(addr);
+        getsockname(listener->fd, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            perror("connect");
+            return false;
+        }
+        while (!s.pcb)
+        {
+            sim::lwip_poll();
+        }
+        tcp_sent(s.pcb, &on_sent);
+        reset_high_water();
+
+        std::vector<uint8_t> frame_payload(size - FRAME_HEADER_SIZE, 0x5a);
+        std::vector<uint8_t> sink(65536);
+        size_t written = 0, received = 0;
+        unsigned waits = 0;
+        const auto start = std::chrono::steady_clock::now();
+        while (received < total)
+        {
+            while (written < total)
+            {
+                uint8_t stack_frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+                uint8_t *frame = zero_copy ? s.ring.acquire() : stack_frame;
+                if (!frame)
+                {
+                    waits++;
+                    break;
+                }
+                frame[0] = FRAME_MAGIC;
+                frame[1] = FRAME_TELEMETRY;
+                write_u16(frame + 2, static_cast<uint16_t>(frame_payload.size()));
+                memcpy(frame + FRAME_HEADER_SIZE, frame_payload.data(), frame_payload.size());
+                if (tcp_write(s.pcb, frame, static_cast<u16_t>(size), zero_copy ? 0 : TCP_WRITE_FLAG_COPY) != ERR_OK)
+                {
+                    waits++;
+                    break;
+                }
+                if (zero_copy)
+                {
+                    s.ring.commit(size);
+                }
+                written += size;
+            }
+            tcp_output(s.pcb);
+            const ssize_t n = recv(fd, sink.data(), sink.size(), MSG_DONTWAIT);
+            if (n > 0)
+            {
+                received += static_cast<size_t>(n);
+            }
+            sim::lwip_poll();
+        }
+        const double s_elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%-10s %8.1f MB/s, %6u writes waited, heap max %5u of %u bytes, TCP_SEG max %2u, PBUF_REF max %2u\n",
+               zero_copy ? "zero-copy" : "copy", total / s_elapsed / 1e6, waits, lwip_stats.mem.max,
+               lwip_stats.mem.avail, lwip_stats.memp[MEMP_TCP_SEG]->max, lwip_stats.memp[MEMP_PBUF]->max);
+        close(fd);
+        tcp_abort(s.pcb);
+        tcp_close(listener);
+        sim::lwip_poll();
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    unsigned kb = 1024, size = 236, seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--kb"))
+            kb = v ? v : 1;
+        else if (!strcmp(argv[i], "--size"))
+            size = std::min<unsigned>(std::max<unsigned>(v, FRAME_HEADER_SIZE + 1), TX_SLOT_SIZE);
+        else if (!strcmp(argv[i], "--seed"))
+            seed = v;
+        else
+        {
+            fprintf(stderr, "usage: %s [--kb N] [--size N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+    std::mt19937 rng(seed);
+    const unsigned failed = check(rng);
+    const size_t total = size_t(kb) * 1024 / size * size;
+    printf("stream  %zu bytes in %u-byte frames (host)\n", total, size);
+    if (!stream(true, total, size) || !stream(false, total, size))
+    {
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,391 @@
+// picow_web.cpp - benchmark of the control page and its WebSocket
+//
+//   picow_web <host> [--http-port N] [--port N] [--loads N] [--commands N] [--rate HZ]
+//
+// Page load: fetches / --loads times (default 20) the way a browser does and
+// reports the bytes on the wire and the time from connect to the last byte.
+//
+// Frame to actuation: upgrades to the WebSocket, runs the device's echo
+// benchmark through it and through the plain control port for comparison,
+// then drives for --commands commands (default 500) at --rate per second
+// (default 50) with telemetry subscribed. The device stamps each command when
+// it is decoded and reports in telemetry how long it took to reach the motion
+// profile; half the round trip through the WebSocket plus that is the time
+// from a frame leaving the browser to the car acting on it.
+#include "control_protocol.hpp"
+#include "histogram.hpp"
+#include "tool_common.hpp"
+#include "websocket.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <poll.h>
+
+using namespace pico_tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+    uint32_t us_since(Clock::time_point start)
+    {
+        return static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    }
+
+    // A control connection, either raw frames or frames in WebSocket messages.
+    struct Link
+    {
+        int fd = -1;
+        bool ws = false;
+        WsDecoder in{false};
+        FrameDecoder frames;
+        std::string pending; // arrived with the upgrade response
+    };
+
+    struct PumpContext
+    {
+        Link *link;
+        FrameDecoder::FrameHandler handler;
+        void *arg;
+    };
+
+    void on_ws(void *arg, uint8_t opcode, uint8_t *data, size_t len)
+    {
+        PumpContext *ctx = static_cast<PumpContext *>(arg);
+        if (opcode == WS_OP_BINARY)
+        {
+            ctx->link->frames.feed(data, len, ctx->handler, ctx->arg);
+        }
+    }
+
+    bool link_send(Link &link, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        if (!link.ws)
+        {
+            return send_frame(link.fd, type, payload, len);
+        }
+        uint8_t buf[WS_CLIENT_HEADER_MAX + FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+        const size_t total = FRAME_HEADER_SIZE + len;
+        const uint32_t key = static_cast<uint32_t>(rand());
+        uint8_t mask[4];
+        write_u32(mask, key);
+        const size_t header = encode_ws_header(WS_OP_BINARY, total, mask, buf);
+        uint8_t *frame = buf + header;
+        frame[0] = FRAME_MAGIC;
+        frame[1] = type;
+        write_u16(frame + 2, len);
+        memcpy(frame + FRAME_HEADER_SIZE, payload, len);
+        for (size_t i = 0; i < total; ++i)
+        {
+            frame[i] ^= mask[i & 3];
+        }
+        return send(link.fd, buf, header + total, MSG_NOSIGNAL) == static_cast<ssize_t>(header + total);
+    }
+
+    bool link_pump(Link &link, FrameDecoder::FrameHandler handler, void *arg)
+    {
+        if (!link.ws)
+        {
+            return pump_frames(link.fd, link.frames, handler, arg);
+        }
+        PumpContext ctx = {&link, handler, arg};
+        if (!link.pending.empty())
+        {
+            std::string data;
+            data.swap(link.pending);
+            return link.in.feed(reinterpret_cast<uint8_t *>(&data[0]), data.size(), &on_ws, &ctx);
+        }
+        uint8_t buf[4096];
+        const ssize_t n = recv(link.fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        return link.in.feed(buf, static_cast<size_t>(n), &on_ws, &ctx);
+    }
+
+    // Read a response head. Returns its size, or 0 if the connection ended
+    // first; the bytes after it are left in rest.
+    size_t read_head(int fd, std::string &head, std::string &rest)
+    {
+        char buf[2048];
+        head.clear();
+        for (;;)
+        {
+            const size_t end = head.find("\r\n\r\n");
+            if (end != std::string::npos)
+            {
+                rest = head.substr(end + 4);
+                head.resize(end + 4);
+                return head.size();
+            }
+            const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+            {
+                return 0;
+            }
+            head.append(buf, static_cast<size_t>(n));
+        }
+    }
+
+    long header_number(const std::string &head, const char *name)
+    {
+        const size_t at = head.find(name);
+        return at == std::string::npos ? -1 : strtol(head.c_str() + at + strlen(name), nullptr, 10);
+    }
+
+    bool page_loads(const char *host, uint16_t port, unsigned loads)
+    {
+        LogHistogram<2> load_us;
+        size_t head_bytes = 0, body_bytes = 0;
+        for (unsigned i = 0; i < loads; ++i)
+        {
+            const Clock::time_point start = Clock::now();
+            const int fd = connect_tcp(host, port);
+            if (fd < 0)
+            {
+                return false;
+            }
+            const std::string request = std::string("GET / HTTP/1.1\r\nHost: ") + host +
+                                        "\r\nUser-Agent: picow_web\r\nAccept: text/html\r\n"
+                                        "Accept-Encoding: gzip, deflate\r\nConnection: keep-alive\r\n\r\n";
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+            std::string head, body;
+            if (!read_head(fd, head, body) || head.compare(0, 12, "HTTP/1.1 200") != 0)
+            {
+                fprintf(stderr, "bad response: %s\n", head.c_str());
+                close(fd);
+                return false;
+            }
+            const long length = header_number(head, "Content-Length: ");
+            char buf[2048];
+            while (length < 0 || body.size() < static_cast<size_t>(length))
+            {
+                const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0)
+                    break;
+                body.append(buf, static_cast<size_t>(n));
+            }
+            load_us.add(us_since(start));
+            close(fd);
+            if (body.size() < 2 || static_cast<uint8_t>(body[0]) != 0x1f || static_cast<uint8_t>(body[1]) != 0x8b)
+            {
+                fprintf(stderr, "body is not gzip\n");
+                return false;
+            }
+            head_bytes = head.size();
+            body_bytes = body.size();
+        }
+        printf("page load  %u loads, %zu bytes (%zu header + %zu gzip body)\n", loads, head_bytes + body_bytes,
+               head_bytes, body_bytes);
+        printf("load us    min %lu  p50 %lu  p90 %lu  max %lu\n", (unsigned long)load_us.min(),
+               (unsigned long)load_us.percentile(50), (unsigned long)load_us.percentile(90),
+               (unsigned long)load_us.max());
+        return true;
+    }
+
+    bool open_websocket(Link &link, const char *host, uint16_t port)
+    {
+        link.fd = connect_tcp(host, port);
+        if (link.fd < 0)
+        {
+            return false;
+        }
+        const char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+        const std::string request = std::string("GET /ws HTTP/1.1\r\nHost: ") + host +
+                                    "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                    "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        send(link.fd, request.data(), request.size(), MSG_NOSIGNAL);
+        std::string head, rest;
+        if (!read_head(link.fd, head, rest) || head.compare(0, 12, "HTTP/1.1 101") != 0)
+        {
+            fprintf(stderr, "upgrade refused: %s\n", head.c_str());
+            return false;
+        }
+        char accept[WS_ACCEPT_SIZE + 1] = {};
+        ws_accept_key(key, strlen(key), accept);
+        if (head.find(std::string("Sec-WebSocket-Accept: ") + accept) == std::string::npos)
+        {
+            fprintf(stderr, "wrong Sec-WebSocket-Accept\n");
+            return false;
+        }
+        link.ws = true;
+        link.pending = rest;
+        return true;
+    }
+
+    struct Session
+    {
+        Link *link;
+        bool report;
+        uint32_t rtt[5]; // min p50 p90 p99 max
+        bool controller;
+        LogHistogram<2> handoff_us;
+        uint32_t applies;
+    };
+
+    void on_frame(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+    {
+        Session *s = static_cast<Session *>(arg);
+        switch (type)
+        {
+        case FRAME_HELLO:
+            if (len >= HELLO_PAYLOAD_SIZE)
+                s->controller = payload[2] == static_cast<uint8_t>(0);
+            break;
+        case FRAME_BENCH_PROBE:
+            link_send(*s->link, FRAME_BENCH_ECHO, payload, len);
+            break;
+        case FRAME_BENCH_REPORT:
+            if (len < BENCH_REPORT_PAYLOAD_SIZE)
+                break;
+            for (int i = 0; i < 5; ++i)
+                s->rtt[i] = read_u32(payload + 16 + 4 * i);
+            s->report = true;
+            break;
+        case FRAME_TELEMETRY:
+        {
+            if (len < TELEMETRY_HEADER_SIZE)
+                break;
+            const uint8_t count = payload[2], size = payload[3];
+            for (uint8_t i = 0; i < count && TELEMETRY_HEADER_SIZE + size_t(i + 1) * size <= len; ++i)
+            {
+                TelemetrySample sample;
+                decode_sample(payload + TELEMETRY_HEADER_SIZE + size_t(i) * size, sample);
+                if (sample.applies)
+                {
+                    s->handoff_us.add(sample.latency_max_us);
+                    s->applies += sample.applies;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    bool run_bench(Session &s, const char *name, unsigned iterations)
+    {
+        uint8_t start[BENCH_START_PAYLOAD_SIZE];
+        write_u16(start, 16);
+        write_u16(start + 2, static_cast<uint16_t>(iterations));
+        start[4] = 1;
+        s.report = false;
+        link_send(*s.link, FRAME_BENCH_START, start, sizeof(start));
+        while (!s.report)
+        {
+            if (!link_pump(*s.link, &on_frame, &s))
+            {
+                fprintf(stderr, "%s: connection closed during the benchmark\n", name);
+                return false;
+            }
+        }
+        printf("%-10s rtt us  min %lu  p50 %lu  p90 %lu  p99 %lu  max %lu\n", name, (unsigned long)s.rtt[0],
+               (unsigned long)s.rtt[1], (unsigned long)s.rtt[2], (unsigned long)s.rtt[3], (unsigned long)s.rtt[4]);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <host> [--http-port N] [--port N] [--loads N] [--commands N] [--rate HZ]\n",
+                argv[0]);
+        return 2;
+    }
+    const char *host = argv[1];
+    unsigned http_port = 80, port = 4242, loads = 20, commands = 500, rate = 50;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const unsigned v = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 0));
+        if (!strcmp(argv[i], "--http-port"))
+            http_port = v;
+        else if (!strcmp(argv[i], "--port"))
+            port = v;
+        else if (!strcmp(argv[i], "--loads"))
+            loads = v;
+        else if (!strcmp(argv[i], "--commands"))
+            commands = v;
+        else if (!strcmp(argv[i], "--rate"))
+            rate = v ? v : 1;
+    }
+
+    if (loads && !page_loads(host, static_cast<uint16_t>(http_port), loads))
+    {
+        return 1;
+    }
+
+    Link ws;
+    if (!open_websocket(ws, host, static_cast<uint16_t>(http_port)))
+    {
+        return 1;
+    }
+    Session s = {};
+    s.link = &ws;
+    if (!run_bench(s, "websocket", commands))
+    {
+        return 1;
+    }
+
+    Link raw;
+    raw.fd = connect_tcp(host, static_cast<uint16_t>(port));
+    if (raw.fd >= 0)
+    {
+        Session rs = {};
+        rs.link = &raw;
+        run_bench(rs, "tcp", commands);
+        close(raw.fd);
+    }
+
+    // drive through the WebSocket, the way the page does
+    const uint8_t topics = SUBSCRIBE_TELEMETRY;
+    link_send(ws, FRAME_SUBSCRIBE, &topics, 1);
+    const uint32_t period_us = 1000000 / rate;
+    Clock::time_point next = Clock::now();
+    unsigned sent = 0;
+    const Clock::time_point start = Clock::now();
+    // keep reading for a telemetry batch after the last command
+    while (sent < commands || us_since(start) < sent * period_us + 200000)
+    {
+        if (sent < commands && Clock::now() >= next)
+        {
+            ControlCommand cmd = {};
+            cmd.seq = static_cast<uint16_t>(sent);
+            cmd.drive = static_cast<int16_t>(200 * sin(sent * 0.05));
+            cmd.steer = static_cast<uint16_t>(90 + 60 * sin(sent * 0.03));
+            uint8_t frame[FRAME_HEADER_SIZE + CONTROL_PAYLOAD_SIZE];
+            encode_control(cmd, frame, sizeof(frame));
+            link_send(ws, FRAME_CONTROL, frame + FRAME_HEADER_SIZE, CONTROL_PAYLOAD_SIZE);
+            ++sent;
+            next += std::chrono::microseconds(period_us);
+        }
+        pollfd pfd = {ws.fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1) > 0 && !link_pump(ws, &on_frame, &s))
+        {
+            fprintf(stderr, "connection closed while driving\n");
+            return 1;
+        }
+    }
+    close(ws.fd);
+
+    if (!s.controller)
+    {
+        fprintf(stderr, "not the controller, commands were ignored\n");
+        return 1;
+    }
+    printf("commands   %u sent, %lu applied\n", sent, (unsigned long)s.applies);
+    printf("handoff us p50 %lu  p99 %lu  max %lu  (decoded -> motion profile, per telemetry sample)\n",
+           (unsigned long)s.handoff_us.percentile(50), (unsigned long)s.handoff_us.percentile(99),
+           (unsigned long)s.handoff_us.max());
+    printf("frame to actuation us  p50 ~%lu  p99 ~%lu  (rtt / 2 + handoff)\n",
+           (unsigned long)(s.rtt[1] / 2 + s.handoff_us.percentile(50)),
+           (unsigned long)(s.rtt[3] / 2 + s.handoff_us.percentile(99)));
+    return 0;
+}
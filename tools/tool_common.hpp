@@ -0,0 +1,116 @@
+#pragma once
+// tool_common.hpp - socket and check helpers shared by the Linux client tools
+
+#include "control_protocol.hpp"
+
+#include <cstdint>
+#include <cstdio>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Blocking TCP connection with Nagle off. Returns -1 (and prints why) on failure.
+inline int connect_tcp(const char *host, uint16_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || !res)
+    {
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return -1;
+    }
+    const int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        perror("connect");
+        freeaddrinfo(res);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    freeaddrinfo(res);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Port of the firmware's UdpControlServer.
+constexpr uint16_t UDP_CONTROL_PORT = 4243;
+
+// UDP socket connected to host:port. Returns -1 on failure.
+inline int udp_socket(const char *host, uint16_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *res = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || !res)
+    {
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return -1;
+    }
+    const int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Send one frame. Returns false if the connection failed.
+inline bool send_frame(int fd, uint8_t type, const uint8_t *payload, uint16_t len)
+{
+    uint8_t buf[pico_tcp::FRAME_HEADER_SIZE + pico_tcp::FRAME_MAX_PAYLOAD];
+    if (len > pico_tcp::FRAME_MAX_PAYLOAD)
+    {
+        return false;
+    }
+    buf[0] = pico_tcp::FRAME_MAGIC;
+    buf[1] = type;
+    pico_tcp::write_u16(buf + 2, len);
+    for (uint16_t i = 0; i < len; ++i)
+    {
+        buf[pico_tcp::FRAME_HEADER_SIZE + i] = payload[i];
+    }
+    const size_t total = pico_tcp::FRAME_HEADER_SIZE + len;
+    return send(fd, buf, total, MSG_NOSIGNAL) == static_cast<ssize_t>(total);
+}
+
+// Read whatever arrived and feed it to the decoder. Returns false on EOF or error.
+inline bool pump_frames(int fd, pico_tcp::FrameDecoder &decoder, pico_tcp::FrameDecoder::FrameHandler handler,
+                        void *arg)
+{
+    uint8_t buf[4096];
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+        return false;
+    }
+    decoder.feed(buf, static_cast<size_t>(n), handler, arg);
+    return true;
+}
+
+// Checks failed so far; a tool that checks exits with 1 if there were any.
+inline unsigned failures = 0;
+
+// Prints a check's result as "ok" or "FAIL" and counts the failures.
+inline void expect(bool ok, const char *what)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+    {
+        failures++;
+    }
+}
@@ -0,0 +1,94 @@
+#!/bin/sh
+# wifi_cache.sh - the flash-cached access point across simulator restarts
+#
+#   wifi_cache.sh <picow_host_sim> <port>
+#
+# Boots the simulator several times on one flash file, with the scan, the
+# targeted join and DHCP taking their time, and checks that
+#   - a first boot scans and writes the cache
+#   - the next boot joins the cached AP and reports the reused lease as
+#     "dhcp cached" rather than a DHCP time
+#   - after the AP moves channel the cached join misses, the boot falls back
+#     to the full scan and the cache holds the new channel
+#   - the same for another AP (BSSID) answering on that channel
+#   - each time the boot after that joins the cached AP again
+#   - every cache write comes before the watchdog is enabled; the simulator
+#     aborts a flash write after it
+# Exits 1 on any failure.
+set -u
+sim=$1
+port=$2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+flash=$dir/flash.bin
+failures=0
+
+# the cache record's channel byte: magic, key, then the BSSID
+channel_offset=$((2 * 1024 * 1024 - 4096 + 8 + 6))
+
+# boot <name> [VAR=value...]: run the simulator until its servers are up
+boot() {
+    name=$1
+    shift
+    env PICOW_SIM_PORT_MAP="4242:$port,4243:$((port + 1)),80:$((port + 2))" PICOW_SIM_FLASH="$flash" \
+        PICOW_SIM_RUN_MS=800 PICOW_SIM_SCAN_MS=300 PICOW_SIM_FAST_JOIN_MS=40 PICOW_SIM_DHCP_MS=150 \
+        "$@" "$sim" >"$dir/$name.log" 2>&1
+    grep "^boot " "$dir/$name.log"
+}
+
+expect() {
+    if grep -q "$2" "$dir/$1.log"; then
+        echo "ok   $3"
+    else
+        echo "FAIL $3"
+        failures=$((failures + 1))
+    fi
+}
+
+not_expect() {
+    if grep -q "$2" "$dir/$1.log"; then
+        echo "FAIL $3"
+        failures=$((failures + 1))
+    else
+        echo "ok   $3"
+    fi
+}
+
+cached_channel() {
+    od -An -tu1 -j $channel_offset -N1 "$flash" | tr -d ' '
+}
+
+expect_channel() {
+    if [ "$(cached_channel)" = "$1" ]; then
+        echo "ok   $2"
+    else
+        echo "FAIL $2 (channel $(cached_channel))"
+        failures=$((failures + 1))
+    fi
+}
+
+boot first
+expect first "^boot (full scan):.* dhcp [0-9]* ms" "first boot scans, DHCP timed"
+expect_channel 6 "cache written with channel 6"
+
+boot cached
+expect cached "^boot (cached AP):.* dhcp cached" "next boot joins the cached AP, lease reported as cached"
+not_expect cached "dhcp [0-9]* ms" "no DHCP time for the reused lease"
+
+boot moved PICOW_SIM_AP_CHANNEL=11
+expect moved "cached AP did not answer" "AP on channel 11: the cached join misses"
+expect moved "^boot (full scan):.* dhcp [0-9]* ms" "and the boot falls back to the full scan and DHCP"
+expect_channel 11 "cache rewritten with channel 11"
+
+boot moved_again PICOW_SIM_AP_CHANNEL=11
+expect moved_again "^boot (cached AP):" "the boot after joins the cached AP on channel 11"
+
+boot other PICOW_SIM_AP_CHANNEL=11 PICOW_SIM_AP_BSSID=2
+expect other "cached AP did not answer" "another BSSID: the cached join misses"
+expect other "^boot (full scan):" "and the boot falls back to the full scan"
+
+boot other_again PICOW_SIM_AP_CHANNEL=11 PICOW_SIM_AP_BSSID=2
+expect other_again "joining 02:00:5e:00:00:02 on channel 11" "cache rewritten with the new BSSID"
+expect other_again "^boot (cached AP):" "the boot after joins it"
+
+[ $failures -eq 0 ]
@@ -0,0 +1,39 @@
+#!/bin/sh
+# with_sim.sh - run a client tool against a fresh picow_host_sim
+#
+#   with_sim.sh <picow_host_sim> <port> <command> [args...]
+#
+# Starts the simulator with its control port on <port>, UDP control on
+# <port>+1 and HTTP on <port>+2 (PICOW_SIM_PORT_MAP), waits until both
+# servers listen, runs the command and stops the simulator again. The
+# command's exit status is the script's. Other PICOW_SIM_* variables in the
+# environment reach the simulator; its output goes to $SIM_LOG if set.
+set -u
+sim=$1
+port=$2
+shift 2
+tmp=
+if [ -n "${SIM_LOG:-}" ]; then
+    log=$SIM_LOG
+else
+    tmp=$(mktemp)
+    log=$tmp
+fi
+
+PICOW_SIM_PORT_MAP="4242:$port,4243:$((port + 1)),80:$((port + 2))" "$sim" >"$log" 2>&1 &
+pid=$!
+trap 'kill $pid 2>/dev/null; wait $pid 2>/dev/null; [ -n "$tmp" ] && rm -f "$tmp"' EXIT
+
+# the UDP server starts after the TCP server
+tries=0
+until grep -q "Listening for udp control" "$log"; do
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ] || ! kill -0 $pid 2>/dev/null; then
+        echo "picow_host_sim did not start:" >&2
+        cat "$log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$@"
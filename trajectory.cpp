@@ -0,0 +1,164 @@
+// trajectory.cpp
+#include "trajectory.hpp"
+
+using namespace pico_tcp;
+
+namespace
+{
+    // a + (b - a) * at / span, for 0 <= at < span
+    int32_t lerp(int32_t a, int32_t b, int32_t at, int32_t span)
+    {
+        return a + static_cast<int32_t>(static_cast<int64_t>(b - a) * at / span);
+    }
+} // namespace
+
+bool TrajectoryPlayer::push(const TrajectoryEntry &entry)
+{
+    return inbox_.push(entry);
+}
+
+bool TrajectoryPlayer::take(TrajectoryEntry &out)
+{
+    if (queue_.size() == TRAJECTORY_RING_SIZE || !inbox_.pop(out))
+    {
+        return false;
+    }
+    return accept(out);
+}
+
+bool TrajectoryPlayer::accept(const TrajectoryEntry &entry)
+{
+    if (!queue_.push(entry))
+    {
+        return false;
+    }
+    newest_t_us_ = entry.point.t_us;
+    return true;
+}
+
+void TrajectoryPlayer::start(const TrajectoryEntry &entry, uint32_t now_us)
+{
+    uint32_t lead_ms = entry.lead_ms ? entry.lead_ms : TRAJECTORY_LEAD_DEFAULT_MS;
+    if (lead_ms > TRAJECTORY_LEAD_MAX_MS)
+    {
+        lead_ms = TRAJECTORY_LEAD_MAX_MS;
+    }
+    lead_us_ = lead_ms * 1000;
+    brake_on_underrun_ = (entry.flags & TRAJECTORY_FLAG_BRAKE_ON_UNDERRUN) != 0;
+    set_flags_ = (entry.flags & TRAJECTORY_FLAG_SPEED) ? CONTROL_FLAG_SPEED : 0;
+    buffer_from(entry, now_us);
+}
+
+void TrajectoryPlayer::buffer_from(const TrajectoryEntry &entry, uint32_t now_us)
+{
+    // the point that arrived first is played a lead from now, the rest keep
+    // their spacing on the client's time line
+    from_ = entry.point;
+    from_arrival_us_ = entry.arrival_us;
+    from_is_end_ = (entry.flags & TRAJECTORY_FLAG_END) != 0;
+    offset_us_ = now_us + lead_us_ - entry.point.t_us;
+    state_ = TrajectoryState::Buffering;
+}
+
+TrajectoryOutput TrajectoryPlayer::step(uint32_t now_us)
+{
+    TrajectoryEntry next;
+    reached_ = false;
+    switch (state_)
+    {
+    case TrajectoryState::Idle:
+        // what is left of a stopped trajectory goes, up to the next start
+        while (queue_.peek(next) && !(next.flags & TRAJECTORY_FLAG_START))
+        {
+            queue_.pop(next);
+        }
+        if (!queue_.pop(next))
+        {
+            return {TrajectoryAction::None, 0, 0, 0};
+        }
+        start(next, now_us);
+        break;
+    case TrajectoryState::Underrun:
+        if (!queue_.pop(next))
+        {
+            return {TrajectoryAction::None, 0, 0, 0};
+        }
+        if (next.flags & TRAJECTORY_FLAG_START)
+        {
+            start(next, now_us);
+        }
+        else
+        {
+            // the stream is back, buffer a full lead again
+            buffer_from(next, now_us);
+        }
+        break;
+    default:
+        break;
+    }
+
+    const uint32_t t = now_us - offset_us_;
+    if (state_ == TrajectoryState::Buffering)
+    {
+        if (static_cast<int32_t>(t - from_.t_us) < 0)
+        {
+            return {TrajectoryAction::None, 0, 0, 0};
+        }
+        state_ = TrajectoryState::Playing;
+        reached_ = true;
+    }
+
+    // move up to the last point that is due
+    while (!from_is_end_ && queue_.peek(next) && !(next.flags & TRAJECTORY_FLAG_START) &&
+           static_cast<int32_t>(t - next.point.t_us) >= 0)
+    {
+        queue_.pop(next);
+        from_ = next.point;
+        from_arrival_us_ = next.arrival_us;
+        from_is_end_ = (next.flags & TRAJECTORY_FLAG_END) != 0;
+        reached_ = true;
+    }
+    if (from_is_end_)
+    {
+        // held from here on; the dead-man timer runs from this last setpoint
+        state_ = TrajectoryState::Idle;
+        return {TrajectoryAction::Set, from_.drive, from_.steer, set_flags_};
+    }
+    if (queue_.peek(next))
+    {
+        if (next.flags & TRAJECTORY_FLAG_START)
+        {
+            // the old trajectory is out of points, the new one takes over
+            queue_.pop(next);
+            start(next, now_us);
+            return {TrajectoryAction::None, 0, 0, 0};
+        }
+        const int32_t span = static_cast<int32_t>(next.point.t_us - from_.t_us);
+        const int32_t at = static_cast<int32_t>(t - from_.t_us);
+        if (span <= 0)
+        {
+            return {TrajectoryAction::Set, next.point.drive, next.point.steer, set_flags_};
+        }
+        return {TrajectoryAction::Set, static_cast<int16_t>(lerp(from_.drive, next.point.drive, at, span)),
+                static_cast<uint16_t>(lerp(from_.steer, next.point.steer, at, span)), set_flags_};
+    }
+
+    underruns_++;
+    state_ = TrajectoryState::Underrun;
+    if (brake_on_underrun_)
+    {
+        return {TrajectoryAction::Brake, 0, from_.steer, CONTROL_FLAG_BRAKE};
+    }
+    // one last time, then held without re-arming the dead-man timer
+    return {TrajectoryAction::Set, from_.drive, from_.steer, set_flags_};
+}
+
+uint32_t TrajectoryPlayer::lead_us(uint32_t now_us) const
+{
+    if (state_ != TrajectoryState::Buffering && state_ != TrajectoryState::Playing)
+    {
+        return 0;
+    }
+    const int32_t lead = static_cast<int32_t>(newest_t_us_ - (now_us - offset_us_));
+    return lead > 0 ? static_cast<uint32_t>(lead) : 0;
+}
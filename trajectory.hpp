@@ -0,0 +1,147 @@
+#pragma once
+// trajectory.hpp - timed setpoints played out by the motion tick
+//
+// Live setpoints carry every bit of WiFi jitter into the car's motion: a
+// command that arrives 30 ms late is applied 30 ms late. In trajectory mode
+// the client sends short batches of points on its own time line instead, a
+// little ahead of when they are due. Core 1 pushes them into the player's
+// inbox, the motion tick on core 0 takes them into its queue and plays them
+// out, a fixed lead behind the arrival of the first point, interpolating
+// linearly between points. Jitter shorter than the lead never reaches the
+// motors.
+//
+// The player's clock is the motion tick count (trajectory_time_us()), not
+// time_us_32(). The tick runs at a fixed rate, so the two keep pace; a tick
+// lost to a late interrupt delays playback by one tick, which the lead
+// absorbs until the next start. Since step() only plays points taken in by
+// take(), the points it returns, with the tick they were taken on, are all
+// a replay needs to play the same setpoints on the same ticks.
+//
+// The output goes through Actuation::set_setpoint(), so the ramps and their
+// limits still apply, and every tick played re-arms the dead-man timer. A
+// trajectory started with TRAJECTORY_FLAG_SPEED has its drive values in mm/s
+// and is played through the speed loop.
+//
+// When playback reaches the last buffered point (an underrun), the player
+// holds that point and stops re-arming the dead-man timer, so the failsafe
+// brakes unless the stream comes back within its timeout. A trajectory started
+// with TRAJECTORY_FLAG_BRAKE_ON_UNDERRUN brakes at once instead. Points that
+// arrive after an underrun are buffered for a full lead again before playback
+// resumes. A point flagged as the end of the trajectory is held without
+// counting an underrun.
+//
+// A live command stops the trajectory (stop()); points still arriving for it
+// are discarded up to the next start.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "control_protocol.hpp"
+#include "motion_profile.hpp"
+#include "spsc_ring.hpp"
+
+namespace pico_tcp
+{
+
+    constexpr size_t TRAJECTORY_RING_SIZE = 64;
+    // core 0 empties the inbox every tick, two batches cover a burst
+    constexpr size_t TRAJECTORY_INBOX_SIZE = 2 * TRAJECTORY_BATCH_MAX;
+    constexpr uint16_t TRAJECTORY_LEAD_DEFAULT_MS = 60;
+    // buffering does not re-arm the dead-man timer, stay well inside it
+    constexpr uint16_t TRAJECTORY_LEAD_MAX_MS = 200;
+
+    enum class TrajectoryState : uint8_t
+    {
+        Idle,      // live commands only
+        Buffering, // waiting out the lead before the first point
+        Playing,
+        Underrun, // out of points, holding or braked
+    };
+
+    // One point as queued from core 1 to core 0. flags holds START only on
+    // the first point of a trajectory, END only on its last.
+    struct TrajectoryEntry
+    {
+        TrajectoryPoint point;
+        uint8_t flags;       // TrajectoryFlags
+        uint16_t lead_ms;    // with START
+        uint32_t arrival_us; // device time core 1 queued it
+    };
+
+    enum class TrajectoryAction : uint8_t
+    {
+        None,  // leave the setpoint alone
+        Set,   // drive and steer are the setpoint for this tick
+        Brake, // underrun with the brake policy
+    };
+
+    struct TrajectoryOutput
+    {
+        TrajectoryAction action;
+        int16_t drive;
+        uint16_t steer;
+        uint8_t flags; // ControlFlags to hand over with the setpoint
+    };
+
+    // The player's time at the start of motion tick number tick + 1.
+    constexpr uint32_t trajectory_time_us(uint32_t tick) { return tick * (1000000 / MOTION_TICK_HZ); }
+
+    class TrajectoryPlayer
+    {
+    public:
+        // Core 1. Returns false, and counts the drop, when the inbox is full.
+        bool push(const TrajectoryEntry &entry);
+
+        // Core 0, before step(): take the oldest point core 1 pushed into the
+        // queue step() plays from. Returns false when there is none, or no
+        // room for it yet.
+        bool take(TrajectoryEntry &out);
+
+        // Core 0: queue a point as take() does, for a replay. Returns false
+        // when the queue is full.
+        bool accept(const TrajectoryEntry &entry);
+
+        // Core 0, once per motion tick: what to hand to the ramps at now_us,
+        // on the clock of trajectory_time_us().
+        TrajectoryOutput step(uint32_t now_us);
+
+        // Core 0, after step(): whether playback reached a point on this tick,
+        // and the last point reached with the time it was queued.
+        bool reached() const { return reached_; }
+        const TrajectoryPoint &point() const { return from_; }
+        uint32_t point_arrival_us() const { return from_arrival_us_; }
+
+        // Core 0, with the tick masked: a live command took over.
+        void stop() { state_ = TrajectoryState::Idle; }
+
+        // Core 0, with the tick masked, for telemetry.
+        TrajectoryState state() const { return state_; }
+        size_t depth() const { return inbox_.size() + queue_.size(); }
+        // How far the newest queued point is ahead of playback at now_us.
+        uint32_t lead_us(uint32_t now_us) const;
+        uint32_t underruns() const { return underruns_; }
+
+        // Points pushed while the inbox was full.
+        uint32_t dropped() const { return inbox_.dropped(); }
+
+    private:
+        void start(const TrajectoryEntry &entry, uint32_t now_us);
+        void buffer_from(const TrajectoryEntry &entry, uint32_t now_us);
+
+        SpscRing<TrajectoryEntry, TRAJECTORY_INBOX_SIZE> inbox_;
+        // only core 0 touches the queue
+        SpscRing<TrajectoryEntry, TRAJECTORY_RING_SIZE> queue_;
+        uint32_t newest_t_us_ = 0; // of the last point queued
+
+        TrajectoryState state_ = TrajectoryState::Idle;
+        TrajectoryPoint from_ = {}; // the last point playback has reached
+        uint32_t from_arrival_us_ = 0;
+        bool from_is_end_ = false;
+        bool reached_ = false; // from_ was reached on the last step()
+        uint32_t offset_us_ = 0; // device time of a point = its t_us + offset
+        uint32_t lead_us_ = TRAJECTORY_LEAD_DEFAULT_MS * 1000;
+        bool brake_on_underrun_ = false;
+        uint8_t set_flags_ = 0; // CONTROL_FLAG_SPEED for a speed trajectory
+        uint32_t underruns_ = 0;
+    };
+} // namespace pico_tcp
@@ -0,0 +1,82 @@
+#pragma once
+// tx_ring.hpp - statically allocated transmit slots for one TCP connection
+//
+// Frames are built directly in a slot and handed to tcp_write() without
+// TCP_WRITE_FLAG_COPY, so lwIP references the slot instead of copying it into
+// its heap. lwIP may read the slot until the peer acknowledges it, so a slot
+// only returns to the ring once sent_cb() has reported all of its bytes.
+// TCP acknowledges in order, so slots are released in the order they were
+// committed.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace pico_tcp
+{
+
+    constexpr size_t TX_SLOTS = 4;
+    constexpr size_t TX_SLOT_SIZE = 256;
+
+    class TxRing
+    {
+    public:
+        TxRing() = default;
+
+        // Next free slot, or nullptr if every slot is still waiting for an ACK.
+        uint8_t *acquire()
+        {
+            return count_ < TX_SLOTS ? slots_[head_].data() : nullptr;
+        }
+
+        // Queue the slot returned by acquire() holding len bytes.
+        void commit(size_t len)
+        {
+            lens_[head_] = static_cast<uint16_t>(len);
+            head_ = (head_ + 1) % TX_SLOTS;
+            count_++;
+        }
+
+        // Queue len bytes lwIP references outside the ring, e.g. const data in
+        // flash. Takes a slot without using its buffer, so acknowledgements
+        // are still matched to writes in order. Only valid if acquire()
+        // would succeed.
+        void commit_external(size_t len) { commit(len); }
+
+        // Account for len acknowledged bytes, freeing fully acknowledged slots.
+        void on_sent(size_t len)
+        {
+            while (len > 0 && count_ > 0)
+            {
+                const size_t left = lens_[tail_] - acked_;
+                if (len < left)
+                {
+                    acked_ += len;
+                    return;
+                }
+                len -= left;
+                acked_ = 0;
+                tail_ = (tail_ + 1) % TX_SLOTS;
+                count_--;
+            }
+        }
+
+        // Forget everything in flight. Only valid once lwIP dropped its references.
+        void reset()
+        {
+            head_ = tail_ = count_ = 0;
+            acked_ = 0;
+        }
+
+        size_t in_flight() const { return count_; }
+        bool full() const { return count_ == TX_SLOTS; }
+
+    private:
+        std::array<std::array<uint8_t, TX_SLOT_SIZE>, TX_SLOTS> slots_;
+        std::array<uint16_t, TX_SLOTS> lens_ = {};
+        uint8_t head_ = 0;  // next slot to hand out
+        uint8_t tail_ = 0;  // oldest slot in flight
+        uint8_t count_ = 0; // slots in flight
+        size_t acked_ = 0;  // acknowledged bytes of the tail slot
+    };
+} // namespace pico_tcp
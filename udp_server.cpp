@@ -0,0 +1,157 @@
+// udp_server.cpp
+#include "udp_server.hpp"
+#include <cstdio>
+
+using namespace pico_tcp;
+
+#define DEBUG_printf printf
+
+UdpControlServer::~UdpControlServer()
+{
+    close();
+}
+
+bool UdpControlServer::start()
+{
+    if (pcb_)
+    {
+        DEBUG_printf("udp already started\n");
+        return false;
+    }
+
+    struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb)
+    {
+        DEBUG_printf("failed to create udp pcb\n");
+        return false;
+    }
+
+    err_t err = udp_bind(pcb, IP_ANY_TYPE, UDP_PORT);
+    if (err)
+    {
+        DEBUG_printf("failed to bind to udp port %u (err %d)\n", UDP_PORT, err);
+        udp_remove(pcb);
+        return false;
+    }
+
+    DEBUG_printf("Listening for udp control on port %u\n", UDP_PORT);
+    pcb_ = pcb;
+    udp_recv(pcb_, &UdpControlServer::recv_cb, this);
+    return true;
+}
+
+void UdpControlServer::close()
+{
+    if (pcb_)
+    {
+        udp_remove(pcb_);
+        pcb_ = nullptr;
+    }
+}
+
+// Whether a datagram from addr:port may drive. Only the TCP controller's host
+// may, if there is one. The first peer binds the server until it has been
+// silent for UDP_RESYNC_TIMEOUT_MS; a new peer starts a new sequence.
+bool UdpControlServer::accept_peer(const ip_addr_t *addr, u16_t port, absolute_time_t now)
+{
+    ip_addr_t controller;
+    if (tcp_ && tcp_->controller_address(controller) && !ip_addr_cmp(addr, &controller))
+    {
+        datagrams_rejected_++;
+        return false;
+    }
+    const bool same = have_peer_ && ip_addr_cmp(addr, &peer_addr_) && port == peer_port_;
+    if (!same && have_peer_ && absolute_time_diff_us(last_rx_, now) <= UDP_RESYNC_TIMEOUT_MS * 1000ll)
+    {
+        datagrams_rejected_++;
+        return false;
+    }
+    if (!same || absolute_time_diff_us(last_rx_, now) > UDP_RESYNC_TIMEOUT_MS * 1000ll)
+    {
+        have_seq_ = false;
+    }
+    have_peer_ = true;
+    peer_addr_ = *addr;
+    peer_port_ = port;
+    last_rx_ = now;
+    return true;
+}
+
+bool UdpControlServer::is_newer(uint16_t seq) const
+{
+    if (!have_seq_)
+    {
+        return true;
+    }
+    // serial number arithmetic, so the sequence may wrap
+    return static_cast<int16_t>(seq - last_seq_) > 0;
+}
+
+void UdpControlServer::apply(const ControlCommand &cmd)
+{
+    have_seq_ = true;
+    last_seq_ = cmd.seq;
+    commands_applied_++;
+    if (on_command_)
+    {
+        on_command_(on_command_arg_, COMMAND_SOURCE_UDP, cmd, arrival_us_);
+    }
+}
+
+/* -----------------------
+   CALLBACKS (static)
+   ----------------------- */
+
+void UdpControlServer::recv_cb(void *arg, struct udp_pcb * /*pcb*/, struct pbuf *p, const ip_addr_t *addr,
+                               u16_t port)
+{
+    UdpControlServer *self = static_cast<UdpControlServer *>(arg);
+    if (!self || !p)
+    {
+        if (p)
+            pbuf_free(p);
+        return;
+    }
+
+    self->arrival_us_ = time_us_32();
+    if (!self->accept_peer(addr, port, get_absolute_time()))
+    {
+        pbuf_free(p);
+        return;
+    }
+
+    // datagrams are self-contained, never carry a partial frame over
+    self->decoder_.reset();
+    self->coalescer_.begin();
+    self->decoder_.feed(p, &UdpControlServer::frame_cb, self);
+    pbuf_free(p);
+
+    ControlCommand cmd;
+    if (self->coalescer_.take(cmd))
+    {
+        self->apply(cmd);
+    }
+}
+
+void UdpControlServer::frame_cb(void *arg, uint8_t type, const uint8_t *payload, uint16_t len)
+{
+    UdpControlServer *self = static_cast<UdpControlServer *>(arg);
+    if (type != FRAME_CONTROL)
+    {
+        return;
+    }
+    ControlCommand cmd;
+    if (!decode_control(payload, len, cmd))
+    {
+        return;
+    }
+    if (!self->is_newer(cmd.seq))
+    {
+        self->commands_dropped_++;
+        return;
+    }
+    if (self->coalescer_.offer(cmd) == CoalesceVerdict::Urgent)
+    {
+        self->apply(cmd);
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+// udp_server.hpp - low-latency control channel over raw lwIP UDP
+//
+// Carries the same frames as TcpServer, one or more per datagram. A steering
+// command is worthless once a newer one exists, so there are no retransmits:
+// datagrams that arrive out of order or late are dropped and only the newest
+// command of each datagram is applied, brakes right away (command_coalescer.hpp).
+//
+// UDP has no connection to hang a role on. While a TCP or WebSocket client
+// holds the controller role, only datagrams from that client's host are
+// accepted, so an observer cannot take control over UDP. Among those, and
+// when no one holds the role, the server binds to the first peer (address and
+// port) that sends it a datagram and ignores everyone else until that peer has
+// been silent for UDP_RESYNC_TIMEOUT_MS. Rejected datagrams are counted.
+
+#include <cstdint>
+#include <cstdbool>
+
+#include "command_coalescer.hpp"
+#include "control_protocol.hpp"
+#include "tcp_server.hpp"
+
+extern "C"
+{
+#include "pico/stdlib.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+}
+
+namespace pico_tcp
+{
+
+    constexpr uint16_t UDP_PORT = 4243;
+    // After this long without a datagram from the bound peer any peer and any
+    // sequence number is accepted, so a restarted client does not have to
+    // continue the old sequence.
+    constexpr uint32_t UDP_RESYNC_TIMEOUT_MS = 1000;
+
+    class UdpControlServer
+    {
+    public:
+        UdpControlServer() = default;
+        ~UdpControlServer();
+
+        // non-copyable
+        UdpControlServer(const UdpControlServer &) = delete;
+        UdpControlServer &operator=(const UdpControlServer &) = delete;
+
+        // Bind and start receiving. Returns true on success.
+        bool start();
+
+        // Stop receiving.
+        void close();
+
+        // Take the controller role from this server. Without one any host may
+        // bind the UDP channel.
+        void set_tcp_server(const TcpServer *tcp) { tcp_ = tcp; }
+
+        // Install the sink for applied control commands.
+        void set_command_handler(CommandHandler handler, void *arg)
+        {
+            on_command_ = handler;
+            on_command_arg_ = arg;
+        }
+
+        bool running() const { return pcb_ != nullptr; }
+
+        // Commands handed to the handler.
+        uint32_t commands_applied() const { return commands_applied_; }
+
+        // Commands dropped because a newer one was already applied or seen
+        // earlier in the same datagram.
+        uint32_t commands_dropped() const { return commands_dropped_ + coalescer_.stale(); }
+
+        // Commands replaced by a newer one in the same datagram.
+        uint32_t commands_coalesced() const { return coalescer_.coalesced(); }
+
+        // Brakes applied ahead of the rest of their datagram.
+        uint32_t commands_urgent() const { return coalescer_.urgent(); }
+
+        // Datagrams ignored because they came from another host than the
+        // controller's or another peer than the bound one.
+        uint32_t datagrams_rejected() const { return datagrams_rejected_; }
+
+    private:
+        struct udp_pcb *pcb_ = nullptr;
+        FrameDecoder decoder_;
+        CommandHandler on_command_ = nullptr;
+        void *on_command_arg_ = nullptr;
+        const TcpServer *tcp_ = nullptr;
+
+        // the peer commands are taken from, and when it last sent one
+        bool have_peer_ = false;
+        ip_addr_t peer_addr_ = {};
+        u16_t peer_port_ = 0;
+        absolute_time_t last_rx_ = 0;
+
+        bool have_seq_ = false;
+        uint16_t last_seq_ = 0;
+
+        // the datagram being decoded
+        CommandCoalescer coalescer_;
+        uint32_t arrival_us_ = 0;
+
+        uint32_t commands_applied_ = 0;
+        uint32_t commands_dropped_ = 0;
+        uint32_t datagrams_rejected_ = 0;
+
+        bool accept_peer(const ip_addr_t *addr, u16_t port, absolute_time_t now);
+        bool is_newer(uint16_t seq) const;
+        void apply(const ControlCommand &cmd);
+
+        static void recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+        static void frame_cb(void *arg, uint8_t type, const uint8_t *payload, uint16_t len);
+    };
+} // namespace pico_tcp
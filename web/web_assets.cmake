@@ -0,0 +1,82 @@
+# web_assets.cmake - gzip the control page at build time and embed it as const data
+#
+# include() this file and call picow_add_web_assets(<target>). The assets are
+# compressed at the highest level and written into a generated source as
+# const arrays, which the linker puts in flash; TcpServer sends them from
+# there without copying (web_assets.hpp).
+#
+# The same file is the build step, run as
+#   cmake -DOUTPUT=<file.cpp> -DASSETS=<a|b|...> -P web_assets.cmake
+
+if (CMAKE_SCRIPT_MODE_FILE)
+    # file(ARCHIVE_CREATE ... FORMAT raw COMPRESSION_LEVEL)
+    cmake_minimum_required(VERSION 3.19)
+
+    string(REPLACE "|" ";" ASSETS "${ASSETS}")
+    get_filename_component(out_dir ${OUTPUT} DIRECTORY)
+    set(arrays "")
+    set(table "")
+    set(index 0)
+    foreach (asset IN LISTS ASSETS)
+        get_filename_component(name ${asset} NAME)
+        get_filename_component(ext ${asset} LAST_EXT)
+        if (ext STREQUAL ".html")
+            set(type "text/html; charset=utf-8")
+        elseif (ext STREQUAL ".js")
+            set(type "application/javascript")
+        elseif (ext STREQUAL ".css")
+            set(type "text/css")
+        elseif (ext STREQUAL ".svg")
+            set(type "image/svg+xml")
+        elseif (ext STREQUAL ".ico")
+            set(type "image/x-icon")
+        else ()
+            set(type "application/octet-stream")
+        endif ()
+
+        set(gz ${out_dir}/${name}.gz)
+        file(ARCHIVE_CREATE OUTPUT ${gz} PATHS ${asset} FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+        file(SIZE ${asset} raw_size)
+        file(SIZE ${gz} gz_size)
+        file(READ ${gz} hex HEX)
+        # zero the gzip timestamp so an unchanged asset generates the same source
+        string(SUBSTRING "${hex}" 0 8 head)
+        string(SUBSTRING "${hex}" 16 -1 tail)
+        set(hex "${head}00000000${tail}")
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+        string(REPEAT "0x..," 16 row)
+        string(REGEX REPLACE "(${row})" "\\1\n        " bytes "${bytes}")
+        string(STRIP "${bytes}" bytes)
+        string(APPEND arrays "    // ${name}: ${raw_size} bytes, ${gz_size} gzipped\n")
+        string(APPEND arrays "    const uint8_t ASSET_${index}[] = {\n        ${bytes}\n    };\n")
+        string(APPEND table "    {\"/${name}\", \"${type}\", ASSET_${index}, sizeof(ASSET_${index}), ${raw_size}},\n")
+        message(STATUS "web asset ${name}: ${raw_size} -> ${gz_size} bytes")
+        math(EXPR index "${index} + 1")
+    endforeach ()
+
+    file(WRITE ${OUTPUT}.tmp
+            "// generated by web/web_assets.cmake, do not edit\n"
+            "#include \"web_assets.hpp\"\n\n"
+            "namespace\n{\n${arrays}} // namespace\n\n"
+            "const pico_tcp::WebAsset pico_tcp::WEB_ASSETS[] = {\n${table}};\n"
+            "const size_t pico_tcp::WEB_ASSET_COUNT = ${index};\n")
+    # only touch the output when it changed, so the firmware is not relinked for nothing
+    execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+    return()
+endif ()
+
+set(PICOW_WEB_DIR ${CMAKE_CURRENT_LIST_DIR})
+set(PICOW_WEB_ASSETS
+        ${PICOW_WEB_DIR}/index.html
+        )
+
+function(picow_add_web_assets target)
+    set(out ${CMAKE_CURRENT_BINARY_DIR}/${target}_web_assets.cpp)
+    string(REPLACE ";" "|" assets "${PICOW_WEB_ASSETS}")
+    add_custom_command(OUTPUT ${out}
+            COMMAND ${CMAKE_COMMAND} -DOUTPUT=${out} -DASSETS=${assets} -P ${PICOW_WEB_DIR}/web_assets.cmake
+            DEPENDS ${PICOW_WEB_ASSETS} ${PICOW_WEB_DIR}/web_assets.cmake
+            COMMENT "Compressing web assets for ${target}"
+            VERBATIM)
+    target_sources(${target} PRIVATE ${out})
+endfunction()
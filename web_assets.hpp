@@ -0,0 +1,42 @@
+#pragma once
+// web_assets.hpp - the control page, gzipped at build time (web/web_assets.cmake)
+//
+// The data is const, so on the device it stays in XIP flash and is handed to
+// tcp_write() from there: serving the page allocates and copies nothing.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace pico_tcp
+{
+
+    struct WebAsset
+    {
+        const char *path; // "/index.html"
+        const char *content_type;
+        const uint8_t *data; // gzip stream
+        uint32_t size;
+        uint32_t raw_size; // before compression
+    };
+
+    extern const WebAsset WEB_ASSETS[];
+    extern const size_t WEB_ASSET_COUNT;
+
+    // The asset served for a request path; "/" is the index page.
+    inline const WebAsset *find_web_asset(const char *path)
+    {
+        if (strcmp(path, "/") == 0)
+        {
+            path = "/index.html";
+        }
+        for (size_t i = 0; i < WEB_ASSET_COUNT; ++i)
+        {
+            if (strcmp(WEB_ASSETS[i].path, path) == 0)
+            {
+                return &WEB_ASSETS[i];
+            }
+        }
+        return nullptr;
+    }
+} // namespace pico_tcp
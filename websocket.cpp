@@ -0,0 +1,453 @@
+// websocket.cpp
+#include "websocket.hpp"
+#include <cstring>
+#include <strings.h>
+
+using namespace pico_tcp;
+
+namespace
+{
+    const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    inline uint32_t rol(uint32_t v, unsigned n)
+    {
+        return (v << n) | (v >> (32 - n));
+    }
+
+    void sha1_block(uint32_t h[5], const uint8_t *block)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i)
+        {
+            w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+                   (uint32_t(block[4 * i + 2]) << 8) | block[4 * i + 3];
+        }
+        for (int i = 16; i < 80; ++i)
+        {
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            const uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    // Match a header name case-insensitively and return its trimmed value.
+    const char *header_value(const char *line, const char *name)
+    {
+        const size_t n = strlen(name);
+        if (strncasecmp(line, name, n) != 0 || line[n] != ':')
+        {
+            return nullptr;
+        }
+        const char *v = line + n + 1;
+        while (*v == ' ' || *v == '\t')
+        {
+            ++v;
+        }
+        return v;
+    }
+
+    // Comma-separated header values, e.g. "keep-alive, Upgrade".
+    bool has_token(const char *value, const char *token)
+    {
+        const size_t n = strlen(token);
+        while (*value)
+        {
+            while (*value == ' ' || *value == ',')
+            {
+                ++value;
+            }
+            if (strncasecmp(value, token, n) == 0 && (value[n] == '\0' || value[n] == ',' || value[n] == ' '))
+            {
+                return true;
+            }
+            while (*value && *value != ',')
+            {
+                ++value;
+            }
+        }
+        return false;
+    }
+
+    // Copy a header value up to the first space into out. Returns false if
+    // it did not fit.
+    template <size_t N>
+    bool copy_value(const char *v, std::array<char, N> &out)
+    {
+        size_t n = 0;
+        while (v[n] && v[n] != ' ' && n < N - 1)
+        {
+            out[n] = v[n];
+            ++n;
+        }
+        out[n] = '\0';
+        return v[n] == '\0' || v[n] == ' ';
+    }
+} // namespace
+
+void pico_tcp::sha1(const uint8_t *data, size_t len, uint8_t out[SHA1_SIZE])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t done = 0;
+    for (; len - done >= 64; done += 64)
+    {
+        sha1_block(h, data + done);
+    }
+
+    // padding: 0x80, zeros, then the message length in bits, big endian
+    uint8_t tail[128] = {};
+    const size_t rest = len - done;
+    memcpy(tail, data + done, rest);
+    tail[rest] = 0x80;
+    const size_t tail_len = rest + 9 <= 64 ? 64 : 128;
+    const uint64_t bits = uint64_t(len) * 8;
+    for (int i = 0; i < 8; ++i)
+    {
+        tail[tail_len - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    for (size_t off = 0; off < tail_len; off += 64)
+    {
+        sha1_block(h, tail + off);
+    }
+
+    for (int i = 0; i < 5; ++i)
+    {
+        out[4 * i] = static_cast<uint8_t>(h[i] >> 24);
+        out[4 * i + 1] = static_cast<uint8_t>(h[i] >> 16);
+        out[4 * i + 2] = static_cast<uint8_t>(h[i] >> 8);
+        out[4 * i + 3] = static_cast<uint8_t>(h[i]);
+    }
+}
+
+size_t pico_tcp::base64_encode(const uint8_t *data, size_t len, char *out)
+{
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3)
+    {
+        const uint32_t v = (uint32_t(data[i]) << 16) | (i + 1 < len ? uint32_t(data[i + 1]) << 8 : 0) |
+                           (i + 2 < len ? data[i + 2] : 0);
+        out[n++] = ALPHABET[(v >> 18) & 63];
+        out[n++] = ALPHABET[(v >> 12) & 63];
+        out[n++] = i + 1 < len ? ALPHABET[(v >> 6) & 63] : '=';
+        out[n++] = i + 2 < len ? ALPHABET[v & 63] : '=';
+    }
+    return n;
+}
+
+void pico_tcp::ws_accept_key(const char *key, size_t key_len, char out[WS_ACCEPT_SIZE])
+{
+    uint8_t buf[HttpRequestParser::KEY_MAX + sizeof(WS_GUID)];
+    if (key_len > HttpRequestParser::KEY_MAX)
+    {
+        key_len = HttpRequestParser::KEY_MAX;
+    }
+    memcpy(buf, key, key_len);
+    memcpy(buf + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    uint8_t digest[SHA1_SIZE];
+    sha1(buf, key_len + sizeof(WS_GUID) - 1, digest);
+    base64_encode(digest, SHA1_SIZE, out);
+}
+
+size_t pico_tcp::ws_header_size(size_t len, bool masked)
+{
+    const size_t base = len < 126 ? 2 : len <= 0xffff ? 4 : 10;
+    return masked ? base + 4 : base;
+}
+
+size_t pico_tcp::encode_ws_header(uint8_t opcode, size_t len, const uint8_t *mask, uint8_t *out)
+{
+    const uint8_t mask_bit = mask ? 0x80 : 0;
+    size_t n = 0;
+    out[n++] = static_cast<uint8_t>(0x80 | opcode);
+    if (len < 126)
+    {
+        out[n++] = static_cast<uint8_t>(mask_bit | len);
+    }
+    else if (len <= 0xffff)
+    {
+        out[n++] = static_cast<uint8_t>(mask_bit | 126);
+        out[n++] = static_cast<uint8_t>(len >> 8);
+        out[n++] = static_cast<uint8_t>(len);
+    }
+    else
+    {
+        out[n++] = static_cast<uint8_t>(mask_bit | 127);
+        for (int i = 7; i >= 0; --i)
+        {
+            out[n++] = static_cast<uint8_t>(uint64_t(len) >> (8 * i));
+        }
+    }
+    if (mask)
+    {
+        memcpy(out + n, mask, 4);
+        n += 4;
+    }
+    return n;
+}
+
+/* -----------------------
+   HttpRequestParser
+   ----------------------- */
+
+void HttpRequestParser::reset()
+{
+    *this = HttpRequestParser();
+}
+
+size_t HttpRequestParser::feed(const uint8_t *data, size_t len)
+{
+    size_t used = 0;
+    while (used < len && !complete_)
+    {
+        const char c = static_cast<char>(data[used++]);
+        if (c == '\n')
+        {
+            line_done();
+            line_len_ = 0;
+        }
+        else if (c != '\r' && line_len_ < LINE_MAX - 1)
+        {
+            line_[line_len_++] = c;
+        }
+    }
+    return used;
+}
+
+void HttpRequestParser::line_done()
+{
+    line_[line_len_] = '\0';
+    const char *line = line_.data();
+    if (first_line_)
+    {
+        // "GET /path HTTP/1.1"; the query string is not needed
+        first_line_ = false;
+        get_ = strncmp(line, "GET ", 4) == 0;
+        const char *p = strchr(line, ' ');
+        if (!p)
+        {
+            return;
+        }
+        ++p;
+        size_t n = 0;
+        while (p[n] && p[n] != ' ' && p[n] != '?' && n < PATH_MAX - 1)
+        {
+            path_[n] = p[n];
+            ++n;
+        }
+        path_[n] = '\0';
+        return;
+    }
+    if (line_len_ == 0)
+    {
+        complete_ = true;
+        return;
+    }
+    const char *v;
+    if ((v = header_value(line, "Upgrade")))
+    {
+        upgrade_ = has_token(v, "websocket");
+    }
+    else if ((v = header_value(line, "Connection")))
+    {
+        connection_upgrade_ = has_token(v, "Upgrade");
+    }
+    else if ((v = header_value(line, "Sec-WebSocket-Key")))
+    {
+        copy_value(v, key_);
+        key_len_ = strlen(key_.data());
+    }
+    else if ((v = header_value(line, "Host")))
+    {
+        host_ok_ = copy_value(v, host_);
+    }
+    else if ((v = header_value(line, "Origin")))
+    {
+        // "http://car.local:8080", the host part is what Host says
+        has_origin_ = true;
+        const char *authority = strstr(v, "://");
+        origin_ok_ = authority && copy_value(authority + 3, origin_);
+    }
+}
+
+bool HttpRequestParser::same_origin() const
+{
+    if (!has_origin_)
+    {
+        return true;
+    }
+    return origin_ok_ && host_ok_ && host_[0] != '\0' && strcasecmp(origin_.data(), host_.data()) == 0;
+}
+
+/* -----------------------
+   WsDecoder
+   ----------------------- */
+
+void WsDecoder::reset()
+{
+    header_fill_ = 0;
+    header_need_ = 2;
+    message_ = 0;
+    remaining_ = 0;
+    control_fill_ = 0;
+}
+
+// The header is complete: take the frame apart. Returns false on a protocol error.
+bool WsDecoder::header_done()
+{
+    const uint8_t *h = header_.data();
+    opcode_ = h[0] & 0x0f;
+    const uint8_t len7 = h[1] & 0x7f;
+    size_t pos = 2;
+    if (len7 == 126)
+    {
+        remaining_ = (uint64_t(h[2]) << 8) | h[3];
+        pos = 4;
+    }
+    else if (len7 == 127)
+    {
+        remaining_ = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            remaining_ = (remaining_ << 8) | h[2 + i];
+        }
+        pos = 10;
+    }
+    else
+    {
+        remaining_ = len7;
+    }
+    if (masked_)
+    {
+        memcpy(mask_.data(), h + pos, 4);
+    }
+    mask_pos_ = 0;
+    control_fill_ = 0;
+
+    if (opcode_ & 0x8)
+    {
+        // control frames are never fragmented and carry at most 125 bytes
+        return (h[0] & 0x80) && remaining_ <= control_.size();
+    }
+    if (opcode_ == WS_OP_CONTINUATION)
+    {
+        if (!message_)
+        {
+            return false;
+        }
+        opcode_ = message_;
+    }
+    else if (message_)
+    {
+        return false; // a new message inside an unfinished one
+    }
+    // remember the opcode for the continuations that follow
+    message_ = (h[0] & 0x80) ? 0 : opcode_;
+    return true;
+}
+
+bool WsDecoder::feed(uint8_t *data, size_t len, Handler handler, void *arg)
+{
+    while (len > 0)
+    {
+        if (header_fill_ < header_need_)
+        {
+            header_[header_fill_++] = *data++;
+            --len;
+            if (header_fill_ == 2)
+            {
+                if (((header_[1] & 0x80) != 0) != masked_)
+                {
+                    return false;
+                }
+                const uint8_t len7 = header_[1] & 0x7f;
+                header_need_ = ws_header_size(len7 < 126 ? 0 : len7 == 126 ? 126 : 0x10000, masked_);
+            }
+            if (header_fill_ < header_need_)
+            {
+                continue;
+            }
+            if (!header_done())
+            {
+                return false;
+            }
+            if (remaining_ > 0)
+            {
+                continue;
+            }
+            // empty frame: only control frames mean anything
+            if (opcode_ & 0x8)
+            {
+                handler(arg, opcode_, control_.data(), 0);
+            }
+            header_fill_ = 0;
+            header_need_ = 2;
+            continue;
+        }
+
+        const size_t n = remaining_ < len ? static_cast<size_t>(remaining_) : len;
+        if (masked_)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                data[i] ^= mask_[(mask_pos_ + i) & 3];
+            }
+            mask_pos_ += n;
+        }
+        if (opcode_ & 0x8)
+        {
+            memcpy(control_.data() + control_fill_, data, n);
+            control_fill_ += n;
+        }
+        else
+        {
+            handler(arg, opcode_, data, n);
+        }
+        data += n;
+        len -= n;
+        remaining_ -= n;
+        if (remaining_ == 0)
+        {
+            if (opcode_ & 0x8)
+            {
+                handler(arg, opcode_, control_.data(), control_fill_);
+            }
+            header_fill_ = 0;
+            header_need_ = 2;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,143 @@
+#pragma once
+// websocket.hpp - the bits of HTTP/1.1 and RFC 6455 the control page needs
+//
+// HttpRequestParser reads a request head line by line as it arrives and keeps
+// only what the server acts on: method, path and the WebSocket upgrade
+// headers. Lines longer than its buffer are cut short, which only ever hits
+// headers it does not look at (User-Agent, Cookie), so a whole browser
+// request costs a 128-byte line and the fields kept per connection instead
+// of a buffer for the head.
+//
+// A browser lets any page open a WebSocket to any address and only says
+// where the page came from in the Origin header. Host and the host part of
+// Origin are kept so the server can refuse an upgrade from another site's
+// page; a client that sends no Origin is not a browser and is let through.
+//
+// WsDecoder unmasks client frames in place, in the pbuf they arrived in, and
+// hands the payload on in whatever pieces the segments cut it into; only
+// control frames (ping, close), at most 125 bytes, are staged.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace pico_tcp
+{
+
+    constexpr size_t SHA1_SIZE = 20;
+    // base64 of a SHA-1 digest, without the terminating nul
+    constexpr size_t WS_ACCEPT_SIZE = 28;
+    // Largest header the server writes: payloads up to 64 KiB, unmasked.
+    constexpr size_t WS_HEADER_MAX = 4;
+    // Largest header a client may write: 64-bit length and mask.
+    constexpr size_t WS_CLIENT_HEADER_MAX = 14;
+
+    enum WsOpcode : uint8_t
+    {
+        WS_OP_CONTINUATION = 0x0,
+        WS_OP_TEXT = 0x1,
+        WS_OP_BINARY = 0x2,
+        WS_OP_CLOSE = 0x8,
+        WS_OP_PING = 0x9,
+        WS_OP_PONG = 0xA,
+    };
+
+    void sha1(const uint8_t *data, size_t len, uint8_t out[SHA1_SIZE]);
+
+    // Returns the number of characters written to out, 4 * ceil(len / 3).
+    size_t base64_encode(const uint8_t *data, size_t len, char *out);
+
+    // Sec-WebSocket-Accept for a Sec-WebSocket-Key. out gets WS_ACCEPT_SIZE characters.
+    void ws_accept_key(const char *key, size_t key_len, char out[WS_ACCEPT_SIZE]);
+
+    // Size of the header encode_ws_header() writes for this payload.
+    size_t ws_header_size(size_t len, bool masked);
+
+    // Write a final-fragment header. mask is the 4-byte key for client
+    // frames, nullptr for server frames. Returns the header size.
+    size_t encode_ws_header(uint8_t opcode, size_t len, const uint8_t *mask, uint8_t *out);
+
+    class HttpRequestParser
+    {
+    public:
+        static constexpr size_t LINE_MAX = 128;
+        static constexpr size_t PATH_MAX = 64;
+        static constexpr size_t KEY_MAX = 32;
+        static constexpr size_t HOST_MAX = 48;
+
+        void reset();
+
+        // Consume request bytes. Returns how many were used; fewer than len
+        // once the blank line ending the head has been read.
+        size_t feed(const uint8_t *data, size_t len);
+
+        // The whole head has been read.
+        bool complete() const { return complete_; }
+
+        bool is_get() const { return get_; }
+        const char *path() const { return path_.data(); }
+
+        // Carries Upgrade: websocket, Connection: Upgrade and a key.
+        bool wants_websocket() const { return upgrade_ && connection_upgrade_ && key_len_ > 0; }
+        const char *ws_key() const { return key_.data(); }
+        size_t ws_key_len() const { return key_len_; }
+
+        // No Origin header, or one whose host (and port) is the Host header.
+        // An Origin of "null", without a scheme, or too long to keep is not.
+        bool same_origin() const;
+
+    private:
+        void line_done();
+
+        std::array<char, LINE_MAX> line_;
+        size_t line_len_ = 0;
+        bool first_line_ = true;
+        bool complete_ = false;
+        bool get_ = false;
+        bool upgrade_ = false;
+        bool connection_upgrade_ = false;
+        std::array<char, PATH_MAX> path_ = {};
+        std::array<char, KEY_MAX> key_ = {};
+        size_t key_len_ = 0;
+        std::array<char, HOST_MAX> host_ = {};
+        std::array<char, HOST_MAX> origin_ = {}; // without the scheme
+        bool host_ok_ = false;   // fit into host_
+        bool has_origin_ = false;
+        bool origin_ok_ = false; // has a scheme and fit into origin_
+    };
+
+    class WsDecoder
+    {
+    public:
+        // Called with payload bytes, already unmasked. For data frames this
+        // is a piece of the message with the message's opcode (continuations
+        // resolved) and may be called several times per frame; control frames
+        // come whole.
+        using Handler = void (*)(void *arg, uint8_t opcode, uint8_t *data, size_t len);
+
+        // The server expects masked frames; a client decoding server frames
+        // expects them unmasked.
+        explicit WsDecoder(bool masked = true) : masked_(masked) {}
+
+        void reset();
+
+        // Decode len bytes, unmasking them in place. Returns false on a
+        // protocol error, after which the connection should be closed.
+        bool feed(uint8_t *data, size_t len, Handler handler, void *arg);
+
+    private:
+        bool header_done();
+
+        bool masked_;
+        std::array<uint8_t, WS_CLIENT_HEADER_MAX> header_;
+        size_t header_fill_ = 0;
+        size_t header_need_ = 2;
+        uint8_t opcode_ = 0;  // of the frame being read
+        uint8_t message_ = 0; // opcode of the data message being read
+        std::array<uint8_t, 4> mask_ = {};
+        uint64_t remaining_ = 0; // payload bytes left in the frame
+        size_t mask_pos_ = 0;
+        std::array<uint8_t, 125> control_;
+        size_t control_fill_ = 0;
+    };
+} // namespace pico_tcp
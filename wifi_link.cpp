@@ -0,0 +1,398 @@
+// wifi_link.cpp
+#include "wifi_link.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+extern "C"
+{
+#include "pico/cyw43_arch.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "lwip/netif.h"
+}
+
+#ifndef CYW43_IOCTL_GET_CHANNEL
+#define CYW43_IOCTL_GET_CHANNEL (0x3a)
+#endif
+
+using namespace pico_tcp;
+
+namespace
+{
+    // The last sector of flash, far past the end of the firmware image.
+    constexpr uint32_t WIFI_CACHE_OFFSET = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+    constexpr uint32_t WIFI_CACHE_MAGIC = 0x57434331; // "WCC1"
+
+    struct CacheRecord
+    {
+        uint32_t magic;
+        uint32_t key; // hash of SSID and password, a new wifi.h invalidates the cache
+        WifiCache cache;
+        uint32_t check; // hash of everything above
+    };
+    static_assert(sizeof(CacheRecord) <= FLASH_PAGE_SIZE, "the cache is programmed as one page");
+
+    // FNV-1a
+    uint32_t hash_bytes(const void *data, size_t len, uint32_t h = 2166136261u)
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < len; ++i)
+        {
+            h = (h ^ p[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    uint32_t credentials_key(const char *ssid, const char *pass)
+    {
+        return hash_bytes(pass, strlen(pass), hash_bytes(ssid, strlen(ssid) + 1));
+    }
+
+    // runs with the other core parked and interrupts off
+    void program_cache_page(void *page)
+    {
+        flash_range_erase(WIFI_CACHE_OFFSET, FLASH_SECTOR_SIZE);
+        flash_range_program(WIFI_CACHE_OFFSET, static_cast<const uint8_t *>(page), FLASH_PAGE_SIZE);
+    }
+
+    uint32_t current_address()
+    {
+        cyw43_arch_lwip_begin();
+        const uint32_t ip = ip4_addr_get_u32(netif_ip4_addr(netif_default));
+        cyw43_arch_lwip_end();
+        return ip;
+    }
+
+    void set_address(uint32_t ip, uint32_t netmask, uint32_t gw)
+    {
+        ip4_addr_t a, m, g;
+        a.addr = ip;
+        m.addr = netmask;
+        g.addr = gw;
+        cyw43_arch_lwip_begin();
+        netif_set_addr(netif_default, &a, &m, &g);
+        cyw43_arch_lwip_end();
+    }
+} // namespace
+
+bool pico_tcp::load_wifi_cache(const char *ssid, const char *pass, WifiCache &out)
+{
+    CacheRecord record;
+    memcpy(&record, reinterpret_cast<const void *>(XIP_BASE + WIFI_CACHE_OFFSET), sizeof(record));
+    if (record.magic != WIFI_CACHE_MAGIC || record.key != credentials_key(ssid, pass) ||
+        record.check != hash_bytes(&record, offsetof(CacheRecord, check)))
+    {
+        return false;
+    }
+    out = record.cache;
+    return true;
+}
+
+bool pico_tcp::save_wifi_cache(const char *ssid, const char *pass, const WifiCache &cache)
+{
+    static uint8_t page[FLASH_PAGE_SIZE];
+    CacheRecord record = {};
+    record.magic = WIFI_CACHE_MAGIC;
+    record.key = credentials_key(ssid, pass);
+    record.cache = cache;
+    record.check = hash_bytes(&record, offsetof(CacheRecord, check));
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, &record, sizeof(record));
+    return flash_safe_execute(&program_cache_page, page, 100) == PICO_OK;
+}
+
+WifiLink::WifiLink(const char *ssid, const char *pass, uint32_t auth) : ssid_(ssid), pass_(pass), auth_(auth) {}
+
+int WifiLink::connect(int retries)
+{
+    if (cyw43_arch_init())
+    {
+        printf("failed to initialise\n");
+        return 1;
+    }
+    printf("initialized\n");
+    mark(BOOT_PHASE_INIT);
+
+    cyw43_arch_enable_sta_mode();
+
+    have_cache_ = load_wifi_cache(ssid_, pass_, cache_);
+    fast_join_ = have_cache_ && join_cached(cache_);
+    if (!fast_join_ && !join_scan(retries))
+    {
+        return 1;
+    }
+    printf("succesfully connected\n");
+    update_cache(have_cache_ ? &cache_ : nullptr);
+    address_ = current_address();
+    state_ = State::Up;
+    return 0;
+}
+
+LinkEvent WifiLink::poll()
+{
+    const int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    switch (state_)
+    {
+    case State::Up:
+        if (status == CYW43_LINK_UP)
+        {
+            // a renewed lease can move us too
+            const uint32_t address = current_address();
+            if (address == address_)
+            {
+                return LinkEvent::None;
+            }
+            address_ = address;
+            printf("link address changed to %s\n", ip4addr_ntoa(netif_ip4_addr(netif_default)));
+            return LinkEvent::Readdressed;
+        }
+        printf("link lost (%d), rejoining\n", status);
+        state_ = State::Down;
+        down_us_ = time_us_32();
+        attempt_ = 0;
+        backoff_ms_ = WIFI_REJOIN_BACKOFF_MS;
+        awaiting_command_ = false;
+        stats_.outages++;
+        return LinkEvent::Lost;
+
+    case State::Down:
+        if (status == CYW43_LINK_UP)
+        {
+            return restored();
+        }
+        start_rejoin();
+        return LinkEvent::None;
+
+    case State::Joining:
+        if (status == CYW43_LINK_UP)
+        {
+            return restored();
+        }
+        if (status < 0 || time_reached(deadline_))
+        {
+            cyw43_arch_lwip_begin();
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+            cyw43_arch_lwip_end();
+            state_ = State::Backoff;
+            deadline_ = make_timeout_time_ms(backoff_ms_);
+            backoff_ms_ = backoff_ms_ * 2 > WIFI_REJOIN_BACKOFF_MAX_MS ? WIFI_REJOIN_BACKOFF_MAX_MS : backoff_ms_ * 2;
+        }
+        return LinkEvent::None;
+
+    case State::Backoff:
+        if (status == CYW43_LINK_UP)
+        {
+            return restored();
+        }
+        if (time_reached(deadline_))
+        {
+            state_ = State::Down;
+        }
+        return LinkEvent::None;
+    }
+    return LinkEvent::None;
+}
+
+void WifiLink::note_command()
+{
+    if (!awaiting_command_)
+    {
+        return;
+    }
+    awaiting_command_ = false;
+    const uint32_t ms = (time_us_32() - down_us_) / 1000;
+    stats_.last_recovery_ms = ms;
+    if (ms > stats_.max_recovery_ms)
+    {
+        stats_.max_recovery_ms = ms;
+    }
+    printf("link recovered: rejoin %lu ms, first command %lu ms after loss (outages %lu, worst %lu ms)\n",
+           (unsigned long)stats_.last_rejoin_ms, (unsigned long)ms, (unsigned long)stats_.outages,
+           (unsigned long)stats_.max_recovery_ms);
+}
+
+// Starts the next attempt of an outage: the cached AP first, then full scans
+// and the cached AP in turn. Neither waits, poll() watches for the result.
+void WifiLink::start_rejoin()
+{
+    const bool cached = have_cache_ && attempt_ % 2 == 0;
+    attempt_++;
+    stats_.rejoin_attempts++;
+    cyw43_arch_lwip_begin();
+    const int rc = cached ? cyw43_wifi_join(&cyw43_state, strlen(ssid_), reinterpret_cast<const uint8_t *>(ssid_),
+                                            strlen(pass_), reinterpret_cast<const uint8_t *>(pass_), auth_,
+                                            cache_.bssid, cache_.channel)
+                          : cyw43_arch_wifi_connect_async(ssid_, pass_, auth_);
+    cyw43_arch_lwip_end();
+    state_ = State::Joining;
+    // a failed start is handled like a failed join, after a short wait
+    deadline_ = make_timeout_time_ms(rc != 0 ? 0 : (cached ? WIFI_FAST_JOIN_TIMEOUT_MS : WIFI_JOIN_TIMEOUT_MS));
+}
+
+LinkEvent WifiLink::restored()
+{
+    state_ = State::Up;
+    stats_.last_rejoin_ms = (time_us_32() - down_us_) / 1000;
+    awaiting_command_ = true;
+    const uint32_t address = current_address();
+    printf("link up again after %lu ms, %lu attempts\n", (unsigned long)stats_.last_rejoin_ms, (unsigned long)attempt_);
+    if (address == address_)
+    {
+        return LinkEvent::Restored;
+    }
+    address_ = address;
+    return LinkEvent::Readdressed;
+}
+
+void WifiLink::print_boot_times() const
+{
+    static const char *const names[BOOT_PHASE_COUNT] = {"init", "join", "dhcp", "listen"};
+    printf("boot (%s):", fast_join_ ? "cached AP" : "full scan");
+    uint32_t prev = 0;
+    for (int i = 0; i < BOOT_PHASE_COUNT; ++i)
+    {
+        if (i == BOOT_PHASE_DHCP && lease_reused_)
+        {
+            printf(" dhcp cached");
+            continue;
+        }
+        if (boot_us_[i] == 0)
+        {
+            continue;
+        }
+        printf(" %s %lu ms (+%lu)", names[i], (unsigned long)(boot_us_[i] / 1000),
+               (unsigned long)((boot_us_[i] - prev) / 1000));
+        prev = boot_us_[i];
+    }
+    printf("\n");
+}
+
+int WifiLink::wait_for_link(absolute_time_t deadline, const WifiCache *lease)
+{
+    bool joined = false;
+    while (!time_reached(deadline))
+    {
+        const int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+        if (status == CYW43_LINK_BADAUTH)
+        {
+            return PICO_ERROR_BADAUTH;
+        }
+        if (status < 0)
+        {
+            return PICO_ERROR_CONNECT_FAILED;
+        }
+        if (status >= CYW43_LINK_NOIP && !joined)
+        {
+            joined = true;
+            mark(BOOT_PHASE_JOIN);
+            if (lease && status == CYW43_LINK_NOIP)
+            {
+                // DHCP keeps running and replaces or removes the address if
+                // the server does not confirm it
+                set_address(lease->ip, lease->netmask, lease->gw);
+                lease_reused_ = true;
+                continue;
+            }
+        }
+        if (status == CYW43_LINK_UP)
+        {
+            if (!lease_reused_)
+            {
+                mark(BOOT_PHASE_DHCP);
+            }
+            return PICO_OK;
+        }
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(deadline);
+    }
+    return PICO_ERROR_TIMEOUT;
+}
+
+bool WifiLink::join_cached(const WifiCache &cache)
+{
+    printf("joining %02x:%02x:%02x:%02x:%02x:%02x on channel %u\n", cache.bssid[0], cache.bssid[1], cache.bssid[2],
+           cache.bssid[3], cache.bssid[4], cache.bssid[5], cache.channel);
+    cyw43_arch_lwip_begin();
+    int rc = cyw43_wifi_join(&cyw43_state, strlen(ssid_), reinterpret_cast<const uint8_t *>(ssid_), strlen(pass_),
+                             reinterpret_cast<const uint8_t *>(pass_), auth_, cache.bssid, cache.channel);
+    cyw43_arch_lwip_end();
+    if (rc == 0)
+    {
+        rc = wait_for_link(make_timeout_time_ms(WIFI_FAST_JOIN_TIMEOUT_MS), cache.has_lease ? &cache : nullptr);
+    }
+    if (rc == PICO_OK)
+    {
+        return true;
+    }
+
+    printf("cached AP did not answer (%d), scanning\n", rc);
+    cyw43_arch_lwip_begin();
+    cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+    cyw43_arch_lwip_end();
+    if (lease_reused_)
+    {
+        set_address(0, 0, 0);
+        lease_reused_ = false;
+    }
+    return false;
+}
+
+bool WifiLink::join_scan(int retries)
+{
+    while (retries-- > 0)
+    {
+        int rc = cyw43_arch_wifi_connect_async(ssid_, pass_, auth_);
+        if (rc == 0)
+        {
+            rc = wait_for_link(make_timeout_time_ms(WIFI_JOIN_TIMEOUT_MS), nullptr);
+        }
+        switch (rc)
+        {
+        case PICO_ERROR_BADAUTH:
+            printf("failed to connect wrong password, retrying...\n");
+            break;
+        case PICO_ERROR_TIMEOUT:
+            printf("failed to connect, connection timed out, retrying...\n");
+            break;
+        case PICO_OK:
+            return true;
+        default:
+            printf("failed to connect, connection failed, retrying...\n");
+            break;
+        }
+    }
+    return false;
+}
+
+void WifiLink::update_cache(const WifiCache *cached)
+{
+    WifiCache now = {};
+    uint8_t channel[12] = {}; // channel_info_t: hw, target and scan channel
+    cyw43_arch_lwip_begin();
+    const bool ok = cyw43_wifi_get_bssid(&cyw43_state, now.bssid) == 0 &&
+                    cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel), channel, CYW43_ITF_STA) == 0;
+    now.ip = ip4_addr_get_u32(netif_ip4_addr(netif_default));
+    now.netmask = ip4_addr_get_u32(netif_ip4_netmask(netif_default));
+    now.gw = ip4_addr_get_u32(netif_ip4_gw(netif_default));
+    cyw43_arch_lwip_end();
+    if (!ok)
+    {
+        return;
+    }
+    now.channel = channel[0];
+    now.has_lease = now.ip != 0;
+
+    if (cached && memcmp(cached, &now, sizeof(now)) == 0)
+    {
+        return;
+    }
+    cache_ = now;
+    have_cache_ = true;
+    // boot time, nothing is driving yet
+    if (!save_wifi_cache(ssid_, pass_, now))
+    {
+        printf("failed to save the AP cache\n");
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+// wifi_link.hpp - station join with a flash-cached access point
+//
+// A full join scans every channel for the SSID before associating, which is
+// most of the time from reset to drivable. After each successful join the
+// access point's BSSID and channel, and the DHCP lease, are kept in the last
+// flash sector. The next boot first tries a join aimed at that BSSID on that
+// channel, and puts the cached address on the interface as soon as the link
+// is up while DHCP confirms it in the background. If the targeted join fails
+// (the AP moved channel, another AP answers) it falls back to the full scan.
+//
+// Every boot phase is timestamped so the gain can be measured.
+//
+// After boot, poll() supervises the link from the main loop without ever
+// blocking: when the access point goes away it rejoins in the background,
+// cached AP and full scan in turn with a growing pause between attempts, and
+// reports the events the servers have to react to.
+
+#include <cstdint>
+
+extern "C"
+{
+#include "pico/stdlib.h"
+}
+
+namespace pico_tcp
+{
+
+    // how long a targeted join may take before falling back to the full scan
+    constexpr uint32_t WIFI_FAST_JOIN_TIMEOUT_MS = 1500;
+    // one full-scan join attempt
+    constexpr uint32_t WIFI_JOIN_TIMEOUT_MS = 3333;
+    // pause after a failed rejoin, doubling up to the maximum
+    constexpr uint32_t WIFI_REJOIN_BACKOFF_MS = 250;
+    constexpr uint32_t WIFI_REJOIN_BACKOFF_MAX_MS = 4000;
+
+    enum BootPhase : uint8_t
+    {
+        BOOT_PHASE_INIT,   // cyw43 chip up
+        BOOT_PHASE_JOIN,   // associated with the access point
+        BOOT_PHASE_DHCP,   // interface has an address
+        BOOT_PHASE_LISTEN, // servers accepting connections
+        BOOT_PHASE_COUNT,
+    };
+
+    // what a join found, as kept in flash
+    struct WifiCache
+    {
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint8_t has_lease;
+        uint32_t ip; // lwIP byte order, like ip4_addr_t::addr
+        uint32_t netmask;
+        uint32_t gw;
+    };
+
+    // what poll() saw happen
+    enum class LinkEvent : uint8_t
+    {
+        None,
+        Lost,        // the link went down, rejoining has started
+        Restored,    // back up with the same address, connections may survive
+        Readdressed, // up with a different address, the servers need a restart
+    };
+
+    struct LinkStats
+    {
+        uint32_t outages;
+        uint32_t rejoin_attempts;
+        uint32_t last_rejoin_ms;   // link lost to address back
+        uint32_t last_recovery_ms; // link lost to the first command after it
+        uint32_t max_recovery_ms;
+    };
+
+    class WifiLink
+    {
+    public:
+        WifiLink(const char *ssid, const char *pass, uint32_t auth);
+
+        // Bring up the chip and join, the cached AP first, then up to
+        // retries full-scan attempts. Returns 0 once the interface has an
+        // address, 1 if all attempts failed. A join that finds something
+        // other than the cache holds rewrites it, see save_wifi_cache().
+        // Nothing else here writes flash.
+        int connect(int retries);
+
+        // Record the end of a boot phase, in microseconds since reset.
+        void mark(BootPhase phase) { boot_us_[phase] = time_us_32(); }
+
+        // One line per phase: time since reset and since the previous phase.
+        // A lease reused from the cache is shown as such, DHCP had no part in it.
+        void print_boot_times() const;
+
+        // True if the last connect() got in with the cached AP.
+        bool fast_join() const { return fast_join_; }
+
+        // Supervise the link after connect(). Never blocks; call from every
+        // iteration of the main loop.
+        LinkEvent poll();
+
+        // Tell the supervisor a control command arrived, which ends a recovery.
+        void note_command();
+
+        const LinkStats &stats() const { return stats_; }
+
+        // Current address of the interface, lwIP byte order.
+        uint32_t address() const { return address_; }
+
+    private:
+        enum class State : uint8_t
+        {
+            Up,
+            Down,    // lost, next attempt not started yet
+            Joining, // attempt running until deadline_
+            Backoff, // attempt failed, waiting until deadline_
+        };
+
+        // Wait for the join started before to end, marking JOIN and DHCP.
+        // Returns PICO_OK or a PICO_ERROR_* code.
+        int wait_for_link(absolute_time_t deadline, const WifiCache *lease);
+
+        bool join_cached(const WifiCache &cache);
+        bool join_scan(int retries);
+        void update_cache(const WifiCache *cached);
+        void start_rejoin();
+        LinkEvent restored();
+
+        const char *ssid_;
+        const char *pass_;
+        uint32_t auth_;
+        uint32_t boot_us_[BOOT_PHASE_COUNT] = {};
+        bool fast_join_ = false;
+        bool lease_reused_ = false; // the address came from the cache, not DHCP
+
+        WifiCache cache_ = {};
+        bool have_cache_ = false;
+
+        State state_ = State::Up;
+        absolute_time_t deadline_ = 0;
+        uint32_t backoff_ms_ = WIFI_REJOIN_BACKOFF_MS;
+        uint32_t attempt_ = 0; // rejoin attempts in this outage
+        uint32_t down_us_ = 0;
+        uint32_t address_ = 0;
+        bool awaiting_command_ = false;
+        LinkStats stats_ = {};
+    };
+
+    // The cache in flash, if there is a valid one for this SSID and password.
+    bool load_wifi_cache(const char *ssid, const char *pass, WifiCache &out);
+
+    // Rewrite the cache sector. Parks the other core with interrupts off
+    // while the sector is erased and programmed, tens of milliseconds and up
+    // to 400 ms on a slow chip. Its motion tick stops and it cannot feed the
+    // watchdog, so only call this before the hardware watchdog is enabled
+    // and before any command can reach the motors.
+    bool save_wifi_cache(const char *ssid, const char *pass, const WifiCache &cache);
+} // namespace pico_tcp